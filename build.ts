@@ -2,8 +2,9 @@
 import { build, type BuildConfig } from "bun";
 import plugin from "bun-plugin-tailwind";
 import { existsSync } from "fs";
-import { rm } from "fs/promises";
+import { readFile, rm, writeFile } from "fs/promises";
 import path from "path";
+import { brotliCompressSync, gzipSync, constants as zlibConstants } from "zlib";
 
 // Print help text if requested
 if (process.argv.includes("--help") || process.argv.includes("-h")) {
@@ -165,6 +166,27 @@ for (const entrypoint of entrypoints) {
   results.push(...result.outputs);
 }
 
+// Precompress text assets so vldwmapi can send .br/.gz variants with sendfile
+const compressible = /\.(html|js|mjs|css|json|map|svg|txt|wasm)$/;
+let precompressed = 0;
+for (const output of results) {
+  if (!compressible.test(output.path)) continue;
+
+  const data = await readFile(output.path);
+  const variants: [string, Buffer][] = [
+    [".br", brotliCompressSync(data, { params: { [zlibConstants.BROTLI_PARAM_QUALITY]: 11 } })],
+    [".gz", gzipSync(data, { level: 9 })],
+  ];
+  for (const [suffix, compressed] of variants) {
+    // Only keep variants that actually save bytes
+    if (compressed.length < data.length) {
+      await writeFile(output.path + suffix, compressed);
+      precompressed++;
+    }
+  }
+}
+console.log(`🗜️ Wrote ${precompressed} precompressed variants\n`);
+
 // Print the results
 const end = performance.now();
 
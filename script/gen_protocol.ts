@@ -0,0 +1,334 @@
+#!/usr/bin/env bun
+// Generates the request decoders of vldwmapi and the matching client
+// types from sys/vldwmapi/protocol.json:
+//   sys/vldwmapi/messages.h, sys/vldwmapi/messages.c   field tables for protocol.c
+//   src/api/protocol.ts                                 request types for src/midleware.ts
+// With --check nothing is written; it exits 1 when a generated file is stale.
+import { readFileSync, writeFileSync } from "fs";
+import path from "path";
+
+interface FieldSpec {
+  type: string;
+  max?: number;
+  maxItems?: number;
+  min?: number;
+  required?: boolean;
+  enum?: string[];
+  doc?: string;
+  ts?: string;
+  fields?: Record<string, FieldSpec>;
+}
+
+interface MessageSpec {
+  doc?: string;
+  fields: Record<string, FieldSpec>;
+}
+
+interface Schema {
+  messages: Record<string, MessageSpec>;
+}
+
+const ROOT = path.resolve(import.meta.dirname, "..");
+const SCHEMA = "sys/vldwmapi/protocol.json";
+const HEADER = `Generated by script/gen_protocol.ts from ${SCHEMA}; do not edit`;
+const MAX_FIELDS = 32;  // Bits in the present mask
+
+const KINDS: Record<string, string> = {
+  "string": "PROTO_STRING",
+  "integer": "PROTO_INTEGER",
+  "boolean": "PROTO_BOOLEAN",
+  "string[]": "PROTO_STRINGS",
+  "map": "PROTO_MAP",
+  "object": "PROTO_OBJECT",
+  "json": "PROTO_JSON",
+  "json[]": "PROTO_JSONS",
+};
+
+const isArray = (spec: FieldSpec): boolean =>
+  spec.type === "string[]" || spec.type === "json[]" || spec.type === "map";
+
+const pascal = (name: string): string =>
+  name.split("_").map((part) => part.charAt(0).toUpperCase() + part.slice(1)).join("");
+
+// Every field gets the limits the decoder needs; a schema without them is
+// a mistake rather than "unlimited"
+function check(where: string, fields: Record<string, FieldSpec>): void {
+  const names = Object.keys(fields);
+  if (names.length > MAX_FIELDS) throw new Error(`${where}: more than ${MAX_FIELDS} fields`);
+  for (const name of names) {
+    const spec = fields[name];
+    if (!/^[a-z][a-z0-9_]*$/.test(name) || name === "type" || name === "id") {
+      throw new Error(`${where}.${name}: invalid field name`);
+    }
+    if (!KINDS[spec.type]) throw new Error(`${where}.${name}: unknown type ${spec.type}`);
+    if ((spec.type === "string" || spec.type === "string[]" || spec.type === "map") && !spec.max) {
+      throw new Error(`${where}.${name}: strings need a max`);
+    }
+    if (isArray(spec) && !spec.maxItems) throw new Error(`${where}.${name}: arrays need maxItems`);
+    if (spec.type === "object") check(`${where}.${name}`, spec.fields ?? {});
+  }
+}
+
+// C
+
+function structName(prefix: string): string {
+  return `proto_${prefix}_t`;
+}
+
+function cMember(prefix: string, name: string, spec: FieldSpec): string[] {
+  switch (spec.type) {
+    case "string":
+    case "json":
+      return [`proto_str_t ${name};`];
+    case "integer":
+      return [`int64_t ${name};`];
+    case "boolean":
+      return [`int ${name};`];
+    case "object":
+      return [`${structName(`${prefix}_${name}`)} ${name};`];
+    default:
+      return [`int ${name}_count;`];
+  }
+}
+
+function cArray(prefix: string, name: string, spec: FieldSpec): string {
+  const type = spec.type === "map" ? "proto_pair_t" : "proto_str_t";
+  return `${type} ${name}[PROTO_${prefix.toUpperCase()}_${name.toUpperCase()}_MAX_ITEMS];`;
+}
+
+// Scalars first: the decoder zeroes the struct only up to the first array
+function cStruct(prefix: string, fields: Record<string, FieldSpec>, doc: string | undefined, out: string[]): void {
+  const names = Object.keys(fields);
+  for (const name of names) {
+    const spec = fields[name];
+    if (spec.type === "object") cStruct(`${prefix}_${name}`, spec.fields ?? {}, spec.doc, out);
+  }
+  if (doc) out.push(`// ${doc}`);
+  out.push("typedef struct {");
+  out.push("    uint32_t present;");
+  for (const name of names) {
+    for (const line of cMember(prefix, name, fields[name])) out.push(`    ${line}`);
+  }
+  for (const name of names) {
+    if (isArray(fields[name])) out.push(`    ${cArray(prefix, name, fields[name])}`);
+  }
+  out.push(`} ${structName(prefix)};`);
+  out.push("");
+}
+
+function cDefines(prefix: string, fields: Record<string, FieldSpec>, out: string[]): void {
+  Object.keys(fields).forEach((name, bit) => {
+    const spec = fields[name];
+    const macro = `PROTO_${prefix.toUpperCase()}_${name.toUpperCase()}`;
+    out.push(`#define ${macro} (1u << ${bit})`);
+    if (spec.max && spec.type !== "integer") out.push(`#define ${macro}_MAX ${spec.max}`);
+    if (spec.maxItems) out.push(`#define ${macro}_MAX_ITEMS ${spec.maxItems}`);
+    if (spec.type === "object") cDefines(`${prefix}_${name}`, spec.fields ?? {}, out);
+  });
+}
+
+function cTables(prefix: string, fields: Record<string, FieldSpec>, out: string[]): void {
+  const names = Object.keys(fields);
+  const struct = structName(prefix);
+  for (const name of names) {
+    const spec = fields[name];
+    if (spec.type === "object") cTables(`${prefix}_${name}`, spec.fields ?? {}, out);
+    if (spec.enum) {
+      const values = spec.enum.map((value) => JSON.stringify(value)).join(", ");
+      out.push(`static const char *const ${prefix}_${name}_values[] = { ${values}, NULL };`);
+      out.push("");
+    }
+  }
+
+  if (names.length > 0) {
+    out.push(`static const proto_field_t ${prefix}_fields[] = {`);
+    for (const name of names) {
+      const spec = fields[name];
+      const macro = `PROTO_${prefix.toUpperCase()}_${name.toUpperCase()}`;
+      const init = [
+        `.name = "${name}"`,
+        `.kind = ${KINDS[spec.type]}`,
+        `.bit = ${macro}`,
+      ];
+      if (spec.required) init.push(".required = 1");
+      init.push(`.offset = offsetof(${struct}, ${name})`);
+      if (isArray(spec)) init.push(`.count_offset = offsetof(${struct}, ${name}_count)`);
+      if (spec.type !== "integer" && spec.max) init.push(`.max = ${macro}_MAX`);
+      if (spec.maxItems) init.push(`.max_items = ${macro}_MAX_ITEMS`);
+      if (spec.type === "integer") {
+        init.push(`.min_value = ${spec.min ?? "INT64_MIN"}`);
+        init.push(`.max_value = ${spec.max ?? "INT64_MAX"}`);
+      }
+      if (spec.enum) init.push(`.values = ${prefix}_${name}_values`);
+      if (spec.type === "object") init.push(`.object = &${prefix}_${name}_object`);
+      out.push(`    { ${init.join(", ")} },`);
+    }
+    out.push("};");
+    out.push("");
+  }
+
+  const firstArray = names.find((name) => isArray(fields[name]));
+  const clear = firstArray ? `offsetof(${struct}, ${firstArray})` : `sizeof(${struct})`;
+  const table = names.length > 0 ? `${prefix}_fields` : "NULL";
+  out.push(`static const proto_object_t ${prefix}_object = { ${table}, ${names.length}, ${clear} };`);
+  out.push("");
+}
+
+function generateHeader(schema: Schema): string {
+  const types = Object.keys(schema.messages);
+  const out: string[] = [
+    `// ${HEADER}`,
+    "#ifndef MESSAGES_H",
+    "#define MESSAGES_H",
+    "",
+    "#include <stddef.h>",
+    "#include <stdint.h>",
+    "",
+    "#include \"protocol.h\"",
+    "",
+    "// Constants",
+  ];
+  for (const type of types) cDefines(type, schema.messages[type].fields, out);
+  out.push("");
+  out.push("typedef enum {");
+  out.push("    PROTO_MSG_NONE = 0,         // Missing or unknown type");
+  for (const type of types) out.push(`    PROTO_MSG_${type.toUpperCase()},`);
+  out.push("    PROTO_MSG_COUNT");
+  out.push("} proto_msg_t;");
+  out.push("");
+  for (const type of types) cStruct(type, schema.messages[type].fields, schema.messages[type].doc, out);
+  out.push("typedef struct {");
+  out.push("    proto_head_t head;");
+  out.push("    union {");
+  for (const type of types) out.push(`        ${structName(type)} ${type};`);
+  out.push("    } u;");
+  out.push("} proto_request_t;");
+  out.push("");
+  out.push("// Decode text, which is modified, into request->u.<type> (see proto_decode)");
+  out.push("int proto_decode_request(char *text, size_t len, proto_request_t *request);");
+  out.push("");
+  out.push("#endif // MESSAGES_H");
+  return out.join("\n") + "\n";
+}
+
+function generateSource(schema: Schema): string {
+  const types = Object.keys(schema.messages);
+  const out: string[] = [
+    `// ${HEADER}`,
+    "#include <stddef.h>",
+    "#include <stdint.h>",
+    "",
+    "#include \"messages.h\"",
+    "",
+  ];
+  for (const type of types) cTables(type, schema.messages[type].fields, out);
+  out.push("const proto_message_info_t proto_messages[] = {");
+  out.push("    { NULL, NULL },");
+  for (const type of types) out.push(`    { "${type}", &${type}_object },`);
+  out.push("};");
+  out.push("");
+  out.push("const int proto_message_count = PROTO_MSG_COUNT;");
+  out.push("");
+  out.push("int proto_decode_request(char *text, size_t len, proto_request_t *request) {");
+  out.push("    return proto_decode(text, len, &request->head, &request->u);");
+  out.push("}");
+  return out.join("\n") + "\n";
+}
+
+// TypeScript
+
+function tsType(spec: FieldSpec): string {
+  switch (spec.type) {
+    case "string":
+      return spec.enum ? spec.enum.map((value) => `'${value}'`).join(" | ") : "string";
+    case "integer":
+      return "number";
+    case "boolean":
+      return "boolean";
+    case "string[]":
+      return "string[]";
+    case "map":
+      return "Record<string, string>";
+    case "object": {
+      const fields = spec.fields ?? {};
+      const members = Object.keys(fields).map((name) => `${name}${fields[name].required ? "" : "?"}: ${tsType(fields[name])}`);
+      return `{ ${members.join("; ")} }`;
+    }
+    case "json":
+      return spec.ts ?? "unknown";
+    default:
+      return spec.ts ? `${spec.ts}[]` : "unknown[]";
+  }
+}
+
+// Field comments line up the way the hand-written interfaces do
+function tsMember(line: string, doc?: string): string {
+  return doc ? `${line.padEnd(27)} // ${doc}` : line;
+}
+
+function generateTypes(schema: Schema): string {
+  const types = Object.keys(schema.messages);
+  const out: string[] = [
+    `// ${HEADER}`,
+    "",
+    "// Echoed in the reply: a string of up to 64 bytes or an integer",
+    "export type RequestId = string | number;",
+    "",
+  ];
+  for (const type of types) {
+    const message = schema.messages[type];
+    if (message.doc) out.push(`// ${message.doc}`);
+    out.push(`export interface ${pascal(type)}Request {`);
+    out.push(`    type: '${type}';`);
+    out.push("    id?: RequestId;");
+    for (const [name, spec] of Object.entries(message.fields)) {
+      out.push(`    ${tsMember(`${name}${spec.required ? "" : "?"}: ${tsType(spec)};`, spec.doc)}`);
+    }
+    out.push("}");
+    out.push("");
+  }
+  out.push("export type ProtocolRequest =");
+  out.push(types.map((type) => `    | ${pascal(type)}Request`).join("\n") + ";");
+  out.push("");
+  out.push("export type RequestType = ProtocolRequest['type'];");
+  out.push("");
+  out.push("// Most items an array or map field takes; the daemon rejects more");
+  out.push("export const REQUEST_MAX_ITEMS = {");
+  for (const type of types) {
+    const fields = Object.entries(schema.messages[type].fields).filter(([, spec]) => spec.maxItems);
+    if (fields.length === 0) continue;
+    out.push(`    ${type}: { ${fields.map(([name, spec]) => `${name}: ${spec.maxItems}`).join(", ")} },`);
+  }
+  out.push("} as const;");
+  return out.join("\n") + "\n";
+}
+
+const schema: Schema = JSON.parse(readFileSync(path.join(ROOT, SCHEMA), "utf8"));
+for (const [type, message] of Object.entries(schema.messages)) check(type, message.fields);
+
+const outputs: Record<string, string> = {
+  "sys/vldwmapi/messages.h": generateHeader(schema),
+  "sys/vldwmapi/messages.c": generateSource(schema),
+  "src/api/protocol.ts": generateTypes(schema),
+};
+
+const checkOnly = process.argv.includes("--check");
+let stale = 0;
+for (const [file, text] of Object.entries(outputs)) {
+  const target = path.join(ROOT, file);
+  let current = "";
+  try {
+    current = readFileSync(target, "utf8");
+  } catch {
+    // Not generated yet
+  }
+  if (current === text) continue;
+  if (checkOnly) {
+    console.error(`❌ ${file} is out of date; run bun script/gen_protocol.ts`);
+    stale++;
+  } else {
+    writeFileSync(target, text);
+    console.log(`📝 Wrote ${file}`);
+  }
+}
+process.exit(stale ? 1 : 0);
@@ -6,6 +6,9 @@ export interface UserInfo {
     home: string;
     shell: string;
     fullname: string;
+    token?: string;
+    session_id?: number;
+    token_expires?: number;
 }
 
 export interface LoginResponse {
@@ -0,0 +1,169 @@
+// Generated by script/gen_protocol.ts from sys/vldwmapi/protocol.json; do not edit
+
+// Echoed in the reply: a string of up to 64 bytes or an integer
+export type RequestId = string | number;
+
+// Password login; over the Unix socket a peer may leave out the password for its own user
+export interface LoginRequest {
+    type: 'login';
+    id?: RequestId;
+    username: string;
+    password?: string;
+}
+
+// Reattach to a session with the token from login
+export interface ResumeRequest {
+    type: 'resume';
+    id?: RequestId;
+    token: string;
+}
+
+// Unlock with a recent token, or with the password once the token is too old
+export interface UnlockRequest {
+    type: 'unlock';
+    id?: RequestId;
+    token?: string;
+    password?: string;
+}
+
+export interface LockRequest {
+    type: 'lock';
+    id?: RequestId;
+}
+
+export interface LogoutRequest {
+    type: 'logout';
+    id?: RequestId;
+}
+
+// Directory listings, file details and the process list
+export interface DesktopSessionRequest {
+    type: 'desktop_session';
+    id?: RequestId;
+    action: 'list_directory' | 'file_info' | 'process_list' | 'system_status';
+    path?: string;
+    params?: { path?: string }; // Older clients send the path here
+}
+
+export interface SystemStatusRequest {
+    type: 'system_status';
+    id?: RequestId;
+}
+
+export interface MemoryStatsRequest {
+    type: 'memory_stats';
+    id?: RequestId;
+}
+
+export interface MetricsRequest {
+    type: 'metrics';
+    id?: RequestId;
+}
+
+export interface ResourceUsageRequest {
+    type: 'resource_usage';
+    id?: RequestId;
+}
+
+export interface TraceRequest {
+    type: 'trace';
+    id?: RequestId;
+    action: 'start' | 'stop' | 'clear' | 'dump';
+}
+
+// PNG thumbnails, answered with binary frames
+export interface ThumbnailRequest {
+    type: 'thumbnail';
+    id?: RequestId;
+    paths: string[];
+    size?: number;
+}
+
+// File names under the indexed directories, best match first
+export interface SearchRequest {
+    type: 'search';
+    id?: RequestId;
+    query: string;
+    mode?: 'substring' | 'fuzzy';
+    offset?: number;
+    limit?: number;
+}
+
+export interface ListAppsRequest {
+    type: 'list_apps';
+    id?: RequestId;
+    locale?: string;
+    include_hidden?: boolean;
+}
+
+export interface SearchAppsRequest {
+    type: 'search_apps';
+    id?: RequestId;
+    query: string;
+    locale?: string;
+    limit?: number;
+}
+
+// Start a catalog application by desktop id, or an explicit argv
+export interface LaunchRequest {
+    type: 'launch';
+    id?: RequestId;
+    app?: string;
+    files?: string[];           // Substituted for %f/%F/%u/%U in the app's Exec line
+    argv?: string[];
+    cwd?: string;               // Defaults to the user's home
+    env?: Record<string, string>;
+    isolate?: boolean;          // Own cgroup for per-app usage (default true)
+}
+
+// Signal a launched program; the default SIGKILL ends everything it forked
+export interface KillRequest {
+    type: 'kill';
+    id?: RequestId;
+    pid: number;
+    signal?: number;
+}
+
+export interface SceneRequest {
+    type: 'scene';
+    id?: RequestId;
+    action: 'snapshot' | 'mutate' | 'unsubscribe';
+    ops?: Array<Record<string, unknown>>; // Window mutations
+}
+
+// Sub-requests run in order; the reply carries their replies in the same order
+export interface BatchRequest {
+    type: 'batch';
+    id?: RequestId;
+    requests: ProtocolRequest[];
+}
+
+export type ProtocolRequest =
+    | LoginRequest
+    | ResumeRequest
+    | UnlockRequest
+    | LockRequest
+    | LogoutRequest
+    | DesktopSessionRequest
+    | SystemStatusRequest
+    | MemoryStatsRequest
+    | MetricsRequest
+    | ResourceUsageRequest
+    | TraceRequest
+    | ThumbnailRequest
+    | SearchRequest
+    | ListAppsRequest
+    | SearchAppsRequest
+    | LaunchRequest
+    | KillRequest
+    | SceneRequest
+    | BatchRequest;
+
+export type RequestType = ProtocolRequest['type'];
+
+// Most items an array or map field takes; the daemon rejects more
+export const REQUEST_MAX_ITEMS = {
+    thumbnail: { paths: 64 },
+    launch: { files: 255, argv: 255, env: 64 },
+    batch: { requests: 32 },
+} as const;
@@ -1,26 +1,98 @@
 // WebSocket API Client for VLDWM API
+import type {
+    DesktopSessionRequest,
+    LaunchRequest,
+    LoginRequest,
+    ProtocolRequest,
+    ResumeRequest,
+    SceneRequest,
+    SearchRequest,
+    SystemStatusRequest,
+    ThumbnailRequest,
+    UnlockRequest
+} from './api/protocol';
+import { REQUEST_MAX_ITEMS } from './api/protocol';
+
+// Anything the daemon sends; requests are typed in ./api/protocol
 interface WebSocketMessage {
     type: string;
     data?: any;
-    id?: string;
+    id?: string | number;
 }
 
-interface LoginMessage extends WebSocketMessage {
-    type: 'login';
-    username: string;
-    password: string;
+export interface Thumbnail {
+    path: string;
+    width?: number;
+    height?: number;
+    cached?: boolean;
+    image?: Blob;               // PNG
+    error?: string;
 }
 
-interface DesktopSessionMessage extends WebSocketMessage {
-    type: 'desktop_session';
-    action: string;
-    params?: any;
+export interface SearchResult {
+    path: string;
+    name: string;
+    is_directory: boolean;
+    score: number;
 }
 
-interface SystemStatusMessage extends WebSocketMessage {
-    type: 'system_status';
+export interface SearchPage {
+    total: number;
+    offset: number;
+    indexing: boolean;          // Still crawling; results may be incomplete
+    indexed: number;
+    results: SearchResult[];
 }
 
+export interface AppEntry {
+    id: string;                 // Desktop file id, e.g. "org.gnome.Nautilus.desktop"
+    name: string;
+    generic_name: string;
+    comment: string;
+    exec: string;
+    icon: string;
+    categories: string[];
+    keywords: string[];
+    terminal: boolean;
+    no_display: boolean;
+    path: string;
+}
+
+export type LaunchOptions = Pick<LaunchRequest, 'files' | 'cwd' | 'env' | 'isolate'>;
+
+export interface ResourceUsage {
+    cpu_usec: number;
+    cpu_permille: number;       // Of one CPU over the last sample interval
+    memory_bytes: number;
+    io_read_bytes: number;
+    io_write_bytes: number;
+    pids: number;
+}
+
+export interface AppUsage extends Partial<ResourceUsage> {
+    pid: number;
+    name: string;
+    isolated: boolean;          // Usage fields are only present for isolated apps
+    running: boolean;           // false while forked children outlive the main process
+}
+
+export interface SessionUsage {
+    available: boolean;         // false without a writable cgroup v2 hierarchy
+    interval_ms: number;
+    session: (ResourceUsage & { age_ms: number }) | null;
+    apps: AppUsage[];
+}
+
+// Pushed to every connection of the session when a launched program ends
+export interface ProcessExit {
+    pid: number;
+    exit_code: number;          // -1 when killed by a signal
+    signal: number;
+    runtime_ms: number;
+}
+
+const SESSION_TOKEN_KEY = 'vldwm.sessionToken';
+
 class WebSocketClient {
     private ws: WebSocket | null = null;
     private url: string;
@@ -28,6 +100,9 @@ class WebSocketClient {
     private maxReconnectAttempts = 5;
     private reconnectDelay = 1000;
     private messageHandlers = new Map<string, (data: any) => void>();
+    private openHandlers: Array<(reconnected: boolean) => void> = [];
+    private replyHandler: ((message: WebSocketMessage) => boolean) | null = null;
+    private hasConnected = false;
     private connectionPromise: Promise<void> | null = null;
     private isConnecting = false;
 
@@ -44,17 +119,23 @@ class WebSocketClient {
         this.connectionPromise = new Promise((resolve, reject) => {
             try {
                 this.ws = new WebSocket(this.url);
+                this.ws.binaryType = 'arraybuffer';
 
                 this.ws.onopen = () => {
                     console.log('🔗 WebSocket connected to VLDWM API');
+                    const reconnected = this.hasConnected;
+                    this.hasConnected = true;
                     this.reconnectAttempts = 0;
                     this.isConnecting = false;
+                    this.openHandlers.forEach((handler) => handler(reconnected));
                     resolve();
                 };
 
                 this.ws.onmessage = (event) => {
                     try {
-                        const message: WebSocketMessage = JSON.parse(event.data);
+                        const message: WebSocketMessage = event.data instanceof ArrayBuffer
+                            ? this.decodeBinaryMessage(event.data)
+                            : JSON.parse(event.data);
                         this.handleMessage(message);
                     } catch (error) {
                         console.error('Failed to parse WebSocket message:', error);
@@ -96,7 +177,31 @@ class WebSocketClient {
         }, delay);
     }
 
+    // Binary frames: u32 little-endian header length, the JSON header, then
+    // the image data its items point into. Each item gets its bytes as a Blob.
+    private decodeBinaryMessage(buffer: ArrayBuffer): WebSocketMessage {
+        const headerLength = new DataView(buffer).getUint32(0, true);
+        const header = JSON.parse(new TextDecoder().decode(new Uint8Array(buffer, 4, headerLength)));
+        const dataStart = 4 + headerLength;
+
+        for (const item of header.items ?? []) {
+            if (item.length !== undefined) {
+                const start = dataStart + item.offset;
+                item.image = new Blob([buffer.slice(start, start + item.length)], { type: 'image/png' });
+                delete item.offset;
+                delete item.length;
+            }
+        }
+        return header;
+    }
+
     private handleMessage(message: WebSocketMessage): void {
+        // Replies to requests carry the request's id; everything else is
+        // pushed by the server and dispatched by type
+        if (message.id !== undefined && this.replyHandler?.(message)) {
+            return;
+        }
+
         const handler = this.messageHandlers.get(message.type);
         if (handler) {
             handler(message);
@@ -113,6 +218,14 @@ class WebSocketClient {
         this.messageHandlers.delete(type);
     }
 
+    onOpen(handler: (reconnected: boolean) => void): void {
+        this.openHandlers.push(handler);
+    }
+
+    onReply(handler: (message: WebSocketMessage) => boolean): void {
+        this.replyHandler = handler;
+    }
+
     async sendMessage(message: WebSocketMessage): Promise<void> {
         if (!this.ws || this.ws.readyState !== WebSocket.OPEN) {
             await this.connect();
@@ -145,7 +258,8 @@ const wsClient = new WebSocketClient('ws://localhost:3001');
 export class WebSocketAPIService {
     private static instance: WebSocketAPIService;
     private client: WebSocketClient;
-    private responseHandlers = new Map<string, { resolve: (data: any) => void; reject: (error: any) => void; timeout: NodeJS.Timeout }>();
+    private nextRequestId = 1;
+    private responseHandlers = new Map<number, { resolve: (data: any) => void; reject: (error: any) => void; timeout: NodeJS.Timeout; items?: any[] }>();
 
     private constructor() {
         this.client = wsClient;
@@ -164,16 +278,15 @@ export class WebSocketAPIService {
             console.log('👋 Welcome message:', message.message);
         });
 
-        this.client.onMessage('login', (message) => {
-            this.handleResponse('login', message);
-        });
-
-        this.client.onMessage('desktop_session', (message) => {
-            this.handleResponse('desktop_session', message);
-        });
+        // Requests may complete in any order; the echoed id finds the caller
+        this.client.onReply((message) => this.handleResponse(message));
 
-        this.client.onMessage('system_status', (message) => {
-            this.handleResponse('system_status', message);
+        // Reattach to the session with the stored token instead of asking
+        // for the password again after a dropped connection or reload
+        this.client.onOpen(() => {
+            if (this.getSessionToken()) {
+                this.resume().catch((error) => console.warn('⚠️ Session resume failed:', error));
+            }
         });
 
         this.client.onMessage('error', (message) => {
@@ -181,29 +294,41 @@ export class WebSocketAPIService {
         });
     }
 
-    private handleResponse(type: string, data: any): void {
-        const handler = this.responseHandlers.get(type);
-        if (handler) {
-            clearTimeout(handler.timeout);
-            this.responseHandlers.delete(type);
-            handler.resolve(data);
+    private handleResponse(message: WebSocketMessage): boolean {
+        const id = Number(message.id);
+        const handler = this.responseHandlers.get(id);
+        if (!handler) {
+            return false;
+        }
+        // Replies split over several frames say `more` until the last one
+        if ((message as any).more) {
+            handler.items = [...(handler.items ?? []), ...((message as any).items ?? [])];
+            return true;
+        }
+        if (handler.items) {
+            (message as any).items = [...handler.items, ...((message as any).items ?? [])];
         }
+        clearTimeout(handler.timeout);
+        this.responseHandlers.delete(id);
+        handler.resolve(message);
+        return true;
     }
 
-    private async sendRequestWithResponse<T>(message: WebSocketMessage, timeout = 10000): Promise<T> {
+    private async sendRequestWithResponse<T>(message: ProtocolRequest, timeout = 10000): Promise<T> {
         await this.client.connect();
         
+        const id = this.nextRequestId++;
         return new Promise((resolve, reject) => {
             const timeoutId = setTimeout(() => {
-                this.responseHandlers.delete(message.type);
+                this.responseHandlers.delete(id);
                 reject(new Error(`Request timeout for ${message.type}`));
             }, timeout);
 
-            this.responseHandlers.set(message.type, { resolve, reject, timeout: timeoutId });
+            this.responseHandlers.set(id, { resolve, reject, timeout: timeoutId });
             
-            this.client.sendMessage(message).catch((error) => {
+            this.client.sendMessage({ ...message, id }).catch((error) => {
                 clearTimeout(timeoutId);
-                this.responseHandlers.delete(message.type);
+                this.responseHandlers.delete(id);
                 reject(error);
             });
         });
@@ -214,25 +339,84 @@ export class WebSocketAPIService {
     }
 
     async login(username: string, password: string): Promise<any> {
-        const message: LoginMessage = {
+        const message: LoginRequest = {
             type: 'login',
             username,
             password
         };
         
-        return this.sendRequestWithResponse(message);
+        const response: any = await this.sendRequestWithResponse(message);
+        if (response?.success && response.user?.token) {
+            this.setSessionToken(response.user.token);
+        }
+        return response;
+    }
+
+    async resume(): Promise<any> {
+        const token = this.getSessionToken();
+        if (!token) {
+            throw new Error('No session token');
+        }
+
+        const message: ResumeRequest = {
+            type: 'resume',
+            token
+        };
+        
+        const response: any = await this.sendRequestWithResponse(message);
+        if (!response?.success) {
+            this.setSessionToken(null);
+        }
+        return response;
+    }
+
+    // Try the session token first; the daemon answers needs_password once
+    // the token is too old to unlock without PAM
+    async unlock(password?: string): Promise<any> {
+        const message: UnlockRequest = password
+            ? { type: 'unlock', password }
+            : { type: 'unlock', token: this.getSessionToken() ?? undefined };
+        
+        const response: any = await this.sendRequestWithResponse(message);
+        if (response?.success && response.user?.token) {
+            this.setSessionToken(response.user.token);
+        }
+        return response;
+    }
+
+    async lock(): Promise<any> {
+        return this.sendRequestWithResponse({ type: 'lock' });
+    }
+
+    async logout(): Promise<any> {
+        const response = await this.sendRequestWithResponse({ type: 'logout' });
+        this.setSessionToken(null);
+        return response;
+    }
+
+    private getSessionToken(): string | null {
+        return typeof sessionStorage !== 'undefined' ? sessionStorage.getItem(SESSION_TOKEN_KEY) : null;
+    }
+
+    private setSessionToken(token: string | null): void {
+        if (typeof sessionStorage === 'undefined') return;
+        if (token) {
+            sessionStorage.setItem(SESSION_TOKEN_KEY, token);
+        } else {
+            sessionStorage.removeItem(SESSION_TOKEN_KEY);
+        }
     }
 
     async getSystemStatus(): Promise<any> {
-        const message: SystemStatusMessage = {
+        const message: SystemStatusRequest = {
             type: 'system_status'
         };
         
         return this.sendRequestWithResponse(message);
     }
 
-    async desktopSessionAction(action: string, params?: any): Promise<any> {
-        const message: DesktopSessionMessage = {
+    async desktopSessionAction(action: DesktopSessionRequest['action'], params?: DesktopSessionRequest['params']): Promise<any> {
+        const message: DesktopSessionRequest = {
             type: 'desktop_session',
             action,
             params
@@ -241,6 +425,141 @@ export class WebSocketAPIService {
         return this.sendRequestWithResponse(message);
     }
 
+    // Send several requests in one round trip; resolves with their replies
+    // in request order
+    async batch(requests: ProtocolRequest[]): Promise<any[]> {
+        if (requests.length > REQUEST_MAX_ITEMS.batch.requests) {
+            throw new Error(`A batch takes at most ${REQUEST_MAX_ITEMS.batch.requests} requests`);
+        }
+
+        const message: ProtocolRequest = {
+            type: 'batch',
+            requests
+        };
+        
+        const response: any = await this.sendRequestWithResponse(message);
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Batch failed');
+        }
+        return response.replies;
+    }
+
+    // PNG thumbnails for image files, e.g. everything in a directory view.
+    // The daemon caches them, so asking again is cheap.
+    async thumbnails(paths: string[], size = 128): Promise<Thumbnail[]> {
+        const message: ThumbnailRequest = {
+            type: 'thumbnail',
+            paths,
+            size
+        };
+        
+        const response: any = await this.sendRequestWithResponse(message, 30000);
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Thumbnail request failed');
+        }
+        return response.items;
+    }
+
+    // File names under the indexed directories, best match first. Fuzzy
+    // mode tolerates typos; substring mode is exact but case-insensitive.
+    async search(query: string, mode: 'substring' | 'fuzzy' = 'substring', offset = 0, limit = 50): Promise<SearchPage> {
+        const message: SearchRequest = {
+            type: 'search',
+            query,
+            mode,
+            offset,
+            limit
+        };
+        
+        const response: any = await this.sendRequestWithResponse(message);
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Search failed');
+        }
+        return response.data;
+    }
+
+    // Installed applications from the daemon's catalog of .desktop files.
+    // Names are localized when a locale such as navigator.language is given.
+    async listApps(locale?: string, includeHidden = false): Promise<AppEntry[]> {
+        const response: any = await this.sendRequestWithResponse({
+            type: 'list_apps',
+            locale,
+            include_hidden: includeHidden
+        });
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Could not list applications');
+        }
+        return response.data.apps;
+    }
+
+    async searchApps(query: string, locale?: string, limit = 50): Promise<AppEntry[]> {
+        const response: any = await this.sendRequestWithResponse({
+            type: 'search_apps',
+            query,
+            locale,
+            limit
+        });
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Application search failed');
+        }
+        return response.data.apps;
+    }
+
+    // Start a program as the logged-in user, either a catalog entry by
+    // desktop id or an explicit argv. Resolves with the pid once it has
+    // exec'd; watch for its end with onRealtimeMessage('process_exit').
+    async launch(target: { app: string } | { argv: string[] }, options: LaunchOptions = {}): Promise<number> {
+        const response: any = await this.sendRequestWithResponse({
+            type: 'launch',
+            ...target,
+            ...options
+        });
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Launch failed');
+        }
+        return response.pid;
+    }
+
+    async resourceUsage(): Promise<SessionUsage> {
+        const response: any = await this.sendRequestWithResponse({ type: 'resource_usage' });
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Could not read resource usage');
+        }
+        return response.data;
+    }
+
+    // SIGKILL (the default) ends the program and everything it forked
+    async kill(pid: number, signal?: number): Promise<void> {
+        const response: any = await this.sendRequestWithResponse({ type: 'kill', pid, signal });
+        if (!response?.success) {
+            throw new Error(response?.message ?? 'Kill failed');
+        }
+    }
+
+    // Current window scene; also subscribes this connection to scene_delta
+    async sceneSnapshot(): Promise<any> {
+        const message: SceneRequest = {
+            type: 'scene',
+            action: 'snapshot'
+        };
+        
+        return this.sendRequestWithResponse(message);
+    }
+
+    async sceneMutate(ops: Array<Record<string, unknown>>): Promise<any> {
+        const message: SceneRequest = {
+            type: 'scene',
+            action: 'mutate',
+            ops
+        };
+        
+        return this.sendRequestWithResponse(message);
+    }
+
+    onConnectionOpen(handler: (reconnected: boolean) => void): void {
+        this.client.onOpen(handler);
+    }
+
     onRealtimeMessage(type: string, handler: (data: any) => void): void {
         this.client.onMessage(type, handler);
     }
@@ -5,6 +5,7 @@ import Cursor from "../../assets/cursor.svg";
 import { useTransition, animated } from "@react-spring/web";
 import { useEffect, useState } from "react";
 import { WebSocketAPIService } from "../../midleware";
+import { startSceneSync } from "../../stores/sceneSync";
 import AppGallery from "@/bin/appgallery";
 import SystemSettings from "@/bin/settings";
 import WindowOverview from "./components/WindowOverview";
@@ -18,6 +19,9 @@ function App() {
     const [showWindowOverview, setShowWindowOverview] = useState(false);
 
     useEffect(() => {
+        let stopSceneSync: (() => void) | null = null;
+        let unmounted = false;
+
         // Initialize WebSocket connection
         const initializeWebSocket = async () => {
             try {
@@ -41,9 +45,17 @@ function App() {
                     // Handle desktop events here
                 });
 
-                // Get initial system status
-                const status = await wsService.getSystemStatus();
+                // Load startup state in one round trip
+                const [status, scene] = await wsService.batch([
+                    { type: 'system_status' },
+                    { type: 'scene', action: 'snapshot' }
+                ]);
                 setSystemStatus(status);
+
+                // Windows come from the daemon's scene, shared with other shells
+                if (!unmounted) {
+                    stopSceneSync = startSceneSync(wsService, scene?.success ? scene : undefined);
+                }
             } catch (error) {
                 console.error('Failed to initialize WebSocket:', error);
                 setConnectionStatus('disconnected');
@@ -62,6 +74,8 @@ function App() {
         }, 5000);
 
         return () => {
+            unmounted = true;
+            stopSceneSync?.();
             clearInterval(statusInterval);
             wsService.offRealtimeMessage('system_update');
             wsService.offRealtimeMessage('notification');
@@ -0,0 +1,255 @@
+import { useWindowStore, WindowInfo, WindowState } from './windowStore';
+import type { WebSocketAPIService } from '../midleware';
+
+// Window scene as vldwmapi keeps it. The daemon is authoritative: local
+// window changes go up as compact ops, and every shell applies the
+// per-frame scene_delta pushes that come back.
+export interface SceneWindow {
+  id: string;
+  title: string;
+  x: number;
+  y: number;
+  width: number;
+  height: number;
+  z: number;
+  state: WindowState;
+  always_on_top: boolean;
+  version: number;
+}
+
+export interface SceneSnapshot {
+  version: number;
+  focus: string | null;
+  windows: SceneWindow[];
+}
+
+interface SceneDelta {
+  from: number;
+  version: number;
+  focus: string | null;
+  full?: boolean;
+  removed: string[];
+  windows: SceneWindow[];
+}
+
+type SceneOp = { op: 'open' | 'set' | 'focus' | 'blur' | 'raise' | 'close'; id: string } & Record<string, unknown>;
+
+const MAX_OPS_PER_MESSAGE = 64;
+
+let service: WebSocketAPIService | null = null;
+let version = 0;
+// What the daemon has, plus local ops already sent
+let shadow: Record<string, WindowInfo> = {};
+let applyingRemote = false;
+let pendingOps: SceneOp[] = [];
+let flushScheduled = false;
+// Windows with ops the daemon has not acknowledged yet: sequence of the
+// last send, then the scene version that includes it
+const unacked = new Map<string, { seq: number; version: number }>();
+let sendSeq = 0;
+
+function toWindowInfo(window: SceneWindow, focus: string | null): WindowInfo {
+  return {
+    id: window.id,
+    title: window.title,
+    isActive: window.id === focus,
+    state: window.state,
+    position: { x: window.x, y: window.y },
+    size: { width: window.width, height: window.height },
+    zIndex: window.z,
+    isAlwaysOnTop: window.always_on_top
+  };
+}
+
+function replaceWindows(windows: Record<string, WindowInfo>, focus: string | null): void {
+  applyingRemote = true;
+  useWindowStore.setState((state) => ({
+    windows,
+    activeWindowId: focus && windows[focus] ? focus : null,
+    _allWindowsCache: null,
+    _visibleWindowsCache: null,
+    _minimizedWindowsCache: null,
+    _cacheVersion: state._cacheVersion + 1
+  }));
+  applyingRemote = false;
+  shadow = windows;
+}
+
+// Keep the local copy of windows whose own ops are still on the way, so
+// a drag doesn't jump back to an older position for a frame
+function keepLocal(id: string, deltaVersion: number): boolean {
+  const entry = unacked.get(id);
+  if (!entry) return false;
+  if (entry.version !== Infinity && deltaVersion >= entry.version) {
+    unacked.delete(id);
+    return false;
+  }
+  return true;
+}
+
+export function applySceneSnapshot(snapshot: SceneSnapshot): void {
+  const local = useWindowStore.getState().windows;
+
+  // A fresh daemon has no scene yet; seed it from this shell's windows
+  if (snapshot.version === 0 && snapshot.windows.length === 0 && Object.keys(local).length > 0) {
+    version = 0;
+    shadow = {};
+    queueChanges(local);
+    return;
+  }
+
+  const windows: Record<string, WindowInfo> = {};
+  for (const window of snapshot.windows) {
+    windows[window.id] = toWindowInfo(window, snapshot.focus);
+  }
+  version = snapshot.version;
+  unacked.clear();
+  replaceWindows(windows, snapshot.focus);
+}
+
+function applySceneDelta(delta: SceneDelta): void {
+  if (delta.from > version) {
+    // Missed a delta (e.g. across a reconnect); start over from a snapshot
+    resync();
+    return;
+  }
+  if (delta.version <= version) {
+    return;
+  }
+
+  const local = useWindowStore.getState().windows;
+  const windows: Record<string, WindowInfo> = delta.full ? {} : { ...shadow };
+  for (const id of delta.removed) {
+    delete windows[id];
+  }
+  for (const window of delta.windows) {
+    windows[window.id] = keepLocal(window.id, delta.version) && local[window.id]
+      ? local[window.id]
+      : toWindowInfo(window, delta.focus);
+  }
+  for (const id of Object.keys(windows)) {
+    windows[id] = { ...windows[id], isActive: id === delta.focus };
+  }
+  version = delta.version;
+  replaceWindows(windows, delta.focus);
+}
+
+function resync(): void {
+  service?.sceneSnapshot()
+    .then((reply) => reply?.success && applySceneSnapshot(reply))
+    .catch((error) => console.warn('⚠️ Scene resync failed:', error));
+}
+
+// Turn the difference between the shadow and the store into ops
+function diffOps(next: Record<string, WindowInfo>): SceneOp[] {
+  const ops: SceneOp[] = [];
+
+  for (const id of Object.keys(shadow)) {
+    if (!next[id]) ops.push({ op: 'close', id });
+  }
+  for (const [id, window] of Object.entries(next)) {
+    const prev = shadow[id];
+    const fields: Record<string, unknown> = {};
+
+    if (!prev || prev.title !== window.title) fields.title = window.title;
+    if (!prev || prev.state !== window.state) fields.state = window.state;
+    if (!prev || prev.isAlwaysOnTop !== window.isAlwaysOnTop) fields.always_on_top = !!window.isAlwaysOnTop;
+    if (window.position && (!prev || prev.position?.x !== window.position.x || prev.position?.y !== window.position.y)) {
+      fields.x = window.position.x;
+      fields.y = window.position.y;
+    }
+    if (window.size && (!prev || prev.size?.width !== window.size.width || prev.size?.height !== window.size.height)) {
+      fields.width = window.size.width;
+      fields.height = window.size.height;
+    }
+
+    if (!prev) {
+      ops.push({ op: 'open', id, ...fields });
+    } else if (Object.keys(fields).length > 0) {
+      ops.push({ op: 'set', id, ...fields });
+    }
+    if (window.isActive && !prev?.isActive) {
+      ops.push({ op: 'focus', id });
+    } else if (!window.isActive && prev?.isActive) {
+      ops.push({ op: 'blur', id });
+    } else if (prev && (window.zIndex ?? 0) > (prev.zIndex ?? 0)) {
+      ops.push({ op: 'raise', id });
+    }
+  }
+  return ops;
+}
+
+function queueChanges(next: Record<string, WindowInfo>): void {
+  const ops = diffOps(next);
+  shadow = next;
+  if (ops.length === 0) return;
+
+  pendingOps.push(...ops);
+  if (!flushScheduled) {
+    flushScheduled = true;
+    const schedule = typeof requestAnimationFrame !== 'undefined'
+      ? requestAnimationFrame
+      : (callback: () => void) => setTimeout(callback, 16);
+    schedule(() => flushOps());
+  }
+}
+
+// One mutate per frame, however many store updates happened in it
+function flushOps(): void {
+  flushScheduled = false;
+  const ops = pendingOps;
+  pendingOps = [];
+  if (!service) return;
+
+  for (let i = 0; i < ops.length; i += MAX_OPS_PER_MESSAGE) {
+    const chunk = ops.slice(i, i + MAX_OPS_PER_MESSAGE);
+    const seq = ++sendSeq;
+    for (const op of chunk) {
+      unacked.set(op.id, { seq, version: Infinity });
+    }
+    service.sceneMutate(chunk)
+      .then((reply) => {
+        for (const op of chunk) {
+          const entry = unacked.get(op.id);
+          if (entry?.seq === seq) entry.version = reply?.version ?? 0;
+        }
+        if (!reply?.success) {
+          console.warn('⚠️ Scene update rejected:', reply?.message);
+          resync();
+        }
+      })
+      .catch((error) => console.warn('⚠️ Scene update failed:', error));
+  }
+}
+
+// Keep the window store in sync with the daemon's scene. Pass the
+// snapshot if it was already fetched (e.g. in the startup batch).
+// Returns a function that stops syncing.
+export function startSceneSync(api: WebSocketAPIService, snapshot?: SceneSnapshot): () => void {
+  service = api;
+  api.onRealtimeMessage('scene_delta', (delta) => applySceneDelta(delta));
+  api.onConnectionOpen((reconnected) => {
+    if (reconnected && service === api) resync();
+  });
+
+  const unsubscribe = useWindowStore.subscribe(
+    (state) => state.windows,
+    (windows) => {
+      if (!applyingRemote) queueChanges(windows);
+    }
+  );
+
+  if (snapshot) {
+    applySceneSnapshot(snapshot);
+  } else {
+    resync();
+  }
+
+  return () => {
+    unsubscribe();
+    api.offRealtimeMessage('scene_delta');
+    service = null;
+    pendingOps = [];
+    unacked.clear();
+  };
+}
@@ -0,0 +1,1266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "appcatalog.h"
+#include "metrics.h"
+
+#define CATALOG_MAGIC "VLDWMAPP"
+#define CATALOG_VERSION 1
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | IN_ONLYDIR)
+#define MAX_LOCALE_CANDIDATES 4
+#define LOCALE_NAME_MAX 96              // lang_COUNTRY@modifier, each part under 32 bytes
+
+enum {
+    FIELD_NAME,
+    FIELD_GENERIC_NAME,
+    FIELD_COMMENT,
+    FIELD_EXEC,
+    FIELD_ICON,
+    FIELD_CATEGORIES,
+    FIELD_KEYWORDS,
+    FIELD_COUNT
+};
+
+enum {
+    APP_NO_DISPLAY = 1,
+    APP_TERMINAL = 2,
+    APP_HIDDEN = 4                  // Deleted by the user; masks the same id in later dirs
+};
+
+static const char *const g_field_keys[FIELD_COUNT] = {
+    "Name", "GenericName", "Comment", "Exec", "Icon", "Categories", "Keywords"
+};
+
+// On-disk index, used in place through mmap: header, directories,
+// applications sorted by name, localized strings, then a pool of
+// NUL-terminated strings addressed by offset (0 is "")
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t generation;
+    uint32_t roots;                 // The root dirs joined by ':'
+    uint32_t dir_count;
+    uint32_t app_count;
+    uint32_t loc_count;
+    uint32_t string_bytes;
+    uint32_t reserved;
+    uint64_t size;
+} catalog_header_t;
+
+typedef struct {
+    uint32_t path;
+    uint32_t reserved;
+    int64_t mtime_sec;              // -1 if the directory doesn't exist
+    int64_t mtime_nsec;
+} catalog_dir_t;
+
+typedef struct {
+    uint32_t id;                    // Desktop file id, e.g. "org.gnome.Terminal.desktop"
+    uint32_t path;
+    uint32_t fields[FIELD_COUNT];
+    uint32_t loc_first;
+    uint16_t loc_count;
+    uint16_t flags;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} catalog_app_t;
+
+typedef struct {
+    uint32_t field;
+    uint32_t locale;
+    uint32_t value;
+} catalog_loc_t;
+
+// A desktop file during a rebuild, parsed or copied from the old index
+typedef struct {
+    int field;
+    char *locale;
+    char *value;
+} source_loc_t;
+
+typedef struct {
+    char *id;
+    char *path;
+    char *fields[FIELD_COUNT];
+    source_loc_t *locs;
+    int loc_count;
+    int loc_cap;
+    int flags;
+    int valid;                      // An Application entry with a name, or Hidden
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} source_app_t;
+
+typedef struct {
+    char *path;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} source_dir_t;
+
+typedef struct {
+    source_app_t *apps;
+    int app_count;
+    int app_cap;
+    source_dir_t *dirs;
+    int dir_count;
+    int dir_cap;
+} scan_t;
+
+// Deduplicating string pool for building an index
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    uint32_t *slots;
+    uint32_t slot_cap;
+    uint32_t count;
+} string_pool_t;
+
+// The current index; swapped under the write lock by rebuilds
+static pthread_rwlock_t g_lock = PTHREAD_RWLOCK_INITIALIZER;
+static unsigned char *g_map = NULL;
+static size_t g_map_size = 0;
+static int g_map_owned = 0;         // malloc'd rather than mapped
+
+static char g_roots[APP_CATALOG_MAX_ROOTS][PATH_MAX];
+static int g_root_count = 0;
+static char g_cache_path[PATH_MAX];
+static int g_inotify_fd = -1;
+
+static pthread_t g_rebuild_thread;
+static int g_rebuild_started = 0;
+static pthread_mutex_t g_rebuild_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_rebuild_cond = PTHREAD_COND_INITIALIZER;
+static int g_rebuild_requested = 0;
+static int g_rebuild_stop = 0;
+
+static const catalog_header_t *map_header(const unsigned char *map) {
+    return (const catalog_header_t *)map;
+}
+
+static const catalog_dir_t *map_dirs(const unsigned char *map) {
+    return (const catalog_dir_t *)(map + sizeof(catalog_header_t));
+}
+
+static const catalog_app_t *map_apps(const unsigned char *map) {
+    return (const catalog_app_t *)(map_dirs(map) + map_header(map)->dir_count);
+}
+
+static const catalog_loc_t *map_locs(const unsigned char *map) {
+    return (const catalog_loc_t *)(map_apps(map) + map_header(map)->app_count);
+}
+
+static const char *map_string(const unsigned char *map, uint32_t offset) {
+    return (const char *)(map_locs(map) + map_header(map)->loc_count) + offset;
+}
+
+// Every offset must land inside the string pool, which must end in NUL
+static int map_valid(const unsigned char *map, size_t size) {
+    const catalog_header_t *h = map_header(map);
+    if (size < sizeof(*h) || memcmp(h->magic, CATALOG_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CATALOG_VERSION || h->size != size) {
+        return 0;
+    }
+    uint64_t expected = sizeof(*h) + (uint64_t)h->dir_count * sizeof(catalog_dir_t) +
+                        (uint64_t)h->app_count * sizeof(catalog_app_t) +
+                        (uint64_t)h->loc_count * sizeof(catalog_loc_t) + h->string_bytes;
+    if (expected != size || h->string_bytes == 0 || map_string(map, h->string_bytes - 1)[0] != '\0') return 0;
+
+    uint32_t limit = h->string_bytes;
+    if (h->roots >= limit) return 0;
+    for (uint32_t i = 0; i < h->dir_count; i++) {
+        if (map_dirs(map)[i].path >= limit) return 0;
+    }
+    for (uint32_t i = 0; i < h->app_count; i++) {
+        const catalog_app_t *app = &map_apps(map)[i];
+        if (app->id >= limit || app->path >= limit || (uint64_t)app->loc_first + app->loc_count > h->loc_count) return 0;
+        for (int f = 0; f < FIELD_COUNT; f++) {
+            if (app->fields[f] >= limit) return 0;
+        }
+    }
+    for (uint32_t i = 0; i < h->loc_count; i++) {
+        const catalog_loc_t *loc = &map_locs(map)[i];
+        if (loc->field >= FIELD_COUNT || loc->locale >= limit || loc->value >= limit) return 0;
+    }
+    return 1;
+}
+
+static void free_map(unsigned char *map, size_t size, int owned) {
+    if (!map) return;
+    if (owned) free(map);
+    else munmap(map, size);
+}
+
+static unsigned char *map_file(const char *path, size_t *size) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    unsigned char *map = NULL;
+
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+        } else if (!map_valid(map, st.st_size)) {
+            munmap(map, st.st_size);
+            map = NULL;
+        } else {
+            *size = st.st_size;
+        }
+    }
+    close(fd);
+    return map;
+}
+
+// Building
+
+static uint32_t hash_string(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static int pool_init(string_pool_t *pool) {
+    memset(pool, 0, sizeof(*pool));
+    pool->cap = 16 * 1024;
+    if (!(pool->data = malloc(pool->cap))) return -1;
+    pool->data[0] = '\0';            // Offset 0 is the empty string
+    pool->len = 1;
+    return 0;
+}
+
+static uint32_t pool_add(string_pool_t *pool, const char *s) {
+    if (!s || !*s) return 0;
+
+    if ((pool->count + 1) * 2 > pool->slot_cap) {
+        uint32_t cap = pool->slot_cap ? pool->slot_cap * 2 : 1024;
+        uint32_t *slots = calloc(cap, sizeof(uint32_t));
+        if (!slots) return 0;
+        for (uint32_t i = 0; i < pool->slot_cap; i++) {
+            if (!pool->slots[i]) continue;
+            uint32_t j = hash_string(pool->data + pool->slots[i]) & (cap - 1);
+            while (slots[j]) j = (j + 1) & (cap - 1);
+            slots[j] = pool->slots[i];
+        }
+        free(pool->slots);
+        pool->slots = slots;
+        pool->slot_cap = cap;
+    }
+
+    uint32_t mask = pool->slot_cap - 1;
+    uint32_t i = hash_string(s) & mask;
+    for (; pool->slots[i]; i = (i + 1) & mask) {
+        if (strcmp(pool->data + pool->slots[i], s) == 0) return pool->slots[i];
+    }
+
+    size_t len = strlen(s) + 1;
+    if (pool->len + len > pool->cap) {
+        size_t cap = pool->cap * 2;
+        while (cap < pool->len + len) cap *= 2;
+        char *data = realloc(pool->data, cap);
+        if (!data) return 0;
+        pool->data = data;
+        pool->cap = cap;
+    }
+    uint32_t offset = (uint32_t)pool->len;
+    memcpy(pool->data + offset, s, len);
+    pool->len += len;
+    pool->slots[i] = offset;
+    pool->count++;
+    return offset;
+}
+
+static void free_source_app(source_app_t *app) {
+    free(app->id);
+    free(app->path);
+    for (int f = 0; f < FIELD_COUNT; f++) free(app->fields[f]);
+    for (int i = 0; i < app->loc_count; i++) {
+        free(app->locs[i].locale);
+        free(app->locs[i].value);
+    }
+    free(app->locs);
+}
+
+static void free_scan(scan_t *scan) {
+    for (int i = 0; i < scan->app_count; i++) free_source_app(&scan->apps[i]);
+    for (int i = 0; i < scan->dir_count; i++) free(scan->dirs[i].path);
+    free(scan->apps);
+    free(scan->dirs);
+}
+
+static void add_loc(source_app_t *app, int field, const char *locale, const char *value) {
+    if (app->loc_count == app->loc_cap) {
+        int cap = app->loc_cap ? app->loc_cap * 2 : 16;
+        source_loc_t *locs = realloc(app->locs, cap * sizeof(source_loc_t));
+        if (!locs) return;
+        app->locs = locs;
+        app->loc_cap = cap;
+    }
+    source_loc_t *loc = &app->locs[app->loc_count];
+    loc->field = field;
+    loc->locale = strdup(locale);
+    loc->value = strdup(value);
+    if (loc->locale && loc->value) {
+        app->loc_count++;
+    } else {
+        free(loc->locale);
+        free(loc->value);
+    }
+}
+
+// \s, \n, \t, \r and \\ from the desktop entry spec; "\;" inside lists
+// is left for the list splitter
+static void unescape_value(char *value) {
+    char *out = value;
+    for (char *p = value; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            char c = p[1];
+            char mapped = c == 's' ? ' ' : c == 'n' ? '\n' : c == 't' ? '\t' : c == 'r' ? '\r' : c == '\\' ? '\\' : 0;
+            if (mapped) {
+                *out++ = mapped;
+                p++;
+                continue;
+            }
+        }
+        *out++ = *p;
+    }
+    *out = '\0';
+}
+
+static int field_for_key(const char *key) {
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (strcmp(key, g_field_keys[f]) == 0) return f;
+    }
+    return -1;
+}
+
+static int localizable(int field) {
+    return field == FIELD_NAME || field == FIELD_GENERIC_NAME || field == FIELD_COMMENT || field == FIELD_KEYWORDS;
+}
+
+// The [Desktop Entry] group only; the first value of a key wins
+static void parse_desktop_file(source_app_t *app) {
+    struct stat st;
+    int fd = open(app->path, O_RDONLY | O_CLOEXEC);
+    char *text;
+    int in_entry = 0, seen_entry = 0, is_application = 0;
+
+    if (fd < 0) return;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > APP_CATALOG_MAX_FILE ||
+        (text = malloc(st.st_size + 1)) == NULL) {
+        close(fd);
+        return;
+    }
+    ssize_t len = read(fd, text, st.st_size);
+    close(fd);
+    if (len < 0) {
+        free(text);
+        return;
+    }
+    text[len] = '\0';
+
+    for (char *line = text, *next; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+
+        size_t n = strlen(line);
+        while (n > 0 && isspace((unsigned char)line[n - 1])) line[--n] = '\0';
+        if (!line[0] || line[0] == '#') continue;
+
+        if (line[0] == '[') {
+            in_entry = strcmp(line, "[Desktop Entry]") == 0;
+            if (seen_entry && !in_entry) break;
+            seen_entry |= in_entry;
+            continue;
+        }
+        if (!in_entry) continue;
+
+        char *eq = strchr(line, '=');
+        if (!eq) continue;
+        char *key = line, *value = eq + 1, *locale = NULL;
+        *eq = '\0';
+        for (char *end = eq; end > key && isspace((unsigned char)end[-1]);) *--end = '\0';
+        while (isspace((unsigned char)*value)) value++;
+        unescape_value(value);
+
+        char *bracket = strchr(key, '[');
+        if (bracket) {
+            *bracket = '\0';
+            locale = bracket + 1;
+            char *close_bracket = strchr(locale, ']');
+            if (!close_bracket) continue;
+            *close_bracket = '\0';
+        }
+
+        int field = field_for_key(key);
+        if (field >= 0) {
+            if (locale) {
+                if (localizable(field)) add_loc(app, field, locale, value);
+            } else if (!app->fields[field]) {
+                app->fields[field] = strdup(value);
+            }
+        } else if (!locale && strcmp(key, "Type") == 0) {
+            is_application = strcmp(value, "Application") == 0;
+        } else if (!locale && strcmp(key, "NoDisplay") == 0 && strcmp(value, "true") == 0) {
+            app->flags |= APP_NO_DISPLAY;
+        } else if (!locale && strcmp(key, "Hidden") == 0 && strcmp(value, "true") == 0) {
+            app->flags |= APP_HIDDEN;
+        } else if (!locale && strcmp(key, "Terminal") == 0 && strcmp(value, "true") == 0) {
+            app->flags |= APP_TERMINAL;
+        }
+    }
+    free(text);
+
+    app->valid = (app->flags & APP_HIDDEN) || (is_application && app->fields[FIELD_NAME]);
+}
+
+static int copy_from_index(source_app_t *app, const unsigned char *map, const catalog_app_t *old) {
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        if (old->fields[f] && !(app->fields[f] = strdup(map_string(map, old->fields[f])))) return -1;
+    }
+    for (uint32_t i = 0; i < old->loc_count; i++) {
+        const catalog_loc_t *loc = &map_locs(map)[old->loc_first + i];
+        add_loc(app, loc->field, map_string(map, loc->locale), map_string(map, loc->value));
+    }
+    app->flags = old->flags;
+    app->valid = 1;
+    return 0;
+}
+
+static void add_dir(scan_t *scan, const char *path, int64_t sec, int64_t nsec) {
+    if (scan->dir_count == scan->dir_cap) {
+        int cap = scan->dir_cap ? scan->dir_cap * 2 : 32;
+        source_dir_t *dirs = realloc(scan->dirs, cap * sizeof(source_dir_t));
+        if (!dirs) return;
+        scan->dirs = dirs;
+        scan->dir_cap = cap;
+    }
+    source_dir_t *dir = &scan->dirs[scan->dir_count];
+    if (!(dir->path = strdup(path))) return;
+    dir->mtime_sec = sec;
+    dir->mtime_nsec = nsec;
+    scan->dir_count++;
+}
+
+static int id_taken(const scan_t *scan, const char *id) {
+    for (int i = 0; i < scan->app_count; i++) {
+        if (strcmp(scan->apps[i].id, id) == 0) return 1;
+    }
+    return 0;
+}
+
+// Collect desktop files; the first file with a given id wins, so roots
+// are walked in XDG precedence order. Subdirectory names become part of
+// the id ("kde4/foo.desktop" is "kde4-foo.desktop").
+static void scan_directory(scan_t *scan, const char *path, const char *prefix, int depth) {
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        if (depth == 0) add_dir(scan, path, -1, 0);
+        return;
+    }
+    add_dir(scan, path, st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+
+    DIR *d = opendir(path);
+    if (!d) return;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+
+        char child[PATH_MAX], id[PATH_MAX];
+        if ((size_t)snprintf(child, sizeof(child), "%s/%s", path, ent->d_name) >= sizeof(child) ||
+            (size_t)snprintf(id, sizeof(id), "%s%s", prefix, ent->d_name) >= sizeof(id) ||
+            fstatat(dirfd(d), ent->d_name, &st, 0) != 0) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (depth + 1 < APP_CATALOG_MAX_DEPTH && strlen(id) + 2 < sizeof(id)) {
+                strcat(id, "-");
+                scan_directory(scan, child, id, depth + 1);
+            }
+            continue;
+        }
+
+        size_t len = strlen(ent->d_name);
+        if (!S_ISREG(st.st_mode) || len < 8 || strcmp(ent->d_name + len - 8, ".desktop") != 0 || id_taken(scan, id)) {
+            continue;
+        }
+        if (scan->app_count == scan->app_cap) {
+            int cap = scan->app_cap ? scan->app_cap * 2 : 256;
+            source_app_t *apps = realloc(scan->apps, cap * sizeof(source_app_t));
+            if (!apps) break;
+            scan->apps = apps;
+            scan->app_cap = cap;
+        }
+        source_app_t *app = &scan->apps[scan->app_count];
+        memset(app, 0, sizeof(*app));
+        app->id = strdup(id);
+        app->path = strdup(child);
+        app->mtime_sec = st.st_mtim.tv_sec;
+        app->mtime_nsec = st.st_mtim.tv_nsec;
+        if (!app->id || !app->path) {
+            free_source_app(app);
+            continue;
+        }
+        scan->app_count++;
+    }
+    closedir(d);
+}
+
+// Old index entries sorted by path, to find files that haven't changed
+static const unsigned char *g_sort_map = NULL;
+
+static int compare_old_paths(const void *a, const void *b) {
+    const catalog_app_t *apps = map_apps(g_sort_map);
+    return strcmp(map_string(g_sort_map, apps[*(const uint32_t *)a].path),
+                  map_string(g_sort_map, apps[*(const uint32_t *)b].path));
+}
+
+static const catalog_app_t *find_old(const unsigned char *map, const uint32_t *by_path, const char *path) {
+    uint32_t lo = 0, hi = map_header(map)->app_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        const catalog_app_t *app = &map_apps(map)[by_path[mid]];
+        int cmp = strcmp(map_string(map, app->path), path);
+        if (cmp == 0) return app;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+typedef struct {
+    source_app_t **apps;
+    int count;
+    int next;
+} parse_work_t;
+
+static void *parse_main(void *arg) {
+    parse_work_t *work = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+        parse_desktop_file(work->apps[i]);
+    }
+    return NULL;
+}
+
+// Parse everything new or modified, spread over a few threads
+static void parse_changed(source_app_t **apps, int count) {
+    parse_work_t work = { apps, count, 0 };
+    pthread_t threads[APP_CATALOG_PARSE_THREADS];
+    int started = 0;
+
+    if (count > APP_CATALOG_PARSE_THREADS * 4) {
+        for (; started < APP_CATALOG_PARSE_THREADS - 1; started++) {
+            if (pthread_create(&threads[started], NULL, parse_main, &work) != 0) break;
+        }
+    }
+    parse_main(&work);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+}
+
+static int compare_source_names(const void *a, const void *b) {
+    const source_app_t *x = *(source_app_t *const *)a, *y = *(source_app_t *const *)b;
+    int cmp = strcasecmp(x->fields[FIELD_NAME], y->fields[FIELD_NAME]);
+    return cmp ? cmp : strcmp(x->id, y->id);
+}
+
+static void join_roots(char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < g_root_count; i++) {
+        int n = snprintf(buf + len, size - len, "%s%s", i ? ":" : "", g_roots[i]);
+        if (n < 0 || (size_t)n >= size - len) break;
+        len += n;
+    }
+}
+
+// Lay out a new index from the scan
+static unsigned char *build_index(const scan_t *scan, uint32_t generation, size_t *size) {
+    char roots[APP_CATALOG_MAX_ROOTS * PATH_MAX];
+    string_pool_t pool;
+    source_app_t **listed = malloc((scan->app_count + 1) * sizeof(source_app_t *));
+    uint32_t listed_count = 0, loc_count = 0;
+    unsigned char *blob = NULL;
+
+    if (!listed) return NULL;
+    if (pool_init(&pool) != 0) {
+        free(listed);
+        return NULL;
+    }
+    for (int i = 0; i < scan->app_count; i++) {
+        source_app_t *app = &scan->apps[i];
+        if (app->valid && !(app->flags & APP_HIDDEN)) {
+            listed[listed_count++] = app;
+            loc_count += app->loc_count;
+        }
+    }
+    qsort(listed, listed_count, sizeof(*listed), compare_source_names);
+
+    join_roots(roots, sizeof(roots));
+    uint32_t roots_offset = pool_add(&pool, roots);
+    uint32_t *dir_paths = malloc((scan->dir_count + 1) * sizeof(uint32_t));
+    catalog_app_t *apps = calloc(listed_count + 1, sizeof(catalog_app_t));
+    catalog_loc_t *locs = calloc(loc_count + 1, sizeof(catalog_loc_t));
+    if (!dir_paths || !apps || !locs) goto out;
+
+    for (int i = 0; i < scan->dir_count; i++) dir_paths[i] = pool_add(&pool, scan->dirs[i].path);
+    loc_count = 0;
+    for (uint32_t i = 0; i < listed_count; i++) {
+        const source_app_t *src = listed[i];
+        catalog_app_t *app = &apps[i];
+        app->id = pool_add(&pool, src->id);
+        app->path = pool_add(&pool, src->path);
+        for (int f = 0; f < FIELD_COUNT; f++) app->fields[f] = pool_add(&pool, src->fields[f]);
+        app->loc_first = loc_count;
+        app->loc_count = src->loc_count > UINT16_MAX ? UINT16_MAX : src->loc_count;
+        app->flags = src->flags;
+        app->mtime_sec = src->mtime_sec;
+        app->mtime_nsec = src->mtime_nsec;
+        for (int l = 0; l < app->loc_count; l++) {
+            locs[loc_count].field = src->locs[l].field;
+            locs[loc_count].locale = pool_add(&pool, src->locs[l].locale);
+            locs[loc_count].value = pool_add(&pool, src->locs[l].value);
+            loc_count++;
+        }
+    }
+
+    *size = sizeof(catalog_header_t) + scan->dir_count * sizeof(catalog_dir_t) +
+            listed_count * sizeof(catalog_app_t) + loc_count * sizeof(catalog_loc_t) + pool.len;
+    blob = calloc(1, *size);
+    if (!blob) goto out;
+
+    catalog_header_t *header = (catalog_header_t *)blob;
+    memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+    header->version = CATALOG_VERSION;
+    header->generation = generation;
+    header->roots = roots_offset;
+    header->dir_count = scan->dir_count;
+    header->app_count = listed_count;
+    header->loc_count = loc_count;
+    header->string_bytes = (uint32_t)pool.len;
+    header->size = *size;
+
+    catalog_dir_t *dirs = (catalog_dir_t *)(blob + sizeof(*header));
+    for (int i = 0; i < scan->dir_count; i++) {
+        dirs[i].path = dir_paths[i];
+        dirs[i].mtime_sec = scan->dirs[i].mtime_sec;
+        dirs[i].mtime_nsec = scan->dirs[i].mtime_nsec;
+    }
+    memcpy(dirs + scan->dir_count, apps, listed_count * sizeof(catalog_app_t));
+    memcpy((catalog_app_t *)(dirs + scan->dir_count) + listed_count, locs, loc_count * sizeof(catalog_loc_t));
+    memcpy(blob + *size - pool.len, pool.data, pool.len);
+
+out:
+    free(listed);
+    free(dir_paths);
+    free(apps);
+    free(locs);
+    free(pool.data);
+    free(pool.slots);
+    return blob;
+}
+
+static int write_cache(const unsigned char *blob, size_t size) {
+    char tmp[PATH_MAX + 8];
+    if (!g_cache_path[0] || (size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", g_cache_path) >= sizeof(tmp)) return -1;
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, blob + done, size - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    if (close(fd) != 0 || done != size || rename(tmp, g_cache_path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void watch_dirs(const scan_t *scan) {
+    if (g_inotify_fd < 0) return;
+
+    for (int i = 0; i < scan->dir_count; i++) {
+        if (scan->dirs[i].mtime_sec >= 0) {
+            inotify_add_watch(g_inotify_fd, scan->dirs[i].path, WATCH_MASK);
+            continue;
+        }
+        // A missing root shows up when its parent gets it
+        char parent[PATH_MAX];
+        snprintf(parent, sizeof(parent), "%s", scan->dirs[i].path);
+        char *slash = strrchr(parent, '/');
+        if (slash && slash != parent) {
+            *slash = '\0';
+            inotify_add_watch(g_inotify_fd, parent, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+        }
+    }
+}
+
+// Scan the roots, reuse entries whose files haven't changed, parse the
+// rest in parallel, then write and map the new index
+static int rebuild_catalog(void) {
+    uint64_t start = metrics_now_ns();
+    const unsigned char *old = g_map;         // Only rebuilds replace it
+    uint32_t *by_path = NULL;
+    source_app_t **changed = NULL;
+    int changed_count = 0, reused = 0;
+    scan_t scan;
+    size_t size;
+
+    memset(&scan, 0, sizeof(scan));
+    for (int i = 0; i < g_root_count; i++) scan_directory(&scan, g_roots[i], "", 0);
+
+    if (old && map_header(old)->app_count) {
+        uint32_t count = map_header(old)->app_count;
+        by_path = malloc(count * sizeof(uint32_t));
+        if (by_path) {
+            for (uint32_t i = 0; i < count; i++) by_path[i] = i;
+            g_sort_map = old;
+            qsort(by_path, count, sizeof(uint32_t), compare_old_paths);
+        }
+    }
+
+    changed = malloc((scan.app_count + 1) * sizeof(source_app_t *));
+    if (!changed) {
+        free(by_path);
+        free_scan(&scan);
+        return -1;
+    }
+    for (int i = 0; i < scan.app_count; i++) {
+        source_app_t *app = &scan.apps[i];
+        const catalog_app_t *prior = by_path ? find_old(old, by_path, app->path) : NULL;
+        if (prior && prior->mtime_sec == app->mtime_sec && prior->mtime_nsec == app->mtime_nsec &&
+            copy_from_index(app, old, prior) == 0) {
+            reused++;
+        } else {
+            changed[changed_count++] = app;
+        }
+    }
+    parse_changed(changed, changed_count);
+
+    unsigned char *blob = build_index(&scan, old ? map_header(old)->generation + 1 : 1, &size);
+    watch_dirs(&scan);
+    free(changed);
+    free(by_path);
+    free_scan(&scan);
+    if (!blob) return -1;
+
+    // Serve the file through the page cache when it could be written
+    unsigned char *map = NULL;
+    size_t map_size = 0;
+    int owned = 0;
+    if (write_cache(blob, size) == 0) map = map_file(g_cache_path, &map_size);
+    if (map) {
+        free(blob);
+    } else {
+        map = blob;
+        map_size = size;
+        owned = 1;
+    }
+
+    pthread_rwlock_wrlock(&g_lock);
+    unsigned char *previous = g_map;
+    size_t previous_size = g_map_size;
+    int previous_owned = g_map_owned;
+    g_map = map;
+    g_map_size = map_size;
+    g_map_owned = owned;
+    pthread_rwlock_unlock(&g_lock);
+    free_map(previous, previous_size, previous_owned);
+
+    printf("📱 App catalog: %u apps (%d parsed, %d unchanged) in %.1f ms\n", map_header(map)->app_count,
+           changed_count, reused, (metrics_now_ns() - start) / 1e6);
+    return 0;
+}
+
+// The cached index still holds if the roots are the same and no
+// directory has a new mtime; adding, removing or renaming a desktop file
+// touches its directory
+static int cache_current(const unsigned char *map) {
+    char roots[APP_CATALOG_MAX_ROOTS * PATH_MAX];
+    join_roots(roots, sizeof(roots));
+    if (strcmp(map_string(map, map_header(map)->roots), roots) != 0) return 0;
+
+    for (uint32_t i = 0; i < map_header(map)->dir_count; i++) {
+        const catalog_dir_t *dir = &map_dirs(map)[i];
+        struct stat st;
+        if (stat(map_string(map, dir->path), &st) != 0) {
+            if (dir->mtime_sec != -1) return 0;
+        } else if (dir->mtime_sec != st.st_mtim.tv_sec || dir->mtime_nsec != st.st_mtim.tv_nsec) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void *rebuild_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&g_rebuild_lock);
+    for (;;) {
+        while (!g_rebuild_requested && !g_rebuild_stop) pthread_cond_wait(&g_rebuild_cond, &g_rebuild_lock);
+        if (g_rebuild_stop) break;
+
+        // Package installs touch many files; wait until they go quiet
+        while (g_rebuild_requested && !g_rebuild_stop) {
+            struct timespec until;
+            g_rebuild_requested = 0;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += (long)APP_CATALOG_DEBOUNCE_MS * 1000000;
+            until.tv_sec += until.tv_nsec / 1000000000;
+            until.tv_nsec %= 1000000000;
+            while (!g_rebuild_requested && !g_rebuild_stop &&
+                   pthread_cond_timedwait(&g_rebuild_cond, &g_rebuild_lock, &until) == 0) {
+            }
+        }
+        if (g_rebuild_stop) break;
+
+        pthread_mutex_unlock(&g_rebuild_lock);
+        rebuild_catalog();
+        pthread_mutex_lock(&g_rebuild_lock);
+    }
+    pthread_mutex_unlock(&g_rebuild_lock);
+    return NULL;
+}
+
+static void add_root(const char *data_dir) {
+    if (!data_dir || data_dir[0] != '/' || g_root_count >= APP_CATALOG_MAX_ROOTS) return;
+
+    char path[PATH_MAX];
+    if ((size_t)snprintf(path, sizeof(path), "%s/applications", data_dir) >= sizeof(path)) return;
+    for (int i = 0; i < g_root_count; i++) {
+        if (strcmp(g_roots[i], path) == 0) return;
+    }
+    strcpy(g_roots[g_root_count++], path);
+}
+
+// $XDG_DATA_HOME first, then each of $XDG_DATA_DIRS
+static void find_roots(void) {
+    const char *home = getenv("HOME");
+    const char *data_home = getenv("XDG_DATA_HOME");
+    const char *data_dirs = getenv("XDG_DATA_DIRS");
+    char buf[PATH_MAX];
+
+    g_root_count = 0;
+    if (data_home && data_home[0] == '/') {
+        add_root(data_home);
+    } else if (home && home[0] == '/' && (size_t)snprintf(buf, sizeof(buf), "%s/.local/share", home) < sizeof(buf)) {
+        add_root(buf);
+    }
+
+    if (!data_dirs || !data_dirs[0]) data_dirs = "/usr/local/share:/usr/share";
+    while (*data_dirs) {
+        size_t len = strcspn(data_dirs, ":");
+        if (len > 0 && len < sizeof(buf)) {
+            memcpy(buf, data_dirs, len);
+            buf[len] = '\0';
+            while (len > 1 && buf[len - 1] == '/') buf[--len] = '\0';
+            add_root(buf);
+        }
+        data_dirs += len;
+        if (*data_dirs == ':') data_dirs++;
+    }
+}
+
+int init_app_catalog(void) {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    printf("📱 Initializing app catalog...\n");
+    find_roots();
+
+    g_cache_path[0] = '\0';
+    if (cache_home && cache_home[0] == '/') {
+        snprintf(g_cache_path, sizeof(g_cache_path), "%s/%s", cache_home, APP_CATALOG_CACHE_NAME);
+    } else if (home && home[0] == '/') {
+        snprintf(g_cache_path, sizeof(g_cache_path), "%s/.cache/%s", home, APP_CATALOG_CACHE_NAME);
+    }
+
+    g_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_inotify_fd < 0) perror("inotify_init1");
+
+    // After boot the mapped cache is normally current and nothing is parsed
+    size_t size = 0;
+    unsigned char *map = g_cache_path[0] ? map_file(g_cache_path, &size) : NULL;
+    if (map) {
+        g_map = map;
+        g_map_size = size;
+        g_map_owned = 0;
+    }
+    if (map && cache_current(map)) {
+        scan_t scan;
+        memset(&scan, 0, sizeof(scan));
+        for (uint32_t i = 0; i < map_header(map)->dir_count; i++) {
+            const catalog_dir_t *dir = &map_dirs(map)[i];
+            add_dir(&scan, map_string(map, dir->path), dir->mtime_sec, dir->mtime_nsec);
+        }
+        watch_dirs(&scan);
+        free_scan(&scan);
+        printf("📱 App catalog: %u apps from %s\n", map_header(map)->app_count, g_cache_path);
+    } else if (rebuild_catalog() != 0) {
+        fprintf(stderr, "⚠️ Could not build the app catalog\n");
+    }
+
+    g_rebuild_stop = 0;
+    g_rebuild_started = pthread_create(&g_rebuild_thread, NULL, rebuild_main, NULL) == 0;
+    return 0;
+}
+
+void cleanup_app_catalog(void) {
+    printf("📱 Cleaning up app catalog...\n");
+
+    if (g_rebuild_started) {
+        pthread_mutex_lock(&g_rebuild_lock);
+        g_rebuild_stop = 1;
+        pthread_cond_signal(&g_rebuild_cond);
+        pthread_mutex_unlock(&g_rebuild_lock);
+        pthread_join(g_rebuild_thread, NULL);
+        g_rebuild_started = 0;
+    }
+    if (g_inotify_fd >= 0) close(g_inotify_fd);
+    g_inotify_fd = -1;
+
+    free_map(g_map, g_map_size, g_map_owned);
+    g_map = NULL;
+    g_map_size = 0;
+}
+
+int app_catalog_fd(void) {
+    return g_inotify_fd;
+}
+
+// Any change under the watched directories schedules a rebuild
+void app_catalog_process_events(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+
+    while (read(g_inotify_fd, buf, sizeof(buf)) > 0) changed = 1;
+    if (!changed) return;
+
+    pthread_mutex_lock(&g_rebuild_lock);
+    g_rebuild_requested = 1;
+    pthread_cond_signal(&g_rebuild_cond);
+    pthread_mutex_unlock(&g_rebuild_lock);
+}
+
+// Queries
+
+typedef struct {
+    char names[MAX_LOCALE_CANDIDATES][LOCALE_NAME_MAX];
+    int count;
+} locale_match_t;
+
+// "de_DE.UTF-8@euro" (or "de-DE" from a browser) is tried as de_DE@euro,
+// de_DE, de@euro and de, as the desktop entry spec describes
+static void match_locale(const char *locale, locale_match_t *match) {
+    char lang[32] = "", country[32] = "", modifier[32] = "";
+    match->count = 0;
+    if (!locale || !*locale) return;
+
+    size_t n = strcspn(locale, "_-.@");
+    if (n == 0 || n >= sizeof(lang)) return;
+    memcpy(lang, locale, n);
+    lang[n] = '\0';
+    locale += n;
+    if (*locale == '_' || *locale == '-') {
+        n = strcspn(++locale, ".@");
+        if (n < sizeof(country)) {
+            memcpy(country, locale, n);
+            country[n] = '\0';
+        }
+        locale += n;
+    }
+    if (*locale == '.') locale += strcspn(locale, "@");
+    if (*locale == '@') snprintf(modifier, sizeof(modifier), "%s", locale + 1);
+
+    if (country[0] && modifier[0]) snprintf(match->names[match->count++], LOCALE_NAME_MAX, "%s_%s@%s", lang, country, modifier);
+    if (country[0]) snprintf(match->names[match->count++], LOCALE_NAME_MAX, "%s_%s", lang, country);
+    if (modifier[0]) snprintf(match->names[match->count++], LOCALE_NAME_MAX, "%s@%s", lang, modifier);
+    snprintf(match->names[match->count++], LOCALE_NAME_MAX, "%s", lang);
+}
+
+static const char *app_field(const catalog_app_t *app, int field, const locale_match_t *match) {
+    const char *best = map_string(g_map, app->fields[field]);
+    int best_rank = match->count;
+
+    for (uint32_t i = 0; i < app->loc_count && best_rank > 0; i++) {
+        const catalog_loc_t *loc = &map_locs(g_map)[app->loc_first + i];
+        if ((int)loc->field != field) continue;
+        const char *name = map_string(g_map, loc->locale);
+        for (int r = 0; r < best_rank; r++) {
+            if (strcmp(name, match->names[r]) == 0) {
+                best = map_string(g_map, loc->value);
+                best_rank = r;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+// Categories and Keywords are ';'-separated with "\;" for a literal ';'
+static void write_list(json_writer_t *w, const char *list) {
+    char item[256];
+    size_t len = 0;
+
+    json_begin_array(w);
+    for (const char *p = list;; p++) {
+        if (*p == '\\' && p[1] == ';') {
+            if (len < sizeof(item) - 1) item[len++] = ';';
+            p++;
+        } else if (*p == ';' || !*p) {
+            if (len) json_write_string_len(w, item, len);
+            len = 0;
+            if (!*p) break;
+        } else if (len < sizeof(item) - 1) {
+            item[len++] = *p;
+        }
+    }
+    json_end_array(w);
+}
+
+static void write_app(json_writer_t *w, const catalog_app_t *app, const locale_match_t *match) {
+    json_begin_object(w);
+    json_field_string(w, "id", map_string(g_map, app->id));
+    json_field_string(w, "name", app_field(app, FIELD_NAME, match));
+    json_field_string(w, "generic_name", app_field(app, FIELD_GENERIC_NAME, match));
+    json_field_string(w, "comment", app_field(app, FIELD_COMMENT, match));
+    json_field_string(w, "exec", map_string(g_map, app->fields[FIELD_EXEC]));
+    json_field_string(w, "icon", map_string(g_map, app->fields[FIELD_ICON]));
+    json_key(w, "categories");
+    write_list(w, map_string(g_map, app->fields[FIELD_CATEGORIES]));
+    json_key(w, "keywords");
+    write_list(w, app_field(app, FIELD_KEYWORDS, match));
+    json_field_bool(w, "terminal", (app->flags & APP_TERMINAL) != 0);
+    json_field_bool(w, "no_display", (app->flags & APP_NO_DISPLAY) != 0);
+    json_field_string(w, "path", map_string(g_map, app->path));
+    json_end_object(w);
+}
+
+typedef struct {
+    const catalog_app_t *app;
+    const char *name;
+    int score;
+} ranked_app_t;
+
+static int compare_ranked(const void *a, const void *b) {
+    const ranked_app_t *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    return strcasecmp(x->name, y->name);
+}
+
+// Applications in name order (localized names when a locale is given).
+// NoDisplay entries are left out unless asked for.
+void app_catalog_list(arena_t *arena, json_writer_t *w, const char *locale, int include_hidden) {
+    locale_match_t match;
+    match_locale(locale, &match);
+
+    pthread_rwlock_rdlock(&g_lock);
+    uint32_t count = g_map ? map_header(g_map)->app_count : 0;
+    ranked_app_t *apps = arena_alloc(arena, (count + 1) * sizeof(ranked_app_t));
+    uint32_t listed = 0;
+
+    for (uint32_t i = 0; apps && i < count; i++) {
+        const catalog_app_t *app = &map_apps(g_map)[i];
+        if ((app->flags & APP_NO_DISPLAY) && !include_hidden) continue;
+        apps[listed].app = app;
+        apps[listed].name = app_field(app, FIELD_NAME, &match);
+        apps[listed].score = 0;
+        listed++;
+    }
+    // The index is already in default-name order
+    if (match.count && apps) qsort(apps, listed, sizeof(ranked_app_t), compare_ranked);
+
+    json_field_uint(w, "generation", g_map ? map_header(g_map)->generation : 0);
+    json_key(w, "apps");
+    json_begin_array(w);
+    for (uint32_t i = 0; i < listed; i++) write_app(w, apps[i].app, &match);
+    json_end_array(w);
+    pthread_rwlock_unlock(&g_lock);
+}
+
+static int contains_ci(const char *haystack, const char *needle, size_t needle_len, int *at_word) {
+    for (const char *p = haystack; *p; p++) {
+        if (strncasecmp(p, needle, needle_len) == 0) {
+            *at_word = p == haystack || !isalnum((unsigned char)p[-1]);
+            return (int)(p - haystack);
+        }
+    }
+    return -1;
+}
+
+// Name matches beat generic names and keywords, which beat the id,
+// categories, command and comment
+static int score_app(const catalog_app_t *app, const locale_match_t *match, const char *query, size_t len) {
+    static const struct {
+        int field;
+        int score;
+    } weights[] = {
+        { FIELD_GENERIC_NAME, 400 }, { FIELD_KEYWORDS, 350 }, { FIELD_CATEGORIES, 200 },
+        { FIELD_EXEC, 150 }, { FIELD_COMMENT, 100 }
+    };
+    int at_word;
+
+    const char *names[2] = { app_field(app, FIELD_NAME, match), map_string(g_map, app->fields[FIELD_NAME]) };
+    for (int i = 0; i < 2; i++) {
+        int pos = contains_ci(names[i], query, len, &at_word);
+        if (pos == 0) return names[i][len] ? 1000 : 1200;
+        if (pos > 0) return at_word ? 800 : 600;
+    }
+    for (size_t i = 0; i < sizeof(weights) / sizeof(weights[0]); i++) {
+        const char *text = weights[i].field == FIELD_CATEGORIES || weights[i].field == FIELD_EXEC
+                               ? map_string(g_map, app->fields[weights[i].field])
+                               : app_field(app, weights[i].field, match);
+        if (contains_ci(text, query, len, &at_word) >= 0) return weights[i].score + (at_word ? 25 : 0);
+    }
+    if (contains_ci(map_string(g_map, app->id), query, len, &at_word) >= 0) return 300;
+    return 0;
+}
+
+void app_catalog_search(arena_t *arena, json_writer_t *w, const char *query, const char *locale, int limit) {
+    locale_match_t match;
+    size_t len = query ? strlen(query) : 0;
+
+    match_locale(locale, &match);
+    if (limit <= 0) limit = APP_CATALOG_DEFAULT_LIMIT;
+
+    pthread_rwlock_rdlock(&g_lock);
+    uint32_t count = g_map ? map_header(g_map)->app_count : 0;
+    ranked_app_t *hits = arena_alloc(arena, (count + 1) * sizeof(ranked_app_t));
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; hits && len && i < count; i++) {
+        const catalog_app_t *app = &map_apps(g_map)[i];
+        if (app->flags & APP_NO_DISPLAY) continue;
+        int score = score_app(app, &match, query, len);
+        if (!score) continue;
+        hits[total].app = app;
+        hits[total].name = app_field(app, FIELD_NAME, &match);
+        hits[total].score = score;
+        total++;
+    }
+    if (hits) qsort(hits, total, sizeof(ranked_app_t), compare_ranked);
+
+    json_field_uint(w, "generation", g_map ? map_header(g_map)->generation : 0);
+    json_field_uint(w, "total", total);
+    json_key(w, "apps");
+    json_begin_array(w);
+    for (uint32_t i = 0; i < total && (int)i < limit; i++) write_app(w, hits[i].app, &match);
+    json_end_array(w);
+    pthread_rwlock_unlock(&g_lock);
+}
+
+static const char *copy_string(arena_t *arena, const char *s) {
+    return arena_strndup(arena, s, strlen(s));
+}
+
+static int push_arg(const char **argv, int *count, const char *arg) {
+    if (*count >= APP_CATALOG_MAX_EXEC_ARGS) return -1;
+    argv[(*count)++] = arg;
+    return 0;
+}
+
+// Exec= split into arguments, with the spec's quoting and field codes:
+// %f/%u take the first file, %F/%U (as a whole argument) all of them,
+// %i becomes "--icon <icon>", %c the name and %k the desktop file.
+// Deprecated codes are dropped.
+static int expand_exec(arena_t *arena, const char *exec, const char *name, const char *icon, const char *path,
+                       const char *const *files, int file_count, const char **argv) {
+    size_t cap = strlen(exec) + strlen(name) + strlen(path) + 1;
+    int count = 0;
+
+    for (int i = 0; i < file_count; i++) cap += strlen(files[i]);
+    for (const char *p = exec;;) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+
+        char *arg = arena_alloc(arena, cap);
+        size_t len = 0;
+        int quoted = 0, explicit_empty = 0, file_list = 0, icon_code = 0;
+        if (!arg) return -1;
+
+        for (; *p && (quoted || (*p != ' ' && *p != '\t')); p++) {
+            const char *insert = NULL;
+            if (*p == '"') {
+                quoted = !quoted;
+                explicit_empty = 1;
+            } else if (quoted && *p == '\\' && p[1] && strchr("\"`$\\", p[1])) {
+                arg[len++] = *++p;
+            } else if (*p == '%' && p[1]) {
+                char code = *++p;
+                int whole = len == 0 && !quoted && (!p[1] || p[1] == ' ' || p[1] == '\t');
+                if (code == '%') arg[len++] = '%';
+                else if ((code == 'F' || code == 'U') && whole) file_list = 1;
+                else if (code == 'f' || code == 'u' || code == 'F' || code == 'U') insert = file_count ? files[0] : NULL;
+                else if (code == 'i' && whole) icon_code = 1;
+                else if (code == 'c') insert = name;
+                else if (code == 'k') insert = path;
+            } else {
+                arg[len++] = *p;
+            }
+            if (insert) {
+                memcpy(arg + len, insert, strlen(insert));
+                len += strlen(insert);
+            }
+        }
+        arg[len] = '\0';
+
+        if (file_list) {
+            for (int i = 0; i < file_count; i++) {
+                if (push_arg(argv, &count, files[i]) != 0) return -1;
+            }
+        } else if (icon_code) {
+            if (*icon && (push_arg(argv, &count, "--icon") != 0 || push_arg(argv, &count, icon) != 0)) return -1;
+        } else if (len || explicit_empty) {
+            if (push_arg(argv, &count, arg) != 0) return -1;
+        }
+    }
+    argv[count] = NULL;
+    return count;
+}
+
+// The command line for launching an app, as a NULL-terminated argv in
+// the arena. 0 on success; -1 for an unknown id or an empty command.
+int app_catalog_exec(arena_t *arena, const char *id, const char *const *files, int file_count,
+                     const char ***argv, int *terminal) {
+    const char *exec = NULL, *name = NULL, *icon = NULL, *path = NULL;
+    locale_match_t none = { .count = 0 };
+
+    pthread_rwlock_rdlock(&g_lock);
+    for (uint32_t i = 0; g_map && i < map_header(g_map)->app_count; i++) {
+        const catalog_app_t *app = &map_apps(g_map)[i];
+        if (strcmp(map_string(g_map, app->id), id) != 0) continue;
+        // Copied out, so a rebuild can swap the mapping meanwhile
+        exec = copy_string(arena, map_string(g_map, app->fields[FIELD_EXEC]));
+        name = copy_string(arena, app_field(app, FIELD_NAME, &none));
+        icon = copy_string(arena, map_string(g_map, app->fields[FIELD_ICON]));
+        path = copy_string(arena, map_string(g_map, app->path));
+        *terminal = (app->flags & APP_TERMINAL) != 0;
+        break;
+    }
+    pthread_rwlock_unlock(&g_lock);
+
+    if (!exec || !name || !icon || !path || !*exec) return -1;
+    *argv = arena_alloc(arena, (APP_CATALOG_MAX_EXEC_ARGS + 1) * sizeof(char *));
+    if (!*argv) return -1;
+    return expand_exec(arena, exec, name, icon, path, files, file_count, *argv) > 0 ? 0 : -1;
+}
@@ -0,0 +1,29 @@
+#ifndef APPCATALOG_H
+#define APPCATALOG_H
+
+#include "arena.h"
+#include "jsonwriter.h"
+
+// Constants
+#define APP_CATALOG_CACHE_NAME "vldwmapi-apps.idx"
+#define APP_CATALOG_MAX_ROOTS 16                // applications dirs from XDG_DATA_HOME and XDG_DATA_DIRS
+#define APP_CATALOG_MAX_DEPTH 4                 // Subdirectory levels under each root
+#define APP_CATALOG_PARSE_THREADS 4
+#define APP_CATALOG_MAX_FILE (64 * 1024)        // Larger .desktop files are skipped
+#define APP_CATALOG_DEBOUNCE_MS 300             // Quiet time before rebuilding after a change
+#define APP_CATALOG_DEFAULT_LIMIT 50
+#define APP_CATALOG_MAX_EXEC_ARGS 256
+
+// Application catalog functions. Queries read the mapped index and may
+// run on any thread; inotify events are processed on the event loop
+// through app_catalog_fd().
+int init_app_catalog(void);
+void cleanup_app_catalog(void);
+int app_catalog_fd(void);
+void app_catalog_process_events(void);
+void app_catalog_list(arena_t *arena, json_writer_t *w, const char *locale, int include_hidden);
+void app_catalog_search(arena_t *arena, json_writer_t *w, const char *query, const char *locale, int limit);
+int app_catalog_exec(arena_t *arena, const char *id, const char *const *files, int file_count,
+                     const char ***argv, int *terminal);
+
+#endif // APPCATALOG_H
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+struct arena_chunk {
+    arena_chunk_t *next;
+    size_t size;
+    _Alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+static arena_chunk_t *new_chunk(size_t size) {
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+    if (!chunk) return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    return chunk;
+}
+
+int arena_init(arena_t *arena, size_t size) {
+    memset(arena, 0, sizeof(*arena));
+    arena->chunks = new_chunk(size ? size : ARENA_DEFAULT_SIZE);
+    return arena->chunks ? 0 : -1;
+}
+
+void arena_free(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+// A request that overflowed the first chunk leaves a chain behind; fold
+// it into one chunk big enough for that request so the next one like it
+// doesn't allocate at all
+void arena_reset(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+
+    if (chunk && chunk->next) {
+        size_t size = chunk->size;
+        while (size < arena->high_water) size *= 2;
+
+        arena_chunk_t *merged = new_chunk(size);
+        if (merged) {
+            arena_free(&(arena_t){ .chunks = chunk });
+            arena->chunks = merged;
+        } else {
+            // Keep the newest chunk and drop the rest
+            arena_free(&(arena_t){ .chunks = chunk->next });
+            chunk->next = NULL;
+        }
+    }
+    arena->used = 0;
+    arena->total_used = 0;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (size == 0) size = ARENA_ALIGNMENT;
+
+    arena_chunk_t *chunk = arena->chunks;
+    if (!chunk || chunk->size - arena->used < size) {
+        size_t chunk_size = chunk ? chunk->size * 2 : ARENA_DEFAULT_SIZE;
+        while (chunk_size < size) chunk_size *= 2;
+
+        arena_chunk_t *grown = new_chunk(chunk_size);
+        if (!grown) return NULL;
+        grown->next = chunk;
+        arena->chunks = chunk = grown;
+        arena->used = 0;
+    }
+
+    void *p = chunk->data + arena->used;
+    arena->used += size;
+    arena->total_used += size;
+    if (arena->total_used > arena->high_water) arena->high_water = arena->total_used;
+    return p;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+size_t arena_capacity(const arena_t *arena) {
+    size_t total = 0;
+    for (const arena_chunk_t *chunk = arena->chunks; chunk; chunk = chunk->next) {
+        total += chunk->size;
+    }
+    return total;
+}
+
+#if defined(__GLIBC__) && defined(ARENA_COUNT_ALLOCATIONS)
+// Count allocations by wrapping glibc's allocator entry points. Only the
+// benchmarks are built this way: the atomic add would otherwise land on
+// every allocation the daemon's threads and libraries make. glibc
+// routes its own internal allocations through these symbols too, so the
+// count covers json-c, stdio and NSS as well as our code.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long g_heap_allocations = 0;
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&g_heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    __atomic_add_fetch(&g_heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&g_heap_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+unsigned long heap_allocation_count(void) {
+    return __atomic_load_n(&g_heap_allocations, __ATOMIC_RELAXED);
+}
+#else
+unsigned long heap_allocation_count(void) {
+    return 0;
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Constants
+#define ARENA_DEFAULT_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_chunk arena_chunk_t;
+
+// Bump allocator for the temporaries of one request. Nothing is freed
+// individually; arena_reset() drops everything at once and keeps the
+// memory for the next request.
+typedef struct {
+    arena_chunk_t *chunks;      // Newest first
+    size_t used;                // Bytes used in the newest chunk
+    size_t total_used;          // Bytes handed out since the last reset
+    size_t high_water;          // Largest total_used seen
+} arena_t;
+
+// Arena functions
+int arena_init(arena_t *arena, size_t size);
+void arena_free(arena_t *arena);
+void arena_reset(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strndup(arena_t *arena, const char *s, size_t len);
+size_t arena_capacity(const arena_t *arena);
+
+// Process-wide count of malloc/calloc/realloc calls, including those
+// made inside libraries. Always 0 unless built with
+// -DARENA_COUNT_ALLOCATIONS on glibc, as the benchmarks are.
+unsigned long heap_allocation_count(void);
+
+#endif // ARENA_H
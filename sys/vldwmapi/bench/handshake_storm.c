@@ -0,0 +1,170 @@
+// Connection storm against vldwmapi: every worker thread connects,
+// performs the WebSocket upgrade, waits for the 101 and disconnects,
+// as fast as it can. Reports completed handshakes per second.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define DEFAULT_THREADS 8
+#define DEFAULT_DURATION 5
+
+static const char *g_host = "127.0.0.1";
+static int g_port = 3001;
+static int g_threads = DEFAULT_THREADS;
+static int g_duration = DEFAULT_DURATION;
+static int g_split = 0;
+static volatile int g_stop = 0;
+
+typedef struct {
+    unsigned long handshakes;
+    unsigned long failures;
+    double total_latency_us;
+} storm_stats_t;
+
+static const char upgrade_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "upgrade: WebSocket\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int one_handshake(const struct sockaddr_in *addr) {
+    char buffer[1024];
+    size_t have = 0;
+    int ok = 0;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return 0;
+    }
+
+    size_t len = sizeof(upgrade_request) - 1;
+    if (g_split) {
+        // Dribble the request in small pieces to exercise partial parsing
+        size_t piece = len / 4;
+        for (size_t off = 0; off < len; off += piece) {
+            size_t n = (len - off < piece) ? len - off : piece;
+            if (send_all(fd, upgrade_request + off, n) < 0) goto out;
+        }
+    } else if (send_all(fd, upgrade_request, len) < 0) {
+        goto out;
+    }
+
+    while (have < sizeof(buffer) - 1) {
+        ssize_t n = recv(fd, buffer + have, sizeof(buffer) - 1 - have, 0);
+        if (n <= 0) break;
+        have += n;
+        buffer[have] = '\0';
+        if (strstr(buffer, "\r\n\r\n")) {
+            ok = strncmp(buffer, "HTTP/1.1 101", 12) == 0 &&
+                 strstr(buffer, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != NULL;
+            break;
+        }
+    }
+
+out:
+    close(fd);
+    return ok;
+}
+
+static void *storm_thread(void *arg) {
+    storm_stats_t *stats = arg;
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    inet_pton(AF_INET, g_host, &addr.sin_addr);
+
+    while (!g_stop) {
+        double start = now_us();
+        if (one_handshake(&addr)) {
+            stats->handshakes++;
+            stats->total_latency_us += now_us() - start;
+        } else {
+            stats->failures++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "--host") == 0) && i + 1 < argc) {
+            g_host = argv[++i];
+        } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) && i + 1 < argc) {
+            g_port = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && i + 1 < argc) {
+            g_threads = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--duration") == 0) && i + 1 < argc) {
+            g_duration = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--split") == 0) {
+            g_split = 1;
+        } else {
+            printf("Usage: %s [-H host] [-p port] [-t threads] [-d seconds] [--split]\n", argv[0]);
+            return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (g_threads < 1) g_threads = 1;
+
+    pthread_t *threads = calloc(g_threads, sizeof(pthread_t));
+    storm_stats_t *stats = calloc(g_threads, sizeof(storm_stats_t));
+    if (!threads || !stats) return 1;
+
+    double start = now_us();
+    for (int i = 0; i < g_threads; i++) {
+        pthread_create(&threads[i], NULL, storm_thread, &stats[i]);
+    }
+    sleep(g_duration);
+    g_stop = 1;
+
+    storm_stats_t total = { 0, 0, 0.0 };
+    for (int i = 0; i < g_threads; i++) {
+        pthread_join(threads[i], NULL);
+        total.handshakes += stats[i].handshakes;
+        total.failures += stats[i].failures;
+        total.total_latency_us += stats[i].total_latency_us;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    printf("handshake_storm threads=%d split=%d duration=%.2fs\n", g_threads, g_split, elapsed);
+    printf("handshakes=%lu failures=%lu handshakes_per_sec=%.0f mean_latency_us=%.1f\n",
+           total.handshakes, total.failures, total.handshakes / elapsed,
+           total.handshakes ? total.total_latency_us / total.handshakes : 0.0);
+
+    free(threads);
+    free(stats);
+    return total.handshakes > 0 ? 0 : 1;
+}
@@ -0,0 +1,315 @@
+// Memory cost of mostly idle connections. Opens and upgrades N
+// WebSocket connections, leaves them idle, then reads the daemon's
+// resident set size and the kernel's socket memory. A sample of the
+// connections then sends one request each, to show the idle ones don't
+// slow the busy ones down. Reports key=value lines.
+//
+// Loopback TCP has about 28k ephemeral ports per source address, so
+// connections are spread over 127.0.0.1, 127.0.0.2, ... (-S). A Unix
+// socket (-u) has no such limit. Both this process and the daemon need
+// a descriptor limit above N (ulimit -n).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_CONNECTIONS 100000
+#define DEFAULT_SAMPLES 1000
+#define PORTS_PER_SOURCE 28000
+#define RX_SIZE 4096
+
+static const char *g_host = "127.0.0.1";
+static int g_port = 3001;
+static const char *g_unix_path = NULL;
+static int g_connections = DEFAULT_CONNECTIONS;
+static int g_samples = DEFAULT_SAMPLES;
+static int g_sources = 0;               // 0: as many as the connection count needs
+static int g_pid = 0;
+static int g_hold = 0;                  // Seconds to keep the connections opened at the end
+
+static const char upgrade_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+static const char request_payload[] = "{\"type\":\"system_status\"}";
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Read one whole server frame and drop it; only short replies expected
+static int read_frame(int fd, char *rx, size_t *rx_len) {
+    for (;;) {
+        const unsigned char *bytes = (const unsigned char *)rx;
+        if (*rx_len >= 2) {
+            size_t header_len = 2, length = bytes[1] & 0x7F;
+            if (length == 126 && *rx_len >= 4) {
+                length = ((size_t)bytes[2] << 8) | bytes[3];
+                header_len = 4;
+            } else if (length > 126) {
+                return -1;
+            }
+            if (length != 126 && *rx_len >= header_len + length) {
+                *rx_len -= header_len + length;
+                memmove(rx, rx + header_len + length, *rx_len);
+                return 0;
+            }
+        }
+        if (*rx_len == RX_SIZE) return -1;
+        ssize_t n = recv(fd, rx + *rx_len, RX_SIZE - *rx_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        *rx_len += n;
+    }
+}
+
+// Upgrade, then wait for the welcome frame
+static int handshake(int fd) {
+    char rx[RX_SIZE];
+    size_t rx_len = 0;
+
+    if (send_all(fd, upgrade_request, sizeof(upgrade_request) - 1) < 0) return -1;
+    for (;;) {
+        ssize_t n = recv(fd, rx + rx_len, sizeof(rx) - rx_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        rx_len += n;
+        char *end = memmem(rx, rx_len, "\r\n\r\n", 4);
+        if (end) {
+            if (strncmp(rx, "HTTP/1.1 101", 12) != 0) return -1;
+            size_t header_len = end + 4 - rx;
+            rx_len -= header_len;
+            memmove(rx, end + 4, rx_len);
+            return read_frame(fd, rx, &rx_len);
+        }
+        if (rx_len == sizeof(rx)) return -1;
+    }
+}
+
+static int open_connection(int index) {
+    int fd;
+
+    if (g_unix_path) {
+        struct sockaddr_un addr;
+        size_t len = strlen(g_unix_path);
+        socklen_t addr_len = sizeof(addr);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (len == 0 || len >= sizeof(addr.sun_path)) return -1;
+        memcpy(addr.sun_path, g_unix_path, len);
+        if (g_unix_path[0] == '@') {
+            addr.sun_path[0] = '\0';
+            addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (const struct sockaddr *)&addr, addr_len) < 0) goto fail;
+    } else {
+        struct sockaddr_in addr, source;
+        int one = 1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(g_port);
+        if (inet_pton(AF_INET, g_host, &addr.sin_addr) != 1) return -1;
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (g_sources > 1) {
+            memset(&source, 0, sizeof(source));
+            source.sin_family = AF_INET;
+            source.sin_addr.s_addr = htonl(0x7F000001 + index % g_sources);
+            if (bind(fd, (const struct sockaddr *)&source, sizeof(source)) < 0) goto fail;
+        }
+        if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) goto fail;
+    }
+    if (handshake(fd) == 0) return fd;
+fail:
+    close(fd);
+    return -1;
+}
+
+static int send_request(int fd) {
+    unsigned char frame[sizeof(request_payload) + 6];
+    size_t len = sizeof(request_payload) - 1;
+    uint32_t mask = (uint32_t)rand();
+
+    frame[0] = 0x81;
+    frame[1] = 0x80 | (unsigned char)len;
+    memcpy(frame + 2, &mask, 4);
+    for (size_t i = 0; i < len; i++) {
+        frame[6 + i] = request_payload[i] ^ frame[2 + (i & 3)];
+    }
+    return send_all(fd, (const char *)frame, 6 + len);
+}
+
+// VmRSS of the daemon in kB, 0 if unknown
+static long daemon_rss_kb(void) {
+    char path[64], line[256];
+    long rss = 0;
+
+    if (g_pid <= 0) return 0;
+    snprintf(path, sizeof(path), "/proc/%d/status", g_pid);
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "VmRSS: %ld", &rss) == 1) break;
+    }
+    fclose(file);
+    return rss;
+}
+
+// Pages the kernel has charged to TCP sockets, both ends of loopback
+static long tcp_mem_pages(void) {
+    char line[256];
+    long inuse, orphan, tw, alloc, mem = 0;
+
+    FILE *file = fopen("/proc/net/sockstat", "r");
+    if (!file) return 0;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "TCP: inuse %ld orphan %ld tw %ld alloc %ld mem %ld", &inuse, &orphan, &tw, &alloc, &mem) == 5) break;
+    }
+    fclose(file);
+    return mem;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *samples, size_t count, double p) {
+    if (count == 0) return 0;
+    return samples[(size_t)(p * (count - 1) + 0.5)];
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "--host") == 0) && i + 1 < argc) {
+            g_host = argv[++i];
+        } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) && i + 1 < argc) {
+            g_port = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "--unix") == 0) && i + 1 < argc) {
+            g_unix_path = argv[++i];
+        } else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--connections") == 0) && i + 1 < argc) {
+            g_connections = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--samples") == 0) && i + 1 < argc) {
+            g_samples = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-S") == 0 || strcmp(argv[i], "--sources") == 0) && i + 1 < argc) {
+            g_sources = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-P") == 0 || strcmp(argv[i], "--pid") == 0) && i + 1 < argc) {
+            g_pid = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hold") == 0 && i + 1 < argc) {
+            g_hold = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [-H host] [-p port] [-u socket|@name] [-n connections] [-s samples]\n"
+                   "       [-S source addresses] [-P daemon pid] [--hold seconds]\n", argv[0]);
+            return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (g_connections < 1) g_connections = 1;
+    if (g_samples > g_connections) g_samples = g_connections;
+    if (g_sources <= 0) g_sources = (g_connections + PORTS_PER_SOURCE - 1) / PORTS_PER_SOURCE;
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    int *fds = calloc(g_connections, sizeof(int));
+    uint32_t *samples = calloc(g_samples > 0 ? g_samples : 1, sizeof(uint32_t));
+    if (!fds || !samples) return 1;
+
+    printf("idle_conns connections=%d samples=%d target=%s sources=%d pid=%d\n", g_connections, g_samples,
+           g_unix_path ? g_unix_path : g_host, g_unix_path ? 0 : g_sources, g_pid);
+    long rss_before = daemon_rss_kb();
+    long tcp_before = tcp_mem_pages();
+
+    int opened = 0;
+    double start = now_us();
+    while (opened < g_connections) {
+        fds[opened] = open_connection(opened);
+        if (fds[opened] < 0) {
+            fprintf(stderr, "connection=%d error=%s\n", opened, strerror(errno));
+            break;
+        }
+        opened++;
+    }
+    double connect_s = (now_us() - start) / 1e6;
+    if (opened == 0) return 1;
+
+    // Let the daemon settle, then measure
+    sleep(1);
+    long rss_after = daemon_rss_kb();
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    long tcp_kb = (tcp_mem_pages() - tcp_before) * page_kb;
+    printf("connections=%d connect_s=%.2f rate=%.0f\n", opened, connect_s, opened / connect_s);
+    if (g_pid > 0) {
+        printf("rss_before_kb=%ld rss_after_kb=%ld per_connection_bytes=%.0f\n", rss_before, rss_after,
+               (rss_after - rss_before) * 1024.0 / opened);
+    }
+    if (!g_unix_path) {
+        // Both ends are on this machine, so this counts client sockets too
+        printf("kernel_tcp_kb=%ld per_connection_bytes=%.0f\n", tcp_kb, tcp_kb * 1024.0 / opened);
+    }
+
+    // A spread of the connections each sends one request
+    int measured = 0;
+    double sum = 0;
+    for (int i = 0; i < g_samples && i < opened; i++) {
+        int fd = fds[(size_t)i * opened / g_samples];
+        char rx[RX_SIZE];
+        size_t rx_len = 0;
+        double sent_at = now_us();
+        if (send_request(fd) != 0 || read_frame(fd, rx, &rx_len) != 0) {
+            fprintf(stderr, "sample=%d error=connection broke\n", i);
+            break;
+        }
+        double latency = now_us() - sent_at;
+        samples[measured] = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+        sum += samples[measured++];
+    }
+    if (measured > 0) {
+        qsort(samples, measured, sizeof(uint32_t), compare_u32);
+        printf("requests=%d mean_us=%.1f p50_us=%u p99_us=%u max_us=%u\n", measured, sum / measured,
+               percentile(samples, measured, 0.50), percentile(samples, measured, 0.99), samples[measured - 1]);
+    }
+    if (g_pid > 0) printf("rss_final_kb=%ld\n", daemon_rss_kb());
+
+    if (g_hold > 0) sleep(g_hold);
+    for (int i = 0; i < opened; i++) close(fds[i]);
+    free(fds);
+    free(samples);
+    return opened == g_connections ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+// Directory listing serialization: the json-c object tree path the
+// daemon used to take (build tree, json_object_to_json_string, strdup in
+// create_response, copy into a frame) against list_directory() streaming
+// into a reused json_writer_t. Both list the same synthetic directory;
+// reports nanoseconds and heap allocations per entry.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <json-c/json.h>
+
+#include "../desktopsession.h"
+#include "../jsonwriter.h"
+#include "../websocket.h"
+#include "../nsscache.h"
+#include "../arena.h"
+
+#define DEFAULT_ENTRIES 1000
+#define DEFAULT_ITERATIONS 200
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The pre-streaming list_directory, kept here as the baseline
+static json_object *jsonc_list_directory(const char *path) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    struct stat file_stat;
+    char full_path[MAX_PATH_LEN];
+    char size_text[FORMAT_BUFFER_SIZE], time_text[FORMAT_BUFFER_SIZE], mode_text[FORMAT_BUFFER_SIZE];
+
+    if (!dir) return NULL;
+
+    json_object *files_array = json_object_new_array();
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+        if (stat(full_path, &file_stat) == 0) {
+            json_object *file_obj = json_object_new_object();
+            json_object_object_add(file_obj, "name", json_object_new_string(entry->d_name));
+            json_object_object_add(file_obj, "path", json_object_new_string(full_path));
+            json_object_object_add(file_obj, "is_directory", json_object_new_boolean(S_ISDIR(file_stat.st_mode)));
+            json_object_object_add(file_obj, "size", json_object_new_int64(file_stat.st_size));
+            json_object_object_add(file_obj, "size_formatted", json_object_new_string(format_file_size(file_stat.st_size, size_text, sizeof(size_text))));
+            json_object_object_add(file_obj, "modified_time", json_object_new_int64(file_stat.st_mtime));
+            json_object_object_add(file_obj, "modified_formatted", json_object_new_string(format_time(file_stat.st_mtime, time_text, sizeof(time_text))));
+            json_object_object_add(file_obj, "permissions", json_object_new_string(format_permissions(file_stat.st_mode, mode_text, sizeof(mode_text))));
+            json_object_object_add(file_obj, "owner_uid", json_object_new_int(file_stat.st_uid));
+            json_object_object_add(file_obj, "owner_gid", json_object_new_int(file_stat.st_gid));
+            json_object_array_add(files_array, file_obj);
+        }
+    }
+
+    closedir(dir);
+    return files_array;
+}
+
+// Tree, reply wrapper, serialize, strdup, frame copy: what a reply cost
+static size_t jsonc_reply(const char *path) {
+    json_object *response = json_object_new_object();
+    json_object_object_add(response, "type", json_object_new_string("desktop_session"));
+    json_object_object_add(response, "success", json_object_new_boolean(1));
+    json_object_object_add(response, "data", jsonc_list_directory(path));
+
+    char *payload = strdup(json_object_to_json_string(response));
+    size_t payload_len = strlen(payload);
+    char *frame = malloc(payload_len + WS_MAX_FRAME_HEADER);
+    unsigned char header[WS_MAX_FRAME_HEADER];
+    size_t header_len = ws_frame_header(0x1, payload_len, header);
+    memcpy(frame, header, header_len);
+    memcpy(frame + header_len, payload, payload_len);
+
+    free(frame);
+    free(payload);
+    json_object_put(response);
+    return header_len + payload_len;
+}
+
+static size_t writer_reply(arena_t *arena, json_writer_t *w, const char *path) {
+    unsigned char header[WS_MAX_FRAME_HEADER];
+
+    json_writer_reset(w);
+    json_begin_object(w);
+    json_field_string(w, "type", "desktop_session");
+    json_key(w, "data");
+    list_directory(arena, w, path);
+    json_field_bool(w, "success", 1);
+    json_end_object(w);
+
+    size_t payload_len = json_writer_payload_len(w);
+    size_t header_len = ws_frame_header(0x1, payload_len, header);
+    memcpy(json_writer_payload(w) - header_len, header, header_len);
+    arena_reset(arena);
+    return header_len + payload_len;
+}
+
+static int make_tree(char *dir, int entries) {
+    char path[MAX_PATH_LEN];
+
+    if (!mkdtemp(dir)) return -1;
+    for (int i = 0; i < entries; i++) {
+        // A few names that need escaping, like real home directories have
+        snprintf(path, sizeof(path), "%s/%s_%05d.txt", dir, (i % 10 == 0) ? "quote\"d" : "document", i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) return -1;
+        if (i % 3 == 0 && write(fd, path, strlen(path)) < 0) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static void remove_tree(const char *dir) {
+    char command[MAX_PATH_LEN + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", dir);
+}
+
+int main(int argc, char *argv[]) {
+    int entries = DEFAULT_ENTRIES;
+    int iterations = DEFAULT_ITERATIONS;
+    char dir[] = "/tmp/vldwm-json-bench-XXXXXX";
+    json_writer_t writer;
+    arena_t arena;
+    size_t jsonc_bytes = 0, writer_bytes = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            entries = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [-n entries] [-i iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (entries <= 0 || iterations <= 0) return 1;
+
+    if (make_tree(dir, entries) != 0) {
+        perror("make_tree");
+        return 1;
+    }
+    init_nss_cache();
+    init_desktop_session();
+    arena_init(&arena, ARENA_DEFAULT_SIZE);
+    json_writer_init(&writer, WS_MAX_FRAME_HEADER);
+
+    // Warm the page cache, the NSS cache and the writer buffer
+    jsonc_reply(dir);
+    writer_reply(&arena, &writer, dir);
+
+    unsigned long allocations = heap_allocation_count();
+    double start = now_ns();
+    for (int i = 0; i < iterations; i++) jsonc_bytes = jsonc_reply(dir);
+    double jsonc_ns = now_ns() - start;
+    unsigned long jsonc_allocations = heap_allocation_count() - allocations;
+
+    allocations = heap_allocation_count();
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) writer_bytes = writer_reply(&arena, &writer, dir);
+    double writer_ns = now_ns() - start;
+    unsigned long writer_allocations = heap_allocation_count() - allocations;
+
+    double rows = (double)entries * iterations;
+    printf("json_listing entries=%d iterations=%d\n", entries, iterations);
+    printf("path=jsonc ns_per_entry=%.1f allocs_per_entry=%.2f frame_bytes=%zu\n",
+           jsonc_ns / rows, jsonc_allocations / rows, jsonc_bytes);
+    printf("path=writer ns_per_entry=%.1f allocs_per_entry=%.2f frame_bytes=%zu\n",
+           writer_ns / rows, writer_allocations / rows, writer_bytes);
+    printf("speedup=%.2f\n", jsonc_ns / writer_ns);
+
+    json_writer_free(&writer);
+    arena_free(&arena);
+    cleanup_desktop_session();
+    cleanup_nss_cache();
+    remove_tree(dir);
+    return 0;
+}
@@ -0,0 +1,169 @@
+// Directory listing with the stats done one after another, spread over
+// the metadata engine's thread pool, and submitted through io_uring.
+// Each run starts from a dropped page cache (needs root; otherwise the
+// runs are reported as warm) and lists a large directory with
+// list_directory(), so reading, stating, owner lookups and serialization
+// are all counted.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../desktopsession.h"
+#include "../jsonwriter.h"
+#include "../websocket.h"
+#include "../nsscache.h"
+#include "../metaio.h"
+#include "../arena.h"
+
+#define DEFAULT_ENTRIES 100000
+#define DEFAULT_ROUNDS 3
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// On disk rather than in /tmp, which is often tmpfs and has nothing to drop
+static int make_tree(char *dir, int entries) {
+    char path[MAX_PATH_LEN];
+
+    if (!mkdtemp(dir)) return -1;
+    for (int i = 0; i < entries; i++) {
+        snprintf(path, sizeof(path), "%s/file_%06d.dat", dir, i);
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) return -1;
+        if (i % 4 == 0 && write(fd, path, strlen(path)) < 0) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static void remove_tree(const char *dir) {
+    char command[MAX_PATH_LEN + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", dir);
+}
+
+static int count_entries(const char *dir) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    int count = 0;
+
+    if (!d) return -1;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) count++;
+    }
+    closedir(d);
+    return count;
+}
+
+// Page cache, dentries and inodes
+static int drop_caches(void) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int ok = write(fd, "3", 1) == 1;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+static size_t list_once(arena_t *arena, json_writer_t *w, const char *dir) {
+    json_writer_reset(w);
+    list_directory(arena, w, dir);
+    size_t len = json_writer_payload_len(w);
+    arena_reset(arena);
+    return len;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *modes[] = { "serial", "threads", "uring" };
+    int entries = DEFAULT_ENTRIES;
+    int rounds = DEFAULT_ROUNDS;
+    int depth = METAIO_DEFAULT_DEPTH;
+    int cold = 1;
+    char created[] = "/var/tmp/vldwm-metadata-bench-XXXXXX";
+    const char *dir = NULL;
+    double serial_ns = 0;
+    json_writer_t writer;
+    arena_t arena;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            entries = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0) {
+            cold = 0;
+        } else {
+            printf("Usage: %s [-n entries] [-r rounds] [-q queue depth] [-d existing dir] [-w]\n", argv[0]);
+            printf("  -d lists a directory as it is, e.g. on NFS; -w keeps the caches warm\n");
+            return 1;
+        }
+    }
+    if (entries <= 0 || rounds <= 0 || metaio_set_depth(depth) != 0) return 1;
+
+    if (!dir) {
+        printf("Creating %d files...\n", entries);
+        if (make_tree(created, entries) != 0) {
+            perror("make_tree");
+            return 1;
+        }
+        dir = created;
+    } else if ((entries = count_entries(dir)) <= 0) {
+        fprintf(stderr, "Cannot list %s\n", dir);
+        return 1;
+    }
+    if (cold && drop_caches() != 0) {
+        fprintf(stderr, "Cannot drop caches (not root?); measuring warm\n");
+        cold = 0;
+    }
+
+    init_nss_cache();
+    init_desktop_session();
+    arena_init(&arena, ARENA_DEFAULT_SIZE);
+    json_writer_init(&writer, WS_MAX_FRAME_HEADER);
+
+    // Warm the NSS cache and grow the writer and arena once
+    list_once(&arena, &writer, dir);
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        double total = 0;
+        size_t bytes = 0;
+
+        metaio_set_mode(modes[m]);
+        if (init_metaio() != 0) return 1;
+        for (int r = 0; r < rounds; r++) {
+            if (cold) drop_caches();
+            double start = now_ns();
+            bytes = list_once(&arena, &writer, dir);
+            total += now_ns() - start;
+        }
+        double mean = total / rounds;
+        if (m == 0) serial_ns = mean;
+        printf("bench=metadata_scan mode=%s depth=%d entries=%d cache=%s ms=%.1f ns_per_entry=%.1f bytes=%zu speedup=%.2f\n",
+               metaio_mode_name(metaio_mode()), depth, entries, cold ? "cold" : "warm", mean / 1e6, mean / entries,
+               bytes, serial_ns / mean);
+        fflush(stdout);
+        cleanup_metaio();
+    }
+
+    json_writer_free(&writer);
+    arena_free(&arena);
+    cleanup_desktop_session();
+    cleanup_nss_cache();
+    if (dir == created) remove_tree(created);
+    return 0;
+}
@@ -0,0 +1,468 @@
+// Subsystem microbenchmarks: WebSocket frame parsing and creation,
+// list_directory() over synthetic trees, get_process_list(), the
+// metrics, tracing and logging calls, request decoding, and image
+// scaling with and without SIMD. Each case runs until it has used up its
+// time budget and prints one key=value line, so runs can be diffed or
+// fed to a script to catch regressions.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "../desktopsession.h"
+#include "../jsonwriter.h"
+#include "../websocket.h"
+#include "../nsscache.h"
+#include "../arena.h"
+#include "../metrics.h"
+#include "../trace.h"
+#include "../logger.h"
+#include "../imagescale.h"
+#include "../jsonreader.h"
+#include "../messages.h"
+
+#define DEFAULT_MIN_TIME 0.5
+#define MAX_FRAME_PAYLOAD (1024 * 1024)
+
+static double g_min_time = DEFAULT_MIN_TIME;
+static const char *g_filter = NULL;
+
+typedef struct {
+    const char *name;
+    char params[96];
+    size_t (*run)(void *ctx);       // One operation; returns bytes handled
+    void *ctx;
+    double units;                   // Entries per operation, 0 if not relevant
+} micro_case_t;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Run in doubling batches until the time budget is used, then report
+static void run_case(micro_case_t *c) {
+    unsigned long iterations = 0, batch = 1;
+    unsigned long long bytes = 0;
+    double elapsed = 0;
+
+    if (g_filter && !strstr(c->name, g_filter)) return;
+
+    c->run(c->ctx);     // Warm caches and buffers
+    unsigned long allocations = heap_allocation_count();
+    double start = now_ns();
+    while (elapsed < g_min_time * 1e9) {
+        for (unsigned long i = 0; i < batch; i++) bytes += c->run(c->ctx);
+        iterations += batch;
+        batch *= 2;
+        elapsed = now_ns() - start;
+    }
+    allocations = heap_allocation_count() - allocations;
+
+    printf("bench=%s %s iterations=%lu ns_per_op=%.1f mb_per_sec=%.1f allocs_per_op=%.2f",
+           c->name, c->params, iterations, elapsed / iterations,
+           bytes / (elapsed / 1e9) / (1024.0 * 1024.0), (double)allocations / iterations);
+    if (c->units > 0) printf(" ns_per_entry=%.1f", elapsed / iterations / c->units);
+    printf("\n");
+    fflush(stdout);
+}
+
+// Frames
+
+typedef struct {
+    char *frame;
+    size_t frame_len;
+    size_t frame_cap;
+    char *payload;
+    size_t payload_len;
+} frame_ctx_t;
+
+// A masked client frame carrying payload_len bytes of JSON-ish text
+static int make_client_frame(frame_ctx_t *ctx, size_t payload_len) {
+    unsigned char header[WS_MAX_FRAME_HEADER];
+    static const unsigned char mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    size_t header_len = ws_frame_header(WS_OPCODE_TEXT, payload_len, header);
+
+    ctx->payload_len = payload_len;
+    ctx->frame_len = header_len + 4 + payload_len;
+    ctx->frame_cap = payload_len + WS_MAX_FRAME_HEADER + 4;
+    ctx->frame = malloc(ctx->frame_cap);
+    ctx->payload = malloc(payload_len + 1);
+    if (!ctx->frame || !ctx->payload) return -1;
+
+    for (size_t i = 0; i < payload_len; i++) ctx->payload[i] = "{\"type\":\"x\"} "[i % 13];
+    header[1] |= 0x80;
+    memcpy(ctx->frame, header, header_len);
+    memcpy(ctx->frame + header_len, mask, 4);
+    for (size_t i = 0; i < payload_len; i++) {
+        ctx->frame[header_len + 4 + i] = ctx->payload[i] ^ mask[i & 3];
+    }
+    return 0;
+}
+
+// Unmasking is in place, so each run flips the payload between masked
+// and clear; the cost is the same either way
+static size_t run_frame_parse(void *arg) {
+    frame_ctx_t *ctx = arg;
+    char *payload;
+    size_t payload_len, frame_len;
+
+    if (parse_websocket_frame(ctx->frame, ctx->frame_len, MAX_FRAME_PAYLOAD,
+                              &payload, &payload_len, &frame_len) != WS_OPCODE_TEXT) {
+        fprintf(stderr, "frame_parse: unexpected result\n");
+        exit(1);
+    }
+    return frame_len;
+}
+
+static size_t run_frame_create(void *arg) {
+    frame_ctx_t *ctx = arg;
+    size_t len = create_websocket_frame(ctx->payload, ctx->payload_len, ctx->frame, ctx->frame_cap);
+
+    if (len == 0) {
+        fprintf(stderr, "frame_create: frame buffer too small\n");
+        exit(1);
+    }
+    return len;
+}
+
+// Directory listings
+
+typedef struct {
+    char dir[64];
+    arena_t arena;
+    json_writer_t writer;
+} listing_ctx_t;
+
+static int make_tree(char *dir, int entries) {
+    char path[MAX_PATH_LEN];
+
+    if (!mkdtemp(dir)) return -1;
+    for (int i = 0; i < entries; i++) {
+        // Every tenth entry is a directory; some names need escaping
+        snprintf(path, sizeof(path), "%s/%s_%05d%s", dir, (i % 10 == 1) ? "quote\"d" : "document", i,
+                 (i % 10 == 0) ? "" : ".txt");
+        if (i % 10 == 0) {
+            if (mkdir(path, 0755) != 0) return -1;
+            continue;
+        }
+        int fd = open(path, O_CREAT | O_WRONLY, 0644);
+        if (fd < 0) return -1;
+        if (i % 3 == 0 && write(fd, path, strlen(path)) < 0) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static void remove_tree(const char *dir) {
+    char command[MAX_PATH_LEN + 16];
+    snprintf(command, sizeof(command), "rm -rf '%s'", dir);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", dir);
+}
+
+static size_t run_list_directory(void *arg) {
+    listing_ctx_t *ctx = arg;
+
+    json_writer_reset(&ctx->writer);
+    if (list_directory(&ctx->arena, &ctx->writer, ctx->dir) != 0) {
+        fprintf(stderr, "list_directory: failed on %s\n", ctx->dir);
+        exit(1);
+    }
+    arena_reset(&ctx->arena);
+    return json_writer_payload_len(&ctx->writer);
+}
+
+static size_t run_process_list(void *arg) {
+    listing_ctx_t *ctx = arg;
+
+    json_writer_reset(&ctx->writer);
+    get_process_list(&ctx->arena, &ctx->writer);
+    arena_reset(&ctx->arena);
+    return json_writer_payload_len(&ctx->writer);
+}
+
+static int count_processes(void) {
+    DIR *dir = opendir("/proc");
+    struct dirent *entry;
+    int count = 0;
+
+    if (!dir) return 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] >= '0' && entry->d_name[0] <= '9') count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+// Metrics: what instrumenting one event costs
+
+static size_t run_metrics_count(void *arg) {
+    (void)arg;
+    metrics_count(METRIC_HTTP_REQUESTS, 1);
+    return 0;
+}
+
+static size_t run_metrics_observe(void *arg) {
+    uint64_t *value = arg;
+    // Walk the value range so different buckets are hit
+    *value = (*value * 6364136223846793005ull + 1442695040888963407ull);
+    metrics_observe(METRIC_HIST_LOOP_ITERATION, *value >> 40);
+    return 0;
+}
+
+static size_t run_metrics_timed(void *arg) {
+    (void)arg;
+    uint64_t start = metrics_now_ns();
+    metrics_observe_message(METRIC_MSG_OTHER, metrics_now_ns() - start);
+    return 0;
+}
+
+static void bench_metrics(void) {
+    uint64_t value = 1;
+    micro_case_t count = { "metrics_count", "", run_metrics_count, NULL, 0 };
+    micro_case_t observe = { "metrics_observe", "", run_metrics_observe, &value, 0 };
+    micro_case_t timed = { "metrics_timed_event", "", run_metrics_timed, NULL, 0 };
+
+    init_metrics();
+    run_case(&count);
+    run_case(&observe);
+    run_case(&timed);
+    cleanup_metrics();
+}
+
+// Tracing: a span with tracing off and on
+
+static size_t run_trace_span(void *arg) {
+    (void)arg;
+    uint64_t span = trace_begin();
+    trace_end("micro", span, 0);
+    return 0;
+}
+
+static void bench_tracing(void) {
+    micro_case_t off = { "trace_span_off", "", run_trace_span, NULL, 0 };
+    micro_case_t on = { "trace_span_on", "", run_trace_span, NULL, 0 };
+
+    init_tracing();
+    run_case(&off);
+    trace_set_enabled(1);
+    run_case(&on);
+    trace_set_enabled(0);
+    cleanup_tracing();
+}
+
+// Logging: an event below the level, and one recorded into the ring.
+// The writer thread formats to /dev/null meanwhile; once the ring is
+// full the rest are counted as dropped, which costs about the same.
+
+static size_t run_log_write(void *arg) {
+    log_event_t *event = arg;
+    log_write(*event, "system_status", 42, 25, 0);
+    return 0;
+}
+
+static void bench_logging(void) {
+    log_event_t filtered_event = LOG_EV_MESSAGE, recorded_event = LOG_EV_CONNECT;
+    micro_case_t filtered = { "log_write_filtered", "", run_log_write, &filtered_event, 0 };
+    micro_case_t recorded = { "log_write", "", run_log_write, &recorded_event, 0 };
+
+    log_set_output("/dev/null");
+    log_set_rate(0);
+    init_metrics();
+    init_log();
+    run_case(&filtered);
+    run_case(&recorded);
+    cleanup_log();
+    cleanup_metrics();
+}
+
+// Request decoding: the generated in-place decoder against building a
+// json_read tree, on the same messages. Both start from a fresh copy,
+// since decoding writes to the text.
+
+typedef struct {
+    const char *text;
+    size_t len;
+    char buf[2048];
+    arena_t arena;
+    proto_request_t request;
+} decode_ctx_t;
+
+static size_t run_proto_decode(void *arg) {
+    decode_ctx_t *ctx = arg;
+    memcpy(ctx->buf, ctx->text, ctx->len);
+    if (proto_decode_request(ctx->buf, ctx->len, &ctx->request) != 0) {
+        fprintf(stderr, "proto_decode: %s\n", ctx->request.head.error);
+    }
+    return ctx->len;
+}
+
+static size_t run_json_read(void *arg) {
+    decode_ctx_t *ctx = arg;
+    memcpy(ctx->buf, ctx->text, ctx->len);
+    if (!json_read(&ctx->arena, ctx->buf, ctx->len)) fprintf(stderr, "json_read: failed\n");
+    arena_reset(&ctx->arena);
+    return ctx->len;
+}
+
+static void bench_decode(void) {
+    static const struct {
+        const char *name;
+        const char *text;
+    } messages[] = {
+        { "login", "{\"type\":\"login\",\"username\":\"alice\",\"password\":\"correct horse\",\"id\":17}" },
+        { "list_directory", "{\"type\":\"desktop_session\",\"action\":\"list_directory\","
+                            "\"path\":\"/home/alice/Pictures/2024\",\"id\":\"req-42\"}" },
+        { "launch", "{\"type\":\"launch\",\"argv\":[\"/usr/bin/env\",\"-u\",\"DISPLAY\",\"xterm\",\"-e\",\"top\"],"
+                    "\"cwd\":\"/tmp\",\"env\":{\"LANG\":\"C.UTF-8\",\"TERM\":\"xterm-256color\"},\"isolate\":false,\"id\":3}" },
+    };
+    static decode_ctx_t ctx;
+
+    arena_init(&ctx.arena, ARENA_DEFAULT_SIZE);
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+        micro_case_t proto = { "proto_decode", "", run_proto_decode, &ctx, 0 };
+        micro_case_t tree = { "json_read", "", run_json_read, &ctx, 0 };
+
+        ctx.text = messages[i].text;
+        ctx.len = strlen(messages[i].text);
+        snprintf(proto.params, sizeof(proto.params), "message=%s bytes=%zu", messages[i].name, ctx.len);
+        snprintf(tree.params, sizeof(tree.params), "message=%s bytes=%zu", messages[i].name, ctx.len);
+        run_case(&proto);
+        run_case(&tree);
+    }
+    arena_free(&ctx.arena);
+}
+
+// Image scaling: a decoded photo and a PNG-sized image down to
+// thumbnail sizes
+
+typedef struct {
+    unsigned char *src;
+    int src_width;
+    int src_height;
+    unsigned char *dst;
+    int dst_width;
+    int dst_height;
+} scale_ctx_t;
+
+static size_t run_image_scale(void *arg) {
+    scale_ctx_t *ctx = arg;
+    image_scale_rgba(ctx->src, ctx->src_width, ctx->src_height, (size_t)ctx->src_width * 4,
+                     ctx->dst, ctx->dst_width, ctx->dst_height);
+    return (size_t)ctx->src_width * ctx->src_height * 4;
+}
+
+static void bench_image_scale(void) {
+    static const int sizes[][3] = { { 1242, 776, 256 }, { 1920, 1080, 128 }, { 640, 480, 128 } };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        scale_ctx_t ctx = { NULL, sizes[i][0], sizes[i][1], NULL, 0, 0 };
+        micro_case_t c = { "image_scale", "", run_image_scale, &ctx, 0 };
+
+        image_fit(ctx.src_width, ctx.src_height, sizes[i][2], &ctx.dst_width, &ctx.dst_height);
+        ctx.src = malloc((size_t)ctx.src_width * ctx.src_height * 4);
+        ctx.dst = malloc((size_t)ctx.dst_width * ctx.dst_height * 4);
+        if (!ctx.src || !ctx.dst) exit(1);
+        for (size_t p = 0; p < (size_t)ctx.src_width * ctx.src_height * 4; p++) {
+            ctx.src[p] = (unsigned char)(p * 31 + p / 4096);
+        }
+
+        for (int simd = image_scale_simd_available(); simd >= 0; simd--) {
+            image_scale_set_simd(simd);
+            snprintf(c.params, sizeof(c.params), "src=%dx%d dst=%dx%d simd=%d", ctx.src_width, ctx.src_height,
+                     ctx.dst_width, ctx.dst_height, simd);
+            run_case(&c);
+        }
+        image_scale_set_simd(1);
+        free(ctx.src);
+        free(ctx.dst);
+    }
+}
+
+static void bench_frames(void) {
+    static const size_t sizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        frame_ctx_t ctx;
+        micro_case_t c = { "frame_parse", "", run_frame_parse, &ctx, 0 };
+
+        if (make_client_frame(&ctx, sizes[i]) != 0) exit(1);
+        snprintf(c.params, sizeof(c.params), "payload_bytes=%zu", sizes[i]);
+        run_case(&c);
+
+        // create_websocket_frame writes into the same buffer
+        c.name = "frame_create";
+        c.run = run_frame_create;
+        run_case(&c);
+
+        free(ctx.frame);
+        free(ctx.payload);
+    }
+}
+
+static void bench_listings(void) {
+    static const int tree_sizes[] = { 10, 100, 1000, 10000 };
+    listing_ctx_t ctx;
+
+    arena_init(&ctx.arena, ARENA_DEFAULT_SIZE);
+    json_writer_init(&ctx.writer, WS_MAX_FRAME_HEADER);
+
+    for (size_t i = 0; i < sizeof(tree_sizes) / sizeof(tree_sizes[0]); i++) {
+        micro_case_t c = { "list_directory", "", run_list_directory, &ctx, tree_sizes[i] };
+
+        if (g_filter && !strstr(c.name, g_filter)) break;
+        snprintf(ctx.dir, sizeof(ctx.dir), "/tmp/vldwm-micro-XXXXXX");
+        if (make_tree(ctx.dir, tree_sizes[i]) != 0) {
+            perror("make_tree");
+            exit(1);
+        }
+        snprintf(c.params, sizeof(c.params), "entries=%d", tree_sizes[i]);
+        run_case(&c);
+        remove_tree(ctx.dir);
+    }
+
+    int processes = count_processes();
+    micro_case_t c = { "process_list", "", run_process_list, &ctx, processes };
+    snprintf(c.params, sizeof(c.params), "processes=%d", processes);
+    run_case(&c);
+
+    json_writer_free(&ctx.writer);
+    arena_free(&ctx.arena);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--time") == 0) && i + 1 < argc) {
+            g_min_time = atof(argv[++i]);
+        } else if ((strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--filter") == 0) && i + 1 < argc) {
+            g_filter = argv[++i];
+        } else {
+            printf("Usage: %s [-t seconds per case] [-f name filter]\n", argv[0]);
+            return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (g_min_time <= 0) g_min_time = DEFAULT_MIN_TIME;
+
+    init_nss_cache();
+    init_desktop_session();
+
+    printf("micro min_time=%.2fs\n", g_min_time);
+    bench_frames();
+    bench_listings();
+    bench_metrics();
+    bench_tracing();
+    bench_logging();
+    bench_decode();
+    bench_image_scale();
+
+    cleanup_desktop_session();
+    cleanup_nss_cache();
+    return 0;
+}
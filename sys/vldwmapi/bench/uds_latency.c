@@ -0,0 +1,246 @@
+// Round trip latency of the same small request over TCP loopback and
+// over the daemon's Unix socket (-u). One connection per transport, one
+// request in flight; the request is a system_status without logging in,
+// so the reply is short and the daemon does almost no work besides the
+// transport. Reports percentiles in key=value form.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_REQUESTS 20000
+#define DEFAULT_WARMUP 1000
+#define RX_SIZE 16384
+
+static const char *g_host = "127.0.0.1";
+static int g_port = 3001;
+static const char *g_unix_path = "/run/vldwmapi.sock";
+static int g_requests = DEFAULT_REQUESTS;
+static int g_warmup = DEFAULT_WARMUP;
+
+static const char upgrade_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+static const char request_payload[] = "{\"type\":\"system_status\"}";
+
+typedef struct {
+    int fd;
+    char rx[RX_SIZE];
+    size_t rx_len;
+} conn_t;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int fill(conn_t *conn) {
+    ssize_t n;
+    do {
+        n = recv(conn->fd, conn->rx + conn->rx_len, sizeof(conn->rx) - conn->rx_len, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+    conn->rx_len += n;
+    return 0;
+}
+
+// Read one whole server frame and drop it; only short replies expected
+static int read_frame(conn_t *conn) {
+    for (;;) {
+        const unsigned char *bytes = (const unsigned char *)conn->rx;
+        size_t header_len = 2, length;
+
+        if (conn->rx_len >= 2) {
+            length = bytes[1] & 0x7F;
+            if (length == 126 && conn->rx_len >= 4) {
+                length = ((size_t)bytes[2] << 8) | bytes[3];
+                header_len = 4;
+            } else if (length > 126) {
+                return -1;
+            }
+            if (length != 126 && conn->rx_len >= header_len + length) {
+                conn->rx_len -= header_len + length;
+                memmove(conn->rx, conn->rx + header_len + length, conn->rx_len);
+                return 0;
+            }
+            if (header_len + length > sizeof(conn->rx)) return -1;
+        }
+        if (fill(conn) != 0) return -1;
+    }
+}
+
+// Upgrade, then wait for the welcome frame
+static int handshake(conn_t *conn) {
+    if (send_all(conn->fd, upgrade_request, sizeof(upgrade_request) - 1) < 0) return -1;
+    for (;;) {
+        if (fill(conn) != 0) return -1;
+        char *end = memmem(conn->rx, conn->rx_len, "\r\n\r\n", 4);
+        if (end) {
+            if (strncmp(conn->rx, "HTTP/1.1 101", 12) != 0) return -1;
+            size_t header_len = end + 4 - conn->rx;
+            conn->rx_len -= header_len;
+            memmove(conn->rx, end + 4, conn->rx_len);
+            return read_frame(conn);
+        }
+        if (conn->rx_len == sizeof(conn->rx)) return -1;
+    }
+}
+
+static int open_tcp(conn_t *conn) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    if (inet_pton(AF_INET, g_host, &addr.sin_addr) != 1) return -1;
+
+    conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->fd < 0) return -1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(conn->fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) return -1;
+    return handshake(conn);
+}
+
+// "@name" is in the abstract namespace, as with the daemon's -u
+static int open_unix(conn_t *conn) {
+    struct sockaddr_un addr;
+    size_t len = strlen(g_unix_path);
+    socklen_t addr_len = sizeof(addr);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (len == 0 || len >= sizeof(addr.sun_path)) return -1;
+    memcpy(addr.sun_path, g_unix_path, len);
+    if (g_unix_path[0] == '@') {
+        addr.sun_path[0] = '\0';
+        addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+    }
+
+    conn->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (conn->fd < 0) return -1;
+    if (connect(conn->fd, (const struct sockaddr *)&addr, addr_len) < 0) return -1;
+    return handshake(conn);
+}
+
+static int send_request(conn_t *conn) {
+    unsigned char frame[sizeof(request_payload) + 6];
+    size_t len = sizeof(request_payload) - 1;
+    uint32_t mask = (uint32_t)rand();
+
+    frame[0] = 0x81;
+    frame[1] = 0x80 | (unsigned char)len;
+    memcpy(frame + 2, &mask, 4);
+    for (size_t i = 0; i < len; i++) {
+        frame[6 + i] = request_payload[i] ^ frame[2 + (i & 3)];
+    }
+    return send_all(conn->fd, (const char *)frame, 6 + len);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *samples, size_t count, double p) {
+    if (count == 0) return 0;
+    return samples[(size_t)(p * (count - 1) + 0.5)];
+}
+
+// Ping-pong on one transport; -1 if it could not be reached
+static int run_transport(const char *name, int (*open_conn)(conn_t *)) {
+    conn_t *conn = calloc(1, sizeof(conn_t));
+    uint32_t *samples = calloc(g_requests, sizeof(uint32_t));
+    double sum = 0, start;
+    int result = -1;
+
+    if (!conn || !samples) goto out;
+    conn->fd = -1;
+    if (open_conn(conn) != 0) {
+        fprintf(stderr, "transport=%s error=%s\n", name, strerror(errno));
+        goto out;
+    }
+
+    for (int i = 0; i < g_warmup; i++) {
+        if (send_request(conn) != 0 || read_frame(conn) != 0) goto broken;
+    }
+    start = now_us();
+    for (int i = 0; i < g_requests; i++) {
+        double sent_at = now_us();
+        if (send_request(conn) != 0 || read_frame(conn) != 0) goto broken;
+        double latency = now_us() - sent_at;
+        samples[i] = latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+        sum += samples[i];
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    qsort(samples, g_requests, sizeof(uint32_t), compare_u32);
+    printf("transport=%s requests=%d rps=%.0f mean_us=%.1f p50_us=%u p99_us=%u p999_us=%u max_us=%u\n",
+           name, g_requests, g_requests / elapsed, sum / g_requests,
+           percentile(samples, g_requests, 0.50), percentile(samples, g_requests, 0.99),
+           percentile(samples, g_requests, 0.999), samples[g_requests - 1]);
+    result = 0;
+    goto out;
+
+broken:
+    fprintf(stderr, "transport=%s error=connection broke\n", name);
+out:
+    if (conn && conn->fd >= 0) close(conn->fd);
+    free(conn);
+    free(samples);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "--host") == 0) && i + 1 < argc) {
+            g_host = argv[++i];
+        } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) && i + 1 < argc) {
+            g_port = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "--unix") == 0) && i + 1 < argc) {
+            g_unix_path = argv[++i];
+        } else if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--requests") == 0) && i + 1 < argc) {
+            g_requests = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-W") == 0 || strcmp(argv[i], "--warmup") == 0) && i + 1 < argc) {
+            g_warmup = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [-H host] [-p port] [-u socket|@name] [-n requests] [-W warmup]\n", argv[0]);
+            return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (g_requests < 1) g_requests = 1;
+    if (g_warmup < 0) g_warmup = 0;
+
+    printf("uds_latency requests=%d warmup=%d host=%s port=%d unix=%s\n",
+           g_requests, g_warmup, g_host, g_port, g_unix_path);
+    int tcp = run_transport("tcp", open_tcp);
+    int uds = run_transport("unix", open_unix);
+    return tcp == 0 && uds == 0 ? 0 : 1;
+}
@@ -0,0 +1,466 @@
+// WebSocket load generator for vldwmapi: opens N clients, logs each one
+// in, then keeps one request in flight per client for the run, picking
+// login, desktop_session or system_status messages by weight. Reports
+// throughput and latency percentiles in key=value form.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define DEFAULT_CLIENTS 32
+#define DEFAULT_THREADS 4
+#define DEFAULT_DURATION 5
+#define DEFAULT_MIX "login:1,desktop_session:4,status:5"
+#define MAX_REQUEST_SIZE 1024
+#define RX_INITIAL_SIZE 16384
+
+typedef enum {
+    MSG_LOGIN = 0,
+    MSG_DESKTOP_SESSION,
+    MSG_STATUS,
+    MSG_KINDS
+} message_kind_t;
+
+static const char *kind_names[MSG_KINDS] = { "login", "desktop_session", "status" };
+
+static const char *g_host = "127.0.0.1";
+static int g_port = 3001;
+static int g_clients = DEFAULT_CLIENTS;
+static int g_threads = DEFAULT_THREADS;
+static int g_duration = DEFAULT_DURATION;
+static const char *g_username = "";
+static const char *g_password = "";
+static const char *g_path = "/tmp";
+static int g_weights[MSG_KINDS];
+static int g_weight_total = 0;
+static volatile int g_stop = 0;
+
+// Latency samples in microseconds, one array per thread so recording
+// never takes a lock
+typedef struct {
+    uint32_t *samples;
+    size_t count;
+    size_t cap;
+} sample_set_t;
+
+typedef struct {
+    int fd;
+    char *rx;
+    size_t rx_len;
+    size_t rx_cap;
+    double sent_at;
+    int kind;
+    int ready;              // Logged in; measured requests may start
+} load_conn_t;
+
+typedef struct {
+    int client_count;
+    unsigned int seed;
+    unsigned long requests[MSG_KINDS];
+    unsigned long failures;         // Replies with "success": false
+    unsigned long errors;           // Connect or protocol errors
+    unsigned long long rx_bytes;
+    sample_set_t latency[MSG_KINDS];
+} load_thread_t;
+
+static const char upgrade_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int add_sample(sample_set_t *set, uint32_t value) {
+    if (set->count == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 4096;
+        uint32_t *grown = realloc(set->samples, cap * sizeof(uint32_t));
+        if (!grown) return -1;
+        set->samples = grown;
+        set->cap = cap;
+    }
+    set->samples[set->count++] = value;
+    return 0;
+}
+
+// Parse "login:1,desktop_session:4,status:5"
+static int parse_mix(const char *mix) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", mix);
+    memset(g_weights, 0, sizeof(g_weights));
+    g_weight_total = 0;
+
+    for (char *item = strtok(copy, ","); item; item = strtok(NULL, ",")) {
+        char *colon = strchr(item, ':');
+        int weight = colon ? atoi(colon + 1) : 1;
+        int kind;
+        if (colon) *colon = '\0';
+        for (kind = 0; kind < MSG_KINDS; kind++) {
+            if (strcmp(item, kind_names[kind]) == 0) break;
+        }
+        if (kind == MSG_KINDS || weight < 0) return -1;
+        g_weights[kind] = weight;
+        g_weight_total += weight;
+    }
+    return g_weight_total > 0 ? 0 : -1;
+}
+
+static int pick_kind(unsigned int *seed) {
+    int roll = rand_r(seed) % g_weight_total;
+    for (int kind = 0; kind < MSG_KINDS; kind++) {
+        if (roll < g_weights[kind]) return kind;
+        roll -= g_weights[kind];
+    }
+    return MSG_STATUS;
+}
+
+// Masked client text frame
+static int send_text(int fd, const char *payload, size_t len, unsigned int *seed) {
+    unsigned char frame[MAX_REQUEST_SIZE + 14];
+    size_t header_len = 0;
+    uint32_t mask = rand_r(seed);
+
+    if (len > MAX_REQUEST_SIZE) return -1;
+    frame[header_len++] = 0x81;
+    if (len < 126) {
+        frame[header_len++] = 0x80 | (unsigned char)len;
+    } else {
+        frame[header_len++] = 0x80 | 126;
+        frame[header_len++] = (unsigned char)(len >> 8);
+        frame[header_len++] = (unsigned char)len;
+    }
+    memcpy(frame + header_len, &mask, 4);
+    for (size_t i = 0; i < len; i++) {
+        frame[header_len + 4 + i] = payload[i] ^ frame[header_len + (i & 3)];
+    }
+    return send_all(fd, (const char *)frame, header_len + 4 + len);
+}
+
+static int send_request(load_conn_t *conn, int kind, unsigned int *seed) {
+    char payload[MAX_REQUEST_SIZE];
+    int len;
+
+    switch (kind) {
+        case MSG_LOGIN:
+            len = snprintf(payload, sizeof(payload), "{\"type\":\"login\",\"username\":\"%s\",\"password\":\"%s\"}",
+                           g_username, g_password);
+            break;
+        case MSG_DESKTOP_SESSION:
+            len = snprintf(payload, sizeof(payload), "{\"type\":\"desktop_session\",\"action\":\"list_directory\",\"path\":\"%s\"}",
+                           g_path);
+            break;
+        default:
+            len = snprintf(payload, sizeof(payload), "{\"type\":\"system_status\"}");
+            break;
+    }
+    if (len <= 0 || (size_t)len >= sizeof(payload)) return -1;
+
+    conn->kind = kind;
+    conn->sent_at = now_us();
+    return send_text(conn->fd, payload, len, seed);
+}
+
+// Connect and upgrade; anything the server sends after the 101 (the
+// welcome frame) is left in rx
+static int open_conn(load_conn_t *conn, const struct sockaddr_in *addr) {
+    int one = 1;
+
+    conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->fd < 0) return -1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(conn->fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0) return -1;
+    if (send_all(conn->fd, upgrade_request, sizeof(upgrade_request) - 1) < 0) return -1;
+
+    conn->rx_cap = RX_INITIAL_SIZE;
+    conn->rx = malloc(conn->rx_cap);
+    if (!conn->rx) return -1;
+
+    for (;;) {
+        ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, conn->rx_cap - conn->rx_len - 1, 0);
+        if (n <= 0) return -1;
+        conn->rx_len += n;
+        conn->rx[conn->rx_len] = '\0';
+
+        char *end = strstr(conn->rx, "\r\n\r\n");
+        if (end) {
+            if (strncmp(conn->rx, "HTTP/1.1 101", 12) != 0) return -1;
+            size_t header_len = end + 4 - conn->rx;
+            conn->rx_len -= header_len;
+            memmove(conn->rx, end + 4, conn->rx_len);
+            return 0;
+        }
+        if (conn->rx_len >= conn->rx_cap - 1) return -1;
+    }
+}
+
+// Length of the complete server frame at the start of rx, or 0 if more
+// input is needed; the payload is returned through the out parameters
+static size_t next_frame(load_conn_t *conn, int *opcode, const char **payload, size_t *payload_len) {
+    const unsigned char *bytes = (const unsigned char *)conn->rx;
+    size_t header_len = 2;
+    uint64_t length;
+
+    if (conn->rx_len < 2) return 0;
+    length = bytes[1] & 0x7F;
+    if (length == 126) {
+        if (conn->rx_len < 4) return 0;
+        length = ((uint64_t)bytes[2] << 8) | bytes[3];
+        header_len = 4;
+    } else if (length == 127) {
+        if (conn->rx_len < 10) return 0;
+        length = 0;
+        for (int i = 2; i < 10; i++) length = (length << 8) | bytes[i];
+        header_len = 10;
+    }
+
+    if (conn->rx_len < header_len + length) {
+        // Make room for the rest of a large reply
+        if (header_len + length > conn->rx_cap) {
+            char *grown = realloc(conn->rx, header_len + length);
+            if (!grown) return 0;
+            conn->rx = grown;
+            conn->rx_cap = header_len + length;
+        }
+        return 0;
+    }
+
+    *opcode = bytes[0] & 0x0F;
+    *payload = conn->rx + header_len;
+    *payload_len = length;
+    return header_len + length;
+}
+
+static int reply_succeeded(const char *payload, size_t len) {
+    return memmem(payload, len, "\"success\":false", 15) == NULL &&
+           memmem(payload, len, "\"success\": false", 16) == NULL;
+}
+
+// Handle every complete frame in rx. Returns -1 if the connection broke.
+static int drain_frames(load_thread_t *t, load_conn_t *conn) {
+    int opcode;
+    const char *payload;
+    size_t payload_len, frame_len;
+
+    while ((frame_len = next_frame(conn, &opcode, &payload, &payload_len)) > 0) {
+        if (opcode == 0x8) return -1;
+        if (opcode == 0x1 && !memmem(payload, payload_len, "\"welcome\"", 9)) {
+            int ok = reply_succeeded(payload, payload_len);
+            if (!conn->ready) {
+                // Startup login: not measured
+                conn->ready = 1;
+                if (!ok) t->failures++;
+            } else {
+                double latency = now_us() - conn->sent_at;
+                add_sample(&t->latency[conn->kind], latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency);
+                t->requests[conn->kind]++;
+                if (!ok) t->failures++;
+            }
+            if (!g_stop && send_request(conn, pick_kind(&t->seed), &t->seed) < 0) return -1;
+        }
+        conn->rx_len -= frame_len;
+        memmove(conn->rx, conn->rx + frame_len, conn->rx_len);
+    }
+    return 0;
+}
+
+static void *load_thread(void *arg) {
+    load_thread_t *t = arg;
+    load_conn_t *conns = calloc(t->client_count, sizeof(load_conn_t));
+    struct pollfd *fds = calloc(t->client_count, sizeof(struct pollfd));
+    struct sockaddr_in addr;
+    int live = 0;
+
+    if (!conns || !fds) goto out;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    inet_pton(AF_INET, g_host, &addr.sin_addr);
+
+    for (int i = 0; i < t->client_count; i++) {
+        conns[i].fd = -1;
+        if (open_conn(&conns[i], &addr) != 0 || send_request(&conns[i], MSG_LOGIN, &t->seed) != 0) {
+            t->errors++;
+            if (conns[i].fd >= 0) close(conns[i].fd);
+            conns[i].fd = -1;
+            continue;
+        }
+        live++;
+    }
+
+    while (!g_stop && live > 0) {
+        for (int i = 0; i < t->client_count; i++) {
+            fds[i].fd = conns[i].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, t->client_count, 100) < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < t->client_count; i++) {
+            load_conn_t *conn = &conns[i];
+            if (conn->fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, conn->rx_cap - conn->rx_len, 0);
+            if (n > 0) {
+                t->rx_bytes += n;
+                conn->rx_len += n;
+                if (drain_frames(t, conn) == 0) continue;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            t->errors++;
+            close(conn->fd);
+            conn->fd = -1;
+            live--;
+        }
+    }
+
+out:
+    for (int i = 0; conns && i < t->client_count; i++) {
+        if (conns[i].fd >= 0) close(conns[i].fd);
+        free(conns[i].rx);
+    }
+    free(conns);
+    free(fds);
+    return NULL;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const sample_set_t *set, double p) {
+    if (set->count == 0) return 0;
+    size_t index = (size_t)(p * (set->count - 1) + 0.5);
+    return set->samples[index];
+}
+
+static void print_latency(const char *name, sample_set_t *set, double elapsed) {
+    double sum = 0;
+    qsort(set->samples, set->count, sizeof(uint32_t), compare_u32);
+    for (size_t i = 0; i < set->count; i++) sum += set->samples[i];
+
+    printf("kind=%s requests=%zu rps=%.0f mean_us=%.1f p50_us=%u p99_us=%u p999_us=%u max_us=%u\n",
+           name, set->count, set->count / elapsed, set->count ? sum / set->count : 0.0,
+           percentile(set, 0.50), percentile(set, 0.99), percentile(set, 0.999),
+           set->count ? set->samples[set->count - 1] : 0);
+}
+
+static int merge_samples(sample_set_t *into, const sample_set_t *from) {
+    for (size_t i = 0; i < from->count; i++) {
+        if (add_sample(into, from->samples[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *mix = DEFAULT_MIX;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "--host") == 0) && i + 1 < argc) {
+            g_host = argv[++i];
+        } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) && i + 1 < argc) {
+            g_port = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--clients") == 0) && i + 1 < argc) {
+            g_clients = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) && i + 1 < argc) {
+            g_threads = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--duration") == 0) && i + 1 < argc) {
+            g_duration = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--mix") == 0) && i + 1 < argc) {
+            mix = argv[++i];
+        } else if ((strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "--user") == 0) && i + 1 < argc) {
+            g_username = argv[++i];
+        } else if ((strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--password") == 0) && i + 1 < argc) {
+            g_password = argv[++i];
+        } else if ((strcmp(argv[i], "-P") == 0 || strcmp(argv[i], "--path") == 0) && i + 1 < argc) {
+            g_path = argv[++i];
+        } else {
+            printf("Usage: %s [-H host] [-p port] [-c clients] [-t threads] [-d seconds]\n"
+                   "       [-m login:W,desktop_session:W,status:W] [-u user] [-w password] [-P path]\n", argv[0]);
+            return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (parse_mix(mix) != 0) {
+        fprintf(stderr, "invalid mix: %s\n", mix);
+        return 1;
+    }
+    if (g_clients < 1) g_clients = 1;
+    if (g_threads < 1) g_threads = 1;
+    if (g_threads > g_clients) g_threads = g_clients;
+
+    pthread_t *threads = calloc(g_threads, sizeof(pthread_t));
+    load_thread_t *stats = calloc(g_threads, sizeof(load_thread_t));
+    if (!threads || !stats) return 1;
+
+    double start = now_us();
+    for (int i = 0; i < g_threads; i++) {
+        stats[i].client_count = g_clients / g_threads + (i < g_clients % g_threads);
+        stats[i].seed = 0x9e3779b9u * (i + 1);
+        pthread_create(&threads[i], NULL, load_thread, &stats[i]);
+    }
+    sleep(g_duration);
+    g_stop = 1;
+
+    sample_set_t all = { NULL, 0, 0 };
+    sample_set_t per_kind[MSG_KINDS];
+    unsigned long failures = 0, errors = 0;
+    unsigned long long rx_bytes = 0;
+
+    memset(per_kind, 0, sizeof(per_kind));
+    for (int i = 0; i < g_threads; i++) {
+        pthread_join(threads[i], NULL);
+        failures += stats[i].failures;
+        errors += stats[i].errors;
+        rx_bytes += stats[i].rx_bytes;
+        for (int kind = 0; kind < MSG_KINDS; kind++) {
+            merge_samples(&per_kind[kind], &stats[i].latency[kind]);
+            merge_samples(&all, &stats[i].latency[kind]);
+            free(stats[i].latency[kind].samples);
+        }
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    printf("ws_load clients=%d threads=%d duration=%.2fs mix=%s\n", g_clients, g_threads, elapsed, mix);
+    printf("requests=%zu failures=%lu errors=%lu rps=%.0f rx_mb_per_sec=%.2f\n",
+           all.count, failures, errors, all.count / elapsed, rx_bytes / elapsed / (1024.0 * 1024.0));
+    print_latency("all", &all, elapsed);
+    for (int kind = 0; kind < MSG_KINDS; kind++) {
+        if (g_weights[kind] > 0) print_latency(kind_names[kind], &per_kind[kind], elapsed);
+        free(per_kind[kind].samples);
+    }
+
+    free(all.samples);
+    free(threads);
+    free(stats);
+    return all.count > 0 ? 0 : 1;
+}
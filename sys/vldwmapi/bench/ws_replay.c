@@ -0,0 +1,734 @@
+// Replays a capture written by vldwmapi --record against a daemon. Each
+// recorded connection becomes one simulated client (or -m of them) that
+// opens, sends and closes when the original did, with the recorded
+// gaps divided by -x; -x 0 sends everything as fast as possible. The
+// tool writes an id into every message to match replies to requests,
+// and reports sent, failed and unanswered requests and latency
+// percentiles per message type in key=value lines. -o saves them and
+// --compare diffs two saved runs.
+//
+// Passwords and tokens are redacted in the capture: logins replay with
+// the password given by -w, and resumed sessions fail.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../recorder.h"
+
+#define DEFAULT_TIMEOUT 5
+#define MAX_TYPES 64
+#define TYPE_NAME_MAX 32
+#define ID_PREFIX "rp"
+#define ID_SEARCH_BYTES 256         // The id follows the type at the start of a reply
+#define RX_INITIAL_SIZE 16384
+#define EVENTS_MAX 256
+
+static const char *g_host = "127.0.0.1";
+static int g_port = 3001;
+static const char *g_unix_path = NULL;
+static const char *g_capture = NULL;
+static const char *g_output = NULL;
+static const char *g_password = NULL;
+static double g_speed = 1.0;                // 0: as fast as possible
+static int g_multiply = 1;
+static int g_timeout = DEFAULT_TIMEOUT;
+
+static const char upgrade_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+typedef struct {
+    uint32_t *samples;
+    size_t count;
+    size_t cap;
+} sample_set_t;
+
+typedef struct {
+    char name[TYPE_NAME_MAX];
+    unsigned long sent;
+    unsigned long replies;
+    unsigned long failures;         // Replies with "success": false
+    sample_set_t latency;
+} type_stats_t;
+
+// One simulated client
+typedef struct {
+    int fd;
+    int done;                       // Closed, by the capture or the daemon
+    int closing;                    // Closed in the capture; waiting for replies
+    int outstanding;
+    char *rx;
+    size_t rx_len;
+    size_t rx_cap;
+    char *tx;
+    size_t tx_len;
+    size_t tx_cap;
+    size_t tx_sent;
+} sim_conn_t;
+
+typedef struct {
+    int conn;
+    int type;
+    int answered;
+    double sent_at;
+} request_t;
+
+static uint64_t *g_conn_ids;                // Recorded ids, sorted
+static size_t g_conn_id_count;
+static sim_conn_t *g_conns;
+static request_t *g_requests;
+static size_t g_request_count;
+static type_stats_t g_types[MAX_TYPES];
+static int g_type_count;
+static unsigned long g_connect_errors;
+static unsigned long g_untracked;           // Not a JSON object; sent but not timed
+static int g_outstanding;
+static int g_epoll_fd = -1;
+static struct sockaddr_storage g_addr;
+static socklen_t g_addr_len;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int add_sample(sample_set_t *set, uint32_t value) {
+    if (set->count == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 4096;
+        uint32_t *grown = realloc(set->samples, cap * sizeof(uint32_t));
+        if (!grown) return -1;
+        set->samples = grown;
+        set->cap = cap;
+    }
+    set->samples[set->count++] = value;
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int grow(char **buf, size_t *cap, size_t needed) {
+    if (needed <= *cap) return 0;
+    size_t size = *cap ? *cap : 4096;
+    while (size < needed) size *= 2;
+    char *grown = realloc(*buf, size);
+    if (!grown) return -1;
+    *buf = grown;
+    *cap = size;
+    return 0;
+}
+
+// The "type" of a message, or "other"
+static int type_index(const char *payload, size_t len) {
+    char name[TYPE_NAME_MAX] = "other";
+    const char *key = memmem(payload, len, "\"type\"", 6);
+
+    if (key) {
+        const char *p = key + 6, *end = payload + len;
+        while (p < end && (*p == ' ' || *p == ':')) p++;
+        if (p < end && *p == '"') {
+            size_t n = 0;
+            for (p++; p < end && *p != '"' && n < sizeof(name) - 1; p++) name[n++] = *p;
+            name[n] = '\0';
+        }
+    }
+    for (int i = 0; i < g_type_count; i++) {
+        if (strcmp(g_types[i].name, name) == 0) return i;
+    }
+    if (g_type_count == MAX_TYPES) return MAX_TYPES - 1;
+    snprintf(g_types[g_type_count].name, sizeof(g_types[0].name), "%s", name);
+    return g_type_count++;
+}
+
+// First simulated client of a recorded connection
+static int conn_base(uint64_t conn_id) {
+    const uint64_t *found = bsearch(&conn_id, g_conn_ids, g_conn_id_count, sizeof(uint64_t), compare_u64);
+    return found ? (int)(found - g_conn_ids) * g_multiply : -1;
+}
+
+// Count connections and messages so everything is allocated up front
+static int scan_capture(void) {
+    rec_reader_t reader;
+    rec_event_t event;
+    size_t cap = 0, messages = 0;
+    int result;
+
+    if (rec_reader_open(&reader, g_capture) != 0) return -1;
+    while ((result = rec_reader_next(&reader, &event)) > 0) {
+        if (event.kind == REC_SEGMENT) continue;
+        if (event.kind == REC_MESSAGE) messages++;
+        if (g_conn_id_count == cap) {
+            cap = cap ? cap * 2 : 1024;
+            uint64_t *grown = realloc(g_conn_ids, cap * sizeof(uint64_t));
+            if (!grown) break;
+            g_conn_ids = grown;
+        }
+        g_conn_ids[g_conn_id_count++] = event.conn_id;
+    }
+    rec_reader_close(&reader);
+    if (result != 0) return -1;
+
+    qsort(g_conn_ids, g_conn_id_count, sizeof(uint64_t), compare_u64);
+    size_t unique = 0;
+    for (size_t i = 0; i < g_conn_id_count; i++) {
+        if (unique == 0 || g_conn_ids[unique - 1] != g_conn_ids[i]) g_conn_ids[unique++] = g_conn_ids[i];
+    }
+    g_conn_id_count = unique;
+
+    g_conns = calloc(unique * g_multiply + 1, sizeof(sim_conn_t));
+    g_requests = calloc(messages * g_multiply + 1, sizeof(request_t));
+    if (!g_conns || !g_requests) return -1;
+    for (size_t i = 0; i < unique * g_multiply; i++) g_conns[i].fd = -1;
+    return 0;
+}
+
+static int resolve_address(void) {
+    memset(&g_addr, 0, sizeof(g_addr));
+    if (g_unix_path) {
+        struct sockaddr_un *addr = (struct sockaddr_un *)&g_addr;
+        size_t len = strlen(g_unix_path);
+
+        addr->sun_family = AF_UNIX;
+        if (len == 0 || len >= sizeof(addr->sun_path)) return -1;
+        memcpy(addr->sun_path, g_unix_path, len);
+        g_addr_len = sizeof(*addr);
+        if (g_unix_path[0] == '@') {
+            addr->sun_path[0] = '\0';
+            g_addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+        }
+        return 0;
+    }
+
+    struct sockaddr_in *addr = (struct sockaddr_in *)&g_addr;
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(g_port);
+    g_addr_len = sizeof(*addr);
+    return inet_pton(AF_INET, g_host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static void close_conn(int index) {
+    sim_conn_t *conn = &g_conns[index];
+
+    if (conn->fd >= 0) close(conn->fd);
+    conn->fd = -1;
+    conn->done = 1;
+    g_outstanding -= conn->outstanding;
+    conn->outstanding = 0;
+    free(conn->rx);
+    free(conn->tx);
+    conn->rx = conn->tx = NULL;
+    conn->rx_len = conn->rx_cap = conn->tx_len = conn->tx_cap = conn->tx_sent = 0;
+}
+
+// Connect and upgrade with blocking calls, then hand the socket to the
+// epoll set. The welcome frame, if already here, stays in rx.
+static int open_conn(int index) {
+    sim_conn_t *conn = &g_conns[index];
+    int one = 1;
+
+    conn->fd = socket(g_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0) goto fail;
+    if (g_addr.ss_family == AF_INET) setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(conn->fd, (const struct sockaddr *)&g_addr, g_addr_len) < 0) goto fail;
+    if (grow(&conn->rx, &conn->rx_cap, RX_INITIAL_SIZE) != 0) goto fail;
+
+    for (size_t sent = 0; sent < sizeof(upgrade_request) - 1;) {
+        ssize_t n = send(conn->fd, upgrade_request + sent, sizeof(upgrade_request) - 1 - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) goto fail;
+        sent += n;
+    }
+    for (;;) {
+        ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, conn->rx_cap - conn->rx_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) goto fail;
+        conn->rx_len += n;
+        char *end = memmem(conn->rx, conn->rx_len, "\r\n\r\n", 4);
+        if (end) {
+            if (strncmp(conn->rx, "HTTP/1.1 101", 12) != 0) goto fail;
+            conn->rx_len -= end + 4 - conn->rx;
+            memmove(conn->rx, end + 4, conn->rx_len);
+            break;
+        }
+        if (conn->rx_len == conn->rx_cap) goto fail;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)index };
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) != 0) goto fail;
+    return 0;
+
+fail:
+    g_connect_errors++;
+    close_conn(index);
+    return -1;
+}
+
+// Write what the socket takes; wait for EPOLLOUT for the rest
+static int flush_tx(int index) {
+    sim_conn_t *conn = &g_conns[index];
+
+    while (conn->tx_sent < conn->tx_len) {
+        ssize_t n = send(conn->fd, conn->tx + conn->tx_sent, conn->tx_len - conn->tx_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) return -1;
+        conn->tx_sent += n;
+    }
+    if (conn->tx_sent == conn->tx_len) conn->tx_sent = conn->tx_len = 0;
+
+    struct epoll_event ev = { .events = EPOLLIN | (conn->tx_len ? EPOLLOUT : 0), .data.u32 = (uint32_t)index };
+    epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return 0;
+}
+
+// Masked client text frame onto the send buffer
+static int queue_text(sim_conn_t *conn, const char *payload, size_t len) {
+    unsigned char header[14];
+    size_t header_len = 0;
+    uint32_t mask = (uint32_t)rand();
+
+    header[header_len++] = 0x81;
+    if (len < 126) {
+        header[header_len++] = 0x80 | (unsigned char)len;
+    } else if (len < 65536) {
+        header[header_len++] = 0x80 | 126;
+        header[header_len++] = (unsigned char)(len >> 8);
+        header[header_len++] = (unsigned char)len;
+    } else {
+        header[header_len++] = 0x80 | 127;
+        for (int shift = 56; shift >= 0; shift -= 8) header[header_len++] = (unsigned char)((uint64_t)len >> shift);
+    }
+    memcpy(header + header_len, &mask, 4);
+    header_len += 4;
+
+    if (grow(&conn->tx, &conn->tx_cap, conn->tx_len + header_len + len) != 0) return -1;
+    unsigned char *out = (unsigned char *)conn->tx + conn->tx_len;
+    memcpy(out, header, header_len);
+    for (size_t i = 0; i < len; i++) {
+        out[header_len + i] = (unsigned char)payload[i] ^ header[header_len - 4 + (i & 3)];
+    }
+    conn->tx_len += header_len + len;
+    return 0;
+}
+
+static size_t skip_space(const char *text, size_t len, size_t i) {
+    while (i < len && strchr(" \t\r\n", text[i])) i++;
+    return i;
+}
+
+// Put the request's id in place of the recorded one, or first in the
+// object if it had none, and the replay password in place of the
+// redacted one
+static void send_message(int index, const char *payload, size_t len) {
+    static char *with_password, *with_id;
+    static size_t password_cap, id_cap;
+    static const char *const password_key[] = { "password" };
+    static const char *const id_key[] = { "id" };
+    sim_conn_t *conn = &g_conns[index];
+    size_t open = skip_space(payload, len, 0);
+    char id[32];
+    int replaced;
+
+    if (conn->done || (conn->fd < 0 && open_conn(index) != 0)) {
+        // Counted as sent and never answered
+        if (open < len && payload[open] == '{') g_types[type_index(payload, len)].sent++;
+        return;
+    }
+    if (open == len || payload[open] != '{') {
+        // Not an object: the daemon can't echo an id
+        g_untracked++;
+        if (queue_text(conn, payload, len) != 0 || flush_tx(index) != 0) close_conn(index);
+        return;
+    }
+
+    if (g_password) {
+        size_t needed = recorder_replace_fields(payload, len, password_key, 1, g_password,
+                                                with_password, password_cap, &replaced);
+        if (grow(&with_password, &password_cap, needed) != 0) return;
+        recorder_replace_fields(payload, len, password_key, 1, g_password, with_password, password_cap, &replaced);
+        payload = with_password;
+        len = needed;
+    }
+
+    size_t seq = g_request_count++;
+    request_t *request = &g_requests[seq];
+    request->conn = index;
+    request->type = type_index(payload, len);
+    g_types[request->type].sent++;
+
+    snprintf(id, sizeof(id), ID_PREFIX "%zu", seq);
+    size_t needed = recorder_replace_fields(payload, len, id_key, 1, id, with_id, id_cap, &replaced);
+    if (grow(&with_id, &id_cap, needed + sizeof(id) + 8) != 0) return;
+    recorder_replace_fields(payload, len, id_key, 1, id, with_id, id_cap, &replaced);
+    if (replaced == 0) {
+        open = skip_space(payload, len, 0);
+        size_t body = skip_space(payload, len, open + 1);
+        int id_len = snprintf(with_id, id_cap, "{\"id\":\"%s\"%s", id, body < len && payload[body] == '}' ? "" : ",");
+        memcpy(with_id + id_len, payload + open + 1, len - open - 1);
+        needed = id_len + len - open - 1;
+    }
+
+    request->sent_at = now_us();
+    conn->outstanding++;
+    g_outstanding++;
+    if (queue_text(conn, with_id, needed) != 0 || flush_tx(index) != 0) close_conn(index);
+}
+
+// Length of the complete server frame at the start of rx, or 0 if more
+// input is needed
+static size_t next_frame(const char *rx, size_t rx_len, int *opcode, const char **payload, size_t *payload_len) {
+    const unsigned char *bytes = (const unsigned char *)rx;
+    size_t header_len = 2;
+    uint64_t length;
+
+    if (rx_len < 2) return 0;
+    length = bytes[1] & 0x7F;
+    if (length == 126) {
+        if (rx_len < 4) return 0;
+        length = ((uint64_t)bytes[2] << 8) | bytes[3];
+        header_len = 4;
+    } else if (length == 127) {
+        if (rx_len < 10) return 0;
+        length = 0;
+        for (int i = 2; i < 10; i++) length = (length << 8) | bytes[i];
+        header_len = 10;
+    }
+    if (rx_len < header_len + length) return 0;
+
+    *opcode = bytes[0] & 0x0F;
+    *payload = rx + header_len;
+    *payload_len = length;
+    return header_len + length;
+}
+
+// A reply to one of our requests: text, or binary with a u32 length and
+// a JSON header (thumbnails; the first frame counts). Pushes such as
+// scene deltas carry no id and are skipped.
+static void handle_reply(int index, int opcode, const char *payload, size_t len) {
+    const char *json = payload;
+    size_t json_len = len;
+
+    if (opcode == 0x2) {
+        uint32_t header_len;
+        if (len < 4) return;
+        memcpy(&header_len, payload, 4);
+        json = payload + 4;
+        json_len = header_len < len - 4 ? header_len : len - 4;
+    } else if (opcode != 0x1) {
+        return;
+    }
+
+    const char *id = memmem(json, json_len < ID_SEARCH_BYTES ? json_len : ID_SEARCH_BYTES,
+                            "\"id\":\"" ID_PREFIX, 6 + strlen(ID_PREFIX));
+    if (!id) return;
+    size_t seq = strtoul(id + 6 + strlen(ID_PREFIX), NULL, 10);
+    if (seq >= g_request_count) return;
+    request_t *request = &g_requests[seq];
+    if (request->answered || request->conn != index) return;
+
+    type_stats_t *type = &g_types[request->type];
+    double latency = now_us() - request->sent_at;
+    request->answered = 1;
+    type->replies++;
+    if (memmem(json, json_len, "\"success\":false", 15) || memmem(json, json_len, "\"success\": false", 16)) {
+        type->failures++;
+    }
+    add_sample(&type->latency, latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency);
+    g_conns[index].outstanding--;
+    g_outstanding--;
+}
+
+static void read_conn(int index) {
+    sim_conn_t *conn = &g_conns[index];
+
+    for (;;) {
+        if (conn->rx_len == conn->rx_cap && grow(&conn->rx, &conn->rx_cap, conn->rx_cap * 2) != 0) break;
+        ssize_t n = recv(conn->fd, conn->rx + conn->rx_len, conn->rx_cap - conn->rx_len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            close_conn(index);
+            return;
+        }
+        conn->rx_len += n;
+
+        int opcode;
+        const char *payload;
+        size_t payload_len, frame_len, used = 0;
+        while ((frame_len = next_frame(conn->rx + used, conn->rx_len - used, &opcode, &payload, &payload_len)) > 0) {
+            if (opcode == 0x8) {
+                close_conn(index);
+                return;
+            }
+            handle_reply(index, opcode, payload, payload_len);
+            used += frame_len;
+        }
+        conn->rx_len -= used;
+        memmove(conn->rx, conn->rx + used, conn->rx_len);
+    }
+    if (conn->closing && conn->outstanding == 0) close_conn(index);
+}
+
+// Handle socket events for up to timeout_ms
+static void pump(int timeout_ms) {
+    struct epoll_event events[EVENTS_MAX];
+    int ready = epoll_wait(g_epoll_fd, events, EVENTS_MAX, timeout_ms);
+
+    for (int e = 0; e < ready; e++) {
+        int index = (int)events[e].data.u32;
+        if (g_conns[index].fd < 0) continue;
+        if ((events[e].events & EPOLLOUT) && flush_tx(index) != 0) {
+            close_conn(index);
+            continue;
+        }
+        if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) read_conn(index);
+    }
+}
+
+static void replay_event(const rec_event_t *event) {
+    int base = conn_base(event->conn_id);
+
+    for (int copy = 0; base >= 0 && copy < g_multiply; copy++) {
+        int index = base + copy;
+        sim_conn_t *conn = &g_conns[index];
+
+        switch (event->kind) {
+            case REC_OPEN:
+                if (conn->fd < 0 && !conn->done) open_conn(index);
+                break;
+            case REC_MESSAGE:
+                // Connections opened before the capture started open on
+                // their first message
+                send_message(index, event->data, event->len);
+                break;
+            case REC_CLOSE:
+                if (conn->outstanding == 0) close_conn(index);
+                else conn->closing = 1;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static uint32_t percentile(const sample_set_t *set, double p) {
+    if (set->count == 0) return 0;
+    size_t index = (size_t)(p * (set->count - 1) + 0.5);
+    return set->samples[index];
+}
+
+static void print_type(FILE *out, const char *name, const type_stats_t *type) {
+    double sum = 0;
+    unsigned long unanswered = type->sent - type->replies;
+
+    for (size_t i = 0; i < type->latency.count; i++) sum += type->latency.samples[i];
+    fprintf(out, "type=%s sent=%lu replies=%lu failures=%lu unanswered=%lu error_rate=%.4f "
+            "mean_us=%.1f p50_us=%u p99_us=%u p999_us=%u max_us=%u\n",
+            name, type->sent, type->replies, type->failures, unanswered,
+            type->sent ? (double)(type->failures + unanswered) / type->sent : 0.0,
+            type->latency.count ? sum / type->latency.count : 0.0,
+            percentile(&type->latency, 0.50), percentile(&type->latency, 0.99),
+            percentile(&type->latency, 0.999),
+            type->latency.count ? type->latency.samples[type->latency.count - 1] : 0);
+}
+
+static void print_results(FILE *out, double elapsed, double recorded) {
+    type_stats_t all;
+
+    memset(&all, 0, sizeof(all));
+    for (int i = 0; i < g_type_count; i++) {
+        type_stats_t *type = &g_types[i];
+        qsort(type->latency.samples, type->latency.count, sizeof(uint32_t), compare_u32);
+        all.sent += type->sent;
+        all.replies += type->replies;
+        all.failures += type->failures;
+        for (size_t s = 0; s < type->latency.count; s++) add_sample(&all.latency, type->latency.samples[s]);
+    }
+    qsort(all.latency.samples, all.latency.count, sizeof(uint32_t), compare_u32);
+
+    fprintf(out, "ws_replay capture=%s connections=%zu clients=%zu speed=%g recorded=%.2fs duration=%.2fs "
+            "rps=%.0f connect_errors=%lu untracked=%lu\n",
+            g_capture, g_conn_id_count, g_conn_id_count * g_multiply, g_speed, recorded, elapsed,
+            elapsed > 0 ? all.sent / elapsed : 0.0, g_connect_errors, g_untracked);
+    print_type(out, "all", &all);
+    for (int i = 0; i < g_type_count; i++) print_type(out, g_types[i].name, &g_types[i]);
+    free(all.latency.samples);
+}
+
+// Value of key=... in a result line, or -1
+static double field(const char *line, const char *key) {
+    size_t len = strlen(key);
+    for (const char *p = strstr(line, key); p; p = strstr(p + 1, key)) {
+        if ((p == line || p[-1] == ' ') && p[len] == '=') return atof(p + len + 1);
+    }
+    return -1;
+}
+
+#define COMPARE_MAX_LINES 256
+#define COMPARE_LINE_MAX 512
+
+static int load_results(const char *path, char lines[][COMPARE_LINE_MAX], int *count) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return -1;
+    }
+    *count = 0;
+    while (*count < COMPARE_MAX_LINES && fgets(lines[*count], COMPARE_LINE_MAX, file)) {
+        if (strncmp(lines[*count], "type=", 5) == 0) (*count)++;
+    }
+    fclose(file);
+    return 0;
+}
+
+static void print_change(const char *key, double before, double after) {
+    if (before < 0 || after < 0) return;
+    if (strcmp(key, "error_rate") == 0) {
+        printf(" %s=%.4f->%.4f", key, before, after);
+    } else if (before > 0) {
+        printf(" %s=%.0f->%.0f(%+.1f%%)", key, before, after, (after - before) * 100.0 / before);
+    } else {
+        printf(" %s=%.0f->%.0f", key, before, after);
+    }
+}
+
+// Per type of a baseline run and a new one: latency and error rate,
+// before->after
+static int compare_runs(const char *baseline, const char *current) {
+    static char before[COMPARE_MAX_LINES][COMPARE_LINE_MAX], after[COMPARE_MAX_LINES][COMPARE_LINE_MAX];
+    static const char *const keys[] = { "sent", "error_rate", "mean_us", "p50_us", "p99_us", "p999_us" };
+    int before_count, after_count;
+
+    if (load_results(baseline, before, &before_count) != 0 || load_results(current, after, &after_count) != 0) return 1;
+    for (int i = 0; i < after_count; i++) {
+        size_t name_len = strcspn(after[i], " \n");
+        int match = -1;
+        for (int j = 0; j < before_count && match < 0; j++) {
+            if (strcspn(before[j], " \n") == name_len && strncmp(before[j], after[i], name_len) == 0) match = j;
+        }
+        printf("%.*s", (int)name_len, after[i]);
+        if (match < 0) {
+            printf(" new\n");
+            continue;
+        }
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            print_change(keys[k], field(before[match], keys[k]), field(after[i], keys[k]));
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+static void usage(const char *name) {
+    printf("Usage: %s -r capture [-H host] [-p port] [-u socket] [-x speed] [-m clients-per-connection]\n"
+           "       [-w password] [-t seconds] [-o results]\n"
+           "       %s --compare baseline-results results\n"
+           "  -x 1 replays in real time, -x 10 ten times faster, -x 0 as fast as possible\n", name, name);
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--compare") == 0 && i + 2 < argc) {
+            return compare_runs(argv[i + 1], argv[i + 2]);
+        } else if ((strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--capture") == 0) && i + 1 < argc) {
+            g_capture = argv[++i];
+        } else if ((strcmp(argv[i], "-H") == 0 || strcmp(argv[i], "--host") == 0) && i + 1 < argc) {
+            g_host = argv[++i];
+        } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) && i + 1 < argc) {
+            g_port = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "--unix") == 0) && i + 1 < argc) {
+            g_unix_path = argv[++i];
+        } else if ((strcmp(argv[i], "-x") == 0 || strcmp(argv[i], "--speed") == 0) && i + 1 < argc) {
+            g_speed = strcmp(argv[i + 1], "max") == 0 ? 0 : atof(argv[i + 1]);
+            i++;
+        } else if ((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--multiply") == 0) && i + 1 < argc) {
+            g_multiply = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--password") == 0) && i + 1 < argc) {
+            g_password = argv[++i];
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--timeout") == 0) && i + 1 < argc) {
+            g_timeout = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && i + 1 < argc) {
+            g_output = argv[++i];
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (!g_capture || g_speed < 0 || g_multiply < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (scan_capture() != 0) {
+        fprintf(stderr, "cannot read capture %s\n", g_capture);
+        return 1;
+    }
+    if (resolve_address() != 0 || (g_epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        fprintf(stderr, "invalid address\n");
+        return 1;
+    }
+
+    rec_reader_t reader;
+    rec_event_t event;
+    double recorded = 0;
+    if (rec_reader_open(&reader, g_capture) != 0) return 1;
+
+    double start = now_us();
+    while (rec_reader_next(&reader, &event) > 0) {
+        if (event.kind == REC_SEGMENT) continue;
+        recorded = event.time_us / 1e6;
+        if (g_speed > 0) {
+            // Replies are read while waiting for the next message
+            double due = start + event.time_us / g_speed, now;
+            while ((now = now_us()) < due) pump((int)((due - now + 999) / 1000));
+        }
+        pump(0);
+        replay_event(&event);
+    }
+    rec_reader_close(&reader);
+
+    double deadline = now_us() + g_timeout * 1e6, now;
+    while (g_outstanding > 0 && (now = now_us()) < deadline) pump((int)((deadline - now + 999) / 1000));
+    double elapsed = (now_us() - start) / 1e6;
+
+    for (size_t i = 0; i < g_conn_id_count * g_multiply; i++) {
+        if (g_conns[i].fd >= 0) close_conn((int)i);
+    }
+    print_results(stdout, elapsed, recorded);
+    if (g_output) {
+        FILE *out = fopen(g_output, "w");
+        if (!out) {
+            fprintf(stderr, "cannot write %s\n", g_output);
+            return 1;
+        }
+        print_results(out, elapsed, recorded);
+        fclose(out);
+    }
+    return g_request_count > 0 ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+
+// Free buffers are chained through their first bytes
+typedef struct free_buffer {
+    struct free_buffer *next;
+} free_buffer_t;
+
+typedef struct {
+    free_buffer_t *head;
+    int count;
+} size_class_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_class_t g_classes[BUFPOOL_CLASSES];
+static bufpool_stats_t g_stats;
+
+static size_t class_size(int index) {
+    return (size_t)BUFPOOL_MIN_SIZE << (2 * index);
+}
+
+// Smallest class that holds size bytes, or -1 if none does
+static int class_for(size_t size) {
+    for (int i = 0; i < BUFPOOL_CLASSES; i++) {
+        if (size <= class_size(i)) return i;
+    }
+    return -1;
+}
+
+void *bufpool_get(size_t size, size_t *capacity) {
+    int index = class_for(size);
+    void *buf = NULL;
+
+    pthread_mutex_lock(&g_lock);
+    g_stats.gets++;
+    if (index < 0) {
+        g_stats.oversized++;
+    } else if (g_classes[index].head) {
+        buf = g_classes[index].head;
+        g_classes[index].head = g_classes[index].head->next;
+        g_classes[index].count--;
+        g_stats.cached_bytes -= class_size(index);
+        g_stats.hits++;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    size_t cap = index < 0 ? size : class_size(index);
+    if (!buf) buf = malloc(cap);
+    if (buf && capacity) *capacity = cap;
+    return buf;
+}
+
+void bufpool_put(void *buf, size_t capacity) {
+    if (!buf) return;
+
+    int index = class_for(capacity);
+    if (index >= 0 && class_size(index) == capacity) {
+        pthread_mutex_lock(&g_lock);
+        if (g_classes[index].count < BUFPOOL_MAX_FREE) {
+            free_buffer_t *node = buf;
+            node->next = g_classes[index].head;
+            g_classes[index].head = node;
+            g_classes[index].count++;
+            g_stats.cached_bytes += capacity;
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&g_lock);
+    }
+    free(buf);
+}
+
+// Move the first `used` bytes into a buffer of at least `needed` bytes.
+// On failure the old buffer is left as it was and NULL is returned.
+void *bufpool_grow(void *buf, size_t used, size_t *capacity, size_t needed) {
+    if (buf && needed <= *capacity) return buf;
+
+    // Past the largest class buffers come at their exact size; doubling
+    // keeps a reply that keeps growing from being copied over and over
+    if (buf && class_for(needed) < 0 && needed < *capacity * 2) needed = *capacity * 2;
+
+    size_t new_capacity;
+    void *grown = bufpool_get(needed, &new_capacity);
+    if (!grown) return NULL;
+    if (buf) {
+        memcpy(grown, buf, used);
+        bufpool_put(buf, *capacity);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+// Release every cached buffer back to the system
+void bufpool_trim(void) {
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < BUFPOOL_CLASSES; i++) {
+        free_buffer_t *node = g_classes[i].head;
+        while (node) {
+            free_buffer_t *next = node->next;
+            free(node);
+            node = next;
+        }
+        g_classes[i].head = NULL;
+        g_classes[i].count = 0;
+    }
+    g_stats.cached_bytes = 0;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void bufpool_get_stats(bufpool_stats_t *stats) {
+    pthread_mutex_lock(&g_lock);
+    *stats = g_stats;
+    pthread_mutex_unlock(&g_lock);
+}
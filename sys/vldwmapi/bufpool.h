@@ -0,0 +1,27 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+// Constants
+#define BUFPOOL_MIN_SIZE 4096
+#define BUFPOOL_CLASSES 7           // 4 KiB .. 4 MiB, by powers of four
+#define BUFPOOL_MAX_FREE 32         // Cached buffers kept per class
+
+typedef struct {
+    unsigned long gets;
+    unsigned long hits;             // Served from a free list
+    unsigned long oversized;        // Bigger than the largest class
+    size_t cached_bytes;
+} bufpool_stats_t;
+
+// Size-classed buffers for socket I/O (thread-safe). Capacities are
+// rounded up to the class size; a buffer must be returned with the
+// capacity it was handed out with.
+void *bufpool_get(size_t size, size_t *capacity);
+void bufpool_put(void *buf, size_t capacity);
+void *bufpool_grow(void *buf, size_t used, size_t *capacity, size_t needed);
+void bufpool_trim(void);
+void bufpool_get_stats(bufpool_stats_t *stats);
+
+#endif // BUFPOOL_H
@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "cgroup.h"
+#include "metrics.h"
+
+typedef struct {
+    uint64_t session_id;
+    int killed;                         // cgroup.kill written; removed once empty
+    uint64_t sampled_ns;
+    cgroup_usage_t usage;
+} session_group_t;
+
+typedef struct {
+    uint32_t id;
+    uint64_t session_id;
+    pid_t pid;                          // Main process; 0 until it has started
+    int isolated;                       // Own app-<id> leaf, else the session's shared leaf
+    int running;
+    int pidfd;                          // Signals go through it; turns readable at exit. -1 without pidfds
+    char name[CGROUP_MAX_NAME];
+    uint64_t sampled_ns;
+    cgroup_usage_t usage;
+} app_group_t;
+
+static char g_base[PATH_MAX - 128];     // Empty when cgroup v2 is unavailable; leaves room for group names
+static session_group_t g_sessions[CGROUP_MAX_SESSIONS];
+static int g_session_count = 0;
+static app_group_t g_apps[CGROUP_MAX_APPS];
+static int g_app_count = 0;
+static uint32_t g_next_app = 1;
+static uint64_t g_next_sample = 0;
+static int g_stale_cleared = 0;
+
+static int read_file(const char *dir, const char *name, char *buf, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return 0;
+}
+
+static int write_file(const char *dir, const char *name, const char *value) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n < 0 ? -1 : 0;
+}
+
+// Value after "key " on its own line of a flat-keyed file
+static uint64_t keyed_value(const char *text, const char *key) {
+    size_t len = strlen(key);
+    for (const char *line = text; line && *line; line = strchr(line, '\n'), line = line ? line + 1 : NULL) {
+        if (strncmp(line, key, len) == 0 && line[len] == ' ') return strtoull(line + len + 1, NULL, 10);
+    }
+    return 0;
+}
+
+// Turn on whichever of the controllers we account with the parent offers
+static void enable_controllers(const char *dir) {
+    static const char *wanted[] = { "cpu", "memory", "io", "pids" };
+    char available[256], control[16];
+
+    if (read_file(dir, "cgroup.controllers", available, sizeof(available)) != 0) return;
+    for (size_t i = 0; i < sizeof(wanted) / sizeof(wanted[0]); i++) {
+        size_t len = strlen(wanted[i]);
+        for (const char *p = strstr(available, wanted[i]); p; p = strstr(p + len, wanted[i])) {
+            if ((p == available || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\n' || p[len] == '\0')) {
+                snprintf(control, sizeof(control), "+%s", wanted[i]);
+                write_file(dir, "cgroup.subtree_control", control);
+                break;
+            }
+        }
+    }
+}
+
+static int make_group(const char *dir) {
+    return mkdir(dir, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+static void session_path(uint64_t session_id, char *buf, size_t size) {
+    snprintf(buf, size, "%s/session-%llu", g_base, (unsigned long long)session_id);
+}
+
+static void app_path(const app_group_t *app, char *buf, size_t size) {
+    if (app->isolated) {
+        snprintf(buf, size, "%s/session-%llu/app-%u", g_base, (unsigned long long)app->session_id, app->id);
+    } else {
+        snprintf(buf, size, "%s/session-%llu/shared", g_base, (unsigned long long)app->session_id);
+    }
+}
+
+static int populated(const char *dir) {
+    char events[128];
+    if (read_file(dir, "cgroup.events", events, sizeof(events)) != 0) return 0;
+    return keyed_value(events, "populated") != 0;
+}
+
+// Remove a session directory and its leaves, deepest first; fails while
+// any process is left
+static int remove_tree(const char *dir) {
+    char child[PATH_MAX];
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_type != DT_DIR || entry->d_name[0] == '.') continue;
+            snprintf(child, sizeof(child), "%s/%s", dir, entry->d_name);
+            rmdir(child);
+        }
+        closedir(d);
+    }
+    return rmdir(dir);
+}
+
+static session_group_t *find_session(uint64_t session_id) {
+    for (int i = 0; i < g_session_count; i++) {
+        if (g_sessions[i].session_id == session_id) return &g_sessions[i];
+    }
+    return NULL;
+}
+
+// Session ids restart with the daemon, so groups left by an earlier run
+// (and not handed over by it) are removed when empty, or renamed out of the way while programs that
+// outlived it still run
+static void clear_stale_sessions(void) {
+    char path[PATH_MAX], renamed[PATH_MAX];
+    DIR *d = opendir(g_base);
+    if (!d) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_type != DT_DIR || strncmp(entry->d_name, "session-", 8) != 0) continue;
+        if (find_session(strtoull(entry->d_name + 8, NULL, 10))) continue;
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", g_base, entry->d_name) >= sizeof(path)) continue;
+        if (remove_tree(path) == 0) continue;
+        if ((size_t)snprintf(renamed, sizeof(renamed), "%s/stale-%d-%s", g_base, (int)getpid(),
+                             entry->d_name + 8) < sizeof(renamed)) {
+            rename(path, renamed);
+        }
+    }
+    closedir(d);
+}
+
+// Mount point of the unified hierarchy and the daemon's place in it
+static int find_hierarchy(char *mount, size_t mount_size, char *own, size_t own_size) {
+    char line[1024], dev[256], dir[PATH_MAX], type[64];
+    FILE *f = fopen("/proc/self/mounts", "re");
+    int found = 0;
+
+    if (!f) return -1;
+    while (!found && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%255s %4095s %63s", dev, dir, type) == 3 && strcmp(type, "cgroup2") == 0) {
+            snprintf(mount, mount_size, "%s", dir);
+            found = 1;
+        }
+    }
+    fclose(f);
+    if (!found || !(f = fopen("/proc/self/cgroup", "re"))) return -1;
+
+    found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(own, own_size, "%s", line + 3);
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+int init_cgroups(void) {
+    char mount[PATH_MAX], own[PATH_MAX], daemon[PATH_MAX + 16];
+
+    printf("📊 Initializing session cgroups...\n");
+    g_base[0] = '\0';
+    g_session_count = g_app_count = 0;
+    if (geteuid() != 0 || find_hierarchy(mount, sizeof(mount), own, sizeof(own)) != 0) {
+        printf("⚠️ No writable cgroup v2 hierarchy; resource accounting is off\n");
+        return 0;
+    }
+
+    int at_root = strcmp(own, "/") == 0;
+    int len = at_root ? snprintf(g_base, sizeof(g_base), "%s/%s", mount, CGROUP_BASE_NAME)
+                      : snprintf(g_base, sizeof(g_base), "%s%s", mount, own);
+    if (len < 0 || (size_t)len >= sizeof(g_base)) {
+        printf("⚠️ cgroup path too long; resource accounting is off\n");
+        g_base[0] = '\0';
+        return 0;
+    }
+
+    if (at_root) {
+        // At the root the daemon can stay where it is
+        enable_controllers(mount);
+    } else {
+        // A cgroup with controllers for its children may not hold
+        // processes itself, so the daemon moves into a leaf of its own.
+        // A binary started by an upgrade is already in it.
+        char *last = strrchr(g_base, '/');
+        if (last && strcmp(last + 1, CGROUP_DAEMON_NAME) == 0) *last = '\0';
+        snprintf(daemon, sizeof(daemon), "%s/%s", g_base, CGROUP_DAEMON_NAME);
+        if (make_group(daemon) != 0 || write_file(daemon, "cgroup.procs", "0") != 0) {
+            printf("⚠️ Could not move into %s: %s; resource accounting is off\n", daemon, strerror(errno));
+            g_base[0] = '\0';
+            return 0;
+        }
+    }
+    if (make_group(g_base) != 0) {
+        printf("⚠️ Could not create %s: %s; resource accounting is off\n", g_base, strerror(errno));
+        g_base[0] = '\0';
+        return 0;
+    }
+    enable_controllers(g_base);
+    g_stale_cleared = 0;
+    printf("📊 Session cgroups under %s\n", g_base);
+    return 0;
+}
+
+void cleanup_cgroups(void) {
+    char path[PATH_MAX];
+
+    printf("📊 Cleaning up session cgroups...\n");
+
+    // Running programs keep their groups; empty ones go
+    for (int i = 0; i < g_session_count && g_base[0]; i++) {
+        session_path(g_sessions[i].session_id, path, sizeof(path));
+        remove_tree(path);
+    }
+    g_session_count = g_app_count = 0;
+}
+
+int cgroup_available(void) {
+    return g_base[0] != '\0';
+}
+
+static app_group_t *find_app_by_pid(pid_t pid) {
+    for (int i = 0; i < g_app_count; i++) {
+        if (g_apps[i].pid == pid) return &g_apps[i];
+    }
+    return NULL;
+}
+
+static void remove_app(app_group_t *app) {
+    char path[PATH_MAX];
+    if (app->pidfd >= 0) close(app->pidfd);
+    if (app->isolated) {
+        app_path(app, path, sizeof(path));
+        rmdir(path);
+    }
+    *app = g_apps[--g_app_count];
+}
+
+// Create the group a program will start in. *path is the directory to
+// pass to the launcher, valid until the next call.
+int cgroup_create_app(uint64_t session_id, int isolated, const char *name, uint32_t *app_id, const char **path) {
+    static char dir[PATH_MAX];
+    session_group_t *session = find_session(session_id);
+
+    if (!g_base[0]) return -1;
+    if (g_app_count == CGROUP_MAX_APPS) return -1;
+    if (!session) {
+        if (g_session_count == CGROUP_MAX_SESSIONS) return -1;
+        session_path(session_id, dir, sizeof(dir));
+        if (make_group(dir) != 0) return -1;
+        enable_controllers(dir);
+        session = &g_sessions[g_session_count++];
+        memset(session, 0, sizeof(*session));
+        session->session_id = session_id;
+    }
+    session->killed = 0;
+
+    app_group_t *app = &g_apps[g_app_count];
+    memset(app, 0, sizeof(*app));
+    app->pidfd = -1;
+    app->id = g_next_app++;
+    app->session_id = session_id;
+    app->isolated = isolated;
+    snprintf(app->name, sizeof(app->name), "%s", name);
+    app_path(app, dir, sizeof(dir));
+    if (make_group(dir) != 0) return -1;
+
+    g_app_count++;
+    *app_id = app->id;
+    *path = dir;
+    return 0;
+}
+
+// Takes ownership of pidfd, which may be -1
+void cgroup_app_started(uint32_t app_id, pid_t pid, int pidfd) {
+    for (int i = 0; i < g_app_count; i++) {
+        if (g_apps[i].id == app_id) {
+            g_apps[i].pid = pid;
+            g_apps[i].pidfd = pidfd;
+            g_apps[i].running = 1;
+            return;
+        }
+    }
+    if (pidfd >= 0) close(pidfd);
+}
+
+void cgroup_app_failed(uint32_t app_id) {
+    for (int i = 0; i < g_app_count; i++) {
+        if (g_apps[i].id == app_id) {
+            remove_app(&g_apps[i]);
+            return;
+        }
+    }
+}
+
+// The main process is gone; an isolated group stays, and is accounted,
+// until whatever it forked has exited too
+void cgroup_app_exited(pid_t pid) {
+    app_group_t *app = find_app_by_pid(pid);
+    if (!app) return;
+    if (app->pidfd >= 0) close(app->pidfd);
+    app->pidfd = -1;
+    app->running = 0;
+    if (!app->isolated) remove_app(app);
+}
+
+static void kill_group(const char *dir) {
+    char procs[4096];
+
+    if (write_file(dir, "cgroup.kill", "1") == 0) return;
+
+    // Before Linux 5.14: signal the members one by one
+    if (read_file(dir, "cgroup.procs", procs, sizeof(procs)) != 0) return;
+    for (char *p = procs; *p; ) {
+        pid_t pid = (pid_t)strtol(p, &p, 10);
+        if (pid > 0) kill(pid, SIGKILL);
+        while (*p == '\n') p++;
+    }
+}
+
+// Signal a program started in this session. SIGKILL to an isolated
+// program takes its whole group, including anything it forked. Signals
+// go through the pidfd, so they never reach a process that took over
+// the pid; without pidfds (before Linux 5.3) the pid is still safe for
+// our own children, whose exits are reaped on the event loop.
+int cgroup_kill_app(uint64_t session_id, pid_t pid, int sig) {
+    char path[PATH_MAX];
+    app_group_t *app = find_app_by_pid(pid);
+
+    if (!app || app->session_id != session_id) return -ESRCH;
+    if (app->isolated && sig == SIGKILL) {
+        app_path(app, path, sizeof(path));
+        kill_group(path);
+        return 0;
+    }
+    if (!app->running) return -ESRCH;
+    if (app->pidfd >= 0) return syscall(SYS_pidfd_send_signal, app->pidfd, sig, NULL, 0) == 0 ? 0 : -errno;
+    return kill(pid, sig) == 0 ? 0 : -errno;
+}
+
+// On logout: end every program of the session at once
+void cgroup_kill_session(uint64_t session_id) {
+    char path[PATH_MAX];
+    session_group_t *session = find_session(session_id);
+
+    if (!session) return;
+    session_path(session_id, path, sizeof(path));
+    kill_group(path);
+    session->killed = 1;
+}
+
+static void read_usage(const char *dir, cgroup_usage_t *usage, uint64_t *sampled_ns, uint64_t now) {
+    char text[4096];
+    uint64_t previous = usage->cpu_usec;
+
+    if (read_file(dir, "cpu.stat", text, sizeof(text)) == 0) {
+        usage->cpu_usec = keyed_value(text, "usage_usec");
+    }
+    uint64_t elapsed_usec = *sampled_ns && now > *sampled_ns ? (now - *sampled_ns) / 1000 : 0;
+    if (elapsed_usec && usage->cpu_usec >= previous) {
+        usage->cpu_permille = (uint32_t)((usage->cpu_usec - previous) * 1000 / elapsed_usec);
+    }
+    *sampled_ns = now;
+
+    if (read_file(dir, "memory.current", text, sizeof(text)) == 0) {
+        usage->memory_bytes = strtoull(text, NULL, 10);
+    }
+    if (read_file(dir, "pids.current", text, sizeof(text)) == 0) {
+        usage->pids = (uint32_t)strtoul(text, NULL, 10);
+    }
+
+    // One line per device: "8:0 rbytes=... wbytes=... rios=..."
+    if (read_file(dir, "io.stat", text, sizeof(text)) == 0) {
+        usage->io_read_bytes = usage->io_write_bytes = 0;
+        for (const char *p = strstr(text, "rbytes="); p; p = strstr(p + 1, "rbytes=")) {
+            usage->io_read_bytes += strtoull(p + 7, NULL, 10);
+        }
+        for (const char *p = strstr(text, "wbytes="); p; p = strstr(p + 1, "wbytes=")) {
+            usage->io_write_bytes += strtoull(p + 7, NULL, 10);
+        }
+    }
+}
+
+// Called every loop wakeup; reads the counters every
+// CGROUP_SAMPLE_INTERVAL_MS and drops groups that have emptied
+void cgroup_sample(uint64_t now) {
+    char path[PATH_MAX];
+
+    if (!g_base[0] || now < g_next_sample) return;
+    g_next_sample = now + (uint64_t)CGROUP_SAMPLE_INTERVAL_MS * 1000000;
+
+    // Not at init: after an upgrade the groups handed over are known
+    // only once the state has been restored
+    if (!g_stale_cleared) {
+        clear_stale_sessions();
+        g_stale_cleared = 1;
+    }
+
+    // A pidfd turns readable when its process exits
+    for (int i = 0; i < g_app_count; i++) {
+        struct pollfd pfd = { g_apps[i].pidfd, POLLIN, 0 };
+        if (g_apps[i].pidfd >= 0 && poll(&pfd, 1, 0) == 1) {
+            close(g_apps[i].pidfd);
+            g_apps[i].pidfd = -1;
+            g_apps[i].running = 0;
+            if (!g_apps[i].isolated) remove_app(&g_apps[i--]);
+        }
+    }
+
+    for (int i = 0; i < g_app_count; i++) {
+        app_group_t *app = &g_apps[i];
+        if (!app->isolated || !app->pid) continue;
+        app_path(app, path, sizeof(path));
+        if (!app->running && !populated(path)) {
+            remove_app(app);
+            i--;
+            continue;
+        }
+        read_usage(path, &app->usage, &app->sampled_ns, now);
+    }
+
+    for (int i = 0; i < g_session_count; i++) {
+        session_group_t *session = &g_sessions[i];
+        session_path(session->session_id, path, sizeof(path));
+        if (session->killed && !populated(path)) {
+            int apps_left = 0;
+            for (int a = 0; a < g_app_count; a++) apps_left += g_apps[a].session_id == session->session_id;
+            if (!apps_left && remove_tree(path) == 0) {
+                g_sessions[i--] = g_sessions[--g_session_count];
+                continue;
+            }
+        }
+        read_usage(path, &session->usage, &session->sampled_ns, now);
+    }
+}
+
+static void write_usage_fields(json_writer_t *w, const cgroup_usage_t *usage) {
+    json_field_uint(w, "cpu_usec", usage->cpu_usec);
+    json_field_uint(w, "cpu_permille", usage->cpu_permille);
+    json_field_uint(w, "memory_bytes", usage->memory_bytes);
+    json_field_uint(w, "io_read_bytes", usage->io_read_bytes);
+    json_field_uint(w, "io_write_bytes", usage->io_write_bytes);
+    json_field_uint(w, "pids", usage->pids);
+}
+
+// The session's totals and one entry per program, as last sampled
+void cgroup_write_usage(json_writer_t *w, uint64_t session_id) {
+    session_group_t *session = find_session(session_id);
+    uint64_t now = metrics_now_ns();
+
+    json_begin_object(w);
+    json_field_bool(w, "available", g_base[0] != '\0');
+    json_field_uint(w, "interval_ms", CGROUP_SAMPLE_INTERVAL_MS);
+    json_key(w, "session");
+    if (session) {
+        json_begin_object(w);
+        write_usage_fields(w, &session->usage);
+        json_field_uint(w, "age_ms", session->sampled_ns ? (now - session->sampled_ns) / 1000000 : 0);
+        json_end_object(w);
+    } else {
+        json_write_null(w);
+    }
+
+    json_key(w, "apps");
+    json_begin_array(w);
+    for (int i = 0; i < g_app_count; i++) {
+        const app_group_t *app = &g_apps[i];
+        if (app->session_id != session_id || !app->pid) continue;
+        json_begin_object(w);
+        json_field_int(w, "pid", app->pid);
+        json_field_string(w, "name", app->name);
+        json_field_bool(w, "isolated", app->isolated);
+        json_field_bool(w, "running", app->running);
+        if (app->isolated) write_usage_fields(w, &app->usage);
+        json_end_object(w);
+    }
+    json_end_array(w);
+    json_end_object(w);
+}
+
+// Groups carried across a binary upgrade. The pidfd of each running
+// program is appended to fds (room for CGROUP_MAX_APPS) and goes along,
+// so signals never fall back to a pid that may have been reused.
+// Returns how many were appended.
+int cgroup_save_state(upgrade_buf_t *buf, int *fds) {
+    int count = 0;
+
+    upgrade_put(buf, &g_next_app, sizeof(g_next_app));
+    upgrade_put(buf, &g_session_count, sizeof(g_session_count));
+    upgrade_put(buf, g_sessions, g_session_count * sizeof(session_group_t));
+    upgrade_put(buf, &g_app_count, sizeof(g_app_count));
+    upgrade_put(buf, g_apps, g_app_count * sizeof(app_group_t));
+    for (int i = 0; i < g_app_count; i++) {
+        if (g_apps[i].running && g_apps[i].pidfd >= 0) fds[count++] = g_apps[i].pidfd;
+    }
+    return count;
+}
+
+// fds are the pidfds cgroup_save_state() appended, in the same order
+int cgroup_restore_state(upgrade_reader_t *reader, const int *fds, int fd_count) {
+    int sessions, apps, used = 0;
+
+    upgrade_get(reader, &g_next_app, sizeof(g_next_app));
+    if (upgrade_get(reader, &sessions, sizeof(sessions)) != 0 || sessions < 0 || sessions > CGROUP_MAX_SESSIONS ||
+        upgrade_get(reader, g_sessions, sessions * sizeof(session_group_t)) != 0 ||
+        upgrade_get(reader, &apps, sizeof(apps)) != 0 || apps < 0 || apps > CGROUP_MAX_APPS ||
+        upgrade_get(reader, g_apps, apps * sizeof(app_group_t)) != 0) {
+        g_session_count = g_app_count = 0;
+        return -1;
+    }
+    for (int i = 0; i < apps; i++) {
+        if (g_apps[i].running && g_apps[i].pidfd >= 0) used++;
+    }
+    if (used != fd_count) {
+        g_session_count = g_app_count = 0;
+        return -1;
+    }
+    g_session_count = sessions;
+    g_app_count = apps;
+
+    used = 0;
+    for (int i = 0; i < g_app_count; i++) {
+        app_group_t *app = &g_apps[i];
+        if (app->running && app->pidfd >= 0) app->pidfd = fds[used++];
+        else app->pidfd = -1;
+        if (!app->running && !app->isolated) remove_app(&g_apps[i--]);
+    }
+    return 0;
+}
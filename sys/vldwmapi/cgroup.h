@@ -0,0 +1,46 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "jsonwriter.h"
+#include "upgrade.h"
+
+// Constants
+#define CGROUP_BASE_NAME "vldwmapi"             // Created under the root cgroup
+#define CGROUP_DAEMON_NAME "daemon"             // Leaf the daemon moves into when not at the root
+#define CGROUP_MAX_APPS 256                     // Launched programs tracked for accounting
+#define CGROUP_MAX_SESSIONS 64
+#define CGROUP_SAMPLE_INTERVAL_MS 2000
+#define CGROUP_MAX_NAME 64
+
+// Resource usage of one cgroup at the last sample
+typedef struct {
+    uint64_t cpu_usec;
+    uint32_t cpu_permille;              // Of one CPU, over the last interval
+    uint64_t memory_bytes;
+    uint64_t io_read_bytes;
+    uint64_t io_write_bytes;
+    uint32_t pids;
+} cgroup_usage_t;
+
+// Session and app cgroups. Each session gets session-<id> under the
+// base; launched programs get an app-<n> leaf of their own, or share the
+// session's "shared" leaf. Everything runs on the event loop.
+// init_cgroups() must run before the launch helper is started so that
+// it leaves the cgroup the daemon vacates.
+int init_cgroups(void);
+void cleanup_cgroups(void);
+int cgroup_available(void);
+int cgroup_create_app(uint64_t session_id, int isolated, const char *name, uint32_t *app, const char **path);
+void cgroup_app_started(uint32_t app, pid_t pid, int pidfd);
+void cgroup_app_failed(uint32_t app);
+void cgroup_app_exited(pid_t pid);
+int cgroup_kill_app(uint64_t session_id, pid_t pid, int sig);
+void cgroup_kill_session(uint64_t session_id);
+void cgroup_sample(uint64_t now);
+void cgroup_write_usage(json_writer_t *w, uint64_t session_id);
+int cgroup_save_state(upgrade_buf_t *buf, int *fds);
+int cgroup_restore_state(upgrade_reader_t *reader, const int *fds, int fd_count);
+
+#endif // CGROUP_H
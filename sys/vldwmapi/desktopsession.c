@@ -1,10 +1,18 @@
 #include "desktopsession.h"
+#include "metaio.h"
+#include "nsscache.h"
+#include "trace.h"
 
 static desktop_session_t active_sessions[MAX_SESSIONS];
 static int session_count = 0;
+static uint64_t next_session_id = 1;
 
 int init_desktop_session(void) {
     printf("🖥️  Initializing desktop session manager...\n");
+    // With TZ unset glibc re-reads /etc/localtime on every localtime_r()
+    // call; pin it once so listings don't pay for that per entry
+    setenv("TZ", ":/etc/localtime", 0);
+    tzset();
     memset(active_sessions, 0, sizeof(active_sessions));
     session_count = 0;
     return 0;
@@ -20,8 +28,16 @@ int start_desktop_session(const char *username) {
         return -1; // Too many sessions
     }
     
+    nss_user_t user;
+    if (nss_get_user_by_name(username, &user) != 0) {
+        return -1; // Unknown user
+    }
+    
     desktop_session_t *session = &active_sessions[session_count];
+    memset(session, 0, sizeof(*session));
     strncpy(session->username, username, sizeof(session->username) - 1);
+    session->uid = user.uid;
+    session->session_id = next_session_id++;
     session->session_pid = getpid(); // In real implementation, this would be the session process
     session->state = SESSION_ACTIVE;
     session->start_time = time(NULL);
@@ -32,6 +48,7 @@ int start_desktop_session(const char *username) {
     return 0;
 }
 
+// Removing the session also revokes every session token bound to its id
 int stop_desktop_session(const char *username) {
     for (int i = 0; i < session_count; i++) {
         if (strcmp(active_sessions[i].username, username) == 0) {
@@ -82,74 +99,211 @@ int get_session_info(const char *username, desktop_session_t *session) {
     return -1;
 }
 
-json_object *list_directory(const char *path) {
-    DIR *dir;
-    struct dirent *entry;
-    struct stat file_stat;
+int get_session_by_id(uint64_t session_id, desktop_session_t *session) {
+    for (int i = 0; i < session_count; i++) {
+        if (active_sessions[i].session_id == session_id) {
+            *session = active_sessions[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Sessions carried across a binary upgrade
+void desktop_session_save_state(upgrade_buf_t *buf) {
+    upgrade_put(buf, &next_session_id, sizeof(next_session_id));
+    upgrade_put(buf, &session_count, sizeof(session_count));
+    upgrade_put(buf, active_sessions, session_count * sizeof(desktop_session_t));
+}
+
+int desktop_session_restore_state(upgrade_reader_t *reader) {
+    int count;
+    upgrade_get(reader, &next_session_id, sizeof(next_session_id));
+    if (upgrade_get(reader, &count, sizeof(count)) != 0 || count < 0 || count > MAX_SESSIONS) return -1;
+    if (upgrade_get(reader, active_sessions, count * sizeof(desktop_session_t)) != 0) return -1;
+    session_count = count;
+    return 0;
+}
+
+// Directories are read with getdents64 into an arena buffer; opendir()
+// would malloc a DIR and its buffer for every listing
+typedef struct {
+    int fd;
+    char *buf;
+    ssize_t len;
+    ssize_t pos;
+} dir_scan_t;
+
+static int dir_scan_open(dir_scan_t *scan, arena_t *arena, const char *path) {
+    scan->buf = arena_alloc(arena, DIR_SCAN_BUFFER_SIZE);
+    scan->len = scan->pos = 0;
+    scan->fd = scan->buf ? open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    return scan->fd >= 0 ? 0 : -1;
+}
+
+// Next entry other than . and .., or NULL at the end
+static const struct dirent64 *dir_scan_next(dir_scan_t *scan) {
+    for (;;) {
+        if (scan->pos >= scan->len) {
+            scan->len = getdents64(scan->fd, scan->buf, DIR_SCAN_BUFFER_SIZE);
+            scan->pos = 0;
+            if (scan->len <= 0) return NULL;
+        }
+        const struct dirent64 *entry = (const struct dirent64 *)(scan->buf + scan->pos);
+        scan->pos += entry->d_reclen;
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            return entry;
+        }
+    }
+}
+
+static void dir_scan_close(dir_scan_t *scan) {
+    if (scan->fd >= 0) close(scan->fd);
+    scan->fd = -1;
+}
+
+// Arena arrays grow by copying into a fresh block; the old one is
+// reclaimed with the rest of the request
+static void *grow_array(arena_t *arena, void *items, size_t count, size_t *cap, size_t elem_size) {
+    if (count < *cap) return items;
+    size_t next = *cap ? *cap * 2 : 64;
+    void *grown = arena_alloc(arena, next * elem_size);
+    if (!grown) return NULL;
+    if (count) memcpy(grown, items, count * elem_size);
+    *cap = next;
+    return grown;
+}
+
+// Read a small /proc file into buf as a C string
+static ssize_t read_small_file(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0) return -1;
+    buf[len] = '\0';
+    return len;
+}
+
+// Write the entries of a directory as a JSON array. All names are read
+// first so the metadata engine can have their stats in flight together,
+// and so all owner names can be resolved in one batch before anything is
+// written. Temporaries come from the request arena.
+int list_directory(arena_t *arena, json_writer_t *w, const char *path) {
+    dir_scan_t scan;
+    const struct dirent64 *entry;
     char full_path[MAX_PATH_LEN];
+    char size_text[FORMAT_BUFFER_SIZE], time_text[FORMAT_BUFFER_SIZE], mode_text[FORMAT_BUFFER_SIZE];
+    meta_stat_t *rows = NULL;
+    size_t count = 0, cap = 0;
+    nss_batch_t owners;
     
     if (!is_valid_path(path)) {
-        return NULL;
+        return -1;
     }
     
-    dir = opendir(path);
-    if (!dir) {
-        return NULL;
+    if (dir_scan_open(&scan, arena, path) != 0) {
+        return -1;
     }
     
-    json_object *files_array = json_object_new_array();
+    nss_batch_init(&owners);
     
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and .. entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
+    uint64_t span = trace_begin();
+    while ((entry = dir_scan_next(&scan)) != NULL) {
+        meta_stat_t *grown = grow_array(arena, rows, count, &cap, sizeof(meta_stat_t));
+        const char *name = arena_strndup(arena, entry->d_name, strlen(entry->d_name));
+        if (!grown || !name) break;
         
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+        rows = grown;
+        rows[count++].name = name;
+    }
+    trace_end("dir_scan", span, count);
+    
+    span = trace_begin();
+    metaio_stat(scan.fd, rows, count);
+    dir_scan_close(&scan);
+    
+    // Entries gone or unreadable since the scan are left out
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (rows[i].error) continue;
+        rows[kept++] = rows[i];
+        nss_batch_add(&owners, rows[i].st.st_uid, rows[i].st.st_gid);
+    }
+    count = kept;
+    trace_end("stat", span, count);
+    
+    span = trace_begin();
+    nss_batch_resolve(&owners);
+    trace_end("nss_resolve", span, owners.uid_count + owners.gid_count);
+    
+    span = trace_begin();
+    size_t path_len = strlen(path);
+    memcpy(full_path, path, path_len);
+    full_path[path_len++] = '/';
+    
+    json_begin_array(w);
+    for (size_t i = 0; i < count; i++) {
+        const meta_stat_t *row = &rows[i];
+        size_t name_len = strlen(row->name);
+        size_t full_len = path_len + name_len;
+        if (full_len > sizeof(full_path)) full_len = sizeof(full_path);
+        memcpy(full_path + path_len, row->name, full_len - path_len);
         
-        if (stat(full_path, &file_stat) == 0) {
-            json_object *file_obj = json_object_new_object();
-            json_object_object_add(file_obj, "name", json_object_new_string(entry->d_name));
-            json_object_object_add(file_obj, "path", json_object_new_string(full_path));
-            json_object_object_add(file_obj, "is_directory", json_object_new_boolean(S_ISDIR(file_stat.st_mode)));
-            json_object_object_add(file_obj, "size", json_object_new_int64(file_stat.st_size));
-            json_object_object_add(file_obj, "size_formatted", json_object_new_string(format_file_size(file_stat.st_size)));
-            json_object_object_add(file_obj, "modified_time", json_object_new_int64(file_stat.st_mtime));
-            json_object_object_add(file_obj, "modified_formatted", json_object_new_string(format_time(file_stat.st_mtime)));
-            json_object_object_add(file_obj, "permissions", json_object_new_string(format_permissions(file_stat.st_mode)));
-            json_object_object_add(file_obj, "owner_uid", json_object_new_int(file_stat.st_uid));
-            json_object_object_add(file_obj, "owner_gid", json_object_new_int(file_stat.st_gid));
-            
-            json_object_array_add(files_array, file_obj);
-        }
+        json_begin_object(w);
+        json_key(w, "name");
+        json_write_string_len(w, row->name, name_len);
+        json_key(w, "path");
+        json_write_string_len(w, full_path, full_len);
+        json_field_bool(w, "is_directory", S_ISDIR(row->st.st_mode));
+        json_field_int(w, "size", row->st.st_size);
+        json_field_string(w, "size_formatted", format_file_size(row->st.st_size, size_text, sizeof(size_text)));
+        json_field_int(w, "modified_time", row->st.st_mtime);
+        json_field_string(w, "modified_formatted", format_time(row->st.st_mtime, time_text, sizeof(time_text)));
+        json_field_string(w, "permissions", format_permissions(row->st.st_mode, mode_text, sizeof(mode_text)));
+        json_field_uint(w, "owner_uid", row->st.st_uid);
+        json_field_uint(w, "owner_gid", row->st.st_gid);
+        json_field_string(w, "owner", nss_batch_user(&owners, row->st.st_uid));
+        json_field_string(w, "group", nss_batch_group(&owners, row->st.st_gid));
+        json_end_object(w);
     }
+    json_end_array(w);
+    trace_end("serialize", span, count);
     
-    closedir(dir);
-    return files_array;
+    return 0;
 }
 
-json_object *get_file_info(const char *path) {
+int get_file_info(json_writer_t *w, const char *path) {
     struct stat file_stat;
+    char size_text[FORMAT_BUFFER_SIZE], mode_text[FORMAT_BUFFER_SIZE];
+    nss_batch_t owners;
     
     if (!is_valid_path(path) || stat(path, &file_stat) != 0) {
-        return NULL;
+        return -1;
     }
     
-    json_object *file_obj = json_object_new_object();
-    json_object_object_add(file_obj, "path", json_object_new_string(path));
-    json_object_object_add(file_obj, "is_directory", json_object_new_boolean(S_ISDIR(file_stat.st_mode)));
-    json_object_object_add(file_obj, "is_regular_file", json_object_new_boolean(S_ISREG(file_stat.st_mode)));
-    json_object_object_add(file_obj, "is_symlink", json_object_new_boolean(S_ISLNK(file_stat.st_mode)));
-    json_object_object_add(file_obj, "size", json_object_new_int64(file_stat.st_size));
-    json_object_object_add(file_obj, "size_formatted", json_object_new_string(format_file_size(file_stat.st_size)));
-    json_object_object_add(file_obj, "access_time", json_object_new_int64(file_stat.st_atime));
-    json_object_object_add(file_obj, "modified_time", json_object_new_int64(file_stat.st_mtime));
-    json_object_object_add(file_obj, "change_time", json_object_new_int64(file_stat.st_ctime));
-    json_object_object_add(file_obj, "permissions", json_object_new_string(format_permissions(file_stat.st_mode)));
-    json_object_object_add(file_obj, "owner_uid", json_object_new_int(file_stat.st_uid));
-    json_object_object_add(file_obj, "owner_gid", json_object_new_int(file_stat.st_gid));
+    nss_batch_init(&owners);
+    nss_batch_add(&owners, file_stat.st_uid, file_stat.st_gid);
+    nss_batch_resolve(&owners);
+    
+    json_begin_object(w);
+    json_field_string(w, "path", path);
+    json_field_bool(w, "is_directory", S_ISDIR(file_stat.st_mode));
+    json_field_bool(w, "is_regular_file", S_ISREG(file_stat.st_mode));
+    json_field_bool(w, "is_symlink", S_ISLNK(file_stat.st_mode));
+    json_field_int(w, "size", file_stat.st_size);
+    json_field_string(w, "size_formatted", format_file_size(file_stat.st_size, size_text, sizeof(size_text)));
+    json_field_int(w, "access_time", file_stat.st_atime);
+    json_field_int(w, "modified_time", file_stat.st_mtime);
+    json_field_int(w, "change_time", file_stat.st_ctime);
+    json_field_string(w, "permissions", format_permissions(file_stat.st_mode, mode_text, sizeof(mode_text)));
+    json_field_uint(w, "owner_uid", file_stat.st_uid);
+    json_field_uint(w, "owner_gid", file_stat.st_gid);
+    json_field_string(w, "owner", nss_batch_user(&owners, file_stat.st_uid));
+    json_field_string(w, "group", nss_batch_group(&owners, file_stat.st_gid));
+    json_end_object(w);
     
-    return file_obj;
+    return 0;
 }
 
 int create_directory(const char *path, mode_t mode) {
@@ -227,95 +381,144 @@ int change_owner(const char *path, uid_t uid, gid_t gid) {
     return chown(path, uid, gid);
 }
 
-json_object *get_system_status(void) {
+void get_system_status(json_writer_t *w) {
     struct sysinfo info;
-    FILE *loadavg_file, *meminfo_file;
-    char line[256];
+    char text[4096];
     
-    json_object *status_obj = json_object_new_object();
+    json_begin_object(w);
     
     // Get system info
     if (sysinfo(&info) == 0) {
-        json_object_object_add(status_obj, "uptime", json_object_new_int64(info.uptime));
-        json_object_object_add(status_obj, "total_memory", json_object_new_int64(info.totalram * info.mem_unit));
-        json_object_object_add(status_obj, "free_memory", json_object_new_int64(info.freeram * info.mem_unit));
-        json_object_object_add(status_obj, "used_memory", json_object_new_int64((info.totalram - info.freeram) * info.mem_unit));
-        json_object_object_add(status_obj, "process_count", json_object_new_int(info.procs));
+        json_field_uint(w, "uptime", info.uptime);
+        json_field_uint(w, "total_memory", (uint64_t)info.totalram * info.mem_unit);
+        json_field_uint(w, "free_memory", (uint64_t)info.freeram * info.mem_unit);
+        json_field_uint(w, "used_memory", (uint64_t)(info.totalram - info.freeram) * info.mem_unit);
+        json_field_uint(w, "process_count", info.procs);
     }
     
     // Get load average
-    loadavg_file = fopen("/proc/loadavg", "r");
-    if (loadavg_file) {
+    if (read_small_file("/proc/loadavg", text, sizeof(text)) > 0) {
         float load1, load5, load15;
-        if (fscanf(loadavg_file, "%f %f %f", &load1, &load5, &load15) == 3) {
-            json_object *load_array = json_object_new_array();
-            json_object_array_add(load_array, json_object_new_double(load1));
-            json_object_array_add(load_array, json_object_new_double(load5));
-            json_object_array_add(load_array, json_object_new_double(load15));
-            json_object_object_add(status_obj, "load_average", load_array);
+        if (sscanf(text, "%f %f %f", &load1, &load5, &load15) == 3) {
+            json_key(w, "load_average");
+            json_begin_array(w);
+            json_write_fixed(w, load1, 2);
+            json_write_fixed(w, load5, 2);
+            json_write_fixed(w, load15, 2);
+            json_end_array(w);
         }
-        fclose(loadavg_file);
     }
     
     // Get detailed memory info
-    meminfo_file = fopen("/proc/meminfo", "r");
-    if (meminfo_file) {
+    if (read_small_file("/proc/meminfo", text, sizeof(text)) > 0) {
         long cached = 0, buffers = 0;
-        while (fgets(line, sizeof(line), meminfo_file)) {
-            if (strncmp(line, "Cached:", 7) == 0) {
-                sscanf(line, "Cached: %ld kB", &cached);
-            } else if (strncmp(line, "Buffers:", 8) == 0) {
-                sscanf(line, "Buffers: %ld kB", &buffers);
-            }
-        }
-        json_object_object_add(status_obj, "cached_memory", json_object_new_int64((cached + buffers) * 1024));
-        fclose(meminfo_file);
+        const char *line = strstr(text, "\nCached:");
+        if (line) sscanf(line, "\nCached: %ld kB", &cached);
+        line = strstr(text, "\nBuffers:");
+        if (line) sscanf(line, "\nBuffers: %ld kB", &buffers);
+        json_field_int(w, "cached_memory", (int64_t)(cached + buffers) * 1024);
     }
     
-    return status_obj;
+    json_end_object(w);
 }
 
-json_object *get_process_list(void) {
-    DIR *proc_dir;
-    struct dirent *entry;
-    char path[256], line[256];
-    FILE *stat_file;
-    
-    json_object *processes_array = json_object_new_array();
+typedef struct {
+    int pid;
+    int ppid;
+    char state;
+    char name[64];
+    unsigned long cpu_time;
+    int has_owner;
+    uid_t uid;
+    gid_t gid;
+} proc_row_t;
+
+// Parse /proc/<pid>/stat. The command name is everything between the
+// first '(' and the last ')', since it may itself contain both.
+static int parse_proc_stat(const char *text, proc_row_t *row) {
+    const char *open = strchr(text, '(');
+    const char *close = strrchr(text, ')');
+    unsigned long utime = 0, stime = 0;
+    
+    if (!open || !close || close < open || sscanf(text, "%d", &row->pid) != 1) {
+        return -1;
+    }
     
-    proc_dir = opendir("/proc");
-    if (!proc_dir) return processes_array;
+    size_t name_len = close - open + 1;
+    if (name_len >= sizeof(row->name)) name_len = sizeof(row->name) - 1;
+    memcpy(row->name, open, name_len);
+    row->name[name_len] = '\0';
     
-    while ((entry = readdir(proc_dir)) != NULL) {
-        // Check if directory name is a number (PID)
-        if (strspn(entry->d_name, "0123456789") != strlen(entry->d_name)) {
-            continue;
-        }
-        
-        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
-        stat_file = fopen(path, "r");
-        if (stat_file) {
-            int pid, ppid;
-            char comm[256], state;
-            unsigned long utime, stime;
+    if (sscanf(close + 1, " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &row->state, &row->ppid, &utime, &stime) < 2) {
+        return -1;
+    }
+    row->cpu_time = utime + stime;
+    return 0;
+}
+
+void get_process_list(arena_t *arena, json_writer_t *w) {
+    dir_scan_t scan;
+    const struct dirent64 *entry;
+    char path[64], text[1024];
+    struct stat proc_stat;
+    proc_row_t *rows = NULL;
+    size_t count = 0, cap = 0;
+    nss_batch_t owners;
+    
+    nss_batch_init(&owners);
+    
+    if (dir_scan_open(&scan, arena, "/proc") == 0) {
+        while ((entry = dir_scan_next(&scan)) != NULL) {
+            // Check if directory name is a number (PID)
+            size_t name_len = strlen(entry->d_name);
+            if (name_len > 20 || strspn(entry->d_name, "0123456789") != name_len) {
+                continue;
+            }
             
-            if (fscanf(stat_file, "%d %s %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
-                      &pid, comm, &state, &ppid, &utime, &stime) >= 4) {
-                json_object *process_obj = json_object_new_object();
-                json_object_object_add(process_obj, "pid", json_object_new_int(pid));
-                json_object_object_add(process_obj, "ppid", json_object_new_int(ppid));
-                json_object_object_add(process_obj, "name", json_object_new_string(comm));
-                json_object_object_add(process_obj, "state", json_object_new_string(&state));
-                json_object_object_add(process_obj, "cpu_time", json_object_new_int64(utime + stime));
-                
-                json_object_array_add(processes_array, process_obj);
+            proc_row_t row;
+            memset(&row, 0, sizeof(row));
+            snprintf(path, sizeof(path), "/proc/%.20s/stat", entry->d_name);
+            if (read_small_file(path, text, sizeof(text)) <= 0 || parse_proc_stat(text, &row) != 0) {
+                continue;
             }
-            fclose(stat_file);
+            
+            // /proc/<pid> is owned by the process's effective uid and gid
+            if (fstatat(scan.fd, entry->d_name, &proc_stat, 0) == 0) {
+                row.has_owner = 1;
+                row.uid = proc_stat.st_uid;
+                row.gid = proc_stat.st_gid;
+                nss_batch_add(&owners, row.uid, row.gid);
+            }
+            
+            proc_row_t *grown = grow_array(arena, rows, count, &cap, sizeof(proc_row_t));
+            if (!grown) break;
+            rows = grown;
+            rows[count++] = row;
         }
+        dir_scan_close(&scan);
     }
     
-    closedir(proc_dir);
-    return processes_array;
+    nss_batch_resolve(&owners);
+    
+    json_begin_array(w);
+    for (size_t i = 0; i < count; i++) {
+        json_begin_object(w);
+        json_field_int(w, "pid", rows[i].pid);
+        json_field_int(w, "ppid", rows[i].ppid);
+        json_field_string(w, "name", rows[i].name);
+        json_key(w, "state");
+        json_write_string_len(w, &rows[i].state, 1);
+        json_field_uint(w, "cpu_time", rows[i].cpu_time);
+        if (rows[i].has_owner) {
+            json_field_uint(w, "uid", rows[i].uid);
+            json_field_uint(w, "gid", rows[i].gid);
+            json_field_string(w, "user", nss_batch_user(&owners, rows[i].uid));
+            json_field_string(w, "group", nss_batch_group(&owners, rows[i].gid));
+        }
+        json_end_object(w);
+    }
+    json_end_array(w);
 }
 
 json_object *get_disk_usage(const char *path) {
@@ -379,9 +582,9 @@ int kill_process(pid_t pid, int signal) {
 }
 
 char *get_home_directory(const char *username) {
-    struct passwd *pwd = getpwnam(username);
-    if (pwd) {
-        return strdup(pwd->pw_dir);
+    nss_user_t user;
+    if (nss_get_user_by_name(username, &user) == 0) {
+        return strdup(user.home);
     }
     return NULL;
 }
@@ -399,8 +602,9 @@ int is_valid_path(const char *path) {
     return 1;
 }
 
-char *format_file_size(off_t size) {
-    static char buffer[64];
+// The format_* helpers write into a caller-supplied buffer (at least
+// FORMAT_BUFFER_SIZE bytes) and return it
+char *format_file_size(off_t size, char *buffer, size_t len) {
     const char *units[] = {"B", "KB", "MB", "GB", "TB"};
     int unit = 0;
     double dsize = size;
@@ -411,16 +615,19 @@ char *format_file_size(off_t size) {
     }
     
     if (unit == 0) {
-        snprintf(buffer, sizeof(buffer), "%.0f %s", dsize, units[unit]);
+        snprintf(buffer, len, "%.0f %s", dsize, units[unit]);
     } else {
-        snprintf(buffer, sizeof(buffer), "%.1f %s", dsize, units[unit]);
+        snprintf(buffer, len, "%.1f %s", dsize, units[unit]);
     }
     
     return buffer;
 }
 
-char *format_permissions(mode_t mode) {
-    static char buffer[12];
+char *format_permissions(mode_t mode, char *buffer, size_t len) {
+    if (len < 11) {
+        if (len) buffer[0] = '\0';
+        return buffer;
+    }
     
     buffer[0] = S_ISDIR(mode) ? 'd' : (S_ISLNK(mode) ? 'l' : '-');
     buffer[1] = (mode & S_IRUSR) ? 'r' : '-';
@@ -437,9 +644,10 @@ char *format_permissions(mode_t mode) {
     return buffer;
 }
 
-char *format_time(time_t time) {
-    static char buffer[64];
-    struct tm *tm_info = localtime(&time);
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", tm_info);
+char *format_time(time_t time, char *buffer, size_t len) {
+    struct tm tm_info;
+    if (!localtime_r(&time, &tm_info) || strftime(buffer, len, "%Y-%m-%d %H:%M:%S", &tm_info) == 0) {
+        if (len) buffer[0] = '\0';
+    }
     return buffer;
-}
\ No newline at end of file
+}
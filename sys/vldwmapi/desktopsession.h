@@ -3,22 +3,31 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/sysinfo.h>
+#include <sys/statvfs.h>
 #include <pwd.h>
 #include <grp.h>
 #include <time.h>
+#include <signal.h>
 #include <json-c/json.h>
+#include "jsonwriter.h"
+#include "arena.h"
+#include "upgrade.h"
 
 // Constants
 #define MAX_PATH_LEN 4096
 #define MAX_SESSIONS 64
 #define MAX_PROCESSES 1024
+#define FORMAT_BUFFER_SIZE 64
+#define DIR_SCAN_BUFFER_SIZE (32 * 1024)
 #define SESSION_ACTIVE 1
 #define SESSION_INACTIVE 0
 #define SESSION_LOCKED 2
@@ -26,6 +35,8 @@
 // Structures
 typedef struct {
     char username[256];
+    uid_t uid;
+    uint64_t session_id;        // Unique per start; session tokens bind to it
     pid_t session_pid;
     int state;
     time_t start_time;
@@ -64,10 +75,13 @@ int get_active_sessions(desktop_session_t *sessions, int max_sessions);
 int lock_session(const char *username);
 int unlock_session(const char *username);
 int get_session_info(const char *username, desktop_session_t *session);
+int get_session_by_id(uint64_t session_id, desktop_session_t *session);
+void desktop_session_save_state(upgrade_buf_t *buf);
+int desktop_session_restore_state(upgrade_reader_t *reader);
 
 // Directory and file system operations
-json_object *list_directory(const char *path);
-json_object *get_file_info(const char *path);
+int list_directory(arena_t *arena, json_writer_t *w, const char *path);
+int get_file_info(json_writer_t *w, const char *path);
 int create_directory(const char *path, mode_t mode);
 int delete_file(const char *path);
 int copy_file(const char *src, const char *dest);
@@ -76,8 +90,8 @@ int change_permissions(const char *path, mode_t mode);
 int change_owner(const char *path, uid_t uid, gid_t gid);
 
 // System status and monitoring
-json_object *get_system_status(void);
-json_object *get_process_list(void);
+void get_system_status(json_writer_t *w);
+void get_process_list(arena_t *arena, json_writer_t *w);
 json_object *get_disk_usage(const char *path);
 json_object *get_network_interfaces(void);
 int kill_process(pid_t pid, int signal);
@@ -85,8 +99,8 @@ int kill_process(pid_t pid, int signal);
 // Utility functions
 char *get_home_directory(const char *username);
 int is_valid_path(const char *path);
-char *format_file_size(off_t size);
-char *format_permissions(mode_t mode);
-char *format_time(time_t time);
+char *format_file_size(off_t size, char *buffer, size_t len);
+char *format_permissions(mode_t mode, char *buffer, size_t len);
+char *format_time(time_t time, char *buffer, size_t len);
 
 #endif // DESKTOPSESSION_H
\ No newline at end of file
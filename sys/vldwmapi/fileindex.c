@@ -0,0 +1,1035 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "fileindex.h"
+#include "metrics.h"
+#include "usercred.h"
+
+#define NO_ENTRY UINT32_MAX
+#define SLOT_EMPTY UINT32_MAX
+#define SLOT_TOMBSTONE (UINT32_MAX - 1)
+#define CRAWL_BATCH 256
+#define INDEX_FILE_MAGIC "VLDWMIDX"
+#define INDEX_FILE_VERSION 1
+#define ACCESS_SLOTS 1024               // Parent directories one search remembers; a power of two
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+enum {
+    ENTRY_DIR = 1,
+    ENTRY_DELETED = 2,
+    ENTRY_SEEN = 4                  // Found by the running full crawl
+};
+
+// One file or directory. Roots have no parent and keep their full path
+// as the name; everything else stores its last component only.
+typedef struct {
+    uint32_t parent;
+    uint32_t name;                  // Offset into the name pool
+    uint16_t name_len;
+    uint8_t flags;
+    uint8_t depth;
+} entry_t;
+
+// Entries whose name contains one trigram, as varint deltas of
+// ascending entry ids
+typedef struct {
+    uint32_t key;                   // Three lowercased bytes
+    uint32_t count;
+    uint32_t last;
+    uint32_t len;
+    uint32_t cap;
+    uint8_t *data;
+} posting_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t names_len;
+} index_file_header_t;
+
+typedef struct {
+    int score;
+    uint32_t id;
+} hit_t;
+
+// Everything below is guarded by g_lock: crawl threads and inotify
+// events write, queries read
+static pthread_rwlock_t g_lock = PTHREAD_RWLOCK_INITIALIZER;
+static entry_t *g_entries = NULL;
+static uint32_t g_entry_count = 0, g_entry_cap = 0, g_deleted = 0;
+static char *g_names = NULL;
+static size_t g_names_len = 0, g_names_cap = 0;
+static uint32_t *g_children = NULL;             // (parent, name) -> entry
+static uint32_t g_children_cap = 0, g_children_used = 0;
+static posting_t *g_postings = NULL;
+static uint32_t g_posting_count = 0, g_posting_cap = 0;
+static uint32_t *g_trigrams = NULL;             // key -> posting
+static uint32_t g_trigrams_cap = 0;
+static size_t g_posting_bytes = 0;
+static uint32_t *g_watch_dirs = NULL;           // inotify wd -> directory
+static int g_watch_cap = 0;
+static uint32_t g_watch_count = 0;
+
+static char g_roots[FILE_INDEX_MAX_ROOTS][PATH_MAX];
+static int g_root_count = 0;
+static char g_cache_path[PATH_MAX];
+static int g_inotify_fd = -1;
+static int g_watch_limit_logged = 0;
+
+// Directories waiting to be crawled
+static pthread_mutex_t g_crawl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_crawl_ready = PTHREAD_COND_INITIALIZER;
+static uint32_t *g_crawl_queue = NULL;
+static uint32_t g_crawl_len = 0, g_crawl_cap = 0;
+static int g_crawl_active = 0;
+static int g_crawl_stop = 0;
+static int g_full_crawl = 0;                    // Reconcile with the disk when the queue drains
+static uint64_t g_crawl_started = 0;
+static pthread_t g_crawl_threads[FILE_INDEX_CRAWL_THREADS];
+static int g_crawl_thread_count = 0;
+static int g_crawling = 0;
+
+static uint32_t hash_bytes(uint32_t seed, const unsigned char *data, size_t len) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static uint32_t hash_key(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x7feb352d;
+    key ^= key >> 15;
+    key *= 0x846ca68b;
+    return key ^ (key >> 16);
+}
+
+static void lower_copy(char *dest, const char *src, size_t len) {
+    for (size_t i = 0; i < len; i++) dest[i] = (char)tolower((unsigned char)src[i]);
+}
+
+static uint32_t trigram_key(const char *lowered) {
+    return (uint32_t)(unsigned char)lowered[0] << 16 | (uint32_t)(unsigned char)lowered[1] << 8 |
+           (unsigned char)lowered[2];
+}
+
+static void *grow(void *items, uint32_t *cap, uint32_t needed, uint32_t first, size_t elem_size) {
+    if (needed <= *cap) return items;
+    uint32_t new_cap = *cap ? *cap : first;
+    while (new_cap < needed) new_cap *= 2;
+    void *grown = realloc(items, (size_t)new_cap * elem_size);
+    if (grown) *cap = new_cap;
+    return grown;
+}
+
+// Child table
+
+static uint32_t child_hash(uint32_t parent, const char *name, size_t len) {
+    return hash_bytes(parent, (const unsigned char *)name, len);
+}
+
+static int child_matches(uint32_t id, uint32_t parent, const char *name, size_t len) {
+    const entry_t *e = &g_entries[id];
+    return e->parent == parent && e->name_len == len && memcmp(g_names + e->name, name, len) == 0;
+}
+
+static uint32_t find_child(uint32_t parent, const char *name, size_t len) {
+    if (!g_children_cap) return NO_ENTRY;
+    uint32_t mask = g_children_cap - 1;
+    for (uint32_t i = child_hash(parent, name, len) & mask;; i = (i + 1) & mask) {
+        uint32_t id = g_children[i];
+        if (id == SLOT_EMPTY) return NO_ENTRY;
+        if (id != SLOT_TOMBSTONE && child_matches(id, parent, name, len)) return id;
+    }
+}
+
+static void insert_child_slot(uint32_t id) {
+    const entry_t *e = &g_entries[id];
+    uint32_t mask = g_children_cap - 1;
+    uint32_t i = child_hash(e->parent, g_names + e->name, e->name_len) & mask;
+    while (g_children[i] != SLOT_EMPTY && g_children[i] != SLOT_TOMBSTONE) i = (i + 1) & mask;
+    if (g_children[i] == SLOT_EMPTY) g_children_used++;
+    g_children[i] = id;
+}
+
+static int insert_child(uint32_t id) {
+    // Rehash at half load, counting tombstones
+    if ((g_children_used + 1) * 2 > g_children_cap) {
+        uint32_t *old = g_children, old_cap = g_children_cap;
+        uint32_t new_cap = old_cap ? old_cap : 4096;
+        while ((g_entry_count + 1) * 2 > new_cap) new_cap *= 2;
+        if (new_cap == old_cap) new_cap *= 2;
+        uint32_t *table = malloc((size_t)new_cap * sizeof(uint32_t));
+        if (!table) return -1;
+        memset(table, 0xff, (size_t)new_cap * sizeof(uint32_t));
+        g_children = table;
+        g_children_cap = new_cap;
+        g_children_used = 0;
+        for (uint32_t i = 0; i < old_cap; i++) {
+            if (old[i] != SLOT_EMPTY && old[i] != SLOT_TOMBSTONE) insert_child_slot(old[i]);
+        }
+        free(old);
+    }
+    insert_child_slot(id);
+    return 0;
+}
+
+static void remove_child(uint32_t id) {
+    const entry_t *e = &g_entries[id];
+    uint32_t mask = g_children_cap - 1;
+    for (uint32_t i = child_hash(e->parent, g_names + e->name, e->name_len) & mask;; i = (i + 1) & mask) {
+        if (g_children[i] == SLOT_EMPTY) return;
+        if (g_children[i] == id) {
+            g_children[i] = SLOT_TOMBSTONE;
+            return;
+        }
+    }
+}
+
+// Trigram postings
+
+static posting_t *get_posting(uint32_t key, int create) {
+    uint32_t mask = g_trigrams_cap - 1;
+
+    if (g_trigrams_cap) {
+        for (uint32_t i = hash_key(key) & mask;; i = (i + 1) & mask) {
+            if (g_trigrams[i] == SLOT_EMPTY) break;
+            if (g_postings[g_trigrams[i]].key == key) return &g_postings[g_trigrams[i]];
+        }
+    }
+    if (!create) return NULL;
+
+    if ((g_posting_count + 1) * 2 > g_trigrams_cap) {
+        uint32_t new_cap = g_trigrams_cap ? g_trigrams_cap * 2 : 4096;
+        uint32_t *table = malloc((size_t)new_cap * sizeof(uint32_t));
+        if (!table) return NULL;
+        memset(table, 0xff, (size_t)new_cap * sizeof(uint32_t));
+        for (uint32_t p = 0; p < g_posting_count; p++) {
+            uint32_t i = hash_key(g_postings[p].key) & (new_cap - 1);
+            while (table[i] != SLOT_EMPTY) i = (i + 1) & (new_cap - 1);
+            table[i] = p;
+        }
+        free(g_trigrams);
+        g_trigrams = table;
+        g_trigrams_cap = new_cap;
+        mask = new_cap - 1;
+    }
+    posting_t *postings = grow(g_postings, &g_posting_cap, g_posting_count + 1, 1024, sizeof(posting_t));
+    if (!postings) return NULL;
+    g_postings = postings;
+
+    uint32_t i = hash_key(key) & mask;
+    while (g_trigrams[i] != SLOT_EMPTY) i = (i + 1) & mask;
+    g_trigrams[i] = g_posting_count;
+    memset(&g_postings[g_posting_count], 0, sizeof(posting_t));
+    g_postings[g_posting_count].key = key;
+    return &g_postings[g_posting_count++];
+}
+
+static void posting_append(posting_t *posting, uint32_t id) {
+    uint8_t bytes[5];
+    uint32_t delta = id - posting->last;
+    int n = 0;
+
+    if (posting->count && posting->last == id) return;     // Trigram repeats in the name
+    do {
+        bytes[n++] = (delta & 0x7f) | (delta > 0x7f ? 0x80 : 0);
+        delta >>= 7;
+    } while (delta);
+
+    uint32_t old_cap = posting->cap;
+    uint8_t *data = grow(posting->data, &posting->cap, posting->len + n, 16, 1);
+    if (!data) return;
+    g_posting_bytes += posting->cap - old_cap;
+    posting->data = data;
+    memcpy(posting->data + posting->len, bytes, n);
+    posting->len += n;
+    posting->last = id;
+    posting->count++;
+}
+
+static void index_name(uint32_t id, const char *name, size_t len) {
+    char lowered[NAME_MAX + 1];
+    if (len < 3 || len > NAME_MAX) return;
+    lower_copy(lowered, name, len);
+    for (size_t i = 0; i + 3 <= len; i++) {
+        posting_t *posting = get_posting(trigram_key(lowered + i), 1);
+        if (posting) posting_append(posting, id);
+    }
+}
+
+// Entries
+
+static uint32_t add_entry(uint32_t parent, const char *name, size_t len, int is_dir) {
+    uint32_t id = find_child(parent, name, len);
+
+    if (id != NO_ENTRY) {
+        entry_t *e = &g_entries[id];
+        if (!!(e->flags & ENTRY_DIR) == !!is_dir) {
+            if (e->flags & ENTRY_DELETED) g_deleted--;
+            e->flags = (e->flags & ~ENTRY_DELETED) | ENTRY_SEEN;
+            return id;
+        }
+        // Replaced by something of the other kind
+        remove_child(id);
+        if (!(e->flags & ENTRY_DELETED)) g_deleted++;
+        e->flags |= ENTRY_DELETED;
+    }
+
+    if (len > UINT16_MAX || g_entry_count >= SLOT_TOMBSTONE) return NO_ENTRY;
+    entry_t *entries = grow(g_entries, &g_entry_cap, g_entry_count + 1, 4096, sizeof(entry_t));
+    if (!entries) return NO_ENTRY;
+    g_entries = entries;
+    if (g_names_len + len > g_names_cap) {
+        size_t cap = g_names_cap ? g_names_cap : 64 * 1024;
+        while (cap < g_names_len + len) cap *= 2;
+        char *names = realloc(g_names, cap);
+        if (!names) return NO_ENTRY;
+        g_names = names;
+        g_names_cap = cap;
+    }
+
+    id = g_entry_count;
+    entry_t *e = &g_entries[id];
+    e->parent = parent;
+    e->name = (uint32_t)g_names_len;
+    e->name_len = (uint16_t)len;
+    e->flags = (is_dir ? ENTRY_DIR : 0) | ENTRY_SEEN;
+    e->depth = parent == NO_ENTRY ? 0 : g_entries[parent].depth < UINT8_MAX ? g_entries[parent].depth + 1 : UINT8_MAX;
+    memcpy(g_names + g_names_len, name, len);
+    g_names_len += len;
+    g_entry_count++;
+
+    if (insert_child(id) != 0) {
+        e->flags |= ENTRY_DELETED;
+        g_deleted++;
+        return NO_ENTRY;
+    }
+    index_name(id, name, len);
+    return id;
+}
+
+// Deleted files stay in the child table so they can come back under the
+// same id; deleted directories leave it, which cuts off their subtree
+static void delete_entry(uint32_t id) {
+    entry_t *e = &g_entries[id];
+    if (e->flags & ENTRY_DELETED) return;
+    e->flags |= ENTRY_DELETED;
+    g_deleted++;
+    if (e->flags & ENTRY_DIR) remove_child(id);
+}
+
+static int is_live(uint32_t id) {
+    for (; id != NO_ENTRY; id = g_entries[id].parent) {
+        if (g_entries[id].flags & ENTRY_DELETED) return 0;
+    }
+    return 1;
+}
+
+static int build_path(uint32_t id, char *buf, size_t size) {
+    uint32_t chain[UINT8_MAX + 1];
+    int depth = 0;
+    size_t len = 0;
+
+    for (; id != NO_ENTRY && depth <= UINT8_MAX; id = g_entries[id].parent) chain[depth++] = id;
+    while (depth-- > 0) {
+        const entry_t *e = &g_entries[chain[depth]];
+        int slash = e->parent != NO_ENTRY && len > 0 && buf[len - 1] != '/';
+        if (len + slash + e->name_len + 1 > size) return -1;
+        if (slash) buf[len++] = '/';
+        memcpy(buf + len, g_names + e->name, e->name_len);
+        len += e->name_len;
+    }
+    buf[len] = '\0';
+    return 0;
+}
+
+static void watch_directory(const char *path, uint32_t id) {
+    if (g_inotify_fd < 0) return;
+
+    int wd = inotify_add_watch(g_inotify_fd, path, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC && !g_watch_limit_logged) {
+            g_watch_limit_logged = 1;
+            printf("⚠️ inotify watch limit reached; parts of the file index will go stale\n");
+        }
+        return;
+    }
+
+    pthread_rwlock_wrlock(&g_lock);
+    if (wd >= g_watch_cap) {
+        int cap = g_watch_cap ? g_watch_cap : 1024;
+        while (cap <= wd) cap *= 2;
+        uint32_t *dirs = realloc(g_watch_dirs, cap * sizeof(uint32_t));
+        if (dirs) {
+            memset(dirs + g_watch_cap, 0xff, (cap - g_watch_cap) * sizeof(uint32_t));
+            g_watch_dirs = dirs;
+            g_watch_cap = cap;
+        }
+    }
+    if (wd < g_watch_cap) {
+        if (g_watch_dirs[wd] == NO_ENTRY) g_watch_count++;
+        g_watch_dirs[wd] = id;
+    }
+    pthread_rwlock_unlock(&g_lock);
+}
+
+// Crawl
+
+static void crawl_push(uint32_t id) {
+    uint32_t *queue = grow(g_crawl_queue, &g_crawl_cap, g_crawl_len + 1, 256, sizeof(uint32_t));
+    if (!queue) return;
+    g_crawl_queue = queue;
+    g_crawl_queue[g_crawl_len++] = id;
+    __atomic_store_n(&g_crawling, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&g_crawl_ready);
+}
+
+static void crawl_enqueue(uint32_t id) {
+    pthread_mutex_lock(&g_crawl_lock);
+    crawl_push(id);
+    pthread_mutex_unlock(&g_crawl_lock);
+}
+
+// Start over from the roots; entries the crawl doesn't find are dropped
+// when it finishes
+static void start_full_crawl(void) {
+    pthread_rwlock_wrlock(&g_lock);
+    for (uint32_t i = 0; i < g_entry_count; i++) g_entries[i].flags &= ~ENTRY_SEEN;
+    uint32_t roots[FILE_INDEX_MAX_ROOTS];
+    int count = 0;
+    for (int r = 0; r < g_root_count; r++) {
+        uint32_t id = add_entry(NO_ENTRY, g_roots[r], strlen(g_roots[r]), 1);
+        if (id != NO_ENTRY) roots[count++] = id;
+    }
+    pthread_rwlock_unlock(&g_lock);
+
+    // Flag and roots go in together, so a crawl thread can't see the
+    // flag with an empty queue and reconcile too early
+    pthread_mutex_lock(&g_crawl_lock);
+    g_full_crawl = 1;
+    g_crawl_started = metrics_now_ns();
+    for (int r = 0; r < count; r++) crawl_push(roots[r]);
+    pthread_mutex_unlock(&g_crawl_lock);
+}
+
+static void save_index(void);
+
+// Drop what the crawl didn't find, then persist: the daemon usually
+// ends by signal, so this is the save that counts
+static void finish_full_crawl(void) {
+    uint32_t dropped = 0;
+
+    pthread_rwlock_wrlock(&g_lock);
+    for (uint32_t i = 0; i < g_entry_count; i++) {
+        if (!(g_entries[i].flags & (ENTRY_SEEN | ENTRY_DELETED))) {
+            delete_entry(i);
+            dropped++;
+        }
+    }
+    uint32_t live = g_entry_count - g_deleted;
+    pthread_rwlock_unlock(&g_lock);
+
+    printf("🔎 File index ready: %u entries (%u gone since last run) in %.0f ms\n", live, dropped,
+           (metrics_now_ns() - g_crawl_started) / 1e6);
+    save_index();
+}
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    int is_dir;
+} crawl_item_t;
+
+// Add one batch of directory entries and queue the subdirectories
+static void add_batch(uint32_t dir, const crawl_item_t *items, int count) {
+    uint32_t subdirs[CRAWL_BATCH];
+    int subdir_count = 0;
+
+    pthread_rwlock_wrlock(&g_lock);
+    for (int i = 0; i < count; i++) {
+        uint32_t id = add_entry(dir, items[i].name, strlen(items[i].name), items[i].is_dir);
+        if (id != NO_ENTRY && items[i].is_dir) subdirs[subdir_count++] = id;
+    }
+    pthread_rwlock_unlock(&g_lock);
+
+    for (int i = 0; i < subdir_count; i++) crawl_enqueue(subdirs[i]);
+}
+
+static void crawl_directory(uint32_t dir, crawl_item_t *items) {
+    char path[PATH_MAX];
+    int ok, count = 0;
+
+    pthread_rwlock_rdlock(&g_lock);
+    ok = is_live(dir) && build_path(dir, path, sizeof(path)) == 0;
+    pthread_rwlock_unlock(&g_lock);
+    if (!ok) return;
+
+    DIR *d = opendir(path);
+    if (!d) return;
+    // Watch before reading, so nothing created meanwhile is missed
+    watch_directory(path, dir);
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+
+        int is_dir = ent->d_type == DT_DIR;
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        snprintf(items[count].name, sizeof(items[count].name), "%s", ent->d_name);
+        items[count++].is_dir = is_dir;
+        if (count == CRAWL_BATCH) {
+            add_batch(dir, items, count);
+            count = 0;
+        }
+    }
+    closedir(d);
+    if (count) add_batch(dir, items, count);
+}
+
+static void *crawl_main(void *arg) {
+    crawl_item_t *items = malloc(CRAWL_BATCH * sizeof(crawl_item_t));
+    (void)arg;
+    if (!items) return NULL;
+
+    pthread_mutex_lock(&g_crawl_lock);
+    for (;;) {
+        while (!g_crawl_len && !g_crawl_stop) pthread_cond_wait(&g_crawl_ready, &g_crawl_lock);
+        if (g_crawl_stop) break;
+
+        // Depth first keeps the queue short on deep trees
+        uint32_t dir = g_crawl_queue[--g_crawl_len];
+        g_crawl_active++;
+        pthread_mutex_unlock(&g_crawl_lock);
+        crawl_directory(dir, items);
+        pthread_mutex_lock(&g_crawl_lock);
+        g_crawl_active--;
+
+        if (!g_crawl_len && !g_crawl_active) {
+            int full = g_full_crawl;
+            g_full_crawl = 0;
+            __atomic_store_n(&g_crawling, 0, __ATOMIC_RELAXED);
+            if (full) {
+                pthread_mutex_unlock(&g_crawl_lock);
+                finish_full_crawl();
+                pthread_mutex_lock(&g_crawl_lock);
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_crawl_lock);
+    free(items);
+    return NULL;
+}
+
+// Persistence: live entries only, renumbered, so loading is a straight
+// replay and the file never carries deleted entries forward
+
+static void save_index(void) {
+    char tmp[PATH_MAX + 8];
+    uint32_t *remap;
+    FILE *file;
+    index_file_header_t header;
+    uint32_t count = 0;
+    uint64_t names_len = 0;
+    int ok = 1;
+
+    if (!g_cache_path[0] || (size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", g_cache_path) >= sizeof(tmp)) return;
+
+    pthread_rwlock_rdlock(&g_lock);
+    // File names under home directories are private
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    remap = malloc((size_t)g_entry_count * sizeof(uint32_t) + 1);
+    file = fd >= 0 && remap ? fdopen(fd, "w") : NULL;
+    if (!file) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        pthread_rwlock_unlock(&g_lock);
+        free(remap);
+        return;
+    }
+
+    for (uint32_t i = 0; i < g_entry_count; i++) {
+        const entry_t *e = &g_entries[i];
+        int keep = !(e->flags & ENTRY_DELETED) && (e->parent == NO_ENTRY || remap[e->parent] != NO_ENTRY);
+        remap[i] = keep ? count++ : NO_ENTRY;
+        if (keep) names_len += e->name_len;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.version = INDEX_FILE_VERSION;
+    header.entry_count = count;
+    header.names_len = names_len;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < g_entry_count && ok; i++) {
+        if (remap[i] == NO_ENTRY) continue;
+        entry_t e = g_entries[i];
+        e.parent = e.parent == NO_ENTRY ? NO_ENTRY : remap[e.parent];
+        e.name = offset;
+        e.flags &= ENTRY_DIR;
+        offset += e.name_len;
+        ok = fwrite(&e, sizeof(e), 1, file) == 1;
+    }
+    for (uint32_t i = 0; i < g_entry_count && ok; i++) {
+        if (remap[i] == NO_ENTRY) continue;
+        ok = fwrite(g_names + g_entries[i].name, 1, g_entries[i].name_len, file) == g_entries[i].name_len;
+    }
+    pthread_rwlock_unlock(&g_lock);
+    free(remap);
+
+    if (fclose(file) != 0) ok = 0;
+    if (!ok || rename(tmp, g_cache_path) != 0) {
+        unlink(tmp);
+        return;
+    }
+    printf("🔎 File index saved: %u entries\n", count);
+}
+
+// Replay a saved index through mmap. Roots no longer configured are
+// skipped together with everything under them.
+static void load_index(void) {
+    struct stat st;
+    int fd = g_cache_path[0] ? open(g_cache_path, O_RDONLY | O_CLOEXEC) : -1;
+
+    if (fd < 0) return;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_file_header_t)) {
+        close(fd);
+        return;
+    }
+    const unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+
+    const index_file_header_t *header = (const index_file_header_t *)map;
+    size_t entries_size = (size_t)header->entry_count * sizeof(entry_t);
+    if (memcmp(header->magic, INDEX_FILE_MAGIC, sizeof(header->magic)) != 0 || header->version != INDEX_FILE_VERSION ||
+        sizeof(*header) + entries_size + header->names_len != (size_t)st.st_size) {
+        munmap((void *)map, st.st_size);
+        return;
+    }
+
+    const entry_t *entries = (const entry_t *)(map + sizeof(*header));
+    const char *names = (const char *)(map + sizeof(*header) + entries_size);
+    uint32_t *remap = malloc((size_t)header->entry_count * sizeof(uint32_t) + 1);
+    uint32_t loaded = 0;
+
+    pthread_rwlock_wrlock(&g_lock);
+    for (uint32_t i = 0; remap && i < header->entry_count; i++) {
+        const entry_t *e = &entries[i];
+        uint32_t parent = NO_ENTRY;
+        remap[i] = NO_ENTRY;
+
+        if ((uint64_t)e->name + e->name_len > header->names_len) break;
+        if (e->parent == NO_ENTRY) {
+            int configured = 0;
+            for (int r = 0; r < g_root_count; r++) {
+                configured |= strlen(g_roots[r]) == e->name_len && memcmp(g_roots[r], names + e->name, e->name_len) == 0;
+            }
+            if (!configured) continue;
+        } else if (e->parent >= i || (parent = remap[e->parent]) == NO_ENTRY) {
+            continue;
+        }
+        remap[i] = add_entry(parent, names + e->name, e->name_len, e->flags & ENTRY_DIR);
+        if (remap[i] != NO_ENTRY) loaded++;
+    }
+    pthread_rwlock_unlock(&g_lock);
+
+    free(remap);
+    munmap((void *)map, st.st_size);
+    printf("🔎 Loaded %u entries from %s\n", loaded, g_cache_path);
+}
+
+static void set_cache_path(void) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    g_cache_path[0] = '\0';
+    if (xdg && xdg[0] == '/') {
+        snprintf(g_cache_path, sizeof(g_cache_path), "%s/%s", xdg, FILE_INDEX_CACHE_NAME);
+    } else if (home && home[0] == '/') {
+        snprintf(g_cache_path, sizeof(g_cache_path), "%s/.cache/%s", home, FILE_INDEX_CACHE_NAME);
+    }
+}
+
+int init_file_index(const char *const *roots, int root_count) {
+    static const char *const default_roots[] = { FILE_INDEX_DEFAULT_ROOT };
+
+    if (root_count <= 0) {
+        roots = default_roots;
+        root_count = 1;
+    }
+    if (root_count > FILE_INDEX_MAX_ROOTS) root_count = FILE_INDEX_MAX_ROOTS;
+
+    g_root_count = 0;
+    for (int i = 0; i < root_count; i++) {
+        char resolved[PATH_MAX];
+        if (!realpath(roots[i], resolved)) {
+            printf("⚠️ Not indexing %s: %s\n", roots[i], strerror(errno));
+            continue;
+        }
+        snprintf(g_roots[g_root_count++], PATH_MAX, "%s", resolved);
+        printf("🔎 Indexing file names under %s\n", resolved);
+    }
+
+    g_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_inotify_fd < 0) perror("inotify_init1");
+
+    set_cache_path();
+    load_index();
+
+    g_crawl_stop = 0;
+    for (g_crawl_thread_count = 0; g_crawl_thread_count < FILE_INDEX_CRAWL_THREADS; g_crawl_thread_count++) {
+        if (pthread_create(&g_crawl_threads[g_crawl_thread_count], NULL, crawl_main, NULL) != 0) break;
+    }
+    if (g_crawl_thread_count == 0) return -1;
+
+    start_full_crawl();
+    return 0;
+}
+
+void cleanup_file_index(void) {
+    printf("🔎 Cleaning up file index...\n");
+
+    pthread_mutex_lock(&g_crawl_lock);
+    g_crawl_stop = 1;
+    int complete = !g_full_crawl;
+    pthread_cond_broadcast(&g_crawl_ready);
+    pthread_mutex_unlock(&g_crawl_lock);
+    for (int i = 0; i < g_crawl_thread_count; i++) pthread_join(g_crawl_threads[i], NULL);
+    g_crawl_thread_count = 0;
+
+    // A half-finished crawl would save a half-empty index
+    if (complete) save_index();
+
+    if (g_inotify_fd >= 0) close(g_inotify_fd);
+    g_inotify_fd = -1;
+
+    for (uint32_t i = 0; i < g_posting_count; i++) free(g_postings[i].data);
+    free(g_postings);
+    free(g_trigrams);
+    free(g_children);
+    free(g_entries);
+    free(g_names);
+    free(g_watch_dirs);
+    free(g_crawl_queue);
+    g_postings = NULL;
+    g_trigrams = g_children = g_watch_dirs = g_crawl_queue = NULL;
+    g_entries = NULL;
+    g_names = NULL;
+    g_entry_count = g_entry_cap = g_deleted = g_posting_count = g_posting_cap = 0;
+    g_trigrams_cap = g_children_cap = g_children_used = g_crawl_len = g_crawl_cap = g_watch_count = 0;
+    g_names_len = g_names_cap = g_posting_bytes = 0;
+    g_watch_cap = 0;
+}
+
+int file_index_fd(void) {
+    return g_inotify_fd;
+}
+
+// Apply queued inotify events; new directories are handed to the
+// crawl threads
+void file_index_process_events(void) {
+    char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while ((len = read(g_inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                printf("⚠️ inotify queue overflowed; recrawling the file index\n");
+                start_full_crawl();
+                continue;
+            }
+
+            pthread_rwlock_wrlock(&g_lock);
+            uint32_t dir = ev->wd >= 0 && ev->wd < g_watch_cap ? g_watch_dirs[ev->wd] : NO_ENTRY;
+            uint32_t created = NO_ENTRY;
+            if (dir != NO_ENTRY && (ev->mask & IN_IGNORED)) {
+                g_watch_dirs[ev->wd] = NO_ENTRY;
+                g_watch_count--;
+            } else if (dir != NO_ENTRY && ev->len > 0) {
+                size_t name_len = strlen(ev->name);
+                int is_dir = (ev->mask & IN_ISDIR) != 0;
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    created = add_entry(dir, ev->name, name_len, is_dir);
+                    if (!is_dir) created = NO_ENTRY;
+                } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    uint32_t id = find_child(dir, ev->name, name_len);
+                    if (id != NO_ENTRY) delete_entry(id);
+                }
+            }
+            pthread_rwlock_unlock(&g_lock);
+
+            // A directory may arrive with contents (moved in, or filled
+            // before its watch exists)
+            if (created != NO_ENTRY) crawl_enqueue(created);
+        }
+    }
+}
+
+// Ranking
+
+static void heap_push(hit_t *heap, int *count, int cap, hit_t hit) {
+    int i;
+    if (cap == 0) return;
+    if (*count < cap) {
+        i = (*count)++;
+    } else if (hit.score > heap[0].score) {
+        // Replace the weakest and sift down
+        i = 0;
+        for (;;) {
+            int child = 2 * i + 1;
+            if (child >= *count) break;
+            if (child + 1 < *count && heap[child + 1].score < heap[child].score) child++;
+            if (heap[child].score >= hit.score) break;
+            heap[i] = heap[child];
+            i = child;
+        }
+        heap[i] = hit;
+        return;
+    } else {
+        return;
+    }
+    while (i > 0 && heap[(i - 1) / 2].score > hit.score) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = hit;
+}
+
+static int compare_hits(const void *a, const void *b) {
+    const hit_t *x = a, *y = b;
+    if (x->score != y->score) return y->score - x->score;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+// Exact name, then prefix, then a match at a word boundary, then any
+// substring; shorter names and shallower paths first within each
+static int substring_score(const char *lowered, size_t len, const char *query, size_t query_len) {
+    const char *match = memmem(lowered, len, query, query_len);
+    if (!match) return -1;
+
+    size_t pos = match - lowered;
+    int base = pos == 0 ? (len == query_len ? 1000 : 800) : !isalnum((unsigned char)lowered[pos - 1]) ? 600 : 400;
+    int extra = (int)(len - query_len);
+    return base - (extra < 100 ? extra : 100);
+}
+
+// A parent directory's access, cached for one search
+typedef struct {
+    uint32_t dir;
+    int visible;
+} access_slot_t;
+
+typedef struct {
+    const char *query;
+    size_t query_len;
+    int fuzzy;
+    uint32_t trigrams;              // Distinct trigrams in the query
+    hit_t *heap;
+    int heap_count;
+    int heap_cap;
+    uint32_t total;
+    access_slot_t *access;          // NULL when the daemon searches as itself
+} search_t;
+
+// The index is built as root, so a match is only shown when the calling
+// thread's user could list it: its parent opens with their credentials.
+// The answer is kept for the rest of the search, or not at all once the
+// table is full.
+static int can_list(search_t *s, uint32_t dir) {
+    uint32_t slot = hash_key(dir) & (ACCESS_SLOTS - 1);
+    uint32_t probe = 0;
+    char path[PATH_MAX];
+
+    for (; probe < ACCESS_SLOTS && s->access[slot].dir != NO_ENTRY; probe++) {
+        if (s->access[slot].dir == dir) return s->access[slot].visible;
+        slot = (slot + 1) & (ACCESS_SLOTS - 1);
+    }
+
+    int fd = build_path(dir, path, sizeof(path)) == 0 ? open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (fd >= 0) close(fd);
+    if (probe < ACCESS_SLOTS) s->access[slot] = (access_slot_t){ dir, fd >= 0 };
+    return fd >= 0;
+}
+
+static void consider(search_t *s, uint32_t id, uint32_t shared) {
+    const entry_t *e = &g_entries[id];
+    char lowered[NAME_MAX + 1];
+    int score;
+
+    if (e->parent == NO_ENTRY || e->name_len > NAME_MAX || !is_live(id)) return;
+    lower_copy(lowered, g_names + e->name, e->name_len);
+    score = substring_score(lowered, e->name_len, s->query, s->query_len);
+
+    if (s->fuzzy && shared) {
+        // Dice coefficient over trigram sets, with a bonus for a real
+        // substring match
+        uint32_t name_trigrams = e->name_len >= 3 ? e->name_len - 2 : 1;
+        int similarity = (int)(500.0 * 2 * shared / (s->trigrams + name_trigrams));
+        score = similarity + (score >= 0 ? 300 : 0);
+    }
+    if (score < 0 || (s->access && !can_list(s, e->parent))) return;
+
+    s->total++;
+    heap_push(s->heap, &s->heap_count, s->heap_cap, (hit_t){ score - 2 * e->depth, id });
+}
+
+static const uint8_t *varint_next(const uint8_t *p, uint32_t *delta) {
+    uint32_t v = 0;
+    int shift = 0;
+    do {
+        v |= (uint32_t)(*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    *delta = v;
+    return p;
+}
+
+// Substring: walk the rarest trigram's list and check each name.
+// Fuzzy: count shared trigrams per entry over all the query's lists and
+// keep names sharing at least half of them.
+static void search_trigrams(search_t *s, const posting_t **postings, uint32_t count) {
+    if (!s->fuzzy) {
+        const posting_t *rarest = postings[0];
+        for (uint32_t i = 1; i < count; i++) {
+            if (!postings[i]) return;
+            if (postings[i]->count < rarest->count) rarest = postings[i];
+        }
+        if (!rarest) return;
+
+        uint32_t id = 0;
+        for (const uint8_t *p = rarest->data, *end = p + rarest->len; p < end;) {
+            uint32_t delta;
+            p = varint_next(p, &delta);
+            id += delta;
+            consider(s, id, 0);
+        }
+        return;
+    }
+
+    uint8_t *shared = calloc(g_entry_count, 1);
+    uint32_t need = (count + 1) / 2;
+    if (!shared) return;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!postings[i]) continue;
+        uint32_t id = 0;
+        for (const uint8_t *p = postings[i]->data, *end = p + postings[i]->len; p < end;) {
+            uint32_t delta;
+            p = varint_next(p, &delta);
+            id += delta;
+            if (shared[id] < UINT8_MAX) shared[id]++;
+        }
+    }
+    for (uint32_t id = 0; id < g_entry_count; id++) {
+        if (shared[id] >= need) consider(s, id, shared[id]);
+    }
+    free(shared);
+}
+
+// Ranked name matches as fields of the open object: total, offset,
+// indexing, indexed and one page of results. Inside user_cred_enter()
+// only what that user can list is counted and returned.
+void file_index_search(arena_t *arena, json_writer_t *w, const char *query, int fuzzy, int offset, int limit) {
+    char lowered[FILE_INDEX_MAX_QUERY];
+    const posting_t **postings;
+    search_t s;
+    size_t len = query ? strlen(query) : 0;
+
+    if (len >= sizeof(lowered)) len = sizeof(lowered) - 1;
+    lower_copy(lowered, query ? query : "", len);
+    if (offset < 0) offset = 0;
+    if (offset > FILE_INDEX_MAX_RESULTS) offset = FILE_INDEX_MAX_RESULTS;
+    if (limit <= 0) limit = FILE_INDEX_DEFAULT_LIMIT;
+    if (offset + limit > FILE_INDEX_MAX_RESULTS) limit = FILE_INDEX_MAX_RESULTS - offset;
+    if (limit < 0) limit = 0;
+
+    memset(&s, 0, sizeof(s));
+    s.query = lowered;
+    s.query_len = len;
+    s.fuzzy = fuzzy && len >= 3;
+    s.heap_cap = offset + limit;
+    s.heap = arena_alloc(arena, (s.heap_cap + 1) * sizeof(hit_t));
+    postings = arena_alloc(arena, (len + 1) * sizeof(*postings));
+    if (user_cred_current()) {
+        s.access = arena_alloc(arena, ACCESS_SLOTS * sizeof(access_slot_t));
+        if (s.access) {
+            for (int i = 0; i < ACCESS_SLOTS; i++) s.access[i].dir = NO_ENTRY;
+        } else {
+            s.heap = NULL;          // Unchecked matches are never shown
+        }
+    }
+
+    pthread_rwlock_rdlock(&g_lock);
+    if (len == 0 || !s.heap || !postings) {
+        // Nothing to match
+    } else if (len < 3) {
+        for (uint32_t id = 0; id < g_entry_count; id++) consider(&s, id, 0);
+    } else {
+        uint32_t count = 0;
+        for (size_t i = 0; i + 3 <= len; i++) {
+            uint32_t key = trigram_key(lowered + i);
+            int repeat = 0;
+            for (size_t j = 0; j < i; j++) repeat |= trigram_key(lowered + j) == key;
+            if (!repeat) postings[count++] = get_posting(key, 0);
+        }
+        s.trigrams = count;
+        search_trigrams(&s, postings, count);
+    }
+
+    qsort(s.heap, s.heap_count, sizeof(hit_t), compare_hits);
+
+    json_field_uint(w, "total", s.total);
+    json_field_int(w, "offset", offset);
+    json_field_bool(w, "indexing", __atomic_load_n(&g_crawling, __ATOMIC_RELAXED));
+    json_field_uint(w, "indexed", g_entry_count - g_deleted);
+    json_key(w, "results");
+    json_begin_array(w);
+    for (int i = offset; i < s.heap_count; i++) {
+        const entry_t *e = &g_entries[s.heap[i].id];
+        char path[PATH_MAX];
+        if (build_path(s.heap[i].id, path, sizeof(path)) != 0) continue;
+        json_begin_object(w);
+        json_field_string(w, "path", path);
+        json_key(w, "name");
+        json_write_string_len(w, g_names + e->name, e->name_len);
+        json_field_bool(w, "is_directory", (e->flags & ENTRY_DIR) != 0);
+        json_field_int(w, "score", s.heap[i].score);
+        json_end_object(w);
+    }
+    json_end_array(w);
+    pthread_rwlock_unlock(&g_lock);
+}
+
+void file_index_get_stats(file_index_stats_t *stats) {
+    pthread_rwlock_rdlock(&g_lock);
+    stats->entries = g_entry_count - g_deleted;
+    stats->deleted = g_deleted;
+    stats->trigrams = g_posting_count;
+    stats->watches = g_watch_count;
+    stats->name_bytes = g_names_len;
+    stats->posting_bytes = g_posting_bytes;
+    pthread_rwlock_unlock(&g_lock);
+    stats->crawling = __atomic_load_n(&g_crawling, __ATOMIC_RELAXED);
+}
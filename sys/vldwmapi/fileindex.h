@@ -0,0 +1,38 @@
+#ifndef FILEINDEX_H
+#define FILEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "jsonwriter.h"
+
+// Constants
+#define FILE_INDEX_DEFAULT_ROOT "/home"
+#define FILE_INDEX_MAX_ROOTS 16
+#define FILE_INDEX_CRAWL_THREADS 4
+#define FILE_INDEX_MAX_RESULTS 1000             // offset + limit of one query
+#define FILE_INDEX_DEFAULT_LIMIT 50
+#define FILE_INDEX_MAX_QUERY 256
+#define FILE_INDEX_CACHE_NAME "vldwmapi-files.idx"
+
+typedef struct {
+    uint32_t entries;
+    uint32_t deleted;
+    uint32_t trigrams;
+    uint32_t watches;
+    size_t name_bytes;
+    size_t posting_bytes;
+    int crawling;
+} file_index_stats_t;
+
+// File index functions. Queries may run on any thread, and answer with
+// what the thread's credentials can list (see usercred.h); inotify
+// events are processed on the event loop through file_index_fd().
+int init_file_index(const char *const *roots, int root_count);
+void cleanup_file_index(void);
+int file_index_fd(void);
+void file_index_process_events(void);
+void file_index_search(arena_t *arena, json_writer_t *w, const char *query, int fuzzy, int offset, int limit);
+void file_index_get_stats(file_index_stats_t *stats);
+
+#endif // FILEINDEX_H
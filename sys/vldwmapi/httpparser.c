@@ -0,0 +1,427 @@
+#include <string.h>
+#include <strings.h>
+
+#include "httpparser.h"
+
+// Parser states
+enum {
+    HTTP_STATE_METHOD = 0,
+    HTTP_STATE_TARGET,
+    HTTP_STATE_VERSION,
+    HTTP_STATE_REQUEST_LINE_LF,
+    HTTP_STATE_HEADER_START,
+    HTTP_STATE_HEADER_NAME,
+    HTTP_STATE_HEADER_VALUE_START,
+    HTTP_STATE_HEADER_VALUE,
+    HTTP_STATE_HEADER_LF,
+    HTTP_STATE_HEADERS_END_LF,
+    HTTP_STATE_DONE
+};
+
+// Headers the daemon acts on; everything else is skipped without copying
+enum {
+    HTTP_HEADER_UNKNOWN = 0,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_WS_KEY,
+    HTTP_HEADER_WS_VERSION,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_ACCEPT_ENCODING
+};
+
+static const struct {
+    const char *name;
+    unsigned char id;
+} known_headers[] = {
+    { "upgrade", HTTP_HEADER_UPGRADE },
+    { "connection", HTTP_HEADER_CONNECTION },
+    { "sec-websocket-key", HTTP_HEADER_WS_KEY },
+    { "sec-websocket-version", HTTP_HEADER_WS_VERSION },
+    { "content-length", HTTP_HEADER_CONTENT_LENGTH },
+    { "if-none-match", HTTP_HEADER_IF_NONE_MATCH },
+    { "range", HTTP_HEADER_RANGE },
+    { "accept-encoding", HTTP_HEADER_ACCEPT_ENCODING },
+};
+
+// RFC 7230 token characters
+static int is_tchar(unsigned char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return 1;
+    }
+    return c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+static int is_base64_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '+' || c == '/';
+}
+
+static unsigned char lookup_header(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(known_headers) / sizeof(known_headers[0]); i++) {
+        if (strlen(known_headers[i].name) == len && memcmp(known_headers[i].name, name, len) == 0) {
+            return known_headers[i].id;
+        }
+    }
+    return HTTP_HEADER_UNKNOWN;
+}
+
+// Check a comma separated header value for a token, ignoring case
+static int has_token(const char *value, size_t len, const char *token) {
+    size_t token_len = strlen(token);
+    size_t i = 0;
+
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+        size_t start = i;
+        while (i < len && value[i] != ',') i++;
+        size_t end = i;
+        while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t')) end--;
+        if (end - start == token_len && strncasecmp(value + start, token, token_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parse Accept-Encoding, skipping codings refused with q=0
+static unsigned int parse_accept_encoding(const char *value, size_t len) {
+    unsigned int encodings = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+        size_t start = i;
+        while (i < len && value[i] != ',' && value[i] != ';' && value[i] != ' ') i++;
+        size_t name_len = i - start;
+        int refused = 0;
+
+        while (i < len && value[i] != ',') {
+            if ((value[i] == 'q' || value[i] == 'Q') && i + 2 < len && value[i + 1] == '=' && value[i + 2] == '0') {
+                size_t j = i + 3;
+                if (j < len && value[j] == '.') j++;
+                while (j < len && value[j] == '0') j++;
+                refused = (j >= len || value[j] == ',' || value[j] == ' ' || value[j] == ';');
+            }
+            i++;
+        }
+        if (refused) continue;
+
+        if (name_len == 2 && strncasecmp(value + start, "br", 2) == 0) {
+            encodings |= HTTP_ENCODING_BR;
+        } else if (name_len == 4 && strncasecmp(value + start, "gzip", 4) == 0) {
+            encodings |= HTTP_ENCODING_GZIP;
+        } else if (name_len == 1 && value[start] == '*') {
+            encodings |= HTTP_ENCODING_BR | HTTP_ENCODING_GZIP;
+        }
+    }
+    return encodings;
+}
+
+static int parse_number(const char *value, size_t len, long long *out) {
+    long long number = 0;
+    if (len == 0 || len > 18) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9') return 0;
+        number = number * 10 + (value[i] - '0');
+    }
+    *out = number;
+    return 1;
+}
+
+// Parse a single "bytes=" range. Multiple ranges are ignored and the
+// full representation is served instead, which RFC 7233 allows.
+static void parse_range(http_request_t *req, const char *value, size_t len) {
+    if (len < 7 || strncasecmp(value, "bytes=", 6) != 0 || memchr(value, ',', len)) return;
+    value += 6;
+    len -= 6;
+
+    const char *dash = memchr(value, '-', len);
+    if (!dash) return;
+    size_t first_len = dash - value;
+    size_t last_len = len - first_len - 1;
+    long long first = -1, last = -1;
+
+    if (first_len == 0) {
+        // Suffix range: the last N bytes
+        if (!parse_number(dash + 1, last_len, &last) || last == 0) return;
+    } else {
+        if (!parse_number(value, first_len, &first)) return;
+        if (last_len > 0 && (!parse_number(dash + 1, last_len, &last) || last < first)) return;
+    }
+
+    req->range_start = first;
+    req->range_end = last;
+    req->flags |= HTTP_FLAG_HAS_RANGE;
+}
+
+// Apply a completed known header to the request
+static int finish_header(http_request_t *req) {
+    const char *value = req->value;
+    size_t len = req->value_len;
+
+    switch (req->header_id) {
+        case HTTP_HEADER_UPGRADE:
+            if (has_token(value, len, "websocket")) req->flags |= HTTP_FLAG_UPGRADE_WEBSOCKET;
+            break;
+        case HTTP_HEADER_CONNECTION:
+            if (has_token(value, len, "upgrade")) req->flags |= HTTP_FLAG_CONNECTION_UPGRADE;
+            if (has_token(value, len, "close")) req->flags |= HTTP_FLAG_CONNECTION_CLOSE;
+            if (has_token(value, len, "keep-alive")) req->flags |= HTTP_FLAG_CONNECTION_KEEP_ALIVE;
+            break;
+        case HTTP_HEADER_WS_KEY:
+            // A valid key is 16 random bytes in base64: 22 symbols and "=="
+            req->ws_key[0] = '\0';
+            if (len != WS_KEY_LEN || value[22] != '=' || value[23] != '=') break;
+            for (size_t i = 0; i < 22; i++) {
+                if (!is_base64_char((unsigned char)value[i])) return HTTP_PARSE_ERROR;
+            }
+            memcpy(req->ws_key, value, WS_KEY_LEN);
+            req->ws_key[WS_KEY_LEN] = '\0';
+            break;
+        case HTTP_HEADER_WS_VERSION: {
+            int version = 0;
+            if (len == 0 || len > 3) {
+                req->ws_version = -1;
+                break;
+            }
+            for (size_t i = 0; i < len; i++) {
+                if (value[i] < '0' || value[i] > '9') {
+                    version = -1;
+                    break;
+                }
+                version = version * 10 + (value[i] - '0');
+            }
+            req->ws_version = version;
+            break;
+        }
+        case HTTP_HEADER_CONTENT_LENGTH: {
+            long length = 0;
+            if (len == 0 || len > 9) return HTTP_PARSE_ERROR;
+            for (size_t i = 0; i < len; i++) {
+                if (value[i] < '0' || value[i] > '9') return HTTP_PARSE_ERROR;
+                length = length * 10 + (value[i] - '0');
+            }
+            if ((req->flags & HTTP_FLAG_HAS_CONTENT_LENGTH) && req->content_length != length) {
+                return HTTP_PARSE_ERROR;
+            }
+            req->content_length = length;
+            req->flags |= HTTP_FLAG_HAS_CONTENT_LENGTH;
+            break;
+        }
+        case HTTP_HEADER_IF_NONE_MATCH:
+            // Lists too long to keep are treated as never matching
+            req->flags |= HTTP_FLAG_HAS_IF_NONE_MATCH;
+            if (len < HTTP_MAX_ETAG_LIST_LEN) {
+                memcpy(req->if_none_match, value, len);
+                req->if_none_match[len] = '\0';
+            }
+            break;
+        case HTTP_HEADER_RANGE:
+            parse_range(req, value, len);
+            break;
+        case HTTP_HEADER_ACCEPT_ENCODING:
+            req->accept_encoding |= parse_accept_encoding(value, len);
+            break;
+    }
+    return HTTP_PARSE_INCOMPLETE;
+}
+
+static int finish_version(http_request_t *req) {
+    if (req->value_len != 8 || memcmp(req->value, "HTTP/", 5) != 0 ||
+        req->value[5] < '0' || req->value[5] > '9' || req->value[6] != '.' ||
+        req->value[7] < '0' || req->value[7] > '9') {
+        return HTTP_PARSE_ERROR;
+    }
+    req->version_major = req->value[5] - '0';
+    req->version_minor = req->value[7] - '0';
+    req->value_len = 0;
+    return req->version_major == 1 ? HTTP_PARSE_INCOMPLETE : HTTP_PARSE_ERROR;
+}
+
+void http_request_init(http_request_t *req) {
+    req->state = HTTP_STATE_METHOD;
+    req->header_id = HTTP_HEADER_UNKNOWN;
+    req->version_major = 0;
+    req->version_minor = 0;
+    req->method_len = 0;
+    req->target_len = 0;
+    req->name_len = 0;
+    req->value_len = 0;
+    req->header_bytes = 0;
+    req->flags = 0;
+    req->accept_encoding = 0;
+    req->ws_version = 0;
+    req->content_length = 0;
+    req->range_start = -1;
+    req->range_end = -1;
+    req->method[0] = '\0';
+    req->target[0] = '\0';
+    req->ws_key[0] = '\0';
+    req->if_none_match[0] = '\0';
+}
+
+// Feed bytes into the parser. Returns HTTP_PARSE_DONE once the blank line
+// ending the headers has been consumed; *consumed tells the caller where
+// any body or pipelined data starts.
+int http_parse_request(http_request_t *req, const char *data, size_t len, size_t *consumed) {
+    size_t i = 0;
+
+    for (; i < len && req->state != HTTP_STATE_DONE; i++) {
+        unsigned char c = (unsigned char)data[i];
+
+        if (++req->header_bytes > HTTP_MAX_HEADER_BYTES) {
+            goto error;
+        }
+
+        switch (req->state) {
+            case HTTP_STATE_METHOD:
+                if (c == ' ' && req->method_len > 0) {
+                    req->method[req->method_len] = '\0';
+                    req->state = HTTP_STATE_TARGET;
+                } else if (is_tchar(c) && req->method_len < HTTP_MAX_METHOD_LEN - 1) {
+                    req->method[req->method_len++] = c;
+                } else if ((c == '\r' || c == '\n') && req->method_len == 0) {
+                    // Tolerate stray line breaks between pipelined requests
+                    req->header_bytes--;
+                } else {
+                    goto error;
+                }
+                break;
+
+            case HTTP_STATE_TARGET:
+                if (c == ' ' && req->target_len > 0) {
+                    req->target[req->target_len] = '\0';
+                    req->value_len = 0;
+                    req->state = HTTP_STATE_VERSION;
+                } else if (c > 0x20 && c < 0x7F && req->target_len < HTTP_MAX_TARGET_LEN - 1) {
+                    req->target[req->target_len++] = c;
+                } else {
+                    goto error;
+                }
+                break;
+
+            case HTTP_STATE_VERSION:
+                if (c == '\r' || c == '\n') {
+                    if (finish_version(req) != HTTP_PARSE_INCOMPLETE) goto error;
+                    req->state = (c == '\r') ? HTTP_STATE_REQUEST_LINE_LF : HTTP_STATE_HEADER_START;
+                } else if (req->value_len < 8) {
+                    req->value[req->value_len++] = c;
+                } else {
+                    goto error;
+                }
+                break;
+
+            case HTTP_STATE_REQUEST_LINE_LF:
+            case HTTP_STATE_HEADER_LF:
+                if (c != '\n') goto error;
+                req->state = HTTP_STATE_HEADER_START;
+                break;
+
+            case HTTP_STATE_HEADER_START:
+                if (c == '\r') {
+                    req->state = HTTP_STATE_HEADERS_END_LF;
+                } else if (c == '\n') {
+                    req->state = HTTP_STATE_DONE;
+                } else if (is_tchar(c)) {
+                    req->name[0] = (c >= 'A' && c <= 'Z') ? c + 32 : c;
+                    req->name_len = 1;
+                    req->state = HTTP_STATE_HEADER_NAME;
+                } else {
+                    // Obsolete line folding and garbage are both rejected
+                    goto error;
+                }
+                break;
+
+            case HTTP_STATE_HEADER_NAME:
+                if (c == ':') {
+                    req->header_id = (req->name_len < HTTP_MAX_HEADER_NAME_LEN)
+                        ? lookup_header(req->name, req->name_len)
+                        : HTTP_HEADER_UNKNOWN;
+                    req->value_len = 0;
+                    req->state = HTTP_STATE_HEADER_VALUE_START;
+                } else if (is_tchar(c)) {
+                    if (req->name_len < HTTP_MAX_HEADER_NAME_LEN) {
+                        req->name[req->name_len] = (c >= 'A' && c <= 'Z') ? c + 32 : c;
+                    }
+                    if (req->name_len < 0xFFFF) req->name_len++;
+                } else {
+                    goto error;
+                }
+                break;
+
+            case HTTP_STATE_HEADER_VALUE_START:
+                if (c == ' ' || c == '\t') {
+                    break;
+                }
+                req->state = HTTP_STATE_HEADER_VALUE;
+                // fall through
+            case HTTP_STATE_HEADER_VALUE:
+                if (c == '\r' || c == '\n') {
+                    while (req->value_len > 0 &&
+                           (req->value[req->value_len - 1] == ' ' || req->value[req->value_len - 1] == '\t')) {
+                        req->value_len--;
+                    }
+                    if (req->header_id != HTTP_HEADER_UNKNOWN && finish_header(req) != HTTP_PARSE_INCOMPLETE) {
+                        goto error;
+                    }
+                    req->header_id = HTTP_HEADER_UNKNOWN;
+                    req->state = (c == '\r') ? HTTP_STATE_HEADER_LF : HTTP_STATE_HEADER_START;
+                } else if (c < 0x20 && c != '\t') {
+                    goto error;
+                } else if (req->header_id != HTTP_HEADER_UNKNOWN) {
+                    if (req->value_len < HTTP_MAX_HEADER_VALUE_LEN) {
+                        req->value[req->value_len++] = c;
+                    } else if (req->header_id == HTTP_HEADER_CONTENT_LENGTH) {
+                        goto error;
+                    } else {
+                        // Oversized optional headers are ignored rather than half-read
+                        req->header_id = HTTP_HEADER_UNKNOWN;
+                    }
+                }
+                break;
+
+            case HTTP_STATE_HEADERS_END_LF:
+                if (c != '\n') goto error;
+                req->state = HTTP_STATE_DONE;
+                break;
+        }
+    }
+
+    if (consumed) *consumed = i;
+    return req->state == HTTP_STATE_DONE ? HTTP_PARSE_DONE : HTTP_PARSE_INCOMPLETE;
+
+error:
+    if (consumed) *consumed = i;
+    return HTTP_PARSE_ERROR;
+}
+
+int http_request_keep_alive(const http_request_t *req) {
+    if (req->flags & HTTP_FLAG_CONNECTION_CLOSE) return 0;
+    if (req->version_minor >= 1) return 1;
+    return (req->flags & HTTP_FLAG_CONNECTION_KEEP_ALIVE) != 0;
+}
+
+// Weak comparison of an entity tag against If-None-Match (RFC 7232 3.2)
+int http_etag_matches(const http_request_t *req, const char *etag) {
+    const char *list = req->if_none_match;
+    size_t etag_len = strlen(etag);
+
+    if (!(req->flags & HTTP_FLAG_HAS_IF_NONE_MATCH)) return 0;
+
+    while (*list) {
+        while (*list == ' ' || *list == '\t' || *list == ',') list++;
+        if (*list == '*') return 1;
+        if (strncmp(list, "W/", 2) == 0) list += 2;
+
+        const char *end = list;
+        while (*end && *end != ',') end++;
+        size_t len = end - list;
+        while (len > 0 && (list[len - 1] == ' ' || list[len - 1] == '\t')) len--;
+
+        if (len == etag_len && memcmp(list, etag, len) == 0) return 1;
+        list = end;
+    }
+    return 0;
+}
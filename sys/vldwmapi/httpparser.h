@@ -0,0 +1,65 @@
+#ifndef HTTPPARSER_H
+#define HTTPPARSER_H
+
+#include <stddef.h>
+
+// Limits
+#define HTTP_MAX_METHOD_LEN 16
+#define HTTP_MAX_TARGET_LEN 1024
+#define HTTP_MAX_HEADER_NAME_LEN 64
+#define HTTP_MAX_HEADER_VALUE_LEN 256
+#define HTTP_MAX_HEADER_BYTES 8192
+#define HTTP_MAX_ETAG_LIST_LEN 128
+#define WS_KEY_LEN 24
+
+// Parse results
+#define HTTP_PARSE_ERROR -1
+#define HTTP_PARSE_INCOMPLETE 0
+#define HTTP_PARSE_DONE 1
+
+// Request flags collected from the headers
+#define HTTP_FLAG_UPGRADE_WEBSOCKET 0x01
+#define HTTP_FLAG_CONNECTION_UPGRADE 0x02
+#define HTTP_FLAG_CONNECTION_CLOSE 0x04
+#define HTTP_FLAG_CONNECTION_KEEP_ALIVE 0x08
+#define HTTP_FLAG_HAS_CONTENT_LENGTH 0x10
+#define HTTP_FLAG_HAS_RANGE 0x20
+#define HTTP_FLAG_HAS_IF_NONE_MATCH 0x40
+
+// Accept-Encoding codings the daemon can serve precompressed
+#define HTTP_ENCODING_GZIP 0x01
+#define HTTP_ENCODING_BR 0x02
+
+// Incremental HTTP/1.x request parser state. Bytes can be fed in any
+// split; only the headers the daemon acts on are retained.
+typedef struct {
+    unsigned char state;
+    unsigned char header_id;
+    unsigned char version_major;
+    unsigned char version_minor;
+    unsigned short method_len;
+    unsigned short target_len;
+    unsigned short name_len;
+    unsigned short value_len;
+    unsigned int header_bytes;
+    unsigned int flags;
+    unsigned int accept_encoding;
+    int ws_version;
+    long content_length;
+    long long range_start;      // -1 for a suffix range
+    long long range_end;        // -1 for an open-ended range
+    char method[HTTP_MAX_METHOD_LEN];
+    char target[HTTP_MAX_TARGET_LEN];
+    char name[HTTP_MAX_HEADER_NAME_LEN];
+    char value[HTTP_MAX_HEADER_VALUE_LEN];
+    char ws_key[WS_KEY_LEN + 1];
+    char if_none_match[HTTP_MAX_ETAG_LIST_LEN];
+} http_request_t;
+
+// Parser functions
+void http_request_init(http_request_t *req);
+int http_parse_request(http_request_t *req, const char *data, size_t len, size_t *consumed);
+int http_request_keep_alive(const http_request_t *req);
+int http_etag_matches(const http_request_t *req, const char *etag);
+
+#endif // HTTPPARSER_H
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "idle.h"
+
+#define INPUT_DEVICE_DIR "/dev/input"
+#define DEFAULT_IDLE_TIMEOUT 300
+
+static time_t g_started = 0;
+static int g_idle_timeout = DEFAULT_IDLE_TIMEOUT;
+static int g_idle_notified = 0;
+static void (*g_idle_callback)(int idle_time) = NULL;
+
+// The kernel touches an evdev node's access time whenever it is read, so
+// the newest event* atime is the last time anyone consumed user input
+static time_t last_input_time(void) {
+    time_t latest = g_started;
+    DIR *dir = opendir(INPUT_DEVICE_DIR);
+    struct dirent *entry;
+    char path[sizeof(INPUT_DEVICE_DIR) + 256];
+    struct stat st;
+
+    if (!dir) return latest;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) != 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", INPUT_DEVICE_DIR, entry->d_name);
+        if (stat(path, &st) != 0) continue;
+        if (st.st_atime > latest) latest = st.st_atime;
+        if (st.st_mtime > latest) latest = st.st_mtime;
+    }
+    closedir(dir);
+    return latest;
+}
+
+int init_idle_detection(void) {
+    g_started = time(NULL);
+    g_idle_notified = 0;
+    printf("💤 Idle detection initialized (timeout %ds)\n", g_idle_timeout);
+    return 0;
+}
+
+void cleanup_idle_detection(void) {
+    g_idle_callback = NULL;
+    g_idle_notified = 0;
+}
+
+// Seconds since the last input event. Crossing the timeout fires the
+// registered callback once per idle period.
+int get_idle_time(void) {
+    time_t now = time(NULL);
+    time_t last = last_input_time();
+    int idle = now > last ? (int)(now - last) : 0;
+
+    if (idle < g_idle_timeout) {
+        g_idle_notified = 0;
+    } else if (!g_idle_notified && g_idle_callback) {
+        g_idle_notified = 1;
+        g_idle_callback(idle);
+    }
+    return idle;
+}
+
+int set_idle_timeout(int seconds) {
+    if (seconds <= 0) return -1;
+    g_idle_timeout = seconds;
+    g_idle_notified = 0;
+    return 0;
+}
+
+void register_idle_callback(void (*callback)(int idle_time)) {
+    g_idle_callback = callback;
+    g_idle_notified = 0;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "imagescale.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+// Source pixels feeding each destination pixel along one axis, with
+// their coverage weights (summing to 1)
+typedef struct {
+    int *start;
+    int *count;
+    float *weights;             // max_count per destination pixel
+    int max_count;
+} contrib_t;
+
+static int g_use_simd = HAVE_SSE2;
+
+static void free_contrib(contrib_t *c) {
+    free(c->start);
+    free(c->count);
+    free(c->weights);
+}
+
+// Area coverage: destination pixel i spans [i * scale, (i + 1) * scale)
+// in source coordinates
+static int build_contrib(contrib_t *c, int src_size, int dst_size) {
+    double scale = (double)src_size / dst_size;
+
+    c->max_count = (int)scale + 2;
+    c->start = malloc(dst_size * sizeof(int));
+    c->count = malloc(dst_size * sizeof(int));
+    c->weights = malloc((size_t)dst_size * c->max_count * sizeof(float));
+    if (!c->start || !c->count || !c->weights) {
+        free_contrib(c);
+        return -1;
+    }
+
+    for (int i = 0; i < dst_size; i++) {
+        double lo = i * scale, hi = (i + 1) * scale;
+        int first = (int)lo, n = 0;
+        float *w = c->weights + (size_t)i * c->max_count;
+
+        if (hi > src_size) hi = src_size;
+        for (int j = first; j < hi && n < c->max_count; j++) {
+            double a = lo > j ? lo : j;
+            double b = hi < j + 1 ? hi : j + 1;
+            if (b > a) w[n++] = (float)((b - a) / scale);
+        }
+        c->start[i] = first;
+        c->count[i] = n;
+    }
+    return 0;
+}
+
+// One source row, scaled horizontally into float RGBA
+static void scale_row_scalar(const unsigned char *row, const contrib_t *c, int dst_width, float *out) {
+    for (int i = 0; i < dst_width; i++) {
+        const unsigned char *p = row + (size_t)c->start[i] * 4;
+        const float *w = c->weights + (size_t)i * c->max_count;
+        float r = 0, g = 0, b = 0, a = 0;
+        for (int k = 0; k < c->count[i]; k++, p += 4) {
+            r += p[0] * w[k];
+            g += p[1] * w[k];
+            b += p[2] * w[k];
+            a += p[3] * w[k];
+        }
+        out[i * 4] = r;
+        out[i * 4 + 1] = g;
+        out[i * 4 + 2] = b;
+        out[i * 4 + 3] = a;
+    }
+}
+
+static void accumulate_scalar(float *acc, const float *row, float weight, int n) {
+    for (int i = 0; i < n; i++) acc[i] += row[i] * weight;
+}
+
+static void store_scalar(const float *acc, unsigned char *dst, int n) {
+    for (int i = 0; i < n; i++) {
+        float v = acc[i] + 0.5f;
+        dst[i] = v <= 0 ? 0 : v >= 255 ? 255 : (unsigned char)v;
+    }
+}
+
+#if HAVE_SSE2
+// The four channels of a pixel ride in the four lanes of one register
+static inline __m128 load_pixel(const unsigned char *p) {
+    int32_t bits;
+    memcpy(&bits, p, sizeof(bits));
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+
+static void scale_row_sse2(const unsigned char *row, const contrib_t *c, int dst_width, float *out) {
+    for (int i = 0; i < dst_width; i++) {
+        const unsigned char *p = row + (size_t)c->start[i] * 4;
+        const float *w = c->weights + (size_t)i * c->max_count;
+        __m128 acc = _mm_setzero_ps();
+        for (int k = 0; k < c->count[i]; k++, p += 4) {
+            acc = _mm_add_ps(acc, _mm_mul_ps(load_pixel(p), _mm_set1_ps(w[k])));
+        }
+        _mm_storeu_ps(out + i * 4, acc);
+    }
+}
+
+static void accumulate_sse2(float *acc, const float *row, float weight, int n) {
+    __m128 w = _mm_set1_ps(weight);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+        _mm_storeu_ps(acc + i + 4, _mm_add_ps(_mm_loadu_ps(acc + i + 4), _mm_mul_ps(_mm_loadu_ps(row + i + 4), w)));
+    }
+    for (; i < n; i += 4) {
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+    }
+}
+
+// Round, saturate and narrow four pixels at a time
+static void store_sse2(const float *acc, unsigned char *dst, int n) {
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_cvtps_epi32(_mm_loadu_ps(acc + i));
+        __m128i b = _mm_cvtps_epi32(_mm_loadu_ps(acc + i + 4));
+        __m128i c = _mm_cvtps_epi32(_mm_loadu_ps(acc + i + 8));
+        __m128i d = _mm_cvtps_epi32(_mm_loadu_ps(acc + i + 12));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i *)(dst + i), bytes);
+    }
+    for (; i < n; i += 4) {
+        __m128i a = _mm_cvtps_epi32(_mm_loadu_ps(acc + i));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, a), a);
+        int32_t bits = _mm_cvtsi128_si32(bytes);
+        memcpy(dst + i, &bits, sizeof(bits));
+    }
+}
+#endif
+
+// Separable: each destination row sums the horizontally scaled source
+// rows it covers. Only two scaled rows are kept, since neighbouring
+// destination rows share at most their boundary row.
+int image_scale_rgba(const unsigned char *src, int src_width, int src_height, size_t src_stride,
+                     unsigned char *dst, int dst_width, int dst_height) {
+    contrib_t cx, cy;
+    int n = dst_width * 4;
+    int simd = g_use_simd;
+    int result = -1;
+
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) return -1;
+    if (build_contrib(&cx, src_width, dst_width) != 0) return -1;
+    if (build_contrib(&cy, src_height, dst_height) != 0) {
+        free_contrib(&cx);
+        return -1;
+    }
+
+    float *acc = malloc(n * sizeof(float));
+    float *row = malloc(n * sizeof(float));
+    float *cache = malloc(n * sizeof(float));
+    int cached_y = -1;
+    if (!acc || !row || !cache) goto out;
+
+    for (int y = 0; y < dst_height; y++) {
+        const float *w = cy.weights + (size_t)y * cy.max_count;
+        int last_scaled = -1;
+
+        memset(acc, 0, n * sizeof(float));
+        for (int k = 0; k < cy.count[y]; k++) {
+            int sy = cy.start[y] + k;
+            const float *scaled = cache;
+            if (sy != cached_y) {
+                const unsigned char *line = src + (size_t)sy * src_stride;
+#if HAVE_SSE2
+                if (simd) scale_row_sse2(line, &cx, dst_width, row);
+                else
+#endif
+                scale_row_scalar(line, &cx, dst_width, row);
+                scaled = row;
+                last_scaled = sy;
+            }
+#if HAVE_SSE2
+            if (simd) accumulate_sse2(acc, scaled, w[k], n);
+            else
+#endif
+            accumulate_scalar(acc, scaled, w[k], n);
+        }
+        if (last_scaled >= 0) {
+            float *swap = cache;
+            cache = row;
+            row = swap;
+            cached_y = last_scaled;
+        }
+
+        unsigned char *out_line = dst + (size_t)y * dst_width * 4;
+#if HAVE_SSE2
+        if (simd) store_sse2(acc, out_line, n);
+        else
+#endif
+        store_scalar(acc, out_line, n);
+    }
+    result = 0;
+
+out:
+    free(acc);
+    free(row);
+    free(cache);
+    free_contrib(&cx);
+    free_contrib(&cy);
+    return result;
+}
+
+// Largest size with the same aspect ratio that fits a box x box square;
+// images already inside it keep their size
+void image_fit(int width, int height, int box, int *fit_width, int *fit_height) {
+    if (width <= box && height <= box) {
+        *fit_width = width;
+        *fit_height = height;
+    } else if (width >= height) {
+        *fit_width = box;
+        *fit_height = (int)((double)height * box / width + 0.5);
+    } else {
+        *fit_height = box;
+        *fit_width = (int)((double)width * box / height + 0.5);
+    }
+    if (*fit_width < 1) *fit_width = 1;
+    if (*fit_height < 1) *fit_height = 1;
+}
+
+// For benchmarks: compare the SIMD kernels against the scalar ones
+void image_scale_set_simd(int enabled) {
+    g_use_simd = enabled && HAVE_SSE2;
+}
+
+int image_scale_simd_available(void) {
+    return HAVE_SSE2;
+}
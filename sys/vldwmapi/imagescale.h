@@ -0,0 +1,15 @@
+#ifndef IMAGESCALE_H
+#define IMAGESCALE_H
+
+#include <stddef.h>
+
+// Image scaling functions. Pixels are 8-bit RGBA; the filter averages
+// each destination pixel over the source area it covers, so downscaling
+// by any factor keeps fine detail from aliasing.
+int image_scale_rgba(const unsigned char *src, int src_width, int src_height, size_t src_stride,
+                     unsigned char *dst, int dst_width, int dst_height);
+void image_fit(int width, int height, int box, int *fit_width, int *fit_height);
+void image_scale_set_simd(int enabled);
+int image_scale_simd_available(void);
+
+#endif // IMAGESCALE_H
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsonreader.h"
+
+typedef struct {
+    arena_t *arena;
+    const char *p;
+    const char *end;
+    int depth;
+} json_reader_t;
+
+static json_value_t *parse_value(json_reader_t *r);
+
+static void skip_space(json_reader_t *r) {
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r')) r->p++;
+}
+
+static json_value_t *new_value(json_reader_t *r, json_value_type_t type) {
+    json_value_t *value = arena_alloc(r->arena, sizeof(json_value_t));
+    if (!value) return NULL;
+    memset(value, 0, sizeof(*value));
+    value->type = type;
+    return value;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int read_hex4(json_reader_t *r, unsigned int *out) {
+    if (r->end - r->p < 4) return -1;
+    unsigned int v = 0;
+    for (int i = 0; i < 4; i++) {
+        int h = hex_value(r->p[i]);
+        if (h < 0) return -1;
+        v = (v << 4) | h;
+    }
+    r->p += 4;
+    *out = v;
+    return 0;
+}
+
+static char *put_utf8(char *out, unsigned int cp) {
+    if (cp < 0x80) {
+        *out++ = (char)cp;
+    } else if (cp < 0x800) {
+        *out++ = (char)(0xC0 | (cp >> 6));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        *out++ = (char)(0xE0 | (cp >> 12));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    } else {
+        *out++ = (char)(0xF0 | (cp >> 18));
+        *out++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+        *out++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+        *out++ = (char)(0x80 | (cp & 0x3F));
+    }
+    return out;
+}
+
+// Unescape a string literal into the arena. The opening quote has been
+// consumed. The unescaped text is never longer than the source.
+static const char *parse_string(json_reader_t *r, size_t *out_len) {
+    const char *start = r->p;
+    const char *q = start;
+
+    while (q < r->end && *q != '"') {
+        if ((unsigned char)*q < 0x20) return NULL;
+        q += (*q == '\\') ? 2 : 1;
+    }
+    if (q >= r->end) return NULL;
+
+    char *out = arena_alloc(r->arena, (q - start) + 1);
+    if (!out) return NULL;
+
+    char *o = out;
+    while (r->p < q) {
+        char c = *r->p++;
+        if (c != '\\') {
+            *o++ = c;
+            continue;
+        }
+        c = *r->p++;
+        switch (c) {
+            case '"': *o++ = '"'; break;
+            case '\\': *o++ = '\\'; break;
+            case '/': *o++ = '/'; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u': {
+                unsigned int cp, low;
+                if (read_hex4(r, &cp) != 0) return NULL;
+                // Surrogate pair: 12 source bytes become 4 output bytes
+                if (cp >= 0xD800 && cp < 0xDC00 && q - r->p >= 6 && r->p[0] == '\\' && r->p[1] == 'u') {
+                    r->p += 2;
+                    if (read_hex4(r, &low) != 0 || low < 0xDC00 || low > 0xDFFF) return NULL;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xD800 && cp < 0xE000) {
+                    return NULL;
+                }
+                if (cp == 0) return NULL;   // Would truncate the C string
+                o = put_utf8(o, cp);
+                break;
+            }
+            default:
+                return NULL;
+        }
+    }
+    r->p = q + 1;
+    *o = '\0';
+    *out_len = o - out;
+    return out;
+}
+
+static json_value_t *parse_number(json_reader_t *r) {
+    char digits[64];
+    const char *start = r->p;
+
+    if (r->p < r->end && *r->p == '-') r->p++;
+    while (r->p < r->end && ((*r->p >= '0' && *r->p <= '9') || *r->p == '.' ||
+                             *r->p == 'e' || *r->p == 'E' || *r->p == '+' || *r->p == '-')) {
+        r->p++;
+    }
+
+    size_t len = r->p - start;
+    if (len == 0 || len >= sizeof(digits)) return NULL;
+    memcpy(digits, start, len);
+    digits[len] = '\0';
+
+    char *end;
+    json_value_t *value = new_value(r, JSON_VALUE_NUMBER);
+    if (!value) return NULL;
+    value->u.number = strtod(digits, &end);
+    return (*end == '\0') ? value : NULL;
+}
+
+static int match_literal(json_reader_t *r, const char *literal, size_t len) {
+    if ((size_t)(r->end - r->p) < len || memcmp(r->p, literal, len) != 0) return 0;
+    r->p += len;
+    return 1;
+}
+
+// Arrays and objects; members are appended in document order
+static json_value_t *parse_container(json_reader_t *r, int is_object) {
+    char close = is_object ? '}' : ']';
+    json_value_t *container = new_value(r, is_object ? JSON_VALUE_OBJECT : JSON_VALUE_ARRAY);
+    json_value_t **tail;
+
+    if (!container || ++r->depth > JSON_READER_MAX_DEPTH) return NULL;
+    tail = &container->u.child;
+
+    skip_space(r);
+    if (r->p < r->end && *r->p == close) {
+        r->p++;
+        r->depth--;
+        return container;
+    }
+
+    for (;;) {
+        const char *key = NULL;
+        size_t key_len;
+
+        skip_space(r);
+        if (is_object) {
+            if (r->p >= r->end || *r->p != '"') return NULL;
+            r->p++;
+            if (!(key = parse_string(r, &key_len))) return NULL;
+            skip_space(r);
+            if (r->p >= r->end || *r->p != ':') return NULL;
+            r->p++;
+        }
+
+        json_value_t *value = parse_value(r);
+        if (!value) return NULL;
+        value->key = key;
+        *tail = value;
+        tail = &value->next;
+
+        skip_space(r);
+        if (r->p >= r->end) return NULL;
+        if (*r->p == ',') {
+            r->p++;
+            continue;
+        }
+        if (*r->p != close) return NULL;
+        r->p++;
+        r->depth--;
+        return container;
+    }
+}
+
+static json_value_t *parse_value(json_reader_t *r) {
+    json_value_t *value;
+
+    skip_space(r);
+    if (r->p >= r->end) return NULL;
+
+    switch (*r->p) {
+        case '{':
+            r->p++;
+            return parse_container(r, 1);
+        case '[':
+            r->p++;
+            return parse_container(r, 0);
+        case '"':
+            r->p++;
+            if (!(value = new_value(r, JSON_VALUE_STRING))) return NULL;
+            value->u.string.ptr = parse_string(r, &value->u.string.len);
+            return value->u.string.ptr ? value : NULL;
+        case 't':
+        case 'f':
+            if (!(value = new_value(r, JSON_VALUE_BOOL))) return NULL;
+            value->u.boolean = (*r->p == 't');
+            return match_literal(r, value->u.boolean ? "true" : "false", value->u.boolean ? 4 : 5) ? value : NULL;
+        case 'n':
+            return match_literal(r, "null", 4) ? new_value(r, JSON_VALUE_NULL) : NULL;
+        default:
+            return parse_number(r);
+    }
+}
+
+// Parse one complete document; NULL on any syntax error or trailing data
+json_value_t *json_read(arena_t *arena, const char *text, size_t len) {
+    json_reader_t reader = { arena, text, text + len, 0 };
+    json_value_t *root = parse_value(&reader);
+
+    if (!root) return NULL;
+    skip_space(&reader);
+    return reader.p == reader.end ? root : NULL;
+}
+
+const json_value_t *json_value_member(const json_value_t *object, const char *key) {
+    if (!object || object->type != JSON_VALUE_OBJECT) return NULL;
+    for (const json_value_t *member = object->u.child; member; member = member->next) {
+        if (strcmp(member->key, key) == 0) return member;
+    }
+    return NULL;
+}
+
+// String member of an object, or NULL if missing or not a string
+const char *json_value_get_string(const json_value_t *object, const char *key) {
+    const json_value_t *member = json_value_member(object, key);
+    return (member && member->type == JSON_VALUE_STRING) ? member->u.string.ptr : NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include <stddef.h>
+#include "arena.h"
+
+// Constants
+#define JSON_READER_MAX_DEPTH 32
+
+typedef enum {
+    JSON_VALUE_NULL = 0,
+    JSON_VALUE_BOOL,
+    JSON_VALUE_NUMBER,
+    JSON_VALUE_STRING,
+    JSON_VALUE_ARRAY,
+    JSON_VALUE_OBJECT
+} json_value_type_t;
+
+// Parsed JSON value. Every node and every unescaped string lives in the
+// arena passed to json_read(), so the whole document goes away with
+// arena_reset().
+typedef struct json_value {
+    json_value_type_t type;
+    const char *key;            // Member name inside an object, else NULL
+    struct json_value *next;    // Next array element or object member
+    union {
+        int boolean;
+        double number;
+        struct {
+            const char *ptr;    // NUL-terminated
+            size_t len;
+        } string;
+        struct json_value *child;   // First element or member
+    } u;
+} json_value_t;
+
+// JSON reader functions
+json_value_t *json_read(arena_t *arena, const char *text, size_t len);
+const json_value_t *json_value_member(const json_value_t *object, const char *key);
+const char *json_value_get_string(const json_value_t *object, const char *key);
+
+#endif // JSONREADER_H
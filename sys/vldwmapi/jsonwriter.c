@@ -0,0 +1,240 @@
+#include <string.h>
+#include <math.h>
+
+#include "jsonwriter.h"
+#include "bufpool.h"
+
+// 0 = copy as is, otherwise the character after the backslash ('u' for
+// the \u00XX form)
+static const char escape_table[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Make room for `extra` more bytes; returns 0 or -1 with w->error set
+static int reserve(json_writer_t *w, size_t extra) {
+    if (w->error) return -1;
+    if (w->len + extra <= w->cap) return 0;
+
+    size_t needed = w->len + extra;
+    if (needed < JSON_WRITER_INITIAL_SIZE) needed = JSON_WRITER_INITIAL_SIZE;
+
+    char *buf = bufpool_grow(w->buf, w->len, &w->cap, needed);
+    if (!buf) {
+        w->error = 1;
+        return -1;
+    }
+    w->buf = buf;
+    return 0;
+}
+
+static void put(json_writer_t *w, const char *data, size_t len) {
+    if (reserve(w, len) != 0) return;
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+// Comma before a value unless it directly follows its key
+static void begin_value(json_writer_t *w) {
+    uint32_t bit = 1u << w->depth;
+    if (w->after_key) {
+        w->after_key = 0;
+        return;
+    }
+    if (w->need_comma & bit) put(w, ",", 1);
+    w->need_comma |= bit;
+}
+
+void json_writer_init(json_writer_t *w, size_t headroom) {
+    memset(w, 0, sizeof(*w));
+    w->headroom = headroom;
+    w->len = headroom;
+}
+
+// Start a new document, keeping the buffer for reuse
+void json_writer_reset(json_writer_t *w) {
+    w->len = w->headroom;
+    w->need_comma = 0;
+    w->depth = 0;
+    w->after_key = 0;
+    w->error = 0;
+}
+
+// Hand the buffer back to the pool; the writer can be used again
+void json_writer_free(json_writer_t *w) {
+    bufpool_put(w->buf, w->cap);
+    json_writer_init(w, w->headroom);
+}
+
+char *json_writer_payload(json_writer_t *w) {
+    return w->buf ? w->buf + w->headroom : NULL;
+}
+
+size_t json_writer_payload_len(const json_writer_t *w) {
+    return w->len - w->headroom;
+}
+
+static void begin_container(json_writer_t *w, char open) {
+    begin_value(w);
+    if (w->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        w->error = 1;
+        return;
+    }
+    put(w, &open, 1);
+    w->depth++;
+    w->need_comma &= ~(1u << w->depth);
+}
+
+static void end_container(json_writer_t *w, char close) {
+    if (w->depth == 0 || w->after_key) {
+        w->error = 1;
+        return;
+    }
+    w->depth--;
+    put(w, &close, 1);
+}
+
+void json_begin_object(json_writer_t *w) {
+    begin_container(w, '{');
+}
+
+void json_end_object(json_writer_t *w) {
+    end_container(w, '}');
+}
+
+void json_begin_array(json_writer_t *w) {
+    begin_container(w, '[');
+}
+
+void json_end_array(json_writer_t *w) {
+    end_container(w, ']');
+}
+
+// quoted_key is the complete `"name":` text, see json_key()
+void json_write_key(json_writer_t *w, const char *quoted_key, size_t len) {
+    uint32_t bit = 1u << w->depth;
+    if (reserve(w, len + 1) != 0) return;
+    if (w->need_comma & bit) w->buf[w->len++] = ',';
+    w->need_comma |= bit;
+    memcpy(w->buf + w->len, quoted_key, len);
+    w->len += len;
+    w->after_key = 1;
+}
+
+void json_write_string_len(json_writer_t *w, const char *s, size_t len) {
+    begin_value(w);
+    // Worst case every byte becomes \u00XX
+    if (reserve(w, len * 6 + 2) != 0) return;
+
+    char *out = w->buf + w->len;
+    *out++ = '"';
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        char esc = escape_table[(unsigned char)s[i]];
+        if (!esc) continue;
+
+        memcpy(out, s + run, i - run);
+        out += i - run;
+        run = i + 1;
+        *out++ = '\\';
+        *out++ = esc;
+        if (esc == 'u') {
+            *out++ = '0';
+            *out++ = '0';
+            *out++ = hex_digits[(unsigned char)s[i] >> 4];
+            *out++ = hex_digits[s[i] & 0xF];
+        }
+    }
+    memcpy(out, s + run, len - run);
+    out += len - run;
+    *out++ = '"';
+    w->len = out - w->buf;
+}
+
+void json_write_string(json_writer_t *w, const char *s) {
+    if (!s) {
+        json_write_null(w);
+        return;
+    }
+    json_write_string_len(w, s, strlen(s));
+}
+
+// Digits are produced backwards into a small scratch buffer
+static size_t format_uint(uint64_t v, char *end) {
+    char *p = end;
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    return end - p;
+}
+
+void json_write_uint(json_writer_t *w, uint64_t v) {
+    char digits[20];
+    size_t n = format_uint(v, digits + sizeof(digits));
+    begin_value(w);
+    put(w, digits + sizeof(digits) - n, n);
+}
+
+void json_write_int(json_writer_t *w, int64_t v) {
+    char digits[21];
+    uint64_t magnitude = v < 0 ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+    size_t n = format_uint(magnitude, digits + sizeof(digits));
+    if (v < 0) digits[sizeof(digits) - ++n] = '-';
+    begin_value(w);
+    put(w, digits + sizeof(digits) - n, n);
+}
+
+// Fixed-point output with a set number of decimals (at most 9); values
+// that don't fit, and NaN/infinity, are written as null
+void json_write_fixed(json_writer_t *w, double v, int decimals) {
+    static const double scales[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+    char digits[32];
+
+    if (decimals < 0) decimals = 0;
+    if (decimals > 9) decimals = 9;
+    if (!isfinite(v) || fabs(v) * scales[decimals] >= 9e18) {
+        json_write_null(w);
+        return;
+    }
+
+    uint64_t scaled = (uint64_t)(fabs(v) * scales[decimals] + 0.5);
+    int negative = v < 0 && scaled != 0;
+    char *end = digits + sizeof(digits), *p = end;
+    for (int i = 0; i < decimals; i++) {
+        *--p = (char)('0' + scaled % 10);
+        scaled /= 10;
+    }
+    if (decimals) *--p = '.';
+    p -= format_uint(scaled, p);
+    if (negative) *--p = '-';
+
+    begin_value(w);
+    put(w, p, end - p);
+}
+
+void json_write_bool(json_writer_t *w, int v) {
+    begin_value(w);
+    if (v) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void json_write_null(json_writer_t *w) {
+    begin_value(w);
+    put(w, "null", 4);
+}
+
+// Already-serialized JSON, e.g. a constant sub-document
+void json_write_raw(json_writer_t *w, const char *json, size_t len) {
+    begin_value(w);
+    put(w, json, len);
+}
@@ -0,0 +1,58 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define JSON_WRITER_INITIAL_SIZE 4096
+#define JSON_WRITER_MAX_DEPTH 32
+
+// Streaming JSON output into one growable buffer. The first `headroom`
+// bytes are left free so a frame header can be put in front of the
+// document without copying it.
+typedef struct {
+    char *buf;
+    size_t len;                 // Includes headroom
+    size_t cap;
+    size_t headroom;
+    uint32_t need_comma;        // One bit per nesting level
+    int depth;
+    int after_key;
+    int error;                  // Allocation failure or bad nesting; output unusable
+} json_writer_t;
+
+// Writer lifecycle
+void json_writer_init(json_writer_t *w, size_t headroom);
+void json_writer_reset(json_writer_t *w);
+void json_writer_free(json_writer_t *w);
+char *json_writer_payload(json_writer_t *w);
+size_t json_writer_payload_len(const json_writer_t *w);
+
+// Structure
+void json_begin_object(json_writer_t *w);
+void json_end_object(json_writer_t *w);
+void json_begin_array(json_writer_t *w);
+void json_end_array(json_writer_t *w);
+void json_write_key(json_writer_t *w, const char *quoted_key, size_t len);
+
+// Values
+void json_write_string(json_writer_t *w, const char *s);
+void json_write_string_len(json_writer_t *w, const char *s, size_t len);
+void json_write_int(json_writer_t *w, int64_t v);
+void json_write_uint(json_writer_t *w, uint64_t v);
+void json_write_fixed(json_writer_t *w, double v, int decimals);
+void json_write_bool(json_writer_t *w, int v);
+void json_write_null(json_writer_t *w);
+void json_write_raw(json_writer_t *w, const char *json, size_t len);
+
+// Keys are string literals, quoted and terminated at compile time, so
+// field order and spelling are fixed by the code writing them
+#define json_key(w, lit) json_write_key((w), "\"" lit "\":", sizeof(lit) + 2)
+
+#define json_field_string(w, lit, v) do { json_key(w, lit); json_write_string((w), (v)); } while (0)
+#define json_field_int(w, lit, v) do { json_key(w, lit); json_write_int((w), (v)); } while (0)
+#define json_field_uint(w, lit, v) do { json_key(w, lit); json_write_uint((w), (v)); } while (0)
+#define json_field_bool(w, lit, v) do { json_key(w, lit); json_write_bool((w), (v)); } while (0)
+
+#endif // JSONWRITER_H
@@ -0,0 +1,684 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/capability.h>
+
+#include "launcher.h"
+#include "metrics.h"
+
+#define HELPER_MAX_ARGS 1024
+#define HELPER_MAX_GROUPS 256
+#define HELPER_STACK_SIZE (64 * 1024)
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+extern char **environ;
+
+// Daemon -> helper: the header, then NUL-terminated strings: the user
+// name, argc arguments, envc environment entries and, if has_cwd and
+// has_cgroup, the working directory and the cgroup directory
+typedef struct {
+    uint32_t request;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t has_cwd;
+    uint32_t has_cgroup;
+    uint64_t owner;                 // Echoed when the program exits
+} spawn_header_t;
+
+enum {
+    HELPER_SPAWNED = 1,             // Answer to a request; the pidfd rides along as SCM_RIGHTS
+    HELPER_EXITED                   // A program the helper started was reaped
+};
+
+// Helper -> daemon
+typedef struct {
+    uint32_t type;
+    uint32_t request;               // SPAWNED
+    int32_t pid;
+    int32_t error;                  // SPAWNED: 0 once exec succeeded
+    int32_t exit_code;              // EXITED: -1 when killed by a signal
+    int32_t signal;
+    uint64_t owner;                 // EXITED
+    uint64_t exec_ns;               // SPAWNED: CLOCK_MONOTONIC once exec succeeded
+    uint64_t runtime_ns;            // EXITED
+} helper_message_t;
+
+typedef struct {
+    uint32_t request;
+    uint64_t owner;
+    uint64_t start;
+} pending_launch_t;
+
+// Launch state a new binary takes over with the helper's socket
+typedef struct {
+    uint32_t next_request;
+    int32_t running;
+} launcher_state_t;
+
+static int g_helper_fd = -1;
+static pid_t g_helper_pid = -1;                 // -1 too for a helper taken over from the last binary
+static int g_signal_fd = -1;
+static sigset_t g_saved_mask;
+static uint32_t g_next_request = 1;
+
+static pending_launch_t g_pending[LAUNCHER_MAX_IN_FLIGHT];
+static int g_pending_count = 0;
+static int g_running = 0;                       // Started and not yet reported exited
+static launch_event_t g_events[LAUNCHER_MAX_EVENTS];
+static int g_event_head = 0, g_event_count = 0;
+
+static void push_event(const launch_event_t *event) {
+    if (g_event_count == LAUNCHER_MAX_EVENTS) {
+        printf("⚠️ Launcher event queue full, dropping event for pid %d\n", event->pid);
+        if (event->pidfd >= 0) close(event->pidfd);
+        return;
+    }
+    g_events[(g_event_head + g_event_count++) % LAUNCHER_MAX_EVENTS] = *event;
+}
+
+// The helper is this binary again, started with posix_spawn (vfork
+// semantics), so the daemon's address space is never copied
+static int start_helper(void) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none, all;
+    int sv[2];
+    char *argv[] = { "/proc/self/exe", LAUNCHER_HELPER_ARG, NULL };
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+        perror("socketpair");
+        return -1;
+    }
+    // dup2 onto itself would keep close-on-exec
+    if (sv[1] == LAUNCHER_HELPER_FD) {
+        int moved = fcntl(sv[1], F_DUPFD_CLOEXEC, LAUNCHER_HELPER_FD + 1);
+        close(sv[1]);
+        sv[1] = moved;
+    }
+
+    sigemptyset(&none);
+    sigfillset(&all);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], LAUNCHER_HELPER_FD);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &all);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    int err = sv[1] >= 0 ? posix_spawn(&g_helper_pid, argv[0], &actions, &attr, argv, environ) : errno;
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (sv[1] >= 0) close(sv[1]);
+    if (err != 0) {
+        fprintf(stderr, "❌ Could not start launch helper: %s\n", strerror(err));
+        close(sv[0]);
+        g_helper_pid = -1;
+        return -1;
+    }
+
+    g_helper_fd = sv[0];
+    fcntl(g_helper_fd, F_SETFL, fcntl(g_helper_fd, F_GETFL) | O_NONBLOCK);
+    printf("🚀 Launch helper running as pid %d\n", g_helper_pid);
+    return 0;
+}
+
+// Requests the helper will never answer
+static void fail_pending(int error) {
+    for (int i = 0; i < g_pending_count; i++) {
+        launch_event_t event = { .type = LAUNCH_EVENT_FAILED, .request = g_pending[i].request,
+                                 .owner = g_pending[i].owner, .error = error, .pidfd = -1 };
+        push_event(&event);
+    }
+    g_pending_count = 0;
+}
+
+// Programs of a helper that died are never reported; they no longer
+// count against the limit
+static void helper_gone(void) {
+    if (g_helper_fd >= 0) close(g_helper_fd);
+    g_helper_fd = -1;
+    g_running = 0;
+    fail_pending(EPIPE);
+}
+
+int init_launcher(void) {
+    sigset_t mask;
+
+    printf("🚀 Initializing launcher...\n");
+
+    // The helper is our child; its SIGCHLD is read from a signalfd
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &g_saved_mask);
+    g_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (g_signal_fd < 0) {
+        perror("signalfd");
+        return -1;
+    }
+
+    g_pending_count = g_running = g_event_count = g_event_head = 0;
+    return start_helper();
+}
+
+// The helper exits when its socket closes; running programs stay
+static void stop_helper(void) {
+    if (g_helper_fd >= 0) close(g_helper_fd);
+    g_helper_fd = -1;
+    if (g_helper_pid > 0) waitpid(g_helper_pid, NULL, 0);
+    g_helper_pid = -1;
+}
+
+void cleanup_launcher(void) {
+    printf("🚀 Cleaning up launcher...\n");
+
+    stop_helper();
+    g_running = 0;
+    if (g_signal_fd >= 0) close(g_signal_fd);
+    g_signal_fd = -1;
+    pthread_sigmask(SIG_SETMASK, &g_saved_mask, NULL);
+}
+
+int launcher_helper_fd(void) {
+    return g_helper_fd;
+}
+
+int launcher_signal_fd(void) {
+    return g_signal_fd;
+}
+
+static int append_string(char *buf, size_t *len, const char *s) {
+    size_t n = strlen(s) + 1;
+    if (*len + n > LAUNCHER_MAX_MESSAGE) return -1;
+    memcpy(buf + *len, s, n);
+    *len += n;
+    return 0;
+}
+
+// Queue a spawn with the helper. Returns 0, or a negative errno: -EBUSY
+// when too many launches are in flight or running, -E2BIG when the
+// request doesn't fit one message.
+int launcher_submit(const launch_request_t *request, uint32_t *request_number) {
+    static char buf[LAUNCHER_MAX_MESSAGE];
+    spawn_header_t header;
+    size_t len = sizeof(header);
+
+    if (g_helper_fd < 0 && start_helper() != 0) return -EAGAIN;
+    if (g_pending_count == LAUNCHER_MAX_IN_FLIGHT || g_pending_count + g_running >= LAUNCHER_MAX_CHILDREN) {
+        return -EBUSY;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.request = g_next_request++;
+    if (!g_next_request) g_next_request = 1;
+    header.uid = request->uid;
+    header.gid = request->gid;
+    header.has_cwd = request->cwd != NULL;
+    header.has_cgroup = request->cgroup != NULL;
+    header.owner = request->owner;
+
+    if (append_string(buf, &len, request->user) != 0) return -E2BIG;
+    for (; request->argv[header.argc]; header.argc++) {
+        if (header.argc == HELPER_MAX_ARGS || append_string(buf, &len, request->argv[header.argc]) != 0) return -E2BIG;
+    }
+    for (; request->envp[header.envc]; header.envc++) {
+        if (header.envc == HELPER_MAX_ARGS || append_string(buf, &len, request->envp[header.envc]) != 0) return -E2BIG;
+    }
+    if (request->cwd && append_string(buf, &len, request->cwd) != 0) return -E2BIG;
+    if (request->cgroup && append_string(buf, &len, request->cgroup) != 0) return -E2BIG;
+    if (header.argc == 0) return -EINVAL;
+    memcpy(buf, &header, sizeof(header));
+
+    // Never wait on the helper; a full socket means it is far behind
+    if (send(g_helper_fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        int error = errno;
+        if (error != EAGAIN) helper_gone();
+        return error == EAGAIN ? -EBUSY : -error;
+    }
+
+    pending_launch_t *pending = &g_pending[g_pending_count++];
+    pending->request = header.request;
+    pending->owner = request->owner;
+    pending->start = request->start;
+    *request_number = header.request;
+    return 0;
+}
+
+// pidfd, if not -1, came with the reply and is handed on with the event
+static void handle_spawned(const helper_message_t *reply, int pidfd) {
+    int index = -1;
+    for (int i = 0; i < g_pending_count; i++) {
+        if (g_pending[i].request == reply->request) index = i;
+    }
+    if (index < 0) {
+        if (pidfd >= 0) close(pidfd);
+        return;
+    }
+
+    pending_launch_t pending = g_pending[index];
+    g_pending[index] = g_pending[--g_pending_count];
+
+    launch_event_t event = { .request = pending.request, .owner = pending.owner, .pid = reply->pid, .pidfd = -1 };
+    if (reply->error == 0 && reply->pid > 0) {
+        event.type = LAUNCH_EVENT_STARTED;
+        event.latency_ns = reply->exec_ns > pending.start ? reply->exec_ns - pending.start : 0;
+        event.pidfd = pidfd;
+        g_running++;
+    } else {
+        event.type = LAUNCH_EVENT_FAILED;
+        event.error = reply->error ? reply->error : EIO;
+        if (pidfd >= 0) close(pidfd);
+    }
+    push_event(&event);
+}
+
+static void handle_exited(const helper_message_t *exited) {
+    launch_event_t event = { .type = LAUNCH_EVENT_EXITED, .owner = exited->owner, .pid = exited->pid, .pidfd = -1 };
+
+    event.exit_code = exited->exit_code;
+    event.signal = exited->signal;
+    event.runtime_ns = exited->runtime_ns;
+    if (g_running > 0) g_running--;
+    push_event(&event);
+}
+
+// One message, and the descriptor a spawn reply may carry (else -1)
+static ssize_t receive_message(helper_message_t *message, int *fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { message, sizeof(*message) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+
+    *fd = -1;
+    ssize_t n = recvmsg(g_helper_fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr *c = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL; c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS && c->cmsg_len == CMSG_LEN(sizeof(int))) {
+            memcpy(fd, CMSG_DATA(c), sizeof(int));
+        }
+    }
+    return n;
+}
+
+// Read what the helper has sent: replies to launches, and the exits of
+// programs it reaped. Results come out of launcher_next_event().
+void launcher_process(void) {
+    struct signalfd_siginfo info;
+    helper_message_t message;
+    siginfo_t child;
+    ssize_t n = -1;
+    int fd;
+
+    while (g_helper_fd >= 0 && (n = receive_message(&message, &fd)) != 0) {
+        if (n == (ssize_t)sizeof(message) && message.type == HELPER_SPAWNED) {
+            handle_spawned(&message, fd);
+        } else if (n == (ssize_t)sizeof(message) && message.type == HELPER_EXITED) {
+            handle_exited(&message);
+        } else if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) helper_gone();
+            break;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (g_helper_fd >= 0 && n == 0) helper_gone();
+
+    // Only the helper is waited for, so children of other code (PAM
+    // helpers) keep their exit status
+    while (read(g_signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+    }
+    memset(&child, 0, sizeof(child));
+    if (g_helper_pid > 0 && waitid(P_PID, g_helper_pid, &child, WEXITED | WNOHANG) == 0 &&
+        child.si_pid == g_helper_pid) {
+        printf("⚠️ Launch helper exited; it will be restarted on the next launch\n");
+        g_helper_pid = -1;
+        helper_gone();
+    }
+}
+
+int launcher_next_event(launch_event_t *event) {
+    if (!g_event_count) return 0;
+    *event = g_events[g_event_head];
+    g_event_head = (g_event_head + 1) % LAUNCHER_MAX_EVENTS;
+    g_event_count--;
+    return 1;
+}
+
+// Upgrade: the helper and the programs it started outlive this process.
+// Its socket goes along with the other descriptors; nothing may be in
+// flight (the drain waits for every launch reply).
+void launcher_save_state(upgrade_buf_t *buf) {
+    launcher_state_t state = { g_next_request, g_running };
+    upgrade_put(buf, &state, sizeof(state));
+}
+
+// New binary: replace the helper this process started with the one
+// handed over (fd, or -1 when the old binary had none). The adopted
+// helper is not our child; its end shows as the socket closing. It
+// keeps running the binary it started as until then.
+int launcher_restore_state(upgrade_reader_t *reader, int fd) {
+    launcher_state_t state;
+
+    if (upgrade_get(reader, &state, sizeof(state)) != 0 || state.running < 0 ||
+        state.running > LAUNCHER_MAX_CHILDREN) {
+        return -1;
+    }
+    g_next_request = state.next_request ? state.next_request : 1;
+    if (fd < 0) return 0;
+
+    stop_helper();
+    g_helper_fd = fd;
+    fcntl(g_helper_fd, F_SETFL, fcntl(g_helper_fd, F_GETFL) | O_NONBLOCK);
+    g_running = state.running;
+    return 0;
+}
+
+// Helper process
+
+// A program started and not yet reaped
+typedef struct {
+    pid_t pid;
+    uint64_t owner;
+    uint64_t started;               // exec_ns of its spawn reply
+} helper_child_t;
+
+static helper_child_t g_helper_children[LAUNCHER_MAX_CHILDREN];
+static int g_helper_child_count = 0;
+
+typedef struct {
+    const char *path;
+    char *const *argv;
+    char *const *envp;
+    const char *cwd;
+    int cgroup_fd;                  // cgroup.procs of the program's group, or -1
+    int switch_user;
+    uid_t uid;
+    gid_t gid;
+    gid_t groups[HELPER_MAX_GROUPS];
+    int group_count;
+    int error;                      // Written by the child; the memory is shared
+} child_args_t;
+
+// Runs in the helper's memory until execve (CLONE_VM | CLONE_VFORK), so
+// only raw system calls: glibc's setuid() would try to synchronise
+// threads that aren't there
+static int child_main(void *arg) {
+    child_args_t *args = arg;
+    sigset_t none;
+
+    setsid();
+    // The helper blocks SIGCHLD for its signalfd; the program starts clean
+    sigemptyset(&none);
+    syscall(SYS_rt_sigprocmask, SIG_SETMASK, &none, NULL, _NSIG / 8);
+
+    // Join the group before exec, while still privileged, so nothing the
+    // program does escapes accounting
+    if (args->cgroup_fd >= 0 && write(args->cgroup_fd, "0", 1) != 1) {
+        args->error = errno;
+        _exit(127);
+    }
+    if (args->switch_user &&
+        (syscall(SYS_setgroups, args->group_count, args->groups) != 0 ||
+         syscall(SYS_setresgid, args->gid, args->gid, args->gid) != 0 ||
+         syscall(SYS_setresuid, args->uid, args->uid, args->uid) != 0)) {
+        args->error = errno;
+        _exit(127);
+    }
+    if (!args->cwd || chdir(args->cwd) != 0) {
+        if (chdir("/") != 0) {
+            // Exec still works from wherever we are
+        }
+    }
+    execve(args->path, args->argv, args->envp);
+    args->error = errno;
+    _exit(127);
+}
+
+// PATH from the request's environment, as execvp would
+static const char *resolve_program(const char *name, char *const *envp, char *buf, size_t size) {
+    const char *path = DEFAULT_PATH;
+
+    if (strchr(name, '/')) return name;
+    for (char *const *env = envp; *env; env++) {
+        if (strncmp(*env, "PATH=", 5) == 0) path = *env + 5;
+    }
+    while (*path) {
+        size_t len = strcspn(path, ":");
+        if (len > 0 && (size_t)snprintf(buf, size, "%.*s/%s", (int)len, path, name) < size && access(buf, X_OK) == 0) {
+            return buf;
+        }
+        path += len;
+        if (*path == ':') path++;
+    }
+    return NULL;
+}
+
+// Start one program; *pidfd is opened before the helper could reap it,
+// so it always refers to the program
+static void spawn_one(const char *msg, size_t len, helper_message_t *reply, int *pidfd) {
+    static char *argv[HELPER_MAX_ARGS + 1], *envp[HELPER_MAX_ARGS + 1];
+    static char stack[HELPER_STACK_SIZE] __attribute__((aligned(16)));
+    static child_args_t args;
+    char resolved[PATH_MAX];
+    spawn_header_t header;
+
+    memset(reply, 0, sizeof(*reply));
+    reply->type = HELPER_SPAWNED;
+    *pidfd = -1;
+    if (len < sizeof(header) || msg[len - 1] != '\0') {
+        reply->error = EINVAL;
+        return;
+    }
+    memcpy(&header, msg, sizeof(header));
+    reply->request = header.request;
+    if (g_helper_child_count == LAUNCHER_MAX_CHILDREN) {
+        reply->error = EAGAIN;
+        return;
+    }
+    if (header.argc == 0 || header.argc > HELPER_MAX_ARGS || header.envc > HELPER_MAX_ARGS) {
+        reply->error = EINVAL;
+        return;
+    }
+
+    // Split the strings; the final NUL checked above bounds every one
+    const char *p = msg + sizeof(header), *end = msg + len;
+    const char *user = p;
+    p += strlen(p) + 1;
+    for (uint32_t i = 0; i < header.argc; i++, p += strlen(p) + 1) {
+        if (p >= end) {
+            reply->error = EINVAL;
+            return;
+        }
+        argv[i] = (char *)p;
+    }
+    argv[header.argc] = NULL;
+    for (uint32_t i = 0; i < header.envc; i++, p += strlen(p) + 1) {
+        if (p >= end) {
+            reply->error = EINVAL;
+            return;
+        }
+        envp[i] = (char *)p;
+    }
+    envp[header.envc] = NULL;
+
+    memset(&args, 0, sizeof(args));
+    args.cgroup_fd = -1;
+    if (header.has_cwd && p < end) {
+        args.cwd = p;
+        p += strlen(p) + 1;
+    }
+    args.argv = argv;
+    args.envp = envp;
+    args.uid = header.uid;
+    args.gid = header.gid;
+    args.switch_user = header.uid != geteuid() || header.gid != getegid();
+    if (args.switch_user) {
+        args.group_count = HELPER_MAX_GROUPS;
+        if (getgrouplist(user, header.gid, args.groups, &args.group_count) < 0) {
+            args.groups[0] = header.gid;
+            args.group_count = 1;
+        }
+    }
+    if (!(args.path = resolve_program(argv[0], envp, resolved, sizeof(resolved)))) {
+        reply->error = ENOENT;
+        return;
+    }
+    if (header.has_cgroup && p < end) {
+        char procs[PATH_MAX];
+        snprintf(procs, sizeof(procs), "%s/cgroup.procs", p);
+        if ((args.cgroup_fd = open(procs, O_WRONLY | O_CLOEXEC)) < 0) {
+            reply->error = errno;
+            return;
+        }
+    }
+
+    // The program is our child, not the daemon's, so its exit status
+    // survives the daemon being replaced by an upgrade
+    pid_t pid = clone(child_main, stack + sizeof(stack), CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+    reply->exec_ns = metrics_now_ns();
+    if (args.cgroup_fd >= 0) close(args.cgroup_fd);
+    if (pid < 0) {
+        reply->error = errno;
+        return;
+    }
+    reply->pid = pid;
+    reply->error = args.error;
+    if (args.error) {
+        // It has already exited; nobody hears of it again
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    *pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    g_helper_children[g_helper_child_count++] = (helper_child_t){ pid, header.owner, reply->exec_ns };
+}
+
+// A message for the daemon, with fd attached unless it is -1. Blocks:
+// the daemon reads whenever it can, and a new binary takes over the
+// socket during an upgrade.
+static int send_message(int sock, const helper_message_t *message, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { (void *)message, sizeof(*message) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    while (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+// Reap every program that has exited and report it
+static int reap_programs(int sock) {
+    siginfo_t info;
+
+    for (;;) {
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) != 0 || info.si_pid == 0) return 0;
+
+        for (int i = 0; i < g_helper_child_count; i++) {
+            helper_child_t child = g_helper_children[i];
+            if (child.pid != info.si_pid) continue;
+            g_helper_children[i] = g_helper_children[--g_helper_child_count];
+
+            helper_message_t exited = { .type = HELPER_EXITED, .pid = child.pid, .owner = child.owner };
+            exited.exit_code = info.si_code == CLD_EXITED ? info.si_status : -1;
+            exited.signal = info.si_code == CLD_EXITED ? 0 : info.si_status;
+            uint64_t now = metrics_now_ns();
+            exited.runtime_ns = now > child.started ? now - child.started : 0;
+            if (send_message(sock, &exited, -1) != 0) return -1;
+            break;
+        }
+    }
+}
+
+// Keep only what switching users needs. Programs started as another
+// user lose these too when their uid changes.
+static void drop_capabilities(void) {
+    struct __user_cap_header_struct header = { _LINUX_CAPABILITY_VERSION_3, 0 };
+    struct __user_cap_data_struct data[2];
+    uint32_t keep = (1u << CAP_SETUID) | (1u << CAP_SETGID);
+
+    if (geteuid() != 0) return;
+    memset(data, 0, sizeof(data));
+    data[0].effective = data[0].permitted = keep;
+    if (syscall(SYS_capset, &header, data) != 0) perror("capset");
+}
+
+// Entry point of the helper process: answer spawn requests and report
+// exits until every daemon holding the socket has closed it. It is not
+// tied to the daemon's lifetime, so it outlives an upgrade.
+int launcher_helper_main(int fd) {
+    static char msg[LAUNCHER_MAX_MESSAGE];
+    helper_message_t reply;
+    sigset_t mask;
+    int pidfd;
+
+    prctl(PR_SET_NAME, "vldwm-launch");
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) return 1;
+
+    // Programs get /dev/null for stdin and nothing else of the daemon's
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        close(null_fd);
+    }
+    for (int other = fd + 1; other < 1024; other++) {
+        if (other != signal_fd) close(other);
+    }
+    drop_capabilities();
+
+    for (;;) {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { signal_fd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+
+        if (fds[1].revents) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+            }
+            if (reap_programs(fd) != 0) return 0;
+        }
+        if (fds[0].revents) {
+            ssize_t n = recv(fd, msg, sizeof(msg), MSG_DONTWAIT);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (n <= 0) return 0;
+
+            spawn_one(msg, n, &reply, &pidfd);
+            int sent = send_message(fd, &reply, pidfd);
+            if (pidfd >= 0) close(pidfd);
+            if (sent != 0) return 0;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "upgrade.h"
+
+// Constants
+#define LAUNCHER_HELPER_ARG "--launch-helper"     // argv[1] of the helper process
+#define LAUNCHER_HELPER_FD 3                      // Its end of the socket pair
+#define LAUNCHER_MAX_MESSAGE (64 * 1024)          // One spawn request: argv, environment and cwd
+#define LAUNCHER_MAX_IN_FLIGHT 32
+#define LAUNCHER_MAX_CHILDREN 256                 // Running programs the helper reports exits for
+#define LAUNCHER_MAX_EVENTS 256
+
+// One program to start as a session user
+typedef struct {
+    const char *user;
+    uid_t uid;
+    gid_t gid;
+    const char *const *argv;            // NULL-terminated
+    const char *const *envp;            // NULL-terminated
+    const char *cwd;
+    const char *cgroup;                 // Directory the program starts in, or NULL
+    uint64_t owner;                     // Handed back with the exit event
+    uint64_t start;                     // metrics_now_ns() when the request arrived
+} launch_request_t;
+
+typedef enum {
+    LAUNCH_EVENT_STARTED,
+    LAUNCH_EVENT_FAILED,
+    LAUNCH_EVENT_EXITED
+} launch_event_type_t;
+
+typedef struct {
+    launch_event_type_t type;
+    uint32_t request;                   // From launcher_submit(); 0 for EXITED
+    uint64_t owner;
+    pid_t pid;
+    int error;                          // errno, for FAILED
+    int exit_code;                      // -1 when killed by a signal
+    int signal;
+    uint64_t latency_ns;                // Request to exec, for STARTED
+    uint64_t runtime_ns;                // Exec to exit, for EXITED
+    int pidfd;                          // STARTED: the program's pidfd, owned by the receiver; else -1
+} launch_event_t;
+
+// Launcher functions. init_launcher() must run before any thread is
+// started so that SIGCHLD stays blocked everywhere and reaches the
+// signalfd. Everything else runs on the event loop. Programs are the
+// helper's children; it reaps them and passes their exits on.
+int init_launcher(void);
+void cleanup_launcher(void);
+int launcher_helper_fd(void);
+int launcher_signal_fd(void);
+int launcher_submit(const launch_request_t *request, uint32_t *request_number);
+void launcher_process(void);
+int launcher_next_event(launch_event_t *event);
+void launcher_save_state(upgrade_buf_t *buf);
+int launcher_restore_state(upgrade_reader_t *reader, int fd);
+int launcher_helper_main(int fd);
+
+#endif // LAUNCHER_H
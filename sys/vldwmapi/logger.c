@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "metrics.h"
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_BATCH_MAX 4096                      // Records taken out of the rings per pass
+#define LOG_OUT_SIZE (64 * 1024)
+#define LOG_LINE_MAX 512
+#define LOG_MAX_REDACT 16
+#define LOG_FLUSH_WAIT_MS 100                   // log_flush() gives up on a writer stuck in write()
+
+typedef enum {
+    LOG_OUTPUT_FD = 0,
+    LOG_OUTPUT_SYSLOG
+} log_output_t;
+
+// Event layout: field names, NULL where unused
+typedef struct {
+    const char *name;
+    log_level_t level;
+    const char *fields[3];
+    const char *text_field;
+} log_event_desc_t;
+
+static const log_event_desc_t g_events[LOG_EV_COUNT] = {
+    [LOG_EV_CONNECT] = { "ws.connect", LOG_LEVEL_INFO, { "conn", "clients", NULL }, NULL },
+    [LOG_EV_LOCAL_CONNECT] = { "ws.connect_local", LOG_LEVEL_INFO, { "conn", "pid", "uid" }, NULL },
+    [LOG_EV_CONNECT_REJECTED] = { "ws.rejected", LOG_LEVEL_WARN, { "clients", NULL, NULL }, NULL },
+    [LOG_EV_HANDSHAKE] = { "ws.handshake", LOG_LEVEL_INFO, { "conn", NULL, NULL }, NULL },
+    [LOG_EV_HANDSHAKE_FAILED] = { "ws.handshake_failed", LOG_LEVEL_WARN, { "conn", NULL, NULL }, NULL },
+    [LOG_EV_HTTP_OVERSIZE] = { "http.oversize", LOG_LEVEL_WARN, { "conn", "bytes", NULL }, NULL },
+    [LOG_EV_MESSAGE] = { "ws.message", LOG_LEVEL_DEBUG, { "conn", "bytes", NULL }, "type" },
+    [LOG_EV_INVALID_FRAME] = { "ws.invalid_frame", LOG_LEVEL_WARN, { "conn", NULL, NULL }, NULL },
+    [LOG_EV_CLOSE] = { "ws.close", LOG_LEVEL_INFO, { "conn", NULL, NULL }, NULL },
+    [LOG_EV_DISCONNECT] = { "ws.disconnect", LOG_LEVEL_INFO, { "conn", "clients", NULL }, NULL },
+    [LOG_EV_REPLY_FAILED] = { "reply.failed", LOG_LEVEL_ERROR, { "conn", NULL, NULL }, NULL },
+    [LOG_EV_LOGIN] = { "auth.login", LOG_LEVEL_INFO, { "conn", "uid", "session" }, "user" },
+    [LOG_EV_LOGIN_FAILED] = { "auth.login_failed", LOG_LEVEL_WARN, { "conn", NULL, NULL }, "user" },
+    [LOG_EV_LAUNCHED] = { "launch.started", LOG_LEVEL_INFO, { "pid", "latency_us", NULL }, NULL },
+    [LOG_EV_LAUNCH_FAILED] = { "launch.failed", LOG_LEVEL_WARN, { "errno", NULL, NULL }, "error" },
+    [LOG_EV_SCENE_DELTA_FAILED] = { "scene.delta_failed", LOG_LEVEL_ERROR, { NULL, NULL, NULL }, NULL },
+    [LOG_EV_THROTTLED] = { "sched.throttled", LOG_LEVEL_WARN, { "conn", "retry_ms", NULL }, "class" },
+    [LOG_EV_SEND_OVERFLOW] = { "ws.send_overflow", LOG_LEVEL_WARN, { "conn", "bytes", NULL }, NULL },
+};
+
+static const char *g_level_names[LOG_LEVEL_COUNT] = { "debug", "info", "warn", "error" };
+static const int g_syslog_priorities[LOG_LEVEL_COUNT] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR };
+
+typedef struct {
+    uint64_t time_ns;                   // CLOCK_REALTIME
+    uint16_t event;
+    uint16_t text_len;
+    int64_t args[3];
+    char text[LOG_TEXT_MAX];
+} log_record_t;
+
+// Records of one thread. Only the owning thread writes records and head;
+// only the writer thread moves tail, so neither side takes a lock.
+typedef struct {
+    uint64_t head;
+    char pad[56];                       // Keep the two indexes on separate cache lines
+    uint64_t tail;
+    uint64_t dropped;                   // Ring full; written by the owner
+    log_record_t records[LOG_RING_SIZE];
+} log_ring_t;
+
+// Per-event sampling and rate limiting, shared by every thread
+typedef struct {
+    uint32_t sample;                    // Keep one record in this many; 0 or 1 keeps all
+    uint64_t seen;
+    uint64_t window;                    // Second the count belongs to
+    uint32_t count;
+    uint64_t suppressed;
+} log_limit_t;
+
+static log_ring_t *g_rings[LOG_MAX_THREADS];
+static int g_ring_count = 0;
+static uint64_t g_unringed_dropped = 0;         // Threads beyond LOG_MAX_THREADS
+static log_limit_t g_limits[LOG_EV_COUNT];
+
+static int g_level = LOG_LEVEL_INFO;
+static uint32_t g_rate = LOG_DEFAULT_RATE;
+static log_output_t g_output = LOG_OUTPUT_FD;
+static int g_out_fd = STDERR_FILENO;
+static char g_redact_list[LOG_MAX_REDACT][24] = { "password", "token" };
+static int g_redact_count = 2;
+
+static pthread_t g_writer_thread;
+static int g_writer_started = 0;
+static int g_stop = 0;
+
+// Taking records out of the rings and writing them; held by the writer
+// thread per pass, or by log_flush()
+static pthread_mutex_t g_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static log_record_t g_batch[LOG_BATCH_MAX];
+static char g_out[LOG_OUT_SIZE];
+static uint64_t g_reported_dropped = 0;
+static uint64_t g_reported_suppressed[LOG_EV_COUNT];
+static uint64_t g_last_stats_ns = 0;
+
+static __thread log_ring_t *t_ring = NULL;
+static __thread int t_ring_unavailable = 0;
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Rings are allocated the first time a thread logs
+static log_ring_t *get_ring(void) {
+    if (t_ring || t_ring_unavailable) return t_ring;
+
+    int index = __atomic_fetch_add(&g_ring_count, 1, __ATOMIC_RELAXED);
+    log_ring_t *ring = index < LOG_MAX_THREADS ? calloc(1, sizeof(log_ring_t)) : NULL;
+    if (!ring) {
+        t_ring_unavailable = 1;
+        return NULL;
+    }
+    __atomic_store_n(&g_rings[index], ring, __ATOMIC_RELEASE);
+    t_ring = ring;
+    return ring;
+}
+
+// Sampling first, then at most g_rate records per event per second
+static int admit(log_event_t event, uint64_t now) {
+    log_limit_t *limit = &g_limits[event];
+    uint32_t sample = __atomic_load_n(&limit->sample, __ATOMIC_RELAXED);
+
+    if (sample > 1 && __atomic_fetch_add(&limit->seen, 1, __ATOMIC_RELAXED) % sample != 0) return 0;
+    if (g_rate == 0) return 1;
+
+    uint64_t second = now / 1000000000ull;
+    if (__atomic_load_n(&limit->window, __ATOMIC_RELAXED) != second) {
+        // Racing threads may each reset; a few extra records get through
+        __atomic_store_n(&limit->window, second, __ATOMIC_RELAXED);
+        __atomic_store_n(&limit->count, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_add_fetch(&limit->count, 1, __ATOMIC_RELAXED) <= g_rate) return 1;
+    __atomic_add_fetch(&limit->suppressed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void log_write(log_event_t event, const char *text, int64_t a, int64_t b, int64_t c) {
+    if ((unsigned)event >= LOG_EV_COUNT || (int)g_events[event].level < g_level) return;
+
+    uint64_t now = realtime_ns();
+    if (!admit(event, now)) return;
+
+    log_ring_t *ring = get_ring();
+    if (!ring) {
+        __atomic_add_fetch(&g_unringed_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    log_record_t *record = &ring->records[head & LOG_RING_MASK];
+    size_t len = text ? strnlen(text, LOG_TEXT_MAX) : 0;
+    record->time_ns = now;
+    record->event = (uint16_t)event;
+    record->text_len = (uint16_t)len;
+    record->args[0] = a;
+    record->args[1] = b;
+    record->args[2] = c;
+    if (len) memcpy(record->text, text, len);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int log_set_level(const char *name) {
+    for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+        if (strcmp(name, g_level_names[i]) == 0) {
+            g_level = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int log_set_output(const char *target) {
+    int fd;
+
+    if (strcmp(target, "stderr") == 0) {
+        fd = STDERR_FILENO;
+    } else if (strcmp(target, "syslog") == 0) {
+        g_output = LOG_OUTPUT_SYSLOG;
+        return 0;
+    } else if ((fd = open(target, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640)) < 0) {
+        return -1;
+    }
+    if (g_out_fd > STDERR_FILENO) close(g_out_fd);
+    g_output = LOG_OUTPUT_FD;
+    g_out_fd = fd;
+    return 0;
+}
+
+int log_set_sample(const char *spec) {
+    const char *equals = strchr(spec, '=');
+    if (!equals) return -1;
+
+    for (int i = 0; i < LOG_EV_COUNT; i++) {
+        size_t len = strlen(g_events[i].name);
+        if ((size_t)(equals - spec) == len && strncmp(spec, g_events[i].name, len) == 0) {
+            int sample = atoi(equals + 1);
+            if (sample < 1) return -1;
+            g_limits[i].sample = (uint32_t)sample;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void log_set_rate(int per_second) {
+    g_rate = per_second > 0 ? (uint32_t)per_second : 0;
+}
+
+void log_set_redact(const char *fields) {
+    const char *p = fields;
+
+    g_redact_count = 0;
+    while (*p && g_redact_count < LOG_MAX_REDACT) {
+        size_t len = strcspn(p, ",");
+        if (len > 0 && len < sizeof(g_redact_list[0])) {
+            memcpy(g_redact_list[g_redact_count], p, len);
+            g_redact_list[g_redact_count][len] = '\0';
+            g_redact_count++;
+        }
+        p += len;
+        if (*p == ',') p++;
+    }
+}
+
+static int is_redacted(const char *field) {
+    for (int i = 0; i < g_redact_count; i++) {
+        if (strcmp(field, g_redact_list[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int compare_records(const void *a, const void *b) {
+    uint64_t x = ((const log_record_t *)a)->time_ns, y = ((const log_record_t *)b)->time_ns;
+    return (x > y) - (x < y);
+}
+
+// Strings come from clients, so anything outside printable ASCII, and
+// the quote and backslash, is escaped
+static int format_text(char *out, size_t cap, const char *text, size_t len) {
+    size_t n = 0;
+
+    out[n++] = '"';
+    for (size_t i = 0; i < len && n + 5 < cap; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            n += snprintf(out + n, cap - n, "\\x%02x", c);
+        } else {
+            out[n++] = (char)c;
+        }
+    }
+    out[n++] = '"';
+    return (int)n;
+}
+
+// One line without the trailing newline; the timestamp is left to syslog
+// when that is the output
+static int format_line(char *line, const log_event_desc_t *desc, uint64_t time_ns,
+                       const int64_t *args, const char *text, size_t text_len) {
+    int n = 0;
+
+    if (g_output == LOG_OUTPUT_FD) {
+        time_t seconds = (time_t)(time_ns / 1000000000ull);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        n += (int)strftime(line, LOG_LINE_MAX, "%Y-%m-%dT%H:%M:%S", &tm);
+        n += snprintf(line + n, LOG_LINE_MAX - n, ".%06uZ ", (unsigned)(time_ns % 1000000000ull / 1000));
+    }
+    n += snprintf(line + n, LOG_LINE_MAX - n, "%s %s", g_level_names[desc->level], desc->name);
+
+    for (int i = 0; i < 3 && desc->fields[i] && n < LOG_LINE_MAX - 64; i++) {
+        if (is_redacted(desc->fields[i])) {
+            n += snprintf(line + n, LOG_LINE_MAX - n, " %s=[redacted]", desc->fields[i]);
+        } else {
+            n += snprintf(line + n, LOG_LINE_MAX - n, " %s=%lld", desc->fields[i], (long long)args[i]);
+        }
+    }
+    if (desc->text_field && n < LOG_LINE_MAX - 64) {
+        n += snprintf(line + n, LOG_LINE_MAX - n, " %s=", desc->text_field);
+        if (is_redacted(desc->text_field)) {
+            n += snprintf(line + n, LOG_LINE_MAX - n, "[redacted]");
+        } else {
+            n += format_text(line + n, LOG_LINE_MAX - n, text, text_len);
+        }
+    }
+    return n < LOG_LINE_MAX ? n : LOG_LINE_MAX - 1;
+}
+
+static void write_out(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(g_out_fd, data, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return;
+        data += written;
+        len -= written;
+    }
+}
+
+// Write a batch as one write() per LOG_OUT_SIZE of text
+static void emit(const log_record_t *records, int count) {
+    char line[LOG_LINE_MAX];
+    size_t used = 0;
+
+    for (int i = 0; i < count; i++) {
+        const log_event_desc_t *desc = &g_events[records[i].event];
+        int len = format_line(line, desc, records[i].time_ns, records[i].args,
+                              records[i].text, records[i].text_len);
+        if (g_output == LOG_OUTPUT_SYSLOG) {
+            syslog(g_syslog_priorities[desc->level], "%.*s", len, line);
+            continue;
+        }
+        if (used + len + 1 > sizeof(g_out)) {
+            write_out(g_out, used);
+            used = 0;
+        }
+        memcpy(g_out + used, line, len);
+        g_out[used + len] = '\n';
+        used += len + 1;
+    }
+    if (used) write_out(g_out, used);
+}
+
+// Lines about the logger itself, written straight out
+static void emit_self(log_level_t level, const char *name, const char *field, uint64_t value, const char *text) {
+    log_event_desc_t desc = { name, level, { field, NULL, NULL }, text ? "event" : NULL };
+    log_record_t record;
+
+    memset(&record, 0, sizeof(record));
+    record.args[0] = (int64_t)value;
+    if (text) {
+        record.text_len = (uint16_t)strnlen(text, LOG_TEXT_MAX);
+        memcpy(record.text, text, record.text_len);
+    }
+    char line[LOG_LINE_MAX];
+    int len = format_line(line, &desc, realtime_ns(), record.args, record.text, record.text_len);
+    if (g_output == LOG_OUTPUT_SYSLOG) {
+        syslog(g_syslog_priorities[level], "%.*s", len, line);
+    } else {
+        line[len++] = '\n';
+        write_out(line, len);
+    }
+}
+
+// Records lost since the last report, rather than a line per loss
+static void report_losses(int force) {
+    uint64_t now = realtime_ns();
+    if (!force && now - g_last_stats_ns < LOG_STATS_INTERVAL_MS * 1000000ull) return;
+    g_last_stats_ns = now;
+
+    uint64_t dropped = __atomic_load_n(&g_unringed_dropped, __ATOMIC_RELAXED);
+    int count = __atomic_load_n(&g_ring_count, __ATOMIC_RELAXED);
+    for (int i = 0; i < count && i < LOG_MAX_THREADS; i++) {
+        log_ring_t *ring = __atomic_load_n(&g_rings[i], __ATOMIC_ACQUIRE);
+        if (ring) dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    if (dropped > g_reported_dropped) {
+        metrics_count(METRIC_LOG_DROPPED, dropped - g_reported_dropped);
+        emit_self(LOG_LEVEL_WARN, "log.dropped", "records", dropped - g_reported_dropped, NULL);
+        g_reported_dropped = dropped;
+    }
+
+    for (int i = 0; i < LOG_EV_COUNT; i++) {
+        uint64_t suppressed = __atomic_load_n(&g_limits[i].suppressed, __ATOMIC_RELAXED);
+        if (suppressed > g_reported_suppressed[i]) {
+            metrics_count(METRIC_LOG_SUPPRESSED, suppressed - g_reported_suppressed[i]);
+            emit_self(LOG_LEVEL_WARN, "log.suppressed", "records", suppressed - g_reported_suppressed[i],
+                      g_events[i].name);
+            g_reported_suppressed[i] = suppressed;
+        }
+    }
+}
+
+// Move everything recorded so far to the output. Returns the number of
+// records written. The lock is held by the caller.
+static int drain_locked(int force_report) {
+    int total = 0;
+
+    for (;;) {
+        int count = 0;
+        int rings = __atomic_load_n(&g_ring_count, __ATOMIC_RELAXED);
+
+        for (int i = 0; i < rings && i < LOG_MAX_THREADS && count < LOG_BATCH_MAX; i++) {
+            log_ring_t *ring = __atomic_load_n(&g_rings[i], __ATOMIC_ACQUIRE);
+            if (!ring) continue;
+            uint64_t tail = ring->tail;
+            uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            while (tail < head && count < LOG_BATCH_MAX) {
+                g_batch[count++] = ring->records[tail & LOG_RING_MASK];
+                tail++;
+            }
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+        if (count == 0) break;
+
+        // Threads' records interleave by time within a pass
+        qsort(g_batch, count, sizeof(log_record_t), compare_records);
+        emit(g_batch, count);
+        total += count;
+    }
+    report_losses(force_report);
+    return total;
+}
+
+static int drain(int force_report) {
+    pthread_mutex_lock(&g_drain_lock);
+    int total = drain_locked(force_report);
+    pthread_mutex_unlock(&g_drain_lock);
+    return total;
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&g_stop, __ATOMIC_RELAXED)) {
+        if (drain(0) == 0) {
+            struct timespec pause = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+int init_log(void) {
+    printf("📝 Initializing logger (%s to %s)...\n", g_level_names[g_level],
+           g_output == LOG_OUTPUT_SYSLOG ? "syslog" : g_out_fd == STDERR_FILENO ? "stderr" : "file");
+    if (g_output == LOG_OUTPUT_SYSLOG) openlog("vldwmapi", LOG_PID, LOG_DAEMON);
+    g_last_stats_ns = realtime_ns();
+
+    if (pthread_create(&g_writer_thread, NULL, writer_main, NULL) != 0) {
+        return -1;
+    }
+    g_writer_started = 1;
+    return 0;
+}
+
+// Write out whatever is queued; for exits that skip cleanup. A stalled
+// output must not hold up the exit, so this waits only briefly for the
+// writer thread.
+void log_flush(void) {
+    struct timespec pause = { 0, 1000000L };
+
+    for (int waited = 0; waited < LOG_FLUSH_WAIT_MS; waited++) {
+        if (pthread_mutex_trylock(&g_drain_lock) == 0) {
+            drain_locked(1);
+            pthread_mutex_unlock(&g_drain_lock);
+            return;
+        }
+        nanosleep(&pause, NULL);
+    }
+}
+
+void cleanup_log(void) {
+    printf("📝 Cleaning up logger...\n");
+    if (g_writer_started) {
+        __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+        pthread_join(g_writer_thread, NULL);
+        g_writer_started = 0;
+    }
+    drain(1);
+    if (g_output == LOG_OUTPUT_SYSLOG) closelog();
+    // Rings stay allocated: other threads may still hold theirs
+}
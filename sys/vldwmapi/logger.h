@@ -0,0 +1,63 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+
+// Constants
+#define LOG_RING_SIZE 1024                      // Records per thread (power of two)
+#define LOG_MAX_THREADS 32
+#define LOG_TEXT_MAX 48                         // Bytes of the one string field a record carries
+#define LOG_FLUSH_INTERVAL_MS 20                // Writer thread wakeup while idle
+#define LOG_STATS_INTERVAL_MS 10000             // Dropped/suppressed counts reported at most this often
+#define LOG_DEFAULT_RATE 1000                   // Records per event per second before suppression
+
+typedef enum {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_COUNT
+} log_level_t;
+
+// Events logged from request paths. Each has a fixed level, up to
+// three numeric fields and one short string field, named in logger.c.
+typedef enum {
+    LOG_EV_CONNECT = 0,
+    LOG_EV_LOCAL_CONNECT,
+    LOG_EV_CONNECT_REJECTED,
+    LOG_EV_HANDSHAKE,
+    LOG_EV_HANDSHAKE_FAILED,
+    LOG_EV_HTTP_OVERSIZE,
+    LOG_EV_MESSAGE,
+    LOG_EV_INVALID_FRAME,
+    LOG_EV_CLOSE,
+    LOG_EV_DISCONNECT,
+    LOG_EV_REPLY_FAILED,
+    LOG_EV_LOGIN,
+    LOG_EV_LOGIN_FAILED,
+    LOG_EV_LAUNCHED,
+    LOG_EV_LAUNCH_FAILED,
+    LOG_EV_SCENE_DELTA_FAILED,
+    LOG_EV_THROTTLED,
+    LOG_EV_SEND_OVERFLOW,
+    LOG_EV_COUNT
+} log_event_t;
+
+// Hot path entry: copies the fields into the calling thread's ring and
+// returns. Never blocks and never formats; when the ring is full the
+// record is counted as dropped. text may be NULL.
+void log_write(log_event_t event, const char *text, int64_t a, int64_t b, int64_t c);
+
+// Configuration, from the command line before init_log()
+int log_set_level(const char *name);
+int log_set_output(const char *target);         // "stderr", "syslog" or a file path
+int log_set_sample(const char *spec);           // "event=N": keep one record in N
+void log_set_rate(int per_second);              // 0 disables rate limiting
+void log_set_redact(const char *fields);        // Comma-separated field names (default: password,token)
+
+// Logger functions
+int init_log(void);
+void cleanup_log(void);
+void log_flush(void);
+
+#endif // LOGGER_H
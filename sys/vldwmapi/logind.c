@@ -2,16 +2,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <pwd.h>
 #include <security/pam_appl.h>
 #include <json-c/json.h>
 
-#define PORT 3001
-#define BUFFER_SIZE 1024
-
 #include "logind.h"
+#include "desktopsession.h"
+#include "sessiontoken.h"
+#include "nsscache.h"
+#include "metrics.h"
+#include "trace.h"
 
 // PAM conversation (no pam_misc needed!)
 static int pam_conv(int num_msg, const struct pam_message **msg,
@@ -35,47 +38,90 @@ static int pam_conv(int num_msg, const struct pam_message **msg,
 
 int init_logind(void) {
     printf("🔐 Initializing login daemon...\n");
-    // Add any initialization logic here
-    return 0;
+    return init_session_tokens();
 }
 
 void cleanup_logind(void) {
     printf("🔐 Cleaning up login daemon...\n");
-    // Add any cleanup logic here
+    cleanup_session_tokens();
 }
 
-int authenticate_user(const char *username, const char *password) {
+// Logins run on work queue threads now, and not every PAM module is
+// safe to enter from two threads at once
+static pthread_mutex_t g_pam_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int pam_check(const char *username, const char *password) {
     pam_handle_t *pamh = NULL;
     int retval;
 
     struct pam_conv conv = { pam_conv, (void *)password };
 
+    uint64_t span = trace_begin();
     retval = pam_start("login", username, &conv, &pamh);
+    trace_end("pam_start", span, retval);
     if (retval != PAM_SUCCESS) return 0;
 
+    span = trace_begin();
     retval = pam_authenticate(pamh, 0);
+    trace_end("pam_authenticate", span, retval);
     if (retval != PAM_SUCCESS) {
         pam_end(pamh, retval);
         return 0;
     }
 
+    span = trace_begin();
     retval = pam_acct_mgmt(pamh, 0);
+    trace_end("pam_acct_mgmt", span, retval);
     pam_end(pamh, retval);
     return retval == PAM_SUCCESS;
 }
 
+int authenticate_user(const char *username, const char *password) {
+    uint64_t start = metrics_now_ns();
+    pthread_mutex_lock(&g_pam_lock);
+    int ok = pam_check(username, password);
+    pthread_mutex_unlock(&g_pam_lock);
+
+    metrics_observe(METRIC_HIST_PAM, metrics_now_ns() - start);
+    metrics_count(ok ? METRIC_PAM_SUCCESS : METRIC_PAM_FAILURE, 1);
+    return ok;
+}
+
 json_object *get_user_info(const char *username) {
-    struct passwd *pwd = getpwnam(username);
-    if (!pwd) return NULL;
+    nss_user_t user;
+    if (nss_get_user_by_name(username, &user) != 0) return NULL;
 
     json_object *user_obj = json_object_new_object();
-    json_object_object_add(user_obj, "username", json_object_new_string(pwd->pw_name));
-    json_object_object_add(user_obj, "uid", json_object_new_int(pwd->pw_uid));
-    json_object_object_add(user_obj, "gid", json_object_new_int(pwd->pw_gid));
-    json_object_object_add(user_obj, "home", json_object_new_string(pwd->pw_dir));
-    json_object_object_add(user_obj, "shell", json_object_new_string(pwd->pw_shell));
-    json_object_object_add(user_obj, "fullname", json_object_new_string(pwd->pw_gecos));
+    json_object_object_add(user_obj, "username", json_object_new_string(user.name));
+    json_object_object_add(user_obj, "uid", json_object_new_int(user.uid));
+    json_object_object_add(user_obj, "gid", json_object_new_int(user.gid));
+    json_object_object_add(user_obj, "home", json_object_new_string(user.home));
+    json_object_object_add(user_obj, "shell", json_object_new_string(user.shell));
+    json_object_object_add(user_obj, "fullname", json_object_new_string(user.gecos));
+
+    return user_obj;
+}
+
+// After a successful PAM login: make sure the user has a desktop session
+// and return their info with a session token for later reconnects
+json_object *create_login_session(const char *username, desktop_session_t *session) {
+    json_object *user_obj = get_user_info(username);
+    char token[SESSION_TOKEN_MAX_LEN];
+    session_claims_t claims;
+
+    if (!user_obj) return NULL;
+
+    if (get_session_info(username, session) != 0 &&
+        (start_desktop_session(username) != 0 || get_session_info(username, session) != 0)) {
+        session->session_id = 0;
+        return user_obj;
+    }
 
+    if (session_token_issue(session->uid, session->session_id, token, sizeof(token), &claims) == 0) {
+        json_object_object_add(user_obj, "token", json_object_new_string(token));
+        json_object_object_add(user_obj, "session_id", json_object_new_int64(session->session_id));
+        json_object_object_add(user_obj, "token_expires", json_object_new_int64(claims.expires_at));
+    }
     return user_obj;
 }
 
@@ -101,7 +147,14 @@ int parse_login_request(const char *json_str, char *username, char *password) {
 }
 
 char *create_response(int success, const char *message, json_object *user_data) {
+    return create_typed_response(NULL, success, message, user_data);
+}
+
+// Same as create_response, tagged with the WebSocket message type it answers
+char *create_typed_response(const char *type, int success, const char *message, json_object *user_data) {
     json_object *response = json_object_new_object();
+    if (type)
+        json_object_object_add(response, "type", json_object_new_string(type));
     json_object_object_add(response, "success", json_object_new_boolean(success));
     json_object_object_add(response, "message", json_object_new_string(message));
     if (user_data)
@@ -113,159 +166,101 @@ char *create_response(int success, const char *message, json_object *user_data)
     return copy;
 }
 
-void handle_request(int client_socket) {
-    char buffer[BUFFER_SIZE];
-    char username[MAX_USERNAME_LEN], password[MAX_PASSWORD_LEN];
-    char *json_start;
+// Build the CORS headers shared by every login endpoint response
+static int cors_headers(char *out, size_t size) {
+    return snprintf(out, size,
+        "Access-Control-Allow-Origin: *\r\n"
+        "Access-Control-Allow-Methods: POST, OPTIONS\r\n"
+        "Access-Control-Allow-Headers: Content-Type\r\n");
+}
 
-    int bytes_read = read(client_socket, buffer, BUFFER_SIZE - 1);
-    if (bytes_read <= 0) {
-        close(client_socket);
-        return;
+static int json_http_response(const char *status, const char *json, const char *extra_headers,
+                              int keep_alive, char *response, size_t size) {
+    char cors[160];
+    cors_headers(cors, sizeof(cors));
+
+    int len = snprintf(response, size,
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: application/json\r\n"
+        "%s"
+        "%s"
+        "Content-Length: %zu\r\n"
+        "Connection: %s\r\n"
+        "\r\n"
+        "%s",
+        status, cors, extra_headers, strlen(json), keep_alive ? "keep-alive" : "close", json);
+    return (len > 0 && (size_t)len < size) ? len : -1;
+}
+
+// Answer one HTTP request to the login endpoint. The caller has already
+// collected the full Content-Length body; the response is written into
+// the caller's buffer so it can be queued on a non-blocking socket.
+// Returns 0 instead when the request carries credentials: username and
+// password are filled in for the caller to check with PAM off the event
+// loop and answer with logind_http_login_response().
+int logind_http_response(const http_request_t *request, const char *body, size_t body_len, int keep_alive,
+                         char *username, char *password, char *response, size_t size) {
+    char json[LOGIND_MAX_BODY + 1];
+
+    if (strcmp(request->method, "OPTIONS") == 0) {
+        char cors[160];
+        cors_headers(cors, sizeof(cors));
+        int len = snprintf(response, size,
+            "HTTP/1.1 204 No Content\r\n"
+            "%s"
+            "Access-Control-Max-Age: 600\r\n"
+            "Connection: %s\r\n"
+            "\r\n",
+            cors, keep_alive ? "keep-alive" : "close");
+        return (len > 0 && (size_t)len < size) ? len : -1;
     }
-    buffer[bytes_read] = '\0';
-
-    json_start = strstr(buffer, "\r\n\r\n");
-    if (!json_start) {
-        const char *res = "HTTP/1.1 400 Bad Request\r\n"
-                          "Content-Type: application/json\r\n"
-                          "Access-Control-Allow-Origin: *\r\n\r\n"
-                          "{\"success\": false, \"message\": \"Invalid request\"}";
-        write(client_socket, res, strlen(res));
-        close(client_socket);
-        return;
+
+    if (strcmp(request->method, "POST") != 0) {
+        return json_http_response("405 Method Not Allowed",
+            "{\"success\": false, \"message\": \"Method not allowed\"}", "", keep_alive, response, size);
     }
-    json_start += 4;
-
-    if (strncmp(buffer, "OPTIONS", 7) == 0) {
-        const char *res = "HTTP/1.1 200 OK\r\n"
-                          "Access-Control-Allow-Origin: *\r\n"
-                          "Access-Control-Allow-Methods: POST, OPTIONS\r\n"
-                          "Access-Control-Allow-Headers: Content-Type\r\n\r\n";
-        write(client_socket, res, strlen(res));
-        close(client_socket);
-        return;
+
+    if (body_len > LOGIND_MAX_BODY) {
+        return json_http_response("413 Payload Too Large",
+            "{\"success\": false, \"message\": \"Request too large\"}", "", keep_alive, response, size);
     }
+    memcpy(json, body, body_len);
+    json[body_len] = '\0';
 
-    if (!parse_login_request(json_start, username, password)) {
-        const char *res = "HTTP/1.1 400 Bad Request\r\n"
-                          "Content-Type: application/json\r\n"
-                          "Access-Control-Allow-Origin: *\r\n\r\n"
-                          "{\"success\": false, \"message\": \"Invalid JSON\"}";
-        write(client_socket, res, strlen(res));
-        close(client_socket);
-        return;
+    if (!parse_login_request(json, username, password)) {
+        memset(password, 0, MAX_PASSWORD_LEN);
+        return json_http_response("400 Bad Request",
+            "{\"success\": false, \"message\": \"Invalid JSON\"}", "", keep_alive, response, size);
     }
+    return 0;
+}
 
-    int auth = authenticate_user(username, password);
+// The response to a login endpoint request once PAM has answered
+int logind_http_login_response(const char *username, int auth, int keep_alive, char *response, size_t size) {
     char *json_res;
 
     if (auth) {
-        json_object *info = get_user_info(username);
+        desktop_session_t session;
+        json_object *info = create_login_session(username, &session);
         json_res = create_response(1, "Authentication successful", info);
     } else {
         json_res = create_response(0, "Invalid credentials", NULL);
     }
 
-    char http_res[2048];
-    snprintf(http_res, sizeof(http_res),
-             "HTTP/1.1 %s\r\n"
-             "Content-Type: application/json\r\n"
-             "Access-Control-Allow-Origin: *\r\n"
-             "Access-Control-Allow-Methods: POST, OPTIONS\r\n"
-             "Access-Control-Allow-Headers: Content-Type\r\n"
-             "Content-Length: %zu\r\n\r\n%s",
-             auth ? "200 OK" : "401 Unauthorized",
-             strlen(json_res),
-             json_res);
-
-    write(client_socket, http_res, strlen(http_res));
+    int len = json_http_response(auth ? "200 OK" : "401 Unauthorized", json_res, "", keep_alive, response, size);
     free(json_res);
-    close(client_socket);
+    return len;
 }
 
-int start_logind_server(int port, int *server_socket_ptr) {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr;
-    socklen_t addr_len = sizeof(server_addr);
-
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("Socket");
-        return 1;
-    }
-
-    *server_socket_ptr = server_socket;
-
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// Turn a login endpoint request away before PAM. A retry delay, if
+// any, goes out as Retry-After in whole seconds.
+int logind_http_refusal(const char *status, const char *message, uint32_t retry_ms, int keep_alive,
+                        char *response, size_t size) {
+    char retry[48] = "";
+    char *json_res = create_response(0, message, NULL);
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind");
-        close(server_socket);
-        return 1;
-    }
-
-    if (listen(server_socket, 5) < 0) {
-        perror("Listen");
-        close(server_socket);
-        return 1;
-    }
-
-    printf("🌐 Login daemon listening on port %d\n", port);
-
-    while (1) {
-        client_socket = accept(server_socket, (struct sockaddr *)&server_addr, &addr_len);
-        if (client_socket >= 0) {
-            handle_request(client_socket);
-        }
-    }
-
-    close(server_socket);
-    return 0;
-}
-
-int main() {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr;
-    socklen_t addr_len = sizeof(server_addr);
-
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("Socket");
-        exit(1);
-    }
-
-    int opt = 1;
-    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(PORT);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("Bind");
-        exit(1);
-    }
-
-    if (listen(server_socket, 5) < 0) {
-        perror("Listen");
-        exit(1);
-    }
-
-    printf("🔥 vldwcweb is running on port %d (FreeBSD Edition)\n", PORT);
-
-    while (1) {
-        client_socket = accept(server_socket, (struct sockaddr *)&server_addr, &addr_len);
-        if (client_socket >= 0) {
-            handle_request(client_socket);
-        }
-    }
-
-    close(server_socket);
-    return 0;
+    if (retry_ms) snprintf(retry, sizeof(retry), "Retry-After: %u\r\n", (retry_ms + 999) / 1000);
+    int len = json_http_response(status, json_res, retry, keep_alive, response, size);
+    free(json_res);
+    return len;
 }
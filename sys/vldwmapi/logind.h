@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -10,21 +11,31 @@
 #include <pwd.h>
 #include <security/pam_appl.h>
 #include <json-c/json.h>
+#include "httpparser.h"
+#include "desktopsession.h"
 
 // Constants
 #define DEFAULT_PORT 3001
 #define BUFFER_SIZE 1024
 #define MAX_USERNAME_LEN 256
 #define MAX_PASSWORD_LEN 256
+#define LOGIND_HTTP_PATH "/api/login"
+#define LOGIND_MAX_BODY 4096
+#define LOGIND_RESPONSE_SIZE 2048
 
 // Function declarations
 int init_logind(void);
 void cleanup_logind(void);
-int start_logind_server(int port, int *server_socket_ptr);
 int authenticate_user(const char *username, const char *password);
 json_object *get_user_info(const char *username);
 int parse_login_request(const char *json_str, char *username, char *password);
 char *create_response(int success, const char *message, json_object *user_data);
-void handle_request(int client_socket);
+char *create_typed_response(const char *type, int success, const char *message, json_object *user_data);
+json_object *create_login_session(const char *username, desktop_session_t *session);
+int logind_http_response(const http_request_t *request, const char *body, size_t body_len, int keep_alive,
+                         char *username, char *password, char *response, size_t size);
+int logind_http_login_response(const char *username, int auth, int keep_alive, char *response, size_t size);
+int logind_http_refusal(const char *status, const char *message, uint32_t retry_ms, int keep_alive,
+                        char *response, size_t size);
 
 #endif // LOGIND_H
\ No newline at end of file
@@ -1,319 +1,2701 @@
 #include "logind.h"
 #include "desktopsession.h"
 #include "idle.h"
+#include "httpparser.h"
+#include "websocket.h"
+#include "staticfiles.h"
+#include "sessiontoken.h"
+#include "nsscache.h"
+#include "jsonwriter.h"
+#include "jsonreader.h"
+#include "messages.h"
+#include "arena.h"
+#include "bufpool.h"
+#include "metrics.h"
+#include "trace.h"
+#include "workqueue.h"
+#include "metaio.h"
+#include "usercred.h"
+#include "scene.h"
+#include "thumbnail.h"
+#include "fileindex.h"
+#include "appcatalog.h"
+#include "launcher.h"
+#include "cgroup.h"
+#include "upgrade.h"
+#include "logger.h"
+#include "scheduler.h"
+#include "recorder.h"
 #include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/wait.h>
-#include <sys/select.h>
-#include <openssl/sha.h>
-#include <openssl/evp.h>
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <limits.h>
 
 // WebSocket constants
-#define WS_MAGIC_STRING "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
-#define MAX_CLIENTS 100
-#define WS_FRAME_SIZE 1024
-
-// WebSocket opcodes
-#define WS_OPCODE_CONTINUATION 0x0
-#define WS_OPCODE_TEXT 0x1
-#define WS_OPCODE_BINARY 0x2
-#define WS_OPCODE_CLOSE 0x8
-#define WS_OPCODE_PING 0x9
-#define WS_OPCODE_PONG 0xA
+#define DEFAULT_MAX_CLIENTS 100000   // Slots are only touched once used; -c lowers it
+#define CLIENTS_LIMIT (1 << 20)
+#define FD_RESERVE 64               // Descriptors kept for files, pipes and the upgrade
+#define EPOLL_MAX_EVENTS 256        // Ready connections handled per loop iteration
+#define ACCEPT_BATCH 64             // Connections accepted per listener wakeup
+#define WS_MAX_MESSAGE_SIZE (64 * 1024)
+#define WS_TX_LIMIT (16 * 1024 * 1024)  // Unsent output a connection may pile up before it is closed
+#define REQUEST_ID_MAX PROTO_ID_MAX // Longest string "id" echoed back
+#define ASYNC_MAX_IN_FLIGHT 64      // Queued desktop_session, search and PAM jobs; more are refused
+#define ASYNC_RETRY_MS 100          // Retry hint sent with a "Busy" reply
+#define THUMBNAIL_MAX_PATHS PROTO_THUMBNAIL_PATHS_MAX_ITEMS
+#define THUMBNAIL_MAX_IN_FLIGHT 8
+#define THUMBNAIL_FRAME_BYTES (512 * 1024)  // Image data per binary frame before starting another
+#define LAUNCH_MAX_ENV PROTO_LAUNCH_ENV_MAX_ITEMS  // Variables a launch request may add or override
+#define LAUNCH_TERMINAL "xterm"     // Runs Terminal=true applications
 
 // Global server socket and client management
 static int g_server_socket = -1;
-static int g_client_sockets[MAX_CLIENTS];
 static int g_client_count = 0;
+static int g_max_clients = DEFAULT_MAX_CLIENTS;
+static int g_epoll_fd = -1;
+static const char *g_www_root = NULL;
+static const char *g_bind_address = "0.0.0.0";
+static const char *g_unix_path = NULL;     // "@name" for the abstract namespace
+static int g_unix_socket = -1;
+static const char *g_index_roots[FILE_INDEX_MAX_ROOTS];
+static int g_index_root_count = 0;
 
-// WebSocket client structure
+// Temporaries of the message being handled; reset after each one
+static arena_t g_request_arena;
+
+// Set by SIGUSR2; the event loop writes the trace file
+static volatile sig_atomic_t g_trace_dump_requested = 0;
+
+// Set by SIGINT and SIGTERM to the signal number; the event loop shuts
+// down
+static volatile sig_atomic_t g_shutdown_signal = 0;
+
+// Set by SIGHUP; the event loop starts the binary on disk and hands
+// the connections over to it
+static volatile sig_atomic_t g_upgrade_requested = 0;
+static char g_exe_path[PATH_MAX];       // Resolved at startup, before the file can be replaced
+static char **g_argv = NULL;
+static int g_draining = 0;              // New binary ready; finishing in-flight work
+static uint64_t g_drain_deadline = 0;
+
+// Client-assigned request id, echoed in the reply so requests may
+// complete out of order. Strings and integers are accepted.
+typedef struct {
+    int present;
+    int is_string;
+    int64_t number;
+    char text[REQUEST_ID_MAX + 1];
+} request_id_t;
+
+// Id of the message being handled
+static request_id_t g_current_id;
+
+// While a batch runs, replies are appended to its "replies" array
+// instead of being sent
+static json_writer_t *g_batch_writer = NULL;
+static int g_batch_replies = 0;
+
+// Set by a handler that answers later from the work queue
+static int g_reply_deferred = 0;
+
+// Scene deltas are built once per frame and sent to every subscriber
+static json_writer_t g_scene_out;
+
+// Connections are renumbered as the client array compacts; queued work
+// finds its client again by this id
+static uint64_t g_next_conn_id = 1;
+
+// Largest amount of unprocessed HTTP input kept per connection
+#define HTTP_RX_LIMIT (HTTP_MAX_HEADER_BYTES + LOGIND_MAX_BODY)
+
+// State only a plain HTTP connection needs. Allocated with its first
+// request and dropped at the WebSocket upgrade, so upgraded connections
+// carry none of it.
+typedef struct {
+    http_request_t request;     // Current HTTP request, parsed as it arrives
+    static_transfer_t transfer; // Static file response still being sent
+    char *tx;                   // Queued HTTP response bytes (pooled)
+    size_t tx_len;
+    size_t tx_cap;
+    size_t tx_sent;
+    unsigned char login_pending;    // PAM for a login request is on a worker
+} http_conn_t;
+
+// WebSocket client structure. Until the upgrade the same slot serves
+// plain HTTP/1.1 (static files, login endpoint) with keep-alive. Kept
+// small: most connections are idle display endpoints, and anything
+// sized by traffic is borrowed from the buffer pool while in use.
+typedef struct {
+    int socket;                 // -1 while the slot is free
+    uint32_t events;            // Registered with epoll; 0 when not registered
+    uint64_t conn_id;           // Stable for the life of the connection
+    unsigned char handshake_complete;
+    unsigned char close_after_send;     // Drop the connection once tx drains
+    unsigned char authenticated;        // Logged in or resumed with a session token
+    unsigned char scene_subscribed;     // Receives scene_delta pushes
+    unsigned char peer_cred;            // Local socket: peer_uid and peer_pid are the kernel's
+    unsigned char backlog;              // Complete frames left over from the last turn
+    unsigned char send_failed;          // Shut down for not reading; further output is dropped
+    uid_t uid;
+    uid_t peer_uid;
+    pid_t peer_pid;
+    uint64_t session_id;
+    sched_bucket_t bucket;      // Request rate limits per message class
+    http_conn_t *http;          // Before the upgrade only
+    char *rx;                   // Buffered input: HTTP bodies and pipelined requests,
+    size_t rx_len;              // or partial WebSocket frames (pooled, held only
+    size_t rx_cap;              // while data is waiting)
+    char *tx;                   // Frames the socket would not take yet (pooled, held
+    size_t tx_len;              // only while bytes are waiting); the first tx_sent
+    size_t tx_cap;              // of them are out
+    size_t tx_sent;
+} ws_client_t;
+
+// Client slots are allocated once for g_max_clients and never move, so
+// an index stays valid for the life of its connection. Pages of slots
+// never used are never touched.
+static ws_client_t *g_ws_clients = NULL;
+static int g_client_slots = 0;          // High-water mark; free slots below it have socket -1
+static int *g_free_slots = NULL;
+static int g_free_slot_count = 0;
+
+// conn_id -> slot, open addressing; queued work finds its client here
+static int *g_conn_table = NULL;
+static size_t g_conn_mask = 0;
+
+// Connections with frames left from their last turn, served before
+// anything more is read from them. Entries whose client has gone are
+// skipped.
+typedef struct {
+    int slot;
+    uint64_t conn_id;
+} backlog_entry_t;
+
+static backlog_entry_t *g_backlog = NULL;
+static int g_backlog_count = 0;
+static int g_backlog_cap = 0;
+
+// Replies are built and sent in one go, so one writer serves every
+// connection
+static json_writer_t g_reply_out;
+
+static void set_nonblocking(int socket, int enable) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags < 0) return;
+    fcntl(socket, F_SETFL, enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+static int transfer_pending(const ws_client_t *client) {
+    const http_conn_t *http = client->http;
+    return http && (http->tx_sent < http->tx_len ||
+                    http->transfer.header_sent < http->transfer.header_len || http->transfer.remaining > 0);
+}
+
+// Upgraded connection with frames waiting for the socket
+static int frames_pending(const ws_client_t *client) {
+    return client->tx_sent < client->tx_len;
+}
+
+static http_conn_t *client_http(ws_client_t *client) {
+    if (!client->http) {
+        client->http = malloc(sizeof(http_conn_t));
+        if (!client->http) return NULL;
+        memset(client->http, 0, sizeof(http_conn_t));
+        http_request_init(&client->http->request);
+        static_transfer_reset(&client->http->transfer);
+    }
+    return client->http;
+}
+
+static void free_client_http(ws_client_t *client) {
+    if (!client->http) return;
+    bufpool_put(client->http->tx, client->http->tx_cap);
+    free(client->http);
+    client->http = NULL;
+}
+
+static int find_client(uint64_t conn_id) {
+    for (size_t i = conn_id & g_conn_mask;; i = (i + 1) & g_conn_mask) {
+        int slot = g_conn_table[i];
+        if (slot < 0 || g_ws_clients[slot].conn_id == conn_id) return slot;
+    }
+}
+
+static void conn_table_insert(int slot) {
+    size_t i = g_ws_clients[slot].conn_id & g_conn_mask;
+    while (g_conn_table[i] >= 0) i = (i + 1) & g_conn_mask;
+    g_conn_table[i] = slot;
+}
+
+// Backward-shift deletion keeps every run free of holes
+static void conn_table_remove(uint64_t conn_id) {
+    size_t hole = conn_id & g_conn_mask;
+    while (g_conn_table[hole] >= 0 && g_ws_clients[g_conn_table[hole]].conn_id != conn_id) {
+        hole = (hole + 1) & g_conn_mask;
+    }
+    if (g_conn_table[hole] < 0) return;
+    for (size_t i = (hole + 1) & g_conn_mask; g_conn_table[i] >= 0; i = (i + 1) & g_conn_mask) {
+        size_t home = g_ws_clients[g_conn_table[i]].conn_id & g_conn_mask;
+        if (((i - home) & g_conn_mask) >= ((i - hole) & g_conn_mask)) {
+            g_conn_table[hole] = g_conn_table[i];
+            hole = i;
+        }
+    }
+    g_conn_table[hole] = -1;
+}
+
+static int init_clients(void) {
+    size_t table_size = 1;
+    while (table_size < (size_t)g_max_clients * 2) table_size <<= 1;
+
+    g_ws_clients = calloc(g_max_clients, sizeof(ws_client_t));
+    g_free_slots = calloc(g_max_clients, sizeof(int));
+    g_conn_table = malloc(table_size * sizeof(int));
+    g_backlog_cap = g_max_clients * 2;
+    g_backlog = calloc(g_backlog_cap, sizeof(backlog_entry_t));
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (!g_ws_clients || !g_free_slots || !g_conn_table || !g_backlog || g_epoll_fd < 0) return -1;
+    memset(g_conn_table, 0xff, table_size * sizeof(int));
+    g_conn_mask = table_size - 1;
+    g_client_slots = g_client_count = g_free_slot_count = g_backlog_count = 0;
+    json_writer_init(&g_reply_out, WS_MAX_FRAME_HEADER);
+    return 0;
+}
+
+static void cleanup_clients(void) {
+    if (g_epoll_fd >= 0) close(g_epoll_fd);
+    g_epoll_fd = -1;
+    json_writer_free(&g_reply_out);
+    free(g_ws_clients);
+    free(g_free_slots);
+    free(g_conn_table);
+    free(g_backlog);
+    g_ws_clients = NULL;
+    g_free_slots = g_conn_table = NULL;
+    g_backlog = NULL;
+    g_client_slots = g_client_count = 0;
+}
+
+// Register for what the connection waits on: writability while a
+// response is queued, otherwise input unless it still has frames to
+// work through or the daemon is draining for an upgrade. A connection
+// waiting on nothing is taken out of the epoll set, so a hangup does
+// not keep waking the loop.
+static void watch_client(int slot) {
+    ws_client_t *client = &g_ws_clients[slot];
+    struct epoll_event event;
+    uint32_t events = 0;
+
+    if (transfer_pending(client) || frames_pending(client)) {
+        events = EPOLLOUT;
+    } else if (!g_draining && !client->backlog) {
+        events = EPOLLIN;
+    }
+    if (events == client->events) return;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.u32 = (uint32_t)slot;
+    if (events == 0) {
+        epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+    } else {
+        epoll_ctl(g_epoll_fd, client->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, client->socket, &event);
+    }
+    client->events = events;
+}
+
+static void watch_all_clients(void) {
+    for (int i = 0; i < g_client_slots; i++) {
+        if (g_ws_clients[i].socket >= 0) watch_client(i);
+    }
+}
+
+// Serve the connection again on the next loop iteration without reading
+static void queue_backlog(int slot) {
+    ws_client_t *client = &g_ws_clients[slot];
+
+    if (g_backlog_count == g_backlog_cap) {
+        client->backlog = 0;        // Can't happen: at most one entry per slot per iteration
+        return;
+    }
+    client->backlog = 1;
+    g_backlog[g_backlog_count].slot = slot;
+    g_backlog[g_backlog_count].conn_id = client->conn_id;
+    g_backlog_count++;
+}
+
+// Take a free slot for a new or taken-over connection; -1 when full.
+// conn_id 0 assigns the next one.
+static int add_client(int socket, uint64_t conn_id) {
+    int slot;
+
+    if (g_client_count >= g_max_clients) return -1;
+    slot = g_free_slot_count > 0 ? g_free_slots[--g_free_slot_count] : g_client_slots++;
+
+    ws_client_t *client = &g_ws_clients[slot];
+    memset(client, 0, sizeof(*client));
+    client->socket = socket;
+    client->conn_id = conn_id ? conn_id : g_next_conn_id++;
+    sched_bucket_init(&client->bucket, metrics_now_ns());
+    conn_table_insert(slot);
+    g_client_count++;
+    metrics_gauge_set(METRIC_CLIENTS_CONNECTED, g_client_count);
+    return slot;
+}
+
+static void free_client_tx(ws_client_t *client) {
+    bufpool_put(client->tx, client->tx_cap);
+    client->tx = NULL;
+    client->tx_len = client->tx_cap = client->tx_sent = 0;
+}
+
+static void free_client_buffers(ws_client_t *client) {
+    bufpool_put(client->rx, client->rx_cap);
+    client->rx = NULL;
+    client->rx_len = client->rx_cap = 0;
+    free_client_tx(client);
+    free_client_http(client);
+}
+
+// Close a client and free its slot
+static void remove_client(int client_index) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    uint64_t conn_id = client->conn_id;
+
+    if (client->handshake_complete) {
+        metrics_gauge_add(METRIC_WEBSOCKET_CLIENTS, -1);
+        recorder_close(conn_id);
+    }
+    free_client_buffers(client);
+    if (client->events) epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+    close(client->socket);
+    conn_table_remove(conn_id);
+    memset(client, 0, sizeof(*client));
+    client->socket = -1;
+    g_free_slots[g_free_slot_count++] = client_index;
+    g_client_count--;
+    metrics_gauge_set(METRIC_CLIENTS_CONNECTED, g_client_count);
+    // Work still waiting for a worker is not worth doing now
+    sched_cancel(conn_id);
+}
+
+// A client that stopped reading or whose socket failed: the socket is
+// shut down, so the next read sees the end of the stream and the client
+// is removed there, where nothing else still holds its index
+static int drop_output(ws_client_t *client) {
+    shutdown(client->socket, SHUT_RDWR);
+    client->send_failed = 1;
+    free_client_tx(client);
+    watch_client((int)(client - g_ws_clients));
+    return -1;
+}
+
+// Send a frame without blocking. Whatever the socket does not take now
+// is queued and goes out as it turns writable; once more than
+// WS_TX_LIMIT is waiting the client is dropped. Replies finish outside
+// the event dispatch too, so the client is rewatched here.
+static int send_frame_parts(ws_client_t *client, const struct iovec *iov, int count) {
+    size_t total = 0, sent = 0;
+
+    if (client->send_failed) return -1;
+    for (int i = 0; i < count; i++) total += iov[i].iov_len;
+
+    if (!frames_pending(client)) {
+        struct msghdr msg;
+        ssize_t n;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = (struct iovec *)iov;
+        msg.msg_iovlen = count;
+        do {
+            n = sendmsg(client->socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return drop_output(client);
+        if (n > 0) sent = (size_t)n;
+        if (sent == total) return 0;
+    } else if (client->tx_len - client->tx_sent > WS_TX_LIMIT) {
+        log_write(LOG_EV_SEND_OVERFLOW, NULL, (int64_t)client->conn_id, (int64_t)(client->tx_len - client->tx_sent), 0);
+        return drop_output(client);
+    }
+
+    // Sent bytes are dropped from the front before the queue grows
+    if (client->tx_sent > 0) {
+        memmove(client->tx, client->tx + client->tx_sent, client->tx_len - client->tx_sent);
+        client->tx_len -= client->tx_sent;
+        client->tx_sent = 0;
+    }
+    char *tx = bufpool_grow(client->tx, client->tx_len, &client->tx_cap, client->tx_len + total - sent);
+    if (!tx) return drop_output(client);
+    client->tx = tx;
+    for (int i = 0; i < count; i++) {
+        size_t len = iov[i].iov_len;
+        size_t skip = sent < len ? sent : len;
+        memcpy(client->tx + client->tx_len, (const char *)iov[i].iov_base + skip, len - skip);
+        client->tx_len += len - skip;
+        sent -= skip;
+    }
+    watch_client((int)(client - g_ws_clients));
+    return 0;
+}
+
+// Push queued frames without blocking. Returns -1 if the client was
+// removed, 1 once everything is out, 0 while waiting for writability.
+static int flush_ws_client(int client_index) {
+    ws_client_t *client = &g_ws_clients[client_index];
+
+    while (client->tx_sent < client->tx_len) {
+        ssize_t n = send(client->socket, client->tx + client->tx_sent,
+                         client->tx_len - client->tx_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            remove_client(client_index);
+            return -1;
+        }
+        client->tx_sent += n;
+    }
+    // Nothing queued: the buffer goes back to the pool until it is needed
+    free_client_tx(client);
+    return 1;
+}
+
+// Header and payload go out in one sendmsg, so the payload isn't copied
+static int send_frame(ws_client_t *client, int opcode, const char *payload, size_t len) {
+    unsigned char header[WS_MAX_FRAME_HEADER];
+    size_t header_len = ws_frame_header(opcode, len, header);
+    struct iovec iov[2] = { { header, header_len }, { (void *)payload, len } };
+
+    uint64_t span = trace_begin();
+    int result = send_frame_parts(client, iov, 2);
+    trace_end("ws_send", span, header_len + len);
+    return result;
+}
+
+// Broadcast message to all connected WebSocket clients
+void broadcast_message(const char* message) {
+    size_t len = strlen(message);
+    for (int i = 0; i < g_client_slots; i++) {
+        if (g_ws_clients[i].handshake_complete) {
+            send_frame(&g_ws_clients[i], WS_OPCODE_TEXT, message, len);
+        }
+    }
+}
+
+static void rx_consume(ws_client_t *client, size_t count) {
+    memmove(client->rx, client->rx + count, client->rx_len - count);
+    client->rx_len -= count;
+}
+
+static int queue_http_response(ws_client_t *client, const char *data, size_t len) {
+    http_conn_t *http = client->http;
+    char *tx = bufpool_grow(http->tx, http->tx_len, &http->tx_cap, http->tx_len + len);
+    if (!tx) return -1;
+    memcpy(tx + http->tx_len, data, len);
+    http->tx = tx;
+    http->tx_len += len;
+    return 0;
+}
+
+static void queue_http_error(ws_client_t *client, const char *status) {
+    char response[256];
+    int len = snprintf(response, sizeof(response),
+        "HTTP/1.1 %s\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n", status);
+    queue_http_response(client, response, len);
+    client->close_after_send = 1;
+}
+
+// Push queued bytes without blocking. Returns -1 if the client was
+// removed, 1 once everything is out, 0 while waiting for writability.
+static int flush_http_client(int client_index) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    http_conn_t *http = client->http;
+
+    while (http->tx_sent < http->tx_len) {
+        ssize_t n = send(client->socket, http->tx + http->tx_sent,
+                         http->tx_len - http->tx_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            remove_client(client_index);
+            return -1;
+        }
+        http->tx_sent += n;
+    }
+    // Nothing queued: the buffer goes back to the pool until the next response
+    bufpool_put(http->tx, http->tx_cap);
+    http->tx = NULL;
+    http->tx_len = http->tx_cap = http->tx_sent = 0;
+
+    int result = static_transfer_send(client->socket, &http->transfer);
+    if (result == STATIC_SEND_PENDING) {
+        return 0;
+    }
+    if (result == STATIC_SEND_ERROR || client->close_after_send ||
+        (http->transfer.header_len > 0 && !http->transfer.keep_alive)) {
+        remove_client(client_index);
+        return -1;
+    }
+    static_transfer_reset(&http->transfer);
+    return 1;
+}
+
+// Metrics are only served to clients on this machine: loopback TCP or
+// the Unix socket
+static int is_local_peer(int socket) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (getpeername(socket, (struct sockaddr *)&addr, &len) != 0) return 0;
+    if (addr.ss_family == AF_UNIX) return 1;
+    if (addr.ss_family != AF_INET) return 0;
+    return (ntohl(((const struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24) == 127;
+}
+
+// Bytes accepted for sending but still waiting on a slow client
+static void update_send_queue_gauge(void) {
+    int64_t queued = 0;
+    for (int i = 0; i < g_client_slots; i++) {
+        const http_conn_t *http = g_ws_clients[i].http;
+        if (g_ws_clients[i].socket < 0) continue;
+        queued += g_ws_clients[i].tx_len - g_ws_clients[i].tx_sent;
+        if (!http) continue;
+        queued += http->tx_len - http->tx_sent;
+        queued += http->transfer.header_len - http->transfer.header_sent + http->transfer.remaining;
+    }
+    metrics_gauge_set(METRIC_SEND_QUEUE_BYTES, queued);
+}
+
+static int queue_metrics_response(ws_client_t *client, int keep_alive) {
+    char header[256];
+    char *body = NULL;
+    size_t body_len = 0, body_cap = 0;
+
+    update_send_queue_gauge();
+    if (metrics_render_prometheus(&body, &body_len, &body_cap) != 0) {
+        bufpool_put(body, body_cap);
+        queue_http_error(client, "500 Internal Server Error");
+        return 0;
+    }
+
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Cache-Control: no-store\r\n"
+        "Connection: %s\r\n"
+        "\r\n", body_len, keep_alive ? "keep-alive" : "close");
+    int result = queue_http_response(client, header, header_len);
+    if (result == 0) result = queue_http_response(client, body, body_len);
+    bufpool_put(body, body_cap);
+
+    if (!keep_alive) client->close_after_send = 1;
+    return result;
+}
+
+static int queue_pam_job(int client_index, metric_message_t kind, int http, int keep_alive,
+                         const char *username, const char *password, uint64_t start);
+
+// 0 once PAM for a login endpoint request is queued, else the length of
+// the refusal written to response. Logins over HTTP are held to the same
+// limits as WebSocket ones.
+static int queue_http_login(int client_index, const char *username, const char *password, int keep_alive,
+                            char *response, size_t size) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    uint32_t retry_ms = 0;
+
+    if (!sched_take(&client->bucket, SCHED_CLASS_AUTH, metrics_now_ns(), &retry_ms)) {
+        log_write(LOG_EV_THROTTLED, sched_class_name(SCHED_CLASS_AUTH), (int64_t)client->conn_id, retry_ms, 0);
+        return logind_http_refusal("429 Too Many Requests", "Rate limited", retry_ms, keep_alive, response, size);
+    }
+    if (queue_pam_job(client_index, METRIC_MSG_LOGIN, 1, keep_alive, username, password, metrics_now_ns()) != 0) {
+        return logind_http_refusal("503 Service Unavailable", "Busy", 0, keep_alive, response, size);
+    }
+    client->http->login_pending = 1;
+    return 0;
+}
+
+static int route_http_request(int client_index, const char *body, size_t body_len) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    http_request_t *request = &client->http->request;
+    int keep_alive = http_request_keep_alive(request);
+    size_t path_len = strcspn(request->target, "?");
+
+    metrics_count(METRIC_HTTP_REQUESTS, 1);
+
+    if (strlen(METRICS_HTTP_PATH) == path_len && strncmp(request->target, METRICS_HTTP_PATH, path_len) == 0) {
+        if (!is_local_peer(client->socket)) {
+            queue_http_error(client, "403 Forbidden");
+            return 0;
+        }
+        return queue_metrics_response(client, keep_alive);
+    }
+
+    if (strlen(LOGIND_HTTP_PATH) == path_len && strncmp(request->target, LOGIND_HTTP_PATH, path_len) == 0) {
+        char response[LOGIND_RESPONSE_SIZE];
+        char username[MAX_USERNAME_LEN], password[MAX_PASSWORD_LEN];
+        int len = logind_http_response(request, body, body_len, keep_alive, username, password,
+                                       response, sizeof(response));
+        // Credentials: the response waits for PAM on a worker
+        if (len == 0) {
+            len = queue_http_login(client_index, username, password, keep_alive, response, sizeof(response));
+            memset(password, 0, sizeof(password));
+            if (len == 0) return 0;
+        }
+        if (len < 0) {
+            queue_http_error(client, "500 Internal Server Error");
+            return 0;
+        }
+        if (!keep_alive) client->close_after_send = 1;
+        return queue_http_response(client, response, len);
+    }
+
+    // Everything else on this port comes from the frontend build
+    if (static_files_enabled()) {
+        return static_prepare_response(request, &client->http->transfer);
+    }
+
+    queue_http_error(client, "404 Not Found");
+    return 0;
+}
+
+static void upgrade_client(int client_index) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    uint64_t start = metrics_now_ns();
+    int upgraded = perform_websocket_handshake(client->socket, &client->http->request);
+
+    metrics_observe(METRIC_HIST_HANDSHAKE, metrics_now_ns() - start);
+    metrics_count(upgraded ? METRIC_HANDSHAKES_OK : METRIC_HANDSHAKES_REJECTED, 1);
+    if (!upgraded) {
+        log_write(LOG_EV_HANDSHAKE_FAILED, NULL, (int64_t)client->conn_id, 0, 0);
+        remove_client(client_index);
+        return;
+    }
+
+    // Frames sent before our 101 are not allowed; drop anything buffered,
+    // along with the HTTP state the connection no longer needs
+    free_client_buffers(client);
+    client->handshake_complete = 1;
+    metrics_gauge_add(METRIC_WEBSOCKET_CLIENTS, 1);
+    log_write(LOG_EV_HANDSHAKE, NULL, (int64_t)client->conn_id, 0, 0);
+    recorder_open(client->conn_id);
+    
+    // Send welcome message
+    const char *welcome = "{\"type\": \"welcome\", \"message\": \"Connected to VLDWM API\"}";
+    send_frame(client, WS_OPCODE_TEXT, welcome, strlen(welcome));
+}
+
+// Work through buffered HTTP input: pipelined requests are answered in
+// order, one at a time, and bodies wait until Content-Length bytes are in
+static void process_http_requests(int client_index) {
+    ws_client_t *client = &g_ws_clients[client_index];
+
+    while (!transfer_pending(client) && !client->close_after_send && !client->http->login_pending) {
+        http_request_t *request = &client->http->request;
+        size_t consumed = 0;
+        int parsed = http_parse_request(request, client->rx, client->rx_len, &consumed);
+
+        rx_consume(client, consumed);
+        if (parsed == HTTP_PARSE_INCOMPLETE) {
+            return;
+        }
+        if (parsed == HTTP_PARSE_ERROR) {
+            queue_http_error(client, "400 Bad Request");
+            break;
+        }
+
+        if (request->flags & HTTP_FLAG_UPGRADE_WEBSOCKET) {
+            upgrade_client(client_index);
+            return;
+        }
+
+        size_t body_len = (request->flags & HTTP_FLAG_HAS_CONTENT_LENGTH) ? (size_t)request->content_length : 0;
+        if (body_len > LOGIND_MAX_BODY) {
+            queue_http_error(client, "413 Payload Too Large");
+            break;
+        }
+        if (client->rx_len < body_len) {
+            return;
+        }
+
+        if (route_http_request(client_index, client->rx, body_len) != 0) {
+            remove_client(client_index);
+            return;
+        }
+        rx_consume(client, body_len);
+        http_request_init(request);
+
+        if (flush_http_client(client_index) < 0) {
+            return;
+        }
+    }
+
+    flush_http_client(client_index);
+}
+
+static void handle_http_input(int client_index, const char *data, size_t len) {
+    ws_client_t *client = &g_ws_clients[client_index];
+
+    if (!client_http(client)) {
+        remove_client(client_index);
+        return;
+    }
+    if (client->rx_len + len > HTTP_RX_LIMIT) {
+        log_write(LOG_EV_HTTP_OVERSIZE, NULL, (int64_t)client->conn_id, (int64_t)(client->rx_len + len), 0);
+        remove_client(client_index);
+        return;
+    }
+    if (!client->rx) {
+        client->rx = bufpool_get(HTTP_RX_LIMIT, &client->rx_cap);
+        if (!client->rx) {
+            remove_client(client_index);
+            return;
+        }
+    }
+    memcpy(client->rx + client->rx_len, data, len);
+    client->rx_len += len;
+
+    process_http_requests(client_index);
+}
+
+// Socket became writable while a response was queued
+static void continue_http_response(int client_index) {
+    if (flush_http_client(client_index) == 1 && g_ws_clients[client_index].rx_len > 0) {
+        process_http_requests(client_index);
+    }
+}
+
+// PAM has answered a login endpoint request: send the response and
+// carry on with anything pipelined behind it
+static void finish_http_login(int client_index, const char *username, int auth, int keep_alive) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    char response[LOGIND_RESPONSE_SIZE];
+    int len = logind_http_login_response(username, auth, keep_alive, response, sizeof(response));
+
+    client->http->login_pending = 0;
+    if (len < 0) {
+        queue_http_error(client, "500 Internal Server Error");
+    } else {
+        if (!keep_alive) client->close_after_send = 1;
+        if (queue_http_response(client, response, len) != 0) {
+            remove_client(client_index);
+            return;
+        }
+    }
+    continue_http_response(client_index);
+    if (client->socket >= 0) watch_client(client_index);
+}
+
+static void write_request_id(json_writer_t *w, const request_id_t *id) {
+    if (!id->present) return;
+    json_key(w, "id");
+    if (id->is_string) json_write_string(w, id->text);
+    else json_write_int(w, id->number);
+}
+
+// Keep the "id" of a request for its reply, which may be sent after the
+// receive buffer has moved on
+static void read_request_id(const proto_head_t *head, request_id_t *id) {
+    memset(id, 0, sizeof(*id));
+    if (!head->id.present) return;
+    id->present = 1;
+    id->is_string = head->id.is_string;
+    if (id->is_string) memcpy(id->text, head->id.text.ptr, head->id.text.len + 1);
+    else id->number = head->id.number;
+}
+
+static void write_reply_head(json_writer_t *w, const char *type, const request_id_t *id) {
+    json_begin_object(w);
+    json_field_string(w, "type", type);
+    write_request_id(w, id);
+}
+
+static void write_reply_tail(json_writer_t *w, int success, const char *message) {
+    json_field_bool(w, "success", success);
+    if (message) json_field_string(w, "message", message);
+    json_end_object(w);
+}
+
+// Send a finished reply as one text frame. The header goes into the
+// headroom in front of the JSON, so the payload is never copied.
+static void send_reply_frame(ws_client_t *client, json_writer_t *w) {
+    unsigned char header[WS_MAX_FRAME_HEADER];
+    size_t payload_len = json_writer_payload_len(w);
+    size_t header_len = ws_frame_header(WS_OPCODE_TEXT, payload_len, header);
+    char *frame = json_writer_payload(w) - header_len;
+    memcpy(frame, header, header_len);
+    struct iovec iov = { frame, header_len + payload_len };
+
+    uint64_t span = trace_begin();
+    send_frame_parts(client, &iov, 1);
+    trace_end("ws_send", span, header_len + payload_len);
+}
+
+// Start a reply in the shared reply buffer, or as the next entry of
+// the running batch; the object stays open for the handler's fields
+// until finish_reply()
+static json_writer_t *begin_reply(int client_index, const char *type) {
+    json_writer_t *w = g_batch_writer;
+    (void)client_index;
+    if (!w) {
+        w = &g_reply_out;
+        json_writer_reset(w);
+    }
+    write_reply_head(w, type, &g_current_id);
+    return w;
+}
+
+// Close the reply and send it, unless it is part of a batch
+static void finish_reply(int client_index, int success, const char *message) {
+    if (g_batch_writer) {
+        write_reply_tail(g_batch_writer, success, message);
+        g_batch_replies++;
+        return;
+    }
+
+    json_writer_t *w = &g_reply_out;
+    write_reply_tail(w, success, message);
+    if (w->error) {
+        log_write(LOG_EV_REPLY_FAILED, NULL, (int64_t)g_ws_clients[client_index].conn_id, 0, 0);
+    } else {
+        send_reply_frame(&g_ws_clients[client_index], w);
+    }
+
+    // Nothing holds on to a reply buffer while the loop is idle
+    json_writer_free(w);
+}
+
+// Reply with the fixed type/success/message fields and optional user data
+static void send_typed_response(int client_index, const char *type, int success,
+                                const char *message, json_object *data) {
+    json_writer_t *w = begin_reply(client_index, type);
+    if (data) {
+        size_t len;
+        const char *json = json_object_to_json_string_length(data, JSON_C_TO_STRING_PLAIN, &len);
+        json_key(w, "user");
+        json_write_raw(w, json, len);
+        json_object_put(data);
+    }
+    finish_reply(client_index, success, message);
+}
+
+// No job to run the request on: the client tries again shortly.
+// Running it inline instead would hand the loop to whoever floods it.
+static void reply_busy(int client_index, const char *type, const char *action) {
+    json_writer_t *w = begin_reply(client_index, type);
+    if (action) json_field_string(w, "action", action);
+    json_field_uint(w, "retry_after_ms", ASYNC_RETRY_MS);
+    finish_reply(client_index, 0, "Busy");
+}
+
+// A decoded count clamped to max, or fallback when absent
+static int get_count_field(uint32_t present, uint32_t bit, int64_t value, int fallback, int max) {
+    if (!(present & bit)) return fallback;
+    return value >= max ? max : (int)value;
+}
+
+static void mark_authenticated(int client_index, const desktop_session_t *session) {
+    g_ws_clients[client_index].authenticated = session->session_id != 0;
+    g_ws_clients[client_index].uid = session->uid;
+    g_ws_clients[client_index].session_id = session->session_id;
+}
+
+// A local peer logs in as itself without a password; root as anyone
+static int peer_is_user(const ws_client_t *client, const char *username) {
+    nss_user_t user;
+    if (!client->peer_cred) return 0;
+    if (client->peer_uid == 0) return 1;
+    return nss_get_user_by_name(username, &user) == 0 && user.uid == client->peer_uid;
+}
+
+// Reply to a login once PAM has answered
+static void finish_login(int client_index, const char *username, int auth) {
+    if (auth) {
+        desktop_session_t session;
+        json_object *info = create_login_session(username, &session);
+        mark_authenticated(client_index, &session);
+        log_write(LOG_EV_LOGIN, username, (int64_t)g_ws_clients[client_index].conn_id,
+                  session.uid, (int64_t)session.session_id);
+        send_typed_response(client_index, "login", 1, "Authentication successful", info);
+    } else {
+        log_write(LOG_EV_LOGIN_FAILED, username, (int64_t)g_ws_clients[client_index].conn_id, 0, 0);
+        send_typed_response(client_index, "login", 0, "Invalid credentials", NULL);
+    }
+}
+
+static void handle_login_message(int client_index, const proto_login_t *msg, uint64_t start) {
+    const char *username_field = msg->username.ptr;
+    const char *password_field = msg->password.ptr;
+    if (username_field && !password_field && peer_is_user(&g_ws_clients[client_index], username_field)) {
+        desktop_session_t session;
+        json_object *info = create_login_session(username_field, &session);
+        mark_authenticated(client_index, &session);
+        log_write(LOG_EV_LOGIN, username_field, (int64_t)g_ws_clients[client_index].conn_id,
+                  session.uid, (int64_t)session.session_id);
+        send_typed_response(client_index, "login", 1, "Authenticated by peer credentials", info);
+        return;
+    }
+    if (!password_field) {
+        send_typed_response(client_index, "login", 0, "Password required", NULL);
+        return;
+    }
+
+    // PAM may take seconds (pam_faildelay); it runs on a worker and the
+    // loop keeps serving everyone else. A batch is answered in one frame
+    // and cannot wait for it.
+    if (g_batch_writer) {
+        send_typed_response(client_index, "login", 0, "Not available in a batch", NULL);
+    } else if (queue_pam_job(client_index, METRIC_MSG_LOGIN, 0, 0, username_field, password_field, start) == 0) {
+        g_reply_deferred = 1;
+    } else {
+        reply_busy(client_index, "login", NULL);
+    }
+}
+
+// Reattach a reconnecting shell to its session without going through PAM
+static void handle_resume_message(int client_index, const proto_resume_t *msg) {
+    session_claims_t claims;
+    desktop_session_t session;
+    int result = session_token_verify(msg->token.ptr, TOKEN_OP_RESUME, &claims);
+
+    if (result != SESSION_TOKEN_OK || get_session_by_id(claims.session_id, &session) != 0) {
+        send_typed_response(client_index, "resume", 0, session_token_strerror(result), NULL);
+        return;
+    }
+
+    mark_authenticated(client_index, &session);
+    json_object *info = get_user_info(session.username);
+    if (info) {
+        json_object_object_add(info, "session_id", json_object_new_int64(session.session_id));
+        json_object_object_add(info, "locked", json_object_new_boolean(session.state == SESSION_LOCKED));
+    }
+    send_typed_response(client_index, "resume", 1, "Session resumed", info);
+}
+
+// The password or peer check for an unlock has passed, or not. The
+// connection must still be in the session it was made for.
+static void finish_unlock(int client_index, const char *username, int auth) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    desktop_session_t session;
+
+    if (!client->authenticated || get_session_by_id(client->session_id, &session) != 0 ||
+        strcmp(session.username, username) != 0) {
+        send_typed_response(client_index, "unlock", 0, "Not logged in", NULL);
+        return;
+    }
+    if (!auth) {
+        send_typed_response(client_index, "unlock", 0, "Invalid credentials", NULL);
+        return;
+    }
+    // A fresh PAM or peer credential check earns a fresh token
+    unlock_session(session.username);
+    send_typed_response(client_index, "unlock", 1, "Session unlocked",
+                        create_login_session(session.username, &session));
+}
+
+// Unlock with a recent token, or with the password once the token is
+// older than the unlock window. A local peer of the same uid needs
+// neither.
+static void handle_unlock_message(int client_index, const proto_unlock_t *msg, uint64_t start) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    desktop_session_t session;
+    const char *token = msg->token.ptr;
+    const char *password = msg->password.ptr;
+
+    if (!client->authenticated || get_session_by_id(client->session_id, &session) != 0) {
+        send_typed_response(client_index, "unlock", 0, "Not logged in", NULL);
+        return;
+    }
+
+    // The password goes to PAM on a worker, as a login's does
+    if (password) {
+        if (g_batch_writer) {
+            send_typed_response(client_index, "unlock", 0, "Not available in a batch", NULL);
+        } else if (queue_pam_job(client_index, METRIC_MSG_UNLOCK, 0, 0, session.username, password, start) == 0) {
+            g_reply_deferred = 1;
+        } else {
+            reply_busy(client_index, "unlock", NULL);
+        }
+        return;
+    }
+    if (!token && peer_is_user(client, session.username)) {
+        finish_unlock(client_index, session.username, 1);
+        return;
+    }
+
+    session_claims_t claims;
+    int result = session_token_verify(token, TOKEN_OP_UNLOCK, &claims);
+    if (result != SESSION_TOKEN_OK || claims.session_id != session.session_id) {
+        json_writer_t *w = begin_reply(client_index, "unlock");
+        json_key(w, "user");
+        json_begin_object(w);
+        json_field_bool(w, "needs_password", 1);
+        json_end_object(w);
+        finish_reply(client_index, 0, session_token_strerror(result));
+        return;
+    }
+
+    unlock_session(session.username);
+    send_typed_response(client_index, "unlock", 1, "Session unlocked", NULL);
+}
+
+static void handle_session_state_message(int client_index, const char *type) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    desktop_session_t session;
+
+    if (!client->authenticated || get_session_by_id(client->session_id, &session) != 0) {
+        send_typed_response(client_index, type, 0, "Not logged in", NULL);
+        return;
+    }
+
+    if (strcmp(type, "lock") == 0) {
+        lock_session(session.username);
+        send_typed_response(client_index, type, 1, "Session locked", NULL);
+    } else {
+        // Stopping the session revokes its tokens for every connection
+        // and ends the programs it launched
+        cgroup_kill_session(client->session_id);
+        stop_desktop_session(session.username);
+        client->authenticated = 0;
+        client->session_id = 0;
+        send_typed_response(client_index, type, 1, "Logged out", NULL);
+    }
+}
+
+// Body of a desktop_session reply after "action"; 1 on success, else
+// *message says why. Runs on the event loop or on a worker thread. Paths
+// are opened with the access of uid, the session user, never root's.
+static int write_desktop_session_data(arena_t *arena, json_writer_t *w, const char *action,
+                                      const char *path, uid_t uid, const char **message) {
+    user_cred_t cred;
+
+    *message = NULL;
+    if (strcmp(action, "list_directory") == 0 || strcmp(action, "file_info") == 0) {
+        int listing = strcmp(action, "list_directory") == 0;
+        json_field_string(w, "path", path);
+        json_key(w, "data");
+        if (user_cred_lookup(uid, &cred) == 0 && user_cred_enter(&cred) == 0) {
+            int result = listing ? list_directory(arena, w, path) : get_file_info(w, path);
+            user_cred_leave();
+            if (result == 0) return 1;
+        }
+        json_write_null(w);
+        *message = "Cannot access path";
+        return 0;
+    } else if (strcmp(action, "process_list") == 0) {
+        json_key(w, "data");
+        get_process_list(arena, w);
+        return 1;
+    } else if (strcmp(action, "system_status") == 0) {
+        json_key(w, "data");
+        get_system_status(w);
+        return 1;
+    }
+    *message = "Unknown action";
+    return 0;
+}
+
+// A desktop_session, search, login or unlock request handed to the work queue. Jobs are
+// pooled and keep their arena between uses.
+typedef struct async_request {
+    work_item_t work;               // First, so the item is the job
+    struct async_request *next_free;
+    metric_message_t kind;
+    uint64_t conn_id;
+    uid_t uid;                          // Session user the query runs as
+    request_id_t id;
+    char action[32];
+    char path[PATH_MAX];
+    int has_path;
+    char query[FILE_INDEX_MAX_QUERY];
+    int fuzzy;
+    int offset;
+    int limit;
+    char username[MAX_USERNAME_LEN];
+    char password[MAX_PASSWORD_LEN];    // Cleared as soon as PAM has it
+    int auth;
+    unsigned char http;                 // Login endpoint request rather than a message
+    unsigned char keep_alive;
+    arena_t arena;
+    json_writer_t out;
+    uint64_t start;
+    uint64_t trace_request;
+} async_request_t;
+
+static async_request_t *g_free_jobs = NULL;
+static int g_jobs_allocated = 0;
+static int g_jobs_in_flight = 0;
+
+static async_request_t *get_job(void) {
+    async_request_t *job = g_free_jobs;
+    if (job) {
+        g_free_jobs = job->next_free;
+        g_jobs_in_flight++;
+        return job;
+    }
+    if (g_jobs_allocated >= ASYNC_MAX_IN_FLIGHT) return NULL;
+    job = calloc(1, sizeof(*job));
+    if (job && arena_init(&job->arena, ARENA_DEFAULT_SIZE) != 0) {
+        free(job);
+        return NULL;
+    }
+    if (job) {
+        g_jobs_allocated++;
+        g_jobs_in_flight++;
+    }
+    return job;
+}
+
+static void put_job(async_request_t *job) {
+    arena_reset(&job->arena);
+    json_writer_free(&job->out);
+    job->next_free = g_free_jobs;
+    g_free_jobs = job;
+    g_jobs_in_flight--;
+}
+
+static void free_jobs(void) {
+    while (g_free_jobs) {
+        async_request_t *job = g_free_jobs;
+        g_free_jobs = job->next_free;
+        arena_free(&job->arena);
+        free(job);
+    }
+    g_jobs_allocated = 0;
+}
+
+// Worker thread: build the whole reply
+static void run_desktop_session_job(work_item_t *item) {
+    async_request_t *job = (async_request_t *)item;
+    json_writer_t *w = &job->out;
+    const char *message;
+
+    trace_set_request(job->trace_request);
+    uint64_t span = trace_begin();
+    write_reply_head(w, "desktop_session", &job->id);
+    json_field_string(w, "action", job->action);
+    int ok = write_desktop_session_data(&job->arena, w, job->action, job->has_path ? job->path : NULL,
+                                        job->uid, &message);
+    write_reply_tail(w, ok, message);
+    trace_end("desktop_session", span, 0);
+    trace_set_request(0);
+}
+
+// Event loop: send the reply if the connection is still there
+static void complete_async_job(work_item_t *item) {
+    async_request_t *job = (async_request_t *)item;
+
+    int i = find_client(job->conn_id);
+    if (i >= 0 && job->out.error) {
+        log_write(LOG_EV_REPLY_FAILED, NULL, (int64_t)job->conn_id, 0, 0);
+    } else if (i >= 0) {
+        trace_set_request(job->trace_request);
+        send_reply_frame(&g_ws_clients[i], &job->out);
+        trace_set_request(0);
+    }
+    metrics_observe_message(job->kind, metrics_now_ns() - job->start);
+    put_job(job);
+}
+
+// Refuse outright when the connection already has all the queued work it
+// may
+static int refuse_when_queue_full(int client_index, const char *type, sched_class_t cls) {
+    if (g_batch_writer || !sched_flow_full(g_ws_clients[client_index].conn_id, cls)) return 0;
+    reply_busy(client_index, type, NULL);
+    return 1;
+}
+
+// Hand a query to the work queue; 0 if it was queued and the reply
+// will come from complete_async_job(), -EBUSY when no job is free, or
+// -ENAMETOOLONG for input no job has room for
+static int queue_desktop_session(int client_index, const char *action, const char *path, uint64_t start) {
+    if (strlen(action) >= sizeof(((async_request_t *)0)->action) || (path && strlen(path) >= PATH_MAX)) {
+        return -ENAMETOOLONG;
+    }
+
+    async_request_t *job = get_job();
+    if (!job) return -EBUSY;
+
+    job->work.run = run_desktop_session_job;
+    job->work.complete = complete_async_job;
+    job->kind = METRIC_MSG_DESKTOP_SESSION;
+    job->conn_id = g_ws_clients[client_index].conn_id;
+    job->uid = g_ws_clients[client_index].uid;
+    job->id = g_current_id;
+    strcpy(job->action, action);
+    job->has_path = path != NULL;
+    if (path) strcpy(job->path, path);
+    json_writer_init(&job->out, WS_MAX_FRAME_HEADER);
+    job->start = start;
+    job->trace_request = trace_current_request();
+
+    if (sched_submit(job->conn_id, SCHED_CLASS_FILESYSTEM, &job->work) != 0) {
+        put_job(job);
+        return -EBUSY;
+    }
+    return 0;
+}
+
+// Filesystem and process queries. Outside a batch they run on the work
+// queue and answer whenever they are done; the "id" tells them apart.
+static void handle_desktop_session_message(int client_index, const proto_desktop_session_t *msg, uint64_t start) {
+    const char *action = msg->action.ptr;
+    const char *path = msg->path.ptr ? msg->path.ptr : msg->params.path.ptr;
+    const char *message;
+
+    if (g_ws_clients[client_index].authenticated && !g_batch_writer) {
+        if (refuse_when_queue_full(client_index, "desktop_session", SCHED_CLASS_FILESYSTEM)) return;
+        int queued = queue_desktop_session(client_index, action, path, start);
+        if (queued == 0) {
+            g_reply_deferred = 1;
+            return;
+        }
+        if (queued == -EBUSY) {
+            reply_busy(client_index, "desktop_session", action);
+            return;
+        }
+        // Too long for a job is too long to run here as well
+        json_writer_t *w = begin_reply(client_index, "desktop_session");
+        json_field_string(w, "action", action);
+        finish_reply(client_index, 0, "Path too long");
+        return;
+    }
+
+    json_writer_t *w = begin_reply(client_index, "desktop_session");
+    json_field_string(w, "action", action);
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+
+    int ok = write_desktop_session_data(&g_request_arena, w, action, path, g_ws_clients[client_index].uid, &message);
+    finish_reply(client_index, ok, message);
+}
+
+// Fields of a search reply after "id"; 1 on success. Only matches uid,
+// the session user, can list are counted or returned.
+static int write_search_results(arena_t *arena, json_writer_t *w, const char *query, int fuzzy,
+                                int offset, int limit, uid_t uid) {
+    user_cred_t cred;
+
+    json_field_string(w, "query", query);
+    json_field_string(w, "mode", fuzzy ? "fuzzy" : "substring");
+    if (user_cred_lookup(uid, &cred) != 0 || user_cred_enter(&cred) != 0) return 0;
+    json_key(w, "data");
+    json_begin_object(w);
+    file_index_search(arena, w, query, fuzzy, offset, limit);
+    json_end_object(w);
+    user_cred_leave();
+    return 1;
+}
+
+static void run_search_job(work_item_t *item) {
+    async_request_t *job = (async_request_t *)item;
+    json_writer_t *w = &job->out;
+
+    trace_set_request(job->trace_request);
+    uint64_t span = trace_begin();
+    write_reply_head(w, "search", &job->id);
+    int ok = write_search_results(&job->arena, w, job->query, job->fuzzy, job->offset, job->limit, job->uid);
+    write_reply_tail(w, ok, ok ? NULL : "Cannot search as this user");
+    trace_end("search", span, 0);
+    trace_set_request(0);
+}
+
+// Same as queue_desktop_session(), for a search
+static int queue_search(int client_index, const char *query, int fuzzy, int offset, int limit, uint64_t start) {
+    if (strlen(query) >= FILE_INDEX_MAX_QUERY) return -ENAMETOOLONG;
+
+    async_request_t *job = get_job();
+    if (!job) return -EBUSY;
+
+    job->work.run = run_search_job;
+    job->work.complete = complete_async_job;
+    job->kind = METRIC_MSG_SEARCH;
+    job->conn_id = g_ws_clients[client_index].conn_id;
+    job->uid = g_ws_clients[client_index].uid;
+    job->id = g_current_id;
+    strcpy(job->query, query);
+    job->fuzzy = fuzzy;
+    job->offset = offset;
+    job->limit = limit;
+    json_writer_init(&job->out, WS_MAX_FRAME_HEADER);
+    job->start = start;
+    job->trace_request = trace_current_request();
+
+    if (sched_submit(job->conn_id, SCHED_CLASS_FILESYSTEM, &job->work) != 0) {
+        put_job(job);
+        return -EBUSY;
+    }
+    return 0;
+}
+
+// Worker thread: PAM only. The session and the reply are made on the
+// event loop.
+static void run_pam_job(work_item_t *item) {
+    async_request_t *job = (async_request_t *)item;
+
+    trace_set_request(job->trace_request);
+    job->auth = authenticate_user(job->username, job->password);
+    memset(job->password, 0, sizeof(job->password));
+    trace_set_request(0);
+}
+
+static void complete_pam_job(work_item_t *item) {
+    async_request_t *job = (async_request_t *)item;
+    request_id_t id = g_current_id;
+
+    memset(job->password, 0, sizeof(job->password));
+    int i = find_client(job->conn_id);
+    if (i >= 0 && job->http) {
+        finish_http_login(i, job->username, job->auth, job->keep_alive);
+    } else if (i >= 0) {
+        g_current_id = job->id;
+        trace_set_request(job->trace_request);
+        if (job->kind == METRIC_MSG_UNLOCK) {
+            finish_unlock(i, job->username, job->auth);
+        } else {
+            finish_login(i, job->username, job->auth);
+        }
+        trace_set_request(0);
+        g_current_id = id;
+    }
+    if (!job->http) metrics_observe_message(job->kind, metrics_now_ns() - job->start);
+    put_job(job);
+}
+
+// Hand a password check to the work queue; kind is METRIC_MSG_LOGIN or
+// METRIC_MSG_UNLOCK, and http marks a login endpoint request
+static int queue_pam_job(int client_index, metric_message_t kind, int http, int keep_alive,
+                         const char *username, const char *password, uint64_t start) {
+    if (sched_flow_full(g_ws_clients[client_index].conn_id, SCHED_CLASS_AUTH)) return -1;
+
+    async_request_t *job = get_job();
+    if (!job) return -1;
+
+    job->work.run = run_pam_job;
+    job->work.complete = complete_pam_job;
+    job->kind = kind;
+    job->conn_id = g_ws_clients[client_index].conn_id;
+    job->id = g_current_id;
+    snprintf(job->username, sizeof(job->username), "%s", username);
+    snprintf(job->password, sizeof(job->password), "%s", password);
+    job->auth = 0;
+    job->http = http != 0;
+    job->keep_alive = keep_alive != 0;
+    job->start = start;
+    job->trace_request = trace_current_request();
+
+    if (sched_submit(job->conn_id, SCHED_CLASS_AUTH, &job->work) != 0) {
+        memset(job->password, 0, sizeof(job->password));
+        put_job(job);
+        return -1;
+    }
+    return 0;
+}
+
+// Filename search over the indexed directories; ranked, one page at a
+// time
+static void handle_search_message(int client_index, const proto_search_t *msg, uint64_t start) {
+    const char *query = msg->query.ptr;
+    int fuzzy = msg->mode.ptr && strcmp(msg->mode.ptr, "fuzzy") == 0;
+    int page_offset = get_count_field(msg->present, PROTO_SEARCH_OFFSET, msg->offset, 0, FILE_INDEX_MAX_RESULTS);
+    int page_limit = get_count_field(msg->present, PROTO_SEARCH_LIMIT, msg->limit,
+                                     FILE_INDEX_DEFAULT_LIMIT, FILE_INDEX_MAX_RESULTS);
+
+    if (g_ws_clients[client_index].authenticated && !g_batch_writer) {
+        if (refuse_when_queue_full(client_index, "search", SCHED_CLASS_FILESYSTEM)) return;
+        int queued = queue_search(client_index, query, fuzzy, page_offset, page_limit, start);
+        if (queued == 0) {
+            g_reply_deferred = 1;
+            return;
+        }
+        if (queued == -EBUSY) {
+            reply_busy(client_index, "search", NULL);
+            return;
+        }
+        begin_reply(client_index, "search");
+        finish_reply(client_index, 0, "Query too long");
+        return;
+    }
+
+    json_writer_t *w = begin_reply(client_index, "search");
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+    int ok = write_search_results(&g_request_arena, w, query, fuzzy, page_offset, page_limit,
+                                  g_ws_clients[client_index].uid);
+    finish_reply(client_index, ok, ok ? NULL : "Cannot search as this user");
+}
+
+// Installed applications, straight from the mapped catalog
+static void handle_apps_message(int client_index, const proto_request_t *request) {
+    int search = request->head.type == PROTO_MSG_SEARCH_APPS;
+    const char *locale = search ? request->u.search_apps.locale.ptr : request->u.list_apps.locale.ptr;
+    json_writer_t *w = begin_reply(client_index, proto_message_name(request->head.type));
+
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+
+    json_key(w, "data");
+    json_begin_object(w);
+    if (search) {
+        const proto_search_apps_t *msg = &request->u.search_apps;
+        app_catalog_search(&g_request_arena, w, msg->query.ptr, locale,
+                           get_count_field(msg->present, PROTO_SEARCH_APPS_LIMIT, msg->limit,
+                                           APP_CATALOG_DEFAULT_LIMIT, 1000));
+    } else {
+        app_catalog_list(&g_request_arena, w, locale, request->u.list_apps.include_hidden);
+    }
+    json_end_object(w);
+    finish_reply(client_index, 1, NULL);
+}
+
+// Launches waiting for the helper; the reply goes out once the program
+// has exec'd or failed
+typedef struct {
+    uint32_t request;
+    uint64_t conn_id;
+    request_id_t id;
+    uint64_t start;
+    uint32_t cgroup_app;        // 0 when the program runs outside session accounting
+} launch_reply_t;
+
+static launch_reply_t g_launch_replies[LAUNCHER_MAX_IN_FLIGHT];
+static int g_launch_reply_count = 0;
+
+static const char *env_entry(const char *name, const char *value) {
+    size_t name_len = strlen(name), value_len = strlen(value);
+    char *entry = arena_alloc(&g_request_arena, name_len + value_len + 2);
+    if (!entry) return NULL;
+    memcpy(entry, name, name_len);
+    entry[name_len] = '=';
+    memcpy(entry + name_len + 1, value, value_len + 1);
+    return entry;
+}
+
+// Replace the variable if the environment has it, else append
+static void env_set(const char **envp, int *count, const char *entry) {
+    size_t name_len = strcspn(entry, "=");
+    for (int i = 0; i < *count; i++) {
+        if (strncmp(envp[i], entry, name_len) == 0 && envp[i][name_len] == '=') {
+            envp[i] = entry;
+            return;
+        }
+    }
+    envp[(*count)++] = entry;
+}
+
+// The session user's login environment plus the request's "env"
+static const char **build_launch_env(const nss_user_t *user, const desktop_session_t *session,
+                                     const proto_launch_t *msg, const char **error) {
+    const char **envp = arena_alloc(&g_request_arena, (LAUNCH_MAX_ENV + 16) * sizeof(*envp));
+    const char *lang = getenv("LANG");
+    char runtime_dir[64];
+    int count = 0;
+
+    if (!envp) {
+        *error = "Out of memory";
+        return NULL;
+    }
+    snprintf(runtime_dir, sizeof(runtime_dir), "/run/user/%u", (unsigned)user->uid);
+    envp[count++] = env_entry("HOME", user->home);
+    envp[count++] = env_entry("USER", user->name);
+    envp[count++] = env_entry("LOGNAME", user->name);
+    envp[count++] = env_entry("SHELL", user->shell[0] ? user->shell : "/bin/sh");
+    envp[count++] = env_entry("PATH", "/usr/local/bin:/usr/bin:/bin");
+    envp[count++] = env_entry("XDG_RUNTIME_DIR", runtime_dir);
+    if (lang) envp[count++] = env_entry("LANG", lang);
+    if (session->display[0]) envp[count++] = env_entry("DISPLAY", session->display);
+
+    for (int i = 0; i < msg->env_count; i++) {
+        const proto_pair_t *var = &msg->env[i];
+        if (!var->key.len || strchr(var->key.ptr, '=')) {
+            *error = "Invalid env";
+            return NULL;
+        }
+        env_set(envp, &count, env_entry(var->key.ptr, var->value.ptr));
+    }
+    for (int i = 0; i < count; i++) {
+        if (!envp[i]) {
+            *error = "Out of memory";
+            return NULL;
+        }
+    }
+    envp[count] = NULL;
+    return envp;
+}
+
+// Command line from a catalog id plus "files", or a plain "argv" array
+static const char **build_launch_argv(const proto_launch_t *msg, const char **error) {
+    const char *app = msg->app.ptr;
+    const proto_str_t *args = app ? msg->files : msg->argv;
+    const char *items[APP_CATALOG_MAX_EXEC_ARGS];
+    const char **argv = NULL;
+    int count = app ? msg->files_count : msg->argv_count;
+    int terminal = 0;
+
+    if (!app && !(msg->present & PROTO_LAUNCH_ARGV)) {
+        *error = "Missing app or argv";
+        return NULL;
+    }
+    // The schema keeps both arrays below APP_CATALOG_MAX_EXEC_ARGS
+    for (int i = 0; i < count; i++) items[i] = args[i].ptr;
+
+    if (!app) {
+        if (count == 0) {
+            *error = "Empty argv";
+            return NULL;
+        }
+        argv = arena_alloc(&g_request_arena, (count + 1) * sizeof(*argv));
+        if (!argv) {
+            *error = "Out of memory";
+            return NULL;
+        }
+        memcpy(argv, items, count * sizeof(*argv));
+        argv[count] = NULL;
+        return argv;
+    }
+
+    if (app_catalog_exec(&g_request_arena, app, items, count, &argv, &terminal) != 0) {
+        *error = "Unknown application";
+        return NULL;
+    }
+    if (terminal) {
+        int argc = 0;
+        while (argv[argc]) argc++;
+        const char **wrapped = arena_alloc(&g_request_arena, (argc + 3) * sizeof(*wrapped));
+        if (!wrapped) {
+            *error = "Out of memory";
+            return NULL;
+        }
+        wrapped[0] = LAUNCH_TERMINAL;
+        wrapped[1] = "-e";
+        memcpy(wrapped + 2, argv, (argc + 1) * sizeof(*wrapped));
+        argv = wrapped;
+    }
+    return argv;
+}
+
+// Start a program as the session user. The helper process forks and
+// execs it; the reply comes when it is running, and its exit is pushed
+// to the session's connections as "process_exit".
+static void handle_launch_message(int client_index, const proto_launch_t *msg, uint64_t start) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    const char *cwd = msg->cwd.ptr;
+    const char *error = NULL;
+    desktop_session_t session;
+    nss_user_t user;
+    launch_request_t request;
+    uint32_t request_number, cgroup_app = 0;
+    int result;
+
+    if (!client->authenticated) {
+        error = "Not logged in";
+    } else if (g_batch_writer) {
+        error = "Not available in a batch";
+    } else if (get_session_by_id(client->session_id, &session) != 0 || nss_get_user_by_uid(client->uid, &user) != 0) {
+        error = "No session";
+    } else if (g_launch_reply_count == LAUNCHER_MAX_IN_FLIGHT) {
+        error = "Busy";
+    }
+
+    memset(&request, 0, sizeof(request));
+    if (!error) request.argv = build_launch_argv(msg, &error);
+    if (!error) request.envp = build_launch_env(&user, &session, msg, &error);
+
+    if (!error) {
+        request.user = user.name;
+        request.uid = user.uid;
+        request.gid = user.gid;
+        request.cwd = cwd ? cwd : user.home;
+        request.owner = client->session_id;
+        request.start = start;
+
+        // A cgroup of its own unless "isolate": false, for accounting
+        // and for killing everything it forks
+        const char *name = msg->app.ptr;
+        if (!name) {
+            name = strrchr(request.argv[0], '/') ? strrchr(request.argv[0], '/') + 1 : request.argv[0];
+        }
+        cgroup_create_app(client->session_id, !(msg->present & PROTO_LAUNCH_ISOLATE) || msg->isolate,
+                          name, &cgroup_app, &request.cgroup);
+
+        result = launcher_submit(&request, &request_number);
+        if (result != 0 && cgroup_app) cgroup_app_failed(cgroup_app);
+        if (result == 0) {
+            launch_reply_t *reply = &g_launch_replies[g_launch_reply_count++];
+            reply->request = request_number;
+            reply->conn_id = client->conn_id;
+            reply->id = g_current_id;
+            reply->start = start;
+            reply->cgroup_app = cgroup_app;
+            g_reply_deferred = 1;
+            return;
+        }
+        error = result == -EBUSY ? "Busy" : result == -E2BIG ? "Request too large" : strerror(-result);
+    }
+
+    begin_reply(client_index, "launch");
+    finish_reply(client_index, 0, error);
+}
+
+static void send_launch_reply(const launch_event_t *event) {
+    launch_reply_t reply;
+    int index = -1;
+
+    for (int i = 0; i < g_launch_reply_count; i++) {
+        if (g_launch_replies[i].request == event->request) index = i;
+    }
+    if (index < 0) {
+        if (event->pidfd >= 0) close(event->pidfd);
+        return;
+    }
+    reply = g_launch_replies[index];
+    g_launch_replies[index] = g_launch_replies[--g_launch_reply_count];
+    metrics_observe_message(METRIC_MSG_LAUNCH, metrics_now_ns() - reply.start);
+    if (reply.cgroup_app && event->type == LAUNCH_EVENT_STARTED) {
+        cgroup_app_started(reply.cgroup_app, event->pid, event->pidfd);
+    } else {
+        if (event->pidfd >= 0) close(event->pidfd);
+        if (reply.cgroup_app) cgroup_app_failed(reply.cgroup_app);
+    }
+
+    int i = find_client(reply.conn_id);
+    if (i < 0) return;
+    json_writer_t *w = &g_reply_out;
+    json_writer_reset(w);
+    write_reply_head(w, "launch", &reply.id);
+    if (event->type == LAUNCH_EVENT_STARTED) {
+        json_field_int(w, "pid", event->pid);
+        json_field_uint(w, "latency_us", event->latency_ns / 1000);
+        write_reply_tail(w, 1, NULL);
+    } else {
+        write_reply_tail(w, 0, strerror(event->error));
+    }
+    if (!w->error) send_reply_frame(&g_ws_clients[i], w);
+    json_writer_free(w);
+}
+
+// Tell every connection of the owning session
+static void send_process_exit(const launch_event_t *event) {
+    json_writer_t *w = &g_scene_out;
+
+    json_writer_reset(w);
+    json_begin_object(w);
+    json_field_string(w, "type", "process_exit");
+    json_field_int(w, "pid", event->pid);
+    json_field_int(w, "exit_code", event->exit_code);
+    json_field_int(w, "signal", event->signal);
+    json_field_uint(w, "runtime_ms", event->runtime_ns / 1000000);
+    json_end_object(w);
+    if (w->error) {
+        json_writer_free(w);
+        return;
+    }
+
+    for (int i = 0; i < g_client_slots; i++) {
+        if (g_ws_clients[i].handshake_complete && g_ws_clients[i].authenticated &&
+            g_ws_clients[i].session_id == event->owner) {
+            send_reply_frame(&g_ws_clients[i], w);
+        }
+    }
+}
+
+static void process_launch_events(void) {
+    launch_event_t event;
+
+    launcher_process();
+    while (launcher_next_event(&event)) {
+        if (event.type == LAUNCH_EVENT_EXITED) {
+            cgroup_app_exited(event.pid);
+            send_process_exit(&event);
+            continue;
+        }
+        if (event.type == LAUNCH_EVENT_STARTED) {
+            metrics_observe(METRIC_HIST_LAUNCH, event.latency_ns);
+            log_write(LOG_EV_LAUNCHED, NULL, event.pid, (int64_t)(event.latency_ns / 1000), 0);
+        } else {
+            log_write(LOG_EV_LAUNCH_FAILED, strerror(event.error), event.error, 0, 0);
+        }
+        send_launch_reply(&event);
+    }
+}
+
+// CPU, memory and I/O of the session and of each program it launched,
+// from the cgroup counters sampled every CGROUP_SAMPLE_INTERVAL_MS
+static void handle_resource_usage_message(int client_index) {
+    json_writer_t *w = begin_reply(client_index, "resource_usage");
+
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+    json_key(w, "data");
+    cgroup_write_usage(w, g_ws_clients[client_index].session_id);
+    finish_reply(client_index, 1, NULL);
+}
+
+// Signal a launched program; the default SIGKILL ends its whole cgroup
+static void handle_kill_message(int client_index, const proto_kill_t *msg) {
+    int sig = get_count_field(msg->present, PROTO_KILL_SIGNAL, msg->signal, SIGKILL, 64);
+    json_writer_t *w = begin_reply(client_index, "kill");
+
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+    json_field_int(w, "pid", msg->pid);
+    int result = cgroup_kill_app(g_ws_clients[client_index].session_id, (pid_t)msg->pid, sig);
+    finish_reply(client_index, result == 0, result == -ESRCH ? "Not a program of this session"
+                                                              : result ? strerror(-result) : NULL);
+}
+
+static void handle_system_status_message(int client_index) {
+    json_writer_t *w = begin_reply(client_index, "system_status");
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+    json_key(w, "data");
+    get_system_status(w);
+    finish_reply(client_index, 1, NULL);
+}
+
+// Allocation and buffer pool counters, to check hot paths stay off malloc
+static void handle_memory_stats_message(int client_index) {
+    bufpool_stats_t pool;
+    file_index_stats_t index;
+    json_writer_t *w = begin_reply(client_index, "memory_stats");
+
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+
+    bufpool_get_stats(&pool);
+    json_key(w, "data");
+    json_begin_object(w);
+    json_field_uint(w, "heap_allocations", heap_allocation_count());
+    json_field_uint(w, "arena_capacity", arena_capacity(&g_request_arena));
+    json_field_uint(w, "arena_high_water", g_request_arena.high_water);
+    json_field_uint(w, "pool_gets", pool.gets);
+    json_field_uint(w, "pool_hits", pool.hits);
+    json_field_uint(w, "pool_oversized", pool.oversized);
+    json_field_uint(w, "pool_cached_bytes", pool.cached_bytes);
+    file_index_get_stats(&index);
+    json_field_uint(w, "index_entries", index.entries);
+    json_field_uint(w, "index_watches", index.watches);
+    json_field_uint(w, "index_bytes", index.name_bytes + index.posting_bytes);
+    json_end_object(w);
+    finish_reply(client_index, 1, NULL);
+}
+
+// Counters, gauges and latency summaries; the same data as /metrics
+static void handle_metrics_message(int client_index) {
+    json_writer_t *w = begin_reply(client_index, "metrics");
+
+    if (!g_ws_clients[client_index].authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+
+    update_send_queue_gauge();
+    json_key(w, "data");
+    metrics_write_json(w);
+    finish_reply(client_index, 1, NULL);
+}
+
+// Switch tracing on or off, or return what has been recorded as Chrome
+// trace-event JSON. Spans cover every user's requests, so only root may:
+// a root session, or a root process on the Unix socket.
+static void handle_trace_message(int client_index, const proto_trace_t *msg) {
+    const ws_client_t *client = &g_ws_clients[client_index];
+    const char *action = msg->action.ptr;
+    json_writer_t *w = begin_reply(client_index, "trace");
+
+    if (!client->authenticated && !client->peer_cred) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+    if (!(client->authenticated && client->uid == 0) && !(client->peer_cred && client->peer_uid == 0)) {
+        finish_reply(client_index, 0, "Permission denied");
+        return;
+    }
+
+    if (strcmp(action, "start") == 0) {
+        trace_set_enabled(1);
+    } else if (strcmp(action, "stop") == 0) {
+        trace_set_enabled(0);
+    } else if (strcmp(action, "clear") == 0) {
+        trace_clear();
+    } else if (strcmp(action, "dump") == 0) {
+        json_key(w, "data");
+        trace_write_json(w);
+    } else {
+        finish_reply(client_index, 0, "Unknown action");
+        return;
+    }
+    json_field_bool(w, "enabled", g_trace_enabled);
+    finish_reply(client_index, 1, NULL);
+}
+
+// A thumbnail request on the work queue. Results go out as binary
+// frames: a little-endian u32 length, a JSON header of that length
+// describing the items, then the PNG bytes the items point into.
+typedef struct {
+    char *buf;                  // Pooled; WS_MAX_FRAME_HEADER of headroom, then the payload
+    size_t len;                 // Payload bytes
+    size_t cap;
+} binary_frame_t;
+
+typedef struct {
+    work_item_t work;           // First, so the item is the job
+    uint64_t conn_id;
+    uid_t uid;                  // Session user the files are read as
+    request_id_t id;
+    int size;
+    int count;
+    const char *paths[THUMBNAIL_MAX_PATHS];    // In the job's arena
+    arena_t arena;
+    int frame_count;
+    binary_frame_t frames[THUMBNAIL_MAX_PATHS];
+    uint64_t start;
+    uint64_t trace_request;
+} thumbnail_job_t;
+
+static int g_thumbnail_jobs = 0;
+
+static void begin_thumbnail_frame(thumbnail_job_t *job, json_writer_t *head) {
+    json_writer_reset(head);
+    write_reply_head(head, "thumbnail", &job->id);
+    json_field_int(head, "size", job->size);
+    json_key(head, "items");
+    json_begin_array(head);
+}
+
+// Put header and image data together behind room for the frame header
+static void close_thumbnail_frame(thumbnail_job_t *job, json_writer_t *head,
+                                  const unsigned char *data, size_t data_len, int more) {
+    binary_frame_t *frame = &job->frames[job->frame_count];
+
+    json_end_array(head);
+    json_field_bool(head, "more", more);
+    write_reply_tail(head, 1, NULL);
+
+    size_t head_len = json_writer_payload_len(head);
+    frame->len = 4 + head_len + data_len;
+    frame->buf = head->error ? NULL : bufpool_get(WS_MAX_FRAME_HEADER + frame->len, &frame->cap);
+    if (!frame->buf) return;
+
+    unsigned char *p = (unsigned char *)frame->buf + WS_MAX_FRAME_HEADER;
+    p[0] = head_len & 0xff;
+    p[1] = (head_len >> 8) & 0xff;
+    p[2] = (head_len >> 16) & 0xff;
+    p[3] = (head_len >> 24) & 0xff;
+    memcpy(p + 4, json_writer_payload(head), head_len);
+    memcpy(p + 4 + head_len, data, data_len);
+    job->frame_count++;
+}
+
+// Worker thread: decode, scale and encode (or load from the cache) each
+// image, cutting frames at THUMBNAIL_FRAME_BYTES. Images are read, and
+// cached in the home directory, as the session user.
+static void run_thumbnail_job(work_item_t *item) {
+    thumbnail_job_t *job = (thumbnail_job_t *)item;
+    json_writer_t head;
+    unsigned char *data = NULL;
+    size_t data_len = 0, data_cap = 0;
+    char cache_root[PATH_MAX];
+    user_cred_t cred;
+    nss_user_t user;
+
+    trace_set_request(job->trace_request);
+    json_writer_init(&head, 0);
+    begin_thumbnail_frame(job, &head);
+
+    int entered = nss_get_user_by_uid(job->uid, &user) == 0 && user_cred_lookup(job->uid, &cred) == 0 &&
+                  user_cred_enter(&cred) == 0;
+    if (entered) thumbnail_cache_root(user.home, cache_root, sizeof(cache_root));
+
+    for (int i = 0; i < job->count; i++) {
+        thumbnail_t thumb;
+        const char *error = "Cannot access path";
+        uint64_t span = trace_begin();
+        int ok = entered && thumbnail_get(job->paths[i], job->size, cache_root, &thumb, &error) == 0;
+        trace_end("thumbnail", span, ok ? (int64_t)thumb.len : -1);
+
+        if (ok) {
+            unsigned char *grown = bufpool_grow(data, data_len, &data_cap, data_len + thumb.len);
+            if (grown) {
+                data = grown;
+                memcpy(data + data_len, thumb.png, thumb.len);
+            } else {
+                ok = 0;
+                error = "Out of memory";
+            }
+        }
+
+        json_begin_object(&head);
+        json_field_string(&head, "path", job->paths[i]);
+        if (ok) {
+            json_field_int(&head, "width", thumb.width);
+            json_field_int(&head, "height", thumb.height);
+            json_field_uint(&head, "offset", data_len);
+            json_field_uint(&head, "length", thumb.len);
+            json_field_bool(&head, "cached", thumb.cached);
+            data_len += thumb.len;
+            thumbnail_release(&thumb);
+        } else {
+            json_field_string(&head, "error", error);
+        }
+        json_end_object(&head);
+
+        int last = i == job->count - 1;
+        if (!last && data_len >= THUMBNAIL_FRAME_BYTES) {
+            close_thumbnail_frame(job, &head, data, data_len, 1);
+            begin_thumbnail_frame(job, &head);
+            data_len = 0;
+        }
+    }
+    close_thumbnail_frame(job, &head, data, data_len, 0);
+    if (entered) user_cred_leave();
+
+    bufpool_put(data, data_cap);
+    json_writer_free(&head);
+    trace_set_request(0);
+}
+
+static void free_thumbnail_job(thumbnail_job_t *job) {
+    for (int i = 0; i < job->frame_count; i++) {
+        bufpool_put(job->frames[i].buf, job->frames[i].cap);
+    }
+    arena_free(&job->arena);
+    free(job);
+    g_thumbnail_jobs--;
+}
+
+// Event loop: send the frames if the connection is still there
+static void complete_thumbnail_job(work_item_t *item) {
+    thumbnail_job_t *job = (thumbnail_job_t *)item;
+
+    int i = find_client(job->conn_id);
+    if (i >= 0) {
+        trace_set_request(job->trace_request);
+        for (int f = 0; f < job->frame_count; f++) {
+            unsigned char header[WS_MAX_FRAME_HEADER];
+            size_t header_len = ws_frame_header(WS_OPCODE_BINARY, job->frames[f].len, header);
+            char *frame = job->frames[f].buf + WS_MAX_FRAME_HEADER - header_len;
+            memcpy(frame, header, header_len);
+            struct iovec iov = { frame, header_len + job->frames[f].len };
+
+            uint64_t span = trace_begin();
+            int sent = send_frame_parts(&g_ws_clients[i], &iov, 1);
+            trace_end("ws_send", span, header_len + job->frames[f].len);
+            if (sent != 0) break;
+        }
+        trace_set_request(0);
+    }
+    metrics_observe_message(METRIC_MSG_THUMBNAIL, metrics_now_ns() - job->start);
+    free_thumbnail_job(job);
+}
+
+// Thumbnails for a set of image paths, e.g. a whole directory view. The
+// reply comes from the work queue as one or more binary frames; errors
+// before that are ordinary text replies.
+static void handle_thumbnail_message(int client_index, const proto_thumbnail_t *msg, uint64_t start) {
+    const char *error = NULL;
+    thumbnail_job_t *job = NULL;
+    int count = 0;
+
+    if (!g_ws_clients[client_index].authenticated) {
+        error = "Not logged in";
+    } else if (g_batch_writer) {
+        error = "Not available in a batch";
+    } else if (g_thumbnail_jobs >= THUMBNAIL_MAX_IN_FLIGHT) {
+        error = "Busy";
+    } else if ((job = calloc(1, sizeof(*job))) == NULL || arena_init(&job->arena, ARENA_DEFAULT_SIZE) != 0) {
+        free(job);
+        job = NULL;
+        error = "Out of memory";
+    }
+
+    // Copied: the job outlives the receive buffer
+    for (int i = 0; job && !error && i < msg->paths_count; i++) {
+        if ((job->paths[count++] = arena_strndup(&job->arena, msg->paths[i].ptr, msg->paths[i].len)) == NULL) {
+            error = "Out of memory";
+        }
+    }
+
+    if (job && !error) {
+        g_thumbnail_jobs++;
+        job->work.run = run_thumbnail_job;
+        job->work.complete = complete_thumbnail_job;
+        job->conn_id = g_ws_clients[client_index].conn_id;
+        job->uid = g_ws_clients[client_index].uid;
+        job->id = g_current_id;
+        job->size = thumbnail_size_for(msg->present & PROTO_THUMBNAIL_SIZE ? (int)msg->size : THUMBNAIL_DEFAULT_SIZE);
+        job->count = count;
+        job->start = start;
+        job->trace_request = trace_current_request();
+        if (sched_submit(job->conn_id, SCHED_CLASS_FILESYSTEM, &job->work) == 0) {
+            g_reply_deferred = 1;
+            return;
+        }
+        g_thumbnail_jobs--;
+        error = "Busy";
+    }
+    if (job) {
+        arena_free(&job->arena);
+        free(job);
+    }
+
+    begin_reply(client_index, "thumbnail");
+    finish_reply(client_index, 0, error);
+}
+
+// Window scene kept by the daemon. "snapshot" returns all of it and
+// subscribes the connection to scene_delta pushes; "mutate" applies ops.
+static void handle_scene_message(int client_index, const proto_scene_t *msg) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    const char *action = msg->action.ptr;
+    const char *error = NULL;
+    json_writer_t *w = begin_reply(client_index, "scene");
+
+    json_field_string(w, "action", action);
+    if (!client->authenticated) {
+        finish_reply(client_index, 0, "Not logged in");
+        return;
+    }
+
+    if (strcmp(action, "snapshot") == 0) {
+        client->scene_subscribed = 1;
+        scene_write_snapshot(w);
+    } else if (strcmp(action, "mutate") == 0) {
+        // Ops are free-form; only they get a tree of their own
+        const json_value_t *ops = msg->ops.ptr ? json_read(&g_request_arena, msg->ops.ptr, msg->ops.len) : NULL;
+        scene_apply(ops, &error);
+        json_field_uint(w, "version", scene_version());
+    } else if (strcmp(action, "unsubscribe") == 0) {
+        client->scene_subscribed = 0;
+    } else {
+        error = "Unknown action";
+    }
+    finish_reply(client_index, error == NULL, error);
+}
+
+// Push the changes of the last frame to subscribed connections
+static void flush_scene_delta(void) {
+    json_writer_t *w = &g_scene_out;
+
+    json_writer_reset(w);
+    json_begin_object(w);
+    json_field_string(w, "type", "scene_delta");
+    if (!scene_write_delta(w)) return;
+    json_end_object(w);
+    if (w->error) {
+        log_write(LOG_EV_SCENE_DELTA_FAILED, NULL, 0, 0, 0);
+        json_writer_free(w);
+        return;
+    }
+
+    for (int i = 0; i < g_client_slots; i++) {
+        if (g_ws_clients[i].handshake_complete && g_ws_clients[i].scene_subscribed) {
+            send_reply_frame(&g_ws_clients[i], w);
+        }
+    }
+}
+
+static void handle_batch_message(int client_index, const proto_batch_t *msg);
+
+// A request the decoder turned down, answered under its type when that
+// much could be read
+static void reply_invalid_request(int client_index, const proto_head_t *head) {
+    begin_reply(client_index, head->type ? proto_message_name(head->type) : "error");
+    finish_reply(client_index, 0, head->error);
+}
+
+// Run the handler for one decoded message
+static void dispatch_message(int client_index, const proto_request_t *request, uint64_t start) {
+    ws_client_t *client = &g_ws_clients[client_index];
+    const char *msg_type = proto_message_name(request->head.type);
+    sched_class_t cls = sched_class_of(msg_type);
+    uint32_t retry_ms = 0;
+
+    // Each sub-request of a batch pays for itself
+    if (!sched_take(&client->bucket, cls, metrics_now_ns(), &retry_ms)) {
+        log_write(LOG_EV_THROTTLED, sched_class_name(cls), (int64_t)client->conn_id, retry_ms, 0);
+        json_writer_t *w = begin_reply(client_index, msg_type);
+        json_field_uint(w, "retry_after_ms", retry_ms);
+        finish_reply(client_index, 0, "Rate limited");
+        return;
+    }
+
+    switch ((proto_msg_t)request->head.type) {
+        case PROTO_MSG_LOGIN:
+            handle_login_message(client_index, &request->u.login, start);
+            break;
+        case PROTO_MSG_RESUME:
+            handle_resume_message(client_index, &request->u.resume);
+            break;
+        case PROTO_MSG_UNLOCK:
+            handle_unlock_message(client_index, &request->u.unlock, start);
+            break;
+        case PROTO_MSG_LOCK:
+        case PROTO_MSG_LOGOUT:
+            handle_session_state_message(client_index, msg_type);
+            break;
+        case PROTO_MSG_DESKTOP_SESSION:
+            handle_desktop_session_message(client_index, &request->u.desktop_session, start);
+            break;
+        case PROTO_MSG_SYSTEM_STATUS:
+            handle_system_status_message(client_index);
+            break;
+        case PROTO_MSG_MEMORY_STATS:
+            handle_memory_stats_message(client_index);
+            break;
+        case PROTO_MSG_METRICS:
+            handle_metrics_message(client_index);
+            break;
+        case PROTO_MSG_TRACE:
+            handle_trace_message(client_index, &request->u.trace);
+            break;
+        case PROTO_MSG_THUMBNAIL:
+            handle_thumbnail_message(client_index, &request->u.thumbnail, start);
+            break;
+        case PROTO_MSG_SEARCH:
+            handle_search_message(client_index, &request->u.search, start);
+            break;
+        case PROTO_MSG_LIST_APPS:
+        case PROTO_MSG_SEARCH_APPS:
+            handle_apps_message(client_index, request);
+            break;
+        case PROTO_MSG_LAUNCH:
+            handle_launch_message(client_index, &request->u.launch, start);
+            break;
+        case PROTO_MSG_RESOURCE_USAGE:
+            handle_resource_usage_message(client_index);
+            break;
+        case PROTO_MSG_KILL:
+            handle_kill_message(client_index, &request->u.kill);
+            break;
+        case PROTO_MSG_SCENE:
+            handle_scene_message(client_index, &request->u.scene);
+            break;
+        case PROTO_MSG_BATCH:
+            handle_batch_message(client_index, &request->u.batch);
+            break;
+        case PROTO_MSG_NONE:
+        case PROTO_MSG_COUNT:
+            break;
+    }
+}
+
+// Run sub-requests in order and answer with all their replies in one
+// frame. Every sub-request gets an entry, so replies line up with
+// requests even where a handler would have stayed silent. Each one is
+// decoded in place when its turn comes.
+static void handle_batch_message(int client_index, const proto_batch_t *msg) {
+    request_id_t batch_id = g_current_id;
+    proto_request_t request;
+
+    json_writer_t *w = begin_reply(client_index, "batch");
+    if (w == g_batch_writer) {
+        finish_reply(client_index, 0, "Batches cannot be nested");
+        return;
+    }
+
+    json_key(w, "replies");
+    json_begin_array(w);
+    g_batch_writer = w;
+    for (int i = 0; i < msg->requests_count; i++) {
+        int replies = g_batch_replies;
+        int ok = proto_decode_request((char *)msg->requests[i].ptr, msg->requests[i].len, &request) == 0;
+
+        read_request_id(&request.head, &g_current_id);
+        if (!ok) {
+            reply_invalid_request(client_index, &request.head);
+            continue;
+        }
+        dispatch_message(client_index, &request, 0);
+        if (g_batch_replies == replies) {
+            begin_reply(client_index, proto_message_name(request.head.type));
+            finish_reply(client_index, 0, "Invalid request");
+        }
+    }
+    g_batch_writer = NULL;
+    g_batch_replies = 0;
+    g_current_id = batch_id;
+
+    json_end_array(w);
+    finish_reply(client_index, 1, NULL);
+}
+
+// Decode one text message and dispatch it by its "type". The payload is
+// decoded where it lies in the receive buffer, so the capture takes it
+// first. Anything else the message needs while it is handled comes from
+// the request arena.
+static void handle_text_message(int client_index, char *payload, size_t len) {
+    uint64_t start = metrics_now_ns();
+    proto_request_t request;
+
+    recorder_message(g_ws_clients[client_index].conn_id, payload, len);
+    uint64_t span = trace_begin();
+    int ok = proto_decode_request(payload, len, &request) == 0;
+    const char *msg_type = proto_message_name(request.head.type);
+    metric_message_t kind = metrics_message_type(msg_type);
+    trace_end("decode", span, len);
+    // Never the payload: it may hold a password. The capture redacts it.
+    log_write(LOG_EV_MESSAGE, msg_type, (int64_t)g_ws_clients[client_index].conn_id, (int64_t)len, 0);
+
+    span = trace_begin();
+    read_request_id(&request.head, &g_current_id);
+    g_reply_deferred = 0;
+    if (ok) {
+        dispatch_message(client_index, &request, start);
+    } else {
+        reply_invalid_request(client_index, &request.head);
+    }
+    trace_end(metrics_message_name(kind), span, client_index);
+
+    arena_reset(&g_request_arena);
+    // Deferred replies are timed when they are sent
+    if (!g_reply_deferred) metrics_observe_message(kind, metrics_now_ns() - start);
+}
+
+// Read from an upgraded connection and handle every complete frame.
+// Input sits in a pooled buffer only while a frame is partial.
+static void handle_websocket_input(int client_index) {
+    ws_client_t *client = &g_ws_clients[client_index];
+
+    if (!client->rx) {
+        client->rx = bufpool_get(BUFPOOL_MIN_SIZE, &client->rx_cap);
+        if (!client->rx) {
+            remove_client(client_index);
+            return;
+        }
+    }
+
+    // The read is traced as part of the first request it completes.
+    // A connection with frames left from its last turn works through
+    // those before anything more is read from it.
+    trace_next_request();
+    if (!client->backlog) {
+        uint64_t span = trace_begin();
+        ssize_t bytes_read = recv(client->socket, client->rx + client->rx_len, client->rx_cap - client->rx_len,
+                                  MSG_DONTWAIT);
+        trace_end("ws_recv", span, bytes_read);
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        if (bytes_read <= 0) {
+            // Client disconnected
+            uint64_t conn_id = client->conn_id;
+            remove_client(client_index);
+            log_write(LOG_EV_DISCONNECT, NULL, (int64_t)conn_id, g_client_count, 0);
+            return;
+        }
+        client->rx_len += bytes_read;
+        metrics_count(METRIC_WS_BYTES_RECEIVED, bytes_read);
+    }
+    client->backlog = 0;
+
+    size_t offset = 0, frame_len = 0;
+    int frames = 0;
+    for (;;) {
+        if (frames >= SCHED_FRAMES_PER_TURN && offset < client->rx_len) {
+            // Turn used up; the rest waits for the next loop iteration.
+            // Checked before parsing, which unmasks the frame in place.
+            queue_backlog(client_index);
+            metrics_count(METRIC_DEFERRED_READ_BUDGET, 1);
+            break;
+        }
+        char *payload = NULL;
+        size_t payload_len = 0;
+        int opcode = parse_websocket_frame(client->rx + offset, client->rx_len - offset, WS_MAX_MESSAGE_SIZE,
+                                           &payload, &payload_len, &frame_len);
+        if (opcode == WS_FRAME_INCOMPLETE) {
+            break;
+        }
+        if (opcode == WS_FRAME_INVALID) {
+            log_write(LOG_EV_INVALID_FRAME, NULL, (int64_t)client->conn_id, 0, 0);
+            metrics_count(METRIC_WS_FRAMES_INVALID, 1);
+            remove_client(client_index);
+            return;
+        }
+        offset += frame_len;
+        frame_len = 0;
+
+        switch (opcode) {
+            case WS_OPCODE_TEXT: {
+                // Everything traced until the next frame belongs to this request
+                if (frames++ > 0) trace_next_request();
+                handle_text_message(client_index, payload, payload_len);
+                break;
+            }
+            case WS_OPCODE_PING: {
+                // Respond with pong
+                send_frame(client, WS_OPCODE_PONG, payload, payload_len);
+                break;
+            }
+            case WS_OPCODE_CLOSE: {
+                log_write(LOG_EV_CLOSE, NULL, (int64_t)client->conn_id, 0, 0);
+                remove_client(client_index);
+                return;
+            }
+        }
+    }
+
+    trace_set_request(0);
+    rx_consume(client, offset);
+    if (client->rx_len == 0) {
+        bufpool_put(client->rx, client->rx_cap);
+        client->rx = NULL;
+        client->rx_cap = 0;
+    } else if (frame_len > client->rx_cap) {
+        // A large frame is on its way; make room for all of it
+        char *rx = bufpool_grow(client->rx, client->rx_len, &client->rx_cap, frame_len);
+        if (!rx) {
+            remove_client(client_index);
+            return;
+        }
+        client->rx = rx;
+    }
+}
+
+// Handle WebSocket client
+void handle_websocket_client(int client_index) {
+    if (g_ws_clients[client_index].handshake_complete) {
+        handle_websocket_input(client_index);
+        return;
+    }
+
+    char buffer[BUFFER_SIZE];
+    int bytes_read = recv(g_ws_clients[client_index].socket, buffer, sizeof(buffer), 0);
+    
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    
+    if (bytes_read <= 0) {
+        // Client disconnected
+        uint64_t conn_id = g_ws_clients[client_index].conn_id;
+        remove_client(client_index);
+        log_write(LOG_EV_DISCONNECT, NULL, (int64_t)conn_id, g_client_count, 0);
+        return;
+    }
+    
+    // HTTP requests and the upgrade may arrive over several reads
+    handle_http_input(client_index, buffer, bytes_read);
+}
+
+// Per-connection state handed to a new binary. The socket itself goes
+// along as a descriptor; the HTTP request being parsed (if has_request),
+// rx_len bytes of buffered input and tx_len bytes of unsent frames follow.
 typedef struct {
-    int socket;
+    uint64_t conn_id;
     int handshake_complete;
-} ws_client_t;
+    int close_after_send;
+    int authenticated;
+    int scene_subscribed;
+    uid_t uid;
+    uint64_t session_id;
+    int peer_cred;
+    uid_t peer_uid;
+    pid_t peer_pid;
+    uint32_t has_request;
+    uint32_t rx_len;
+    uint32_t tx_len;
+} handoff_client_t;
+
+// Layouts both binaries must agree on
+typedef struct {
+    uint32_t client_size;
+    uint32_t session_size;
+    uint32_t window_size;
+    uint32_t client_count;
+    uint32_t has_unix;              // Second descriptor is the Unix listener
+    uint32_t has_launcher;          // Next, the launch helper's socket
+    uint32_t pidfd_count;           // Then the launched programs' pidfds, before the connections
+    uint64_t next_conn_id;
+} handoff_header_t;
+
+// Work that answers a connection later. None of it can be handed over.
+static int replies_pending(void) {
+    return g_jobs_in_flight || g_thumbnail_jobs || g_launch_reply_count;
+}
+
+// Nothing in flight that would answer a connection later
+static int handoff_quiescent(void) {
+    if (replies_pending()) return 0;
+    for (int i = 0; i < g_client_slots; i++) {
+        if (transfer_pending(&g_ws_clients[i])) return 0;
+    }
+    return 1;
+}
+
+// Serialize everything a connection needs and pass the sockets on. On
+// success the new binary owns them and this process exits.
+static void hand_off(void) {
+    upgrade_buf_t state;
+    handoff_header_t header;
+    int *fds = malloc((g_client_count + 3 + CGROUP_MAX_APPS) * sizeof(int));
+    int fd_count = 0;
+
+    if (!fds) {
+        printf("⚠️ Upgrade abandoned; still serving\n");
+        g_draining = 0;
+        watch_all_clients();
+        return;
+    }
+    if (scene_flush_deadline()) flush_scene_delta();
+
+    memset(&state, 0, sizeof(state));
+    memset(&header, 0, sizeof(header));
+    header.client_size = sizeof(handoff_client_t);
+    header.session_size = sizeof(desktop_session_t);
+    header.window_size = sizeof(scene_window_t);
+    header.next_conn_id = g_next_conn_id;
+    fds[fd_count++] = g_server_socket;
+    if (g_unix_socket >= 0) {
+        header.has_unix = 1;
+        fds[fd_count++] = g_unix_socket;
+    }
+    // The helper and the programs it started outlive this process
+    if (launcher_helper_fd() >= 0) {
+        header.has_launcher = 1;
+        fds[fd_count++] = launcher_helper_fd();
+    }
+
+    // Connections still sending a file at the deadline stay behind and
+    // close with this process
+    for (int i = 0; i < g_client_slots; i++) {
+        if (g_ws_clients[i].socket >= 0 && !transfer_pending(&g_ws_clients[i])) header.client_count++;
+    }
+    upgrade_put(&state, &header, sizeof(header));
+    session_token_save_state(&state);
+    desktop_session_save_state(&state);
+    scene_save_state(&state);
+    header.pidfd_count = cgroup_save_state(&state, fds + fd_count);
+    fd_count += header.pidfd_count;
+    launcher_save_state(&state);
+    memcpy(state.data, &header, sizeof(header));
 
-static ws_client_t g_ws_clients[MAX_CLIENTS];
+    for (int i = 0; i < g_client_slots; i++) {
+        ws_client_t *client = &g_ws_clients[i];
+        handoff_client_t record;
 
-// Base64 encoding function
-char* base64_encode(const unsigned char* input, int length) {
-    BIO *bio, *b64;
-    BUF_MEM *bufferPtr;
-    
-    b64 = BIO_new(BIO_f_base64());
-    bio = BIO_new(BIO_s_mem());
-    bio = BIO_push(b64, bio);
-    
-    BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL);
-    BIO_write(bio, input, length);
-    BIO_flush(bio);
-    BIO_get_mem_ptr(bio, &bufferPtr);
-    
-    char* result = malloc(bufferPtr->length + 1);
-    memcpy(result, bufferPtr->data, bufferPtr->length);
-    result[bufferPtr->length] = '\0';
-    
-    BIO_free_all(bio);
-    return result;
+        if (client->socket < 0 || transfer_pending(client)) continue;
+        memset(&record, 0, sizeof(record));
+        record.conn_id = client->conn_id;
+        record.handshake_complete = client->handshake_complete;
+        record.close_after_send = client->close_after_send;
+        record.authenticated = client->authenticated;
+        record.scene_subscribed = client->scene_subscribed;
+        record.uid = client->uid;
+        record.session_id = client->session_id;
+        record.peer_cred = client->peer_cred;
+        record.peer_uid = client->peer_uid;
+        record.peer_pid = client->peer_pid;
+        record.has_request = client->http != NULL;
+        record.rx_len = (uint32_t)client->rx_len;
+        record.tx_len = (uint32_t)(client->tx_len - client->tx_sent);
+        upgrade_put(&state, &record, sizeof(record));
+        if (client->http) upgrade_put(&state, &client->http->request, sizeof(http_request_t));
+        upgrade_put(&state, client->rx, client->rx_len);
+        upgrade_put(&state, client->tx + client->tx_sent, record.tx_len);
+        fds[fd_count++] = client->socket;
+    }
+
+    if (upgrade_send_state(&state, fds, fd_count) == 0) {
+        printf("♻️ Upgrade complete; %u connections handed over\n", header.client_count);
+        fflush(stdout);
+        recorder_flush();
+        log_flush();
+        _exit(0);
+    }
+    upgrade_buf_free(&state);
+    free(fds);
+    g_draining = 0;
+    watch_all_clients();
+    printf("⚠️ Upgrade abandoned; still serving\n");
 }
 
-// WebSocket handshake
-int perform_websocket_handshake(int client_socket, const char* request) {
-    char* key_start = strstr(request, "Sec-WebSocket-Key: ");
-    if (!key_start) return 0;
-    
-    key_start += 19; // Length of "Sec-WebSocket-Key: "
-    char* key_end = strstr(key_start, "\r\n");
-    if (!key_end) return 0;
-    
-    char key[256];
-    int key_len = key_end - key_start;
-    strncpy(key, key_start, key_len);
-    key[key_len] = '\0';
-    
-    // Concatenate key with magic string
-    char concat[512];
-    snprintf(concat, sizeof(concat), "%s%s", key, WS_MAGIC_STRING);
-    
-    // Calculate SHA1 hash
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    SHA1((unsigned char*)concat, strlen(concat), hash);
-    
-    // Base64 encode the hash
-    char* accept_key = base64_encode(hash, SHA_DIGEST_LENGTH);
-    
-    // Send handshake response
-    char response[1024];
-    snprintf(response, sizeof(response),
-        "HTTP/1.1 101 Switching Protocols\r\n"
-        "Upgrade: websocket\r\n"
-        "Connection: Upgrade\r\n"
-        "Sec-WebSocket-Accept: %s\r\n"
-        "\r\n", accept_key);
-    
-    int result = send(client_socket, response, strlen(response), 0);
-    free(accept_key);
-    
-    return result > 0;
+// The drain deadline has passed. A download still running is cut off,
+// but replies still owed would be lost: then the upgrade is given up
+// and this binary keeps serving.
+static void drain_timed_out(void) {
+    if (!replies_pending()) {
+        hand_off();
+        return;
+    }
+    upgrade_abort();
+    g_draining = 0;
+    watch_all_clients();
+    printf("⚠️ Upgrade abandoned: replies still pending after %d ms; still serving\n", UPGRADE_DRAIN_TIMEOUT_MS);
 }
 
-// Parse WebSocket frame
-int parse_websocket_frame(const char* buffer, int buffer_len, char* payload, int* payload_len) {
-    if (buffer_len < 2) return 0;
-    
-    unsigned char first_byte = buffer[0];
-    unsigned char second_byte = buffer[1];
-    
-    int fin = (first_byte >> 7) & 1;
-    int opcode = first_byte & 0x0F;
-    int masked = (second_byte >> 7) & 1;
-    int payload_length = second_byte & 0x7F;
-    
-    int header_len = 2;
-    
-    // Extended payload length
-    if (payload_length == 126) {
-        if (buffer_len < 4) return 0;
-        payload_length = (buffer[2] << 8) | buffer[3];
-        header_len = 4;
-    } else if (payload_length == 127) {
-        if (buffer_len < 10) return 0;
-        // For simplicity, we'll limit to 32-bit payload lengths
-        payload_length = (buffer[6] << 24) | (buffer[7] << 16) | (buffer[8] << 8) | buffer[9];
-        header_len = 10;
+// Refuse the handoff: the previous binary keeps its descriptors and
+// goes on serving, and this process exits without touching them
+static int reject_handoff(int fd, upgrade_buf_t *state, int *fds, int fd_count) {
+    upgrade_ack(fd, 0);
+    upgrade_buf_free(state);
+    for (int i = 0; i < fd_count; i++) close(fds[i]);
+    free(fds);
+    return -1;
+}
+
+// New binary: take the listening socket, the connections and the state
+// of the daemon being replaced
+static int take_over(int fd) {
+    upgrade_buf_t state;
+    upgrade_reader_t reader;
+    handoff_header_t header;
+    int max_fds = g_max_clients + 3 + CGROUP_MAX_APPS;
+    int *fds = malloc(max_fds * sizeof(int));
+    int fd_count = 0;
+
+    if (!fds || upgrade_signal_ready(fd) != 0 || upgrade_receive_state(fd, &state, fds, max_fds, &fd_count) != 0) {
+        upgrade_buf_free(&state);
+        free(fds);
+        return -1;
     }
-    
-    // Masking key
-    unsigned char mask[4];
-    if (masked) {
-        if (buffer_len < header_len + 4) return 0;
-        memcpy(mask, buffer + header_len, 4);
-        header_len += 4;
+    reader.data = state.data;
+    reader.len = state.len;
+    reader.pos = 0;
+    reader.error = 0;
+
+    upgrade_get(&reader, &header, sizeof(header));
+    int pidfd_start = 1 + (int)header.has_unix + (int)header.has_launcher;
+    int first_client = pidfd_start + (int)header.pidfd_count;
+    if (reader.error || header.client_size != sizeof(handoff_client_t) ||
+        header.session_size != sizeof(desktop_session_t) || header.window_size != sizeof(scene_window_t) ||
+        header.client_count > (uint32_t)g_max_clients || header.pidfd_count > CGROUP_MAX_APPS ||
+        header.has_unix > 1 || header.has_launcher > 1 || first_client + (int)header.client_count != fd_count ||
+        session_token_restore_state(&reader) != 0 || desktop_session_restore_state(&reader) != 0 ||
+        scene_restore_state(&reader) != 0 ||
+        cgroup_restore_state(&reader, fds + pidfd_start, (int)header.pidfd_count) != 0 ||
+        launcher_restore_state(&reader, header.has_launcher ? fds[pidfd_start - 1] : -1) != 0) {
+        fprintf(stderr, "❌ Handoff state does not match this binary\n");
+        return reject_handoff(fd, &state, fds, fd_count);
     }
-    
-    if (buffer_len < header_len + payload_length) return 0;
-    
-    // Extract and unmask payload
-    for (int i = 0; i < payload_length; i++) {
-        payload[i] = buffer[header_len + i];
-        if (masked) {
-            payload[i] ^= mask[i % 4];
+
+    g_server_socket = fds[0];
+    if (header.has_unix) g_unix_socket = fds[1];
+    g_next_conn_id = header.next_conn_id;
+    for (uint32_t i = 0; i < header.client_count && !reader.error; i++) {
+        handoff_client_t record;
+
+        if (upgrade_get(&reader, &record, sizeof(record)) != 0) break;
+        int slot = add_client(fds[first_client + i], record.conn_id);
+        if (slot < 0) break;
+        ws_client_t *client = &g_ws_clients[slot];
+        client->handshake_complete = record.handshake_complete;
+        client->close_after_send = record.close_after_send;
+        client->authenticated = record.authenticated;
+        client->scene_subscribed = record.scene_subscribed;
+        client->uid = record.uid;
+        client->session_id = record.session_id;
+        client->peer_cred = record.peer_cred;
+        client->peer_uid = record.peer_uid;
+        client->peer_pid = record.peer_pid;
+        if (record.has_request) {
+            http_request_t request;
+            if (upgrade_get(&reader, &request, sizeof(request)) == 0 && client_http(client)) {
+                client->http->request = request;
+            }
+        }
+        if (record.rx_len) {
+            client->rx = bufpool_get(record.rx_len, &client->rx_cap);
+            if (client->rx && upgrade_get(&reader, client->rx, record.rx_len) == 0) client->rx_len = record.rx_len;
+            // Frames the old binary had not got to are handled before the next read
+            if (client->handshake_complete && client->rx_len > 0) queue_backlog(slot);
+        }
+        // Frames the old binary could not send yet go out as the socket drains
+        if (record.tx_len) {
+            client->tx = bufpool_get(record.tx_len, &client->tx_cap);
+            if (client->tx && upgrade_get(&reader, client->tx, record.tx_len) == 0) client->tx_len = record.tx_len;
         }
+        if (client->handshake_complete) metrics_gauge_add(METRIC_WEBSOCKET_CLIENTS, 1);
+        watch_client(slot);
     }
-    payload[payload_length] = '\0';
-    *payload_len = payload_length;
-    
-    return opcode;
+    if (reader.error || g_client_count != (int)header.client_count) {
+        fprintf(stderr, "❌ Could not take over every connection\n");
+        return reject_handoff(fd, &state, fds, fd_count);
+    }
+
+    upgrade_ack(fd, 1);
+    upgrade_buf_free(&state);
+    free(fds);
+    close(fd);
+    printf("♻️ Took over %d connections from the previous binary\n", g_client_count);
+    return 0;
 }
 
-// Create WebSocket frame
-int create_websocket_frame(const char* payload, int payload_len, char* frame, int frame_size) {
-    if (frame_size < payload_len + 10) return 0;
-    
-    int frame_len = 0;
-    
-    // First byte: FIN=1, opcode=text
-    frame[frame_len++] = 0x80 | WS_OPCODE_TEXT;
-    
-    // Payload length
-    if (payload_len < 126) {
-        frame[frame_len++] = payload_len;
-    } else if (payload_len < 65536) {
-        frame[frame_len++] = 126;
-        frame[frame_len++] = (payload_len >> 8) & 0xFF;
-        frame[frame_len++] = payload_len & 0xFF;
-    } else {
-        frame[frame_len++] = 127;
-        // Zero out the first 4 bytes (we're using 32-bit lengths)
-        for (int i = 0; i < 4; i++) frame[frame_len++] = 0;
-        frame[frame_len++] = (payload_len >> 24) & 0xFF;
-        frame[frame_len++] = (payload_len >> 16) & 0xFF;
-        frame[frame_len++] = (payload_len >> 8) & 0xFF;
-        frame[frame_len++] = payload_len & 0xFF;
-    }
-    
-    // Copy payload
-    memcpy(frame + frame_len, payload, payload_len);
-    frame_len += payload_len;
-    
-    return frame_len;
+// SIGHUP: upgrade to the binary now on disk
+void upgrade_signal_handler(int sig) {
+    (void)sig;
+    g_upgrade_requested = 1;
 }
 
-// Broadcast message to all connected WebSocket clients
-void broadcast_message(const char* message) {
-    char frame[WS_FRAME_SIZE];
-    int frame_len = create_websocket_frame(message, strlen(message), frame, sizeof(frame));
-    
-    for (int i = 0; i < g_client_count; i++) {
-        if (g_ws_clients[i].handshake_complete) {
-            send(g_ws_clients[i].socket, frame, frame_len, 0);
-        }
+// Start the new binary with our own arguments plus --takeover
+static void start_upgrade(void) {
+    char *argv[64];
+    int argc = 0;
+
+    for (int i = 0; g_argv[i] && argc < 62; i++) {
+        if (strcmp(g_argv[i], UPGRADE_TAKEOVER_ARG) != 0) argv[argc++] = g_argv[i];
     }
+    argv[argc++] = UPGRADE_TAKEOVER_ARG;
+    argv[argc] = NULL;
+    upgrade_start(g_exe_path, argv);
 }
 
-// Handle WebSocket client
-void handle_websocket_client(int client_index) {
-    char buffer[BUFFER_SIZE];
-    int bytes_read = recv(g_ws_clients[client_index].socket, buffer, sizeof(buffer) - 1, 0);
-    
-    if (bytes_read <= 0) {
-        // Client disconnected
-        close(g_ws_clients[client_index].socket);
-        // Remove client from array
-        for (int i = client_index; i < g_client_count - 1; i++) {
-            g_ws_clients[i] = g_ws_clients[i + 1];
-        }
-        g_client_count--;
-        printf("🔌 WebSocket client disconnected. Active clients: %d\n", g_client_count);
-        return;
-    }
-    
-    buffer[bytes_read] = '\0';
-    
-    if (!g_ws_clients[client_index].handshake_complete) {
-        // Perform WebSocket handshake
-        if (perform_websocket_handshake(g_ws_clients[client_index].socket, buffer)) {
-            g_ws_clients[client_index].handshake_complete = 1;
-            printf("🤝 WebSocket handshake completed for client %d\n", client_index);
-            
-            // Send welcome message
-            char* welcome = "{\"type\": \"welcome\", \"message\": \"Connected to VLDWM API\"}";
-            char frame[WS_FRAME_SIZE];
-            int frame_len = create_websocket_frame(welcome, strlen(welcome), frame, sizeof(frame));
-            send(g_ws_clients[client_index].socket, frame, frame_len, 0);
-        } else {
-            printf("❌ WebSocket handshake failed for client %d\n", client_index);
-            close(g_ws_clients[client_index].socket);
-            // Remove client from array
-            for (int i = client_index; i < g_client_count - 1; i++) {
-                g_ws_clients[i] = g_ws_clients[i + 1];
-            }
-            g_client_count--;
-        }
+// SIGUSR1 toggles tracing; SIGUSR2 asks the event loop to dump it
+void trace_signal_handler(int sig) {
+    if (sig == SIGUSR1) {
+        trace_set_enabled(!g_trace_enabled);
     } else {
-        // Handle WebSocket frame
-        char payload[BUFFER_SIZE];
-        int payload_len;
-        int opcode = parse_websocket_frame(buffer, bytes_read, payload, &payload_len);
-        
-        switch (opcode) {
-            case WS_OPCODE_TEXT: {
-                printf("📨 Received WebSocket message: %s\n", payload);
-                
-                // Parse JSON and handle different message types
-                json_object *root = json_tokener_parse(payload);
-                if (root) {
-                    json_object *type_obj;
-                    if (json_object_object_get_ex(root, "type", &type_obj)) {
-                        const char* msg_type = json_object_get_string(type_obj);
-                        
-                        if (strcmp(msg_type, "login") == 0) {
-                            // Handle login request
-                            char username[MAX_USERNAME_LEN], password[MAX_PASSWORD_LEN];
-                            if (parse_login_request(payload, username, password)) {
-                                int auth = authenticate_user(username, password);
-                                char *json_res;
-                                
-                                if (auth) {
-                                    json_object *info = get_user_info(username);
-                                    json_res = create_response(1, "Authentication successful", info);
-                                } else {
-                                    json_res = create_response(0, "Invalid credentials", NULL);
-                                }
-                                
-                                // Send response back to this client
-                                char frame[WS_FRAME_SIZE];
-                                int frame_len = create_websocket_frame(json_res, strlen(json_res), frame, sizeof(frame));
-                                send(g_ws_clients[client_index].socket, frame, frame_len, 0);
-                                free(json_res);
-                            }
-                        } else if (strcmp(msg_type, "desktop_session") == 0) {
-                            // Handle desktop session requests
-                            // This would integrate with desktopsession.c functions
-                            char* response = "{\"type\": \"desktop_session\", \"status\": \"handled\"}";
-                            char frame[WS_FRAME_SIZE];
-                            int frame_len = create_websocket_frame(response, strlen(response), frame, sizeof(frame));
-                            send(g_ws_clients[client_index].socket, frame, frame_len, 0);
-                        }
-                    }
-                    json_object_put(root);
-                }
-                break;
-            }
-            case WS_OPCODE_PING: {
-                // Respond with pong
-                char pong_frame[10];
-                pong_frame[0] = 0x80 | WS_OPCODE_PONG;
-                pong_frame[1] = 0; // No payload
-                send(g_ws_clients[client_index].socket, pong_frame, 2, 0);
-                break;
-            }
-            case WS_OPCODE_CLOSE: {
-                printf("🔒 WebSocket close frame received from client %d\n", client_index);
-                close(g_ws_clients[client_index].socket);
-                // Remove client from array
-                for (int i = client_index; i < g_client_count - 1; i++) {
-                    g_ws_clients[i] = g_ws_clients[i + 1];
-                }
-                g_client_count--;
-                break;
-            }
-        }
+        g_trace_dump_requested = 1;
     }
 }
 
-// Signal handler for graceful shutdown
+// SIGINT, SIGTERM: graceful shutdown, carried out by the event loop
 void signal_handler(int sig) {
+    g_shutdown_signal = sig;
+}
+
+// Graceful shutdown, on the event loop after a signal asked for it
+static void shut_down(int sig) {
     printf("\n🛑 Received signal %d, shutting down vldwmapi...\n", sig);
     
     // Close all client connections
-    for (int i = 0; i < g_client_count; i++) {
-        close(g_ws_clients[i].socket);
+    for (int i = 0; i < g_client_slots; i++) {
+        if (g_ws_clients[i].socket >= 0) close(g_ws_clients[i].socket);
     }
     
     if (g_server_socket >= 0) {
         close(g_server_socket);
     }
+    if (g_unix_socket >= 0 && g_unix_path && g_unix_path[0] != '@') {
+        unlink(g_unix_path);
+    }
+    recorder_flush();
+    log_flush();
     exit(0);
 }
 
@@ -321,9 +2703,97 @@ void signal_handler(int sig) {
 int init_vldwmapi() {
     printf("🚀 Initializing VLDWM API subsystems...\n");
     
-    // Initialize WebSocket client array
-    memset(g_ws_clients, 0, sizeof(g_ws_clients));
-    g_client_count = 0;
+    // Client slots and the epoll set; only the slots used get touched
+    if (init_clients() != 0) {
+        fprintf(stderr, "❌ Failed to allocate %d client slots\n", g_max_clients);
+        return -1;
+    }
+    
+    // Initialize metrics first so every subsystem can record
+    if (init_metrics() != 0) {
+        fprintf(stderr, "❌ Failed to initialize metrics\n");
+        return -1;
+    }
+    
+    if (init_tracing() != 0) {
+        fprintf(stderr, "❌ Failed to initialize tracing\n");
+        return -1;
+    }
+    
+    if (init_log() != 0) {
+        fprintf(stderr, "❌ Failed to start logger\n");
+        return -1;
+    }
+    
+    if (init_recorder() != 0) {
+        fprintf(stderr, "❌ Failed to start traffic recorder\n");
+        return -1;
+    }
+    
+    // Before the launch helper, which starts in whichever cgroup the
+    // daemon ends up in
+    if (init_cgroups() != 0) {
+        fprintf(stderr, "❌ Failed to initialize session cgroups\n");
+        return -1;
+    }
+    
+    // Before any thread starts, so SIGCHLD stays blocked in all of them
+    if (init_launcher() != 0) {
+        fprintf(stderr, "❌ Failed to initialize launcher\n");
+        return -1;
+    }
+    
+    if (arena_init(&g_request_arena, ARENA_DEFAULT_SIZE) != 0) {
+        fprintf(stderr, "❌ Failed to allocate request arena\n");
+        return -1;
+    }
+    
+    if (init_thumbnails() != 0) {
+        fprintf(stderr, "❌ Failed to initialize thumbnail service\n");
+        return -1;
+    }
+    
+    if (init_scene() != 0) {
+        fprintf(stderr, "❌ Failed to initialize scene graph\n");
+        return -1;
+    }
+    json_writer_init(&g_scene_out, WS_MAX_FRAME_HEADER);
+    
+    // Directory listings stat their entries through it, from any thread
+    if (init_metaio() != 0) {
+        fprintf(stderr, "❌ Failed to initialize metadata engine\n");
+        return -1;
+    }
+    
+    // Workers for queries that may block on the filesystem
+    if (init_workqueue(WORKQUEUE_THREADS) != 0) {
+        fprintf(stderr, "❌ Failed to start work queue\n");
+        return -1;
+    }
+    
+    // Fair queue and rate limits in front of the workers
+    if (init_scheduler() != 0) {
+        fprintf(stderr, "❌ Failed to initialize request scheduler\n");
+        return -1;
+    }
+    
+    // Crawl in the background; searches see whatever is indexed so far
+    if (init_file_index(g_index_roots, g_index_root_count) != 0) {
+        fprintf(stderr, "❌ Failed to initialize file index\n");
+        return -1;
+    }
+    
+    // Usually just maps the cached catalog
+    if (init_app_catalog() != 0) {
+        fprintf(stderr, "❌ Failed to initialize app catalog\n");
+        return -1;
+    }
+    
+    // Initialize user/group name cache
+    if (init_nss_cache() != 0) {
+        fprintf(stderr, "❌ Failed to initialize user/group cache\n");
+        return -1;
+    }
     
     // Initialize desktop session management
     if (init_desktop_session() != 0) {
@@ -343,6 +2813,12 @@ int init_vldwmapi() {
         return -1;
     }
     
+    // Index the frontend build, if one was given
+    if (init_static_files(g_www_root) != 0) {
+        fprintf(stderr, "❌ Failed to initialize static file serving\n");
+        return -1;
+    }
+    
     printf("✅ All subsystems initialized successfully\n");
     return 0;
 }
@@ -352,21 +2828,38 @@ void cleanup_vldwmapi() {
     printf("🧹 Cleaning up VLDWM API subsystems...\n");
     
     // Close all client connections
-    for (int i = 0; i < g_client_count; i++) {
-        close(g_ws_clients[i].socket);
+    for (int i = 0; i < g_client_slots; i++) {
+        if (g_ws_clients[i].socket >= 0) close(g_ws_clients[i].socket);
     }
     
+    cleanup_static_files();
     cleanup_logind();
     cleanup_idle_detection();
     cleanup_desktop_session();
+    cleanup_nss_cache();
+    cleanup_workqueue();
+    cleanup_metaio();
+    cleanup_scheduler();
+    free_jobs();
+    cleanup_file_index();
+    cleanup_app_catalog();
+    json_writer_free(&g_scene_out);
+    cleanup_scene();
+    cleanup_thumbnails();
+    arena_free(&g_request_arena);
+    cleanup_clients();
+    bufpool_trim();
+    cleanup_launcher();
+    cleanup_cgroups();
+    cleanup_recorder();
+    cleanup_log();
+    cleanup_tracing();
+    cleanup_metrics();
 }
 
-// Start WebSocket server
-int start_websocket_server(int port) {
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    fd_set read_fds;
-    int max_fd;
+// Bind and listen on all interfaces
+static int open_server_socket(int port) {
+    struct sockaddr_in server_addr;
     
     // Create server socket
     g_server_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -382,7 +2875,11 @@ int start_websocket_server(int port) {
     // Bind socket
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+    if (inet_pton(AF_INET, g_bind_address, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "❌ Invalid bind address %s\n", g_bind_address);
+        close(g_server_socket);
+        return -1;
+    }
     
     if (bind(g_server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("Bind failed");
@@ -391,55 +2888,302 @@ int start_websocket_server(int port) {
     }
     
     // Listen for connections
-    if (listen(g_server_socket, 10) < 0) {
+    if (listen(g_server_socket, SOMAXCONN) < 0) {
         perror("Listen failed");
         close(g_server_socket);
         return -1;
     }
+    return 0;
+}
+
+// Optional local listener. Clients on it are identified by SO_PEERCRED;
+// a path starting with '@' is in the abstract namespace and leaves
+// nothing on disk.
+static int open_unix_socket(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    size_t len = strlen(path);
+    socklen_t addr_len;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (len == 0 || len >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "❌ Invalid socket path %s\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, len);
+    if (path[0] == '@') {
+        addr.sun_path[0] = '\0';
+        addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+    } else {
+        // Left behind by a daemon that didn't exit cleanly
+        if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+        addr_len = sizeof(addr);
+    }
+
+    g_unix_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_unix_socket < 0) {
+        perror("Unix socket creation failed");
+        return -1;
+    }
+    if (bind(g_unix_socket, (struct sockaddr *)&addr, addr_len) < 0 || listen(g_unix_socket, SOMAXCONN) < 0) {
+        perror("Unix socket bind failed");
+        close(g_unix_socket);
+        g_unix_socket = -1;
+        return -1;
+    }
+    // Anyone local may connect; logging in is what needs credentials
+    if (path[0] != '@') chmod(path, 0666);
+    printf("🌐 WebSocket server listening on %s\n", path);
+    return 0;
+}
+
+// Take what is waiting on a listener, up to ACCEPT_BATCH connections
+static void accept_clients(int listener, int local) {
+    for (int n = 0; n < ACCEPT_BATCH; n++) {
+        int new_socket = accept4(listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (new_socket < 0) return;
+        int slot = add_client(new_socket, 0);
+        if (slot < 0) {
+            log_write(LOG_EV_CONNECT_REJECTED, NULL, g_client_count, 0, 0);
+            metrics_count(METRIC_CONNECTIONS_REJECTED, 1);
+            close(new_socket);
+            continue;
+        }
+
+        ws_client_t *client = &g_ws_clients[slot];
+        if (local) {
+            struct ucred cred;
+            socklen_t cred_len = sizeof(cred);
+            if (getsockopt(new_socket, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0) {
+                client->peer_cred = 1;
+                client->peer_uid = cred.uid;
+                client->peer_pid = cred.pid;
+            }
+        }
+        watch_client(slot);
+        metrics_count(METRIC_CONNECTIONS_ACCEPTED, 1);
+        if (client->peer_cred) {
+            log_write(LOG_EV_LOCAL_CONNECT, NULL, (int64_t)client->conn_id, client->peer_pid, client->peer_uid);
+        } else {
+            log_write(LOG_EV_CONNECT, NULL, (int64_t)client->conn_id, g_client_count, 0);
+        }
+    }
+}
+
+// Every connection is a descriptor: take what the hard limit allows,
+// and accept no more connections than it leaves room for. Done after
+// the launch helper has started, so launched programs keep the usual
+// soft limit.
+static void raise_descriptor_limit(void) {
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < (rlim_t)g_max_clients + FD_RESERVE) {
+        g_max_clients = limit.rlim_cur > FD_RESERVE * 2 ? (int)(limit.rlim_cur - FD_RESERVE) : FD_RESERVE;
+    }
+}
+
+// Descriptors besides the connections. They are few and come and go
+// with helpers, so they are polled afresh each iteration; connections
+// stay registered in the epoll set, which is polled as one of them.
+enum {
+    PFD_EPOLL = 0,
+    PFD_LISTEN,
+    PFD_UNIX,
+    PFD_UPGRADE,
+    PFD_WORKQUEUE,
+    PFD_FILE_INDEX,
+    PFD_APP_CATALOG,
+    PFD_LAUNCHER_SIGNAL,
+    PFD_LAUNCHER_HELPER,
+    PFD_COUNT
+};
+
+// Serve connections whose last turn left frames unhandled. Entries
+// added while this runs wait for the next iteration.
+static void serve_backlog(int count) {
+    for (int n = 0; n < count; n++) {
+        int i = g_backlog[n].slot;
+        if (g_ws_clients[i].socket < 0 || g_ws_clients[i].conn_id != g_backlog[n].conn_id ||
+            !g_ws_clients[i].backlog) {
+            continue;
+        }
+        handle_websocket_client(i);
+        if (g_ws_clients[i].socket >= 0) watch_client(i);
+    }
+    g_backlog_count -= count;
+    memmove(g_backlog, g_backlog + count, g_backlog_count * sizeof(backlog_entry_t));
+}
+
+// Start WebSocket server, or carry on with a socket taken over
+int start_websocket_server(int port) {
+    struct pollfd fds[PFD_COUNT];
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    
+    if (g_server_socket < 0 && open_server_socket(port) != 0) {
+        return -1;
+    }
+    if (g_unix_path && g_unix_socket < 0 && open_unix_socket(g_unix_path) != 0) {
+        close(g_server_socket);
+        return -1;
+    }
+    
+    // Accepting drains the listener until it would block
+    set_nonblocking(g_server_socket, 1);
+    if (g_unix_socket >= 0) set_nonblocking(g_unix_socket, 1);
     
-    printf("🌐 WebSocket server listening on port %d\n", port);
+    printf("🌐 WebSocket server listening on %s port %d (up to %d connections)\n",
+           g_bind_address, port, g_max_clients);
+    
+    // The loop wakes at least every METRICS_LAG_INTERVAL_MS; how late it
+    // gets to that deadline is the event-loop lag
+    uint64_t lag_interval = (uint64_t)METRICS_LAG_INTERVAL_MS * 1000000;
+    uint64_t next_tick = metrics_now_ns() + lag_interval;
     
     // Main server loop
     while (1) {
-        FD_ZERO(&read_fds);
-        FD_SET(g_server_socket, &read_fds);
-        max_fd = g_server_socket;
-        
-        // Add client sockets to fd_set
-        for (int i = 0; i < g_client_count; i++) {
-            FD_SET(g_ws_clients[i].socket, &read_fds);
-            if (g_ws_clients[i].socket > max_fd) {
-                max_fd = g_ws_clients[i].socket;
-            }
+        // While draining for an upgrade no connections are accepted and
+        // no input is read; the kernel keeps it for the new binary.
+        // Connections register for what they wait on in watch_client().
+        fds[PFD_EPOLL].fd = g_epoll_fd;
+        fds[PFD_LISTEN].fd = g_draining ? -1 : g_server_socket;
+        fds[PFD_UNIX].fd = g_draining ? -1 : g_unix_socket;
+        fds[PFD_UPGRADE].fd = upgrade_fd();
+        fds[PFD_WORKQUEUE].fd = workqueue_fd();
+        fds[PFD_FILE_INDEX].fd = file_index_fd();
+        fds[PFD_APP_CATALOG].fd = app_catalog_fd();
+        fds[PFD_LAUNCHER_SIGNAL].fd = launcher_signal_fd();
+        fds[PFD_LAUNCHER_HELPER].fd = launcher_helper_fd();
+        for (int i = 0; i < PFD_COUNT; i++) {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
         }
+        int backlog = g_draining ? 0 : g_backlog_count;
         
         // Wait for activity
-        int activity = select(max_fd + 1, &read_fds, NULL, NULL, NULL);
+        uint64_t now = metrics_now_ns();
+        uint64_t deadline = next_tick;
+        if (scene_flush_deadline() && scene_flush_deadline() < deadline) {
+            deadline = scene_flush_deadline();
+        }
+        if (g_draining && now + 5000000 < deadline) {
+            deadline = now + 5000000;    // Check for quiescence every 5 ms
+        }
+        if (backlog) {
+            deadline = now;              // Just poll; connections have frames waiting
+        }
+        uint64_t wait = deadline > now ? deadline - now : 0;
+        int activity = poll(fds, PFD_COUNT, (int)((wait + 999999) / 1000000));
+        int poll_errno = errno;         // The signal work below may change errno
+        if (g_trace_dump_requested) {
+            g_trace_dump_requested = 0;
+            trace_dump_file();
+        }
+        if (g_upgrade_requested) {
+            g_upgrade_requested = 0;
+            if (upgrade_fd() < 0 && !g_draining) start_upgrade();
+        }
+        if (g_shutdown_signal) {
+            shut_down(g_shutdown_signal);
+        }
         if (activity < 0) {
-            perror("Select error");
+            if (poll_errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Poll error: %s\n", strerror(poll_errno));
             break;
         }
         
-        // Check for new connections
-        if (FD_ISSET(g_server_socket, &read_fds)) {
-            int new_socket = accept(g_server_socket, (struct sockaddr*)&client_addr, &client_len);
-            if (new_socket >= 0 && g_client_count < MAX_CLIENTS) {
-                g_ws_clients[g_client_count].socket = new_socket;
-                g_ws_clients[g_client_count].handshake_complete = 0;
-                g_client_count++;
-                printf("🔗 New WebSocket connection. Active clients: %d\n", g_client_count);
-            } else if (g_client_count >= MAX_CLIENTS) {
-                printf("⚠️ Maximum clients reached, rejecting connection\n");
-                close(new_socket);
+        uint64_t woke = metrics_now_ns();
+        if (woke >= next_tick) {
+            metrics_observe(METRIC_HIST_LOOP_LAG, woke - next_tick);
+            next_tick = woke + lag_interval;
+        }
+        if (scene_flush_deadline() && woke >= scene_flush_deadline()) {
+            flush_scene_delta();
+        }
+        cgroup_sample(woke);
+        recorder_tick(woke);
+        if (g_draining && handoff_quiescent()) {
+            hand_off();
+        } else if (g_draining && woke >= g_drain_deadline) {
+            drain_timed_out();
+        }
+        if (activity == 0 && !backlog) {
+            continue;
+        }
+        
+        // The new binary has initialized (or died); stop taking input
+        // and hand over once in-flight work is done
+        if (fds[PFD_UPGRADE].revents) {
+            int ready = upgrade_poll_ready();
+            if (ready == 1) {
+                g_draining = 1;
+                g_drain_deadline = woke + (uint64_t)UPGRADE_DRAIN_TIMEOUT_MS * 1000000;
+                watch_all_clients();
+                printf("♻️ New binary ready; draining before the handoff\n");
+            } else if (ready < 0 && g_draining) {
+                g_draining = 0;
+                watch_all_clients();
             }
         }
         
-        // Check existing clients for data
-        for (int i = 0; i < g_client_count; i++) {
-            if (FD_ISSET(g_ws_clients[i].socket, &read_fds)) {
+        // Send replies the workers have finished
+        if (fds[PFD_WORKQUEUE].revents) {
+            workqueue_complete();
+            sched_pump();
+        }
+        
+        // Keep the file index in step with the disk
+        if (fds[PFD_FILE_INDEX].revents) {
+            file_index_process_events();
+        }
+        if (fds[PFD_APP_CATALOG].revents) {
+            app_catalog_process_events();
+        }
+        
+        // Spawn replies from the helper and exited programs
+        if (fds[PFD_LAUNCHER_SIGNAL].revents || fds[PFD_LAUNCHER_HELPER].revents) {
+            process_launch_events();
+        }
+        
+        // Connections with input, or writable while a response is
+        // queued. A slot freed earlier in this batch is skipped; slots
+        // are only reused by accepting, which comes after.
+        int ready = 0;
+        if (fds[PFD_EPOLL].revents) {
+            ready = epoll_wait(g_epoll_fd, events, EPOLL_MAX_EVENTS, 0);
+        }
+        for (int e = 0; e < ready; e++) {
+            int i = (int)events[e].data.u32;
+            if (g_ws_clients[i].socket < 0) continue;
+            if (transfer_pending(&g_ws_clients[i])) {
+                continue_http_response(i);
+            } else if (frames_pending(&g_ws_clients[i])) {
+                flush_ws_client(i);
+            } else if (!g_draining) {
                 handle_websocket_client(i);
             }
+            if (g_ws_clients[i].socket >= 0) watch_client(i);
+        }
+        if (backlog) {
+            serve_backlog(backlog);
+        }
+        
+        // Check for new connections
+        if (fds[PFD_LISTEN].revents) {
+            accept_clients(g_server_socket, 0);
         }
+        if (fds[PFD_UNIX].revents) {
+            accept_clients(g_unix_socket, 1);
+        }
+        
+        metrics_observe(METRIC_HIST_LOOP_ITERATION, metrics_now_ns() - woke);
     }
     
     return 0;
@@ -448,9 +3192,24 @@ int start_websocket_server(int port) {
 int main(int argc, char *argv[]) {
     int port = DEFAULT_PORT;
     
+    // The launch helper is this binary re-executed by init_launcher()
+    if (argc == 2 && strcmp(argv[1], LAUNCHER_HELPER_ARG) == 0) {
+        return launcher_helper_main(LAUNCHER_HELPER_FD);
+    }
+    
+    int takeover = 0;
+    
+    // Remember how we were started for an upgrade
+    g_argv = argv;
+    if (!realpath("/proc/self/exe", g_exe_path)) {
+        snprintf(g_exe_path, sizeof(g_exe_path), "%s", argv[0]);
+    }
+    
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) {
+        if (strcmp(argv[i], UPGRADE_TAKEOVER_ARG) == 0) {
+            takeover = 1;
+        } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--port") == 0) {
             if (i + 1 < argc) {
                 port = atoi(argv[i + 1]);
                 i++; // Skip next argument
@@ -458,12 +3217,113 @@ int main(int argc, char *argv[]) {
                 fprintf(stderr, "Error: Port number required after %s\n", argv[i]);
                 return 1;
             }
+        } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--www") == 0) {
+            if (i + 1 < argc) {
+                g_www_root = argv[i + 1];
+                i++; // Skip next argument
+            } else {
+                fprintf(stderr, "Error: Directory required after %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--bind") == 0) {
+            if (i + 1 < argc) {
+                g_bind_address = argv[i + 1];
+                i++; // Skip next argument
+            } else {
+                fprintf(stderr, "Error: Address required after %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-u") == 0 || strcmp(argv[i], "--unix") == 0) {
+            if (i + 1 < argc) {
+                g_unix_path = argv[i + 1];
+                i++; // Skip next argument
+            } else {
+                fprintf(stderr, "Error: Socket path required after %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--log-level") == 0 || strcmp(argv[i], "--log") == 0 ||
+                   strcmp(argv[i], "--log-sample") == 0 || strcmp(argv[i], "--log-rate") == 0 ||
+                   strcmp(argv[i], "--log-redact") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: Value required after %s\n", argv[i]);
+                return 1;
+            }
+            const char *value = argv[++i];
+            int result = 0;
+            if (strcmp(argv[i - 1], "--log-level") == 0) result = log_set_level(value);
+            else if (strcmp(argv[i - 1], "--log") == 0) result = log_set_output(value);
+            else if (strcmp(argv[i - 1], "--log-sample") == 0) result = log_set_sample(value);
+            else if (strcmp(argv[i - 1], "--log-rate") == 0) log_set_rate(atoi(value));
+            else log_set_redact(value);
+            if (result != 0) {
+                fprintf(stderr, "Error: Invalid value for %s: %s\n", argv[i - 1], value);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--max-clients") == 0) {
+            int count = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+            if (count < 1 || count > CLIENTS_LIMIT) {
+                fprintf(stderr, "Error: %s takes a count from 1 to %d\n", argv[i], CLIENTS_LIMIT);
+                return 1;
+            }
+            g_max_clients = count;
+            i++; // Skip next argument
+        } else if (strcmp(argv[i], "--metadata") == 0) {
+            if (i + 1 >= argc || metaio_set_mode(argv[i + 1]) != 0) {
+                fprintf(stderr, "Error: %s takes uring, threads or serial\n", argv[i]);
+                return 1;
+            }
+            i++; // Skip next argument
+        } else if (strcmp(argv[i], "--metadata-depth") == 0) {
+            if (i + 1 >= argc || metaio_set_depth(atoi(argv[i + 1])) != 0) {
+                fprintf(stderr, "Error: %s takes a count from 1 to %d\n", argv[i], METAIO_MAX_DEPTH);
+                return 1;
+            }
+            i++; // Skip next argument
+        } else if (strcmp(argv[i], "--record") == 0) {
+            if (i + 1 >= argc || recorder_set_path(argv[i + 1]) != 0) {
+                fprintf(stderr, "Error: Capture file required after %s\n", argv[i]);
+                return 1;
+            }
+            i++; // Skip next argument
+        } else if (strcmp(argv[i], "--rate-limit") == 0) {
+            if (i + 1 >= argc || sched_set_rate(argv[i + 1]) != 0) {
+                fprintf(stderr, "Error: %s takes class=RATE[/BURST] (auth, filesystem, monitoring, process)\n", argv[i]);
+                return 1;
+            }
+            i++; // Skip next argument
+        } else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--index") == 0) {
+            if (i + 1 < argc) {
+                if (g_index_root_count < FILE_INDEX_MAX_ROOTS) {
+                    g_index_roots[g_index_root_count++] = argv[i + 1];
+                }
+                i++; // Skip next argument
+            } else {
+                fprintf(stderr, "Error: Directory required after %s\n", argv[i]);
+                return 1;
+            }
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             printf("VLDWM API WebSocket Server\n");
             printf("Usage: %s [options]\n", argv[0]);
             printf("Options:\n");
             printf("  -p, --port <port>    Set server port (default: %d)\n", DEFAULT_PORT);
+            printf("  -b, --bind <addr>    Listen on this IPv4 address only (default: 0.0.0.0)\n");
+            printf("  -u, --unix <path>    Also listen on a Unix socket; @name for the abstract namespace\n");
+            printf("  -c, --max-clients <n> Connections accepted at once (default: %d)\n", DEFAULT_MAX_CLIENTS);
+            printf("  -w, --www <dir>      Serve the frontend build directory on the same port\n");
+            printf("  -i, --index <dir>    Index file names under dir for search (repeatable, default: %s)\n",
+                   FILE_INDEX_DEFAULT_ROOT);
+            printf("  --log <target>       Log to stderr (default), syslog or a file\n");
+            printf("  --log-level <level>  debug, info (default), warn or error\n");
+            printf("  --log-sample <ev=N>  Keep one in N records of an event, e.g. ws.message=100\n");
+            printf("  --log-rate <n>       Records per event per second before suppressing (default: %d, 0: off)\n",
+                   LOG_DEFAULT_RATE);
+            printf("  --log-redact <list>  Fields logged as [redacted] (default: password,token)\n");
+            printf("  --rate-limit <c=R[/B]> Requests per second and burst per connection for a class (0: off)\n");
+            printf("  --metadata <mode>    Stat directory entries through uring (default), threads or serial\n");
+            printf("  --metadata-depth <n> Stats in flight per listing (default: %d)\n", METAIO_DEFAULT_DEPTH);
+            printf("  --record <file>      Append inbound WebSocket messages to a capture for bench/ws_replay\n");
             printf("  -h, --help           Show this help message\n");
+            printf("\nSend SIGHUP to upgrade to the binary on disk without dropping connections.\n");
             return 0;
         }
     }
@@ -471,6 +3331,9 @@ int main(int argc, char *argv[]) {
     // Set up signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
+    signal(SIGUSR1, trace_signal_handler);
+    signal(SIGUSR2, trace_signal_handler);
+    signal(SIGHUP, upgrade_signal_handler);
     
     // Initialize all subsystems
     if (init_vldwmapi() != 0) {
@@ -478,6 +3341,14 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    raise_descriptor_limit();
+    
+    // Started by a running daemon's upgrade: its connections become ours
+    if (takeover && take_over(UPGRADE_TAKEOVER_FD) != 0) {
+        fprintf(stderr, "❌ Takeover failed; the running daemon keeps serving\n");
+        return 1;
+    }
+    
     // Start the WebSocket server
     printf("🔥 Starting VLDWM API WebSocket server on port %d (FreeBSD Edition)\n", port);
     int result = start_websocket_server(port);
@@ -0,0 +1,156 @@
+// Generated by script/gen_protocol.ts from sys/vldwmapi/protocol.json; do not edit
+#include <stddef.h>
+#include <stdint.h>
+
+#include "messages.h"
+
+static const proto_field_t login_fields[] = {
+    { .name = "username", .kind = PROTO_STRING, .bit = PROTO_LOGIN_USERNAME, .required = 1, .offset = offsetof(proto_login_t, username), .max = PROTO_LOGIN_USERNAME_MAX },
+    { .name = "password", .kind = PROTO_STRING, .bit = PROTO_LOGIN_PASSWORD, .offset = offsetof(proto_login_t, password), .max = PROTO_LOGIN_PASSWORD_MAX },
+};
+
+static const proto_object_t login_object = { login_fields, 2, sizeof(proto_login_t) };
+
+static const proto_field_t resume_fields[] = {
+    { .name = "token", .kind = PROTO_STRING, .bit = PROTO_RESUME_TOKEN, .required = 1, .offset = offsetof(proto_resume_t, token), .max = PROTO_RESUME_TOKEN_MAX },
+};
+
+static const proto_object_t resume_object = { resume_fields, 1, sizeof(proto_resume_t) };
+
+static const proto_field_t unlock_fields[] = {
+    { .name = "token", .kind = PROTO_STRING, .bit = PROTO_UNLOCK_TOKEN, .offset = offsetof(proto_unlock_t, token), .max = PROTO_UNLOCK_TOKEN_MAX },
+    { .name = "password", .kind = PROTO_STRING, .bit = PROTO_UNLOCK_PASSWORD, .offset = offsetof(proto_unlock_t, password), .max = PROTO_UNLOCK_PASSWORD_MAX },
+};
+
+static const proto_object_t unlock_object = { unlock_fields, 2, sizeof(proto_unlock_t) };
+
+static const proto_object_t lock_object = { NULL, 0, sizeof(proto_lock_t) };
+
+static const proto_object_t logout_object = { NULL, 0, sizeof(proto_logout_t) };
+
+static const char *const desktop_session_action_values[] = { "list_directory", "file_info", "process_list", "system_status", NULL };
+
+static const proto_field_t desktop_session_params_fields[] = {
+    { .name = "path", .kind = PROTO_STRING, .bit = PROTO_DESKTOP_SESSION_PARAMS_PATH, .offset = offsetof(proto_desktop_session_params_t, path), .max = PROTO_DESKTOP_SESSION_PARAMS_PATH_MAX },
+};
+
+static const proto_object_t desktop_session_params_object = { desktop_session_params_fields, 1, sizeof(proto_desktop_session_params_t) };
+
+static const proto_field_t desktop_session_fields[] = {
+    { .name = "action", .kind = PROTO_STRING, .bit = PROTO_DESKTOP_SESSION_ACTION, .required = 1, .offset = offsetof(proto_desktop_session_t, action), .max = PROTO_DESKTOP_SESSION_ACTION_MAX, .values = desktop_session_action_values },
+    { .name = "path", .kind = PROTO_STRING, .bit = PROTO_DESKTOP_SESSION_PATH, .offset = offsetof(proto_desktop_session_t, path), .max = PROTO_DESKTOP_SESSION_PATH_MAX },
+    { .name = "params", .kind = PROTO_OBJECT, .bit = PROTO_DESKTOP_SESSION_PARAMS, .offset = offsetof(proto_desktop_session_t, params), .object = &desktop_session_params_object },
+};
+
+static const proto_object_t desktop_session_object = { desktop_session_fields, 3, sizeof(proto_desktop_session_t) };
+
+static const proto_object_t system_status_object = { NULL, 0, sizeof(proto_system_status_t) };
+
+static const proto_object_t memory_stats_object = { NULL, 0, sizeof(proto_memory_stats_t) };
+
+static const proto_object_t metrics_object = { NULL, 0, sizeof(proto_metrics_t) };
+
+static const proto_object_t resource_usage_object = { NULL, 0, sizeof(proto_resource_usage_t) };
+
+static const char *const trace_action_values[] = { "start", "stop", "clear", "dump", NULL };
+
+static const proto_field_t trace_fields[] = {
+    { .name = "action", .kind = PROTO_STRING, .bit = PROTO_TRACE_ACTION, .required = 1, .offset = offsetof(proto_trace_t, action), .max = PROTO_TRACE_ACTION_MAX, .values = trace_action_values },
+};
+
+static const proto_object_t trace_object = { trace_fields, 1, sizeof(proto_trace_t) };
+
+static const proto_field_t thumbnail_fields[] = {
+    { .name = "paths", .kind = PROTO_STRINGS, .bit = PROTO_THUMBNAIL_PATHS, .required = 1, .offset = offsetof(proto_thumbnail_t, paths), .count_offset = offsetof(proto_thumbnail_t, paths_count), .max = PROTO_THUMBNAIL_PATHS_MAX, .max_items = PROTO_THUMBNAIL_PATHS_MAX_ITEMS },
+    { .name = "size", .kind = PROTO_INTEGER, .bit = PROTO_THUMBNAIL_SIZE, .offset = offsetof(proto_thumbnail_t, size), .min_value = 1, .max_value = 4096 },
+};
+
+static const proto_object_t thumbnail_object = { thumbnail_fields, 2, offsetof(proto_thumbnail_t, paths) };
+
+static const char *const search_mode_values[] = { "substring", "fuzzy", NULL };
+
+static const proto_field_t search_fields[] = {
+    { .name = "query", .kind = PROTO_STRING, .bit = PROTO_SEARCH_QUERY, .required = 1, .offset = offsetof(proto_search_t, query), .max = PROTO_SEARCH_QUERY_MAX },
+    { .name = "mode", .kind = PROTO_STRING, .bit = PROTO_SEARCH_MODE, .offset = offsetof(proto_search_t, mode), .max = PROTO_SEARCH_MODE_MAX, .values = search_mode_values },
+    { .name = "offset", .kind = PROTO_INTEGER, .bit = PROTO_SEARCH_OFFSET, .offset = offsetof(proto_search_t, offset), .min_value = 0, .max_value = 1000000 },
+    { .name = "limit", .kind = PROTO_INTEGER, .bit = PROTO_SEARCH_LIMIT, .offset = offsetof(proto_search_t, limit), .min_value = 0, .max_value = 1000000 },
+};
+
+static const proto_object_t search_object = { search_fields, 4, sizeof(proto_search_t) };
+
+static const proto_field_t list_apps_fields[] = {
+    { .name = "locale", .kind = PROTO_STRING, .bit = PROTO_LIST_APPS_LOCALE, .offset = offsetof(proto_list_apps_t, locale), .max = PROTO_LIST_APPS_LOCALE_MAX },
+    { .name = "include_hidden", .kind = PROTO_BOOLEAN, .bit = PROTO_LIST_APPS_INCLUDE_HIDDEN, .offset = offsetof(proto_list_apps_t, include_hidden) },
+};
+
+static const proto_object_t list_apps_object = { list_apps_fields, 2, sizeof(proto_list_apps_t) };
+
+static const proto_field_t search_apps_fields[] = {
+    { .name = "query", .kind = PROTO_STRING, .bit = PROTO_SEARCH_APPS_QUERY, .required = 1, .offset = offsetof(proto_search_apps_t, query), .max = PROTO_SEARCH_APPS_QUERY_MAX },
+    { .name = "locale", .kind = PROTO_STRING, .bit = PROTO_SEARCH_APPS_LOCALE, .offset = offsetof(proto_search_apps_t, locale), .max = PROTO_SEARCH_APPS_LOCALE_MAX },
+    { .name = "limit", .kind = PROTO_INTEGER, .bit = PROTO_SEARCH_APPS_LIMIT, .offset = offsetof(proto_search_apps_t, limit), .min_value = 0, .max_value = 1000000 },
+};
+
+static const proto_object_t search_apps_object = { search_apps_fields, 3, sizeof(proto_search_apps_t) };
+
+static const proto_field_t launch_fields[] = {
+    { .name = "app", .kind = PROTO_STRING, .bit = PROTO_LAUNCH_APP, .offset = offsetof(proto_launch_t, app), .max = PROTO_LAUNCH_APP_MAX },
+    { .name = "files", .kind = PROTO_STRINGS, .bit = PROTO_LAUNCH_FILES, .offset = offsetof(proto_launch_t, files), .count_offset = offsetof(proto_launch_t, files_count), .max = PROTO_LAUNCH_FILES_MAX, .max_items = PROTO_LAUNCH_FILES_MAX_ITEMS },
+    { .name = "argv", .kind = PROTO_STRINGS, .bit = PROTO_LAUNCH_ARGV, .offset = offsetof(proto_launch_t, argv), .count_offset = offsetof(proto_launch_t, argv_count), .max = PROTO_LAUNCH_ARGV_MAX, .max_items = PROTO_LAUNCH_ARGV_MAX_ITEMS },
+    { .name = "cwd", .kind = PROTO_STRING, .bit = PROTO_LAUNCH_CWD, .offset = offsetof(proto_launch_t, cwd), .max = PROTO_LAUNCH_CWD_MAX },
+    { .name = "env", .kind = PROTO_MAP, .bit = PROTO_LAUNCH_ENV, .offset = offsetof(proto_launch_t, env), .count_offset = offsetof(proto_launch_t, env_count), .max = PROTO_LAUNCH_ENV_MAX, .max_items = PROTO_LAUNCH_ENV_MAX_ITEMS },
+    { .name = "isolate", .kind = PROTO_BOOLEAN, .bit = PROTO_LAUNCH_ISOLATE, .offset = offsetof(proto_launch_t, isolate) },
+};
+
+static const proto_object_t launch_object = { launch_fields, 6, offsetof(proto_launch_t, files) };
+
+static const proto_field_t kill_fields[] = {
+    { .name = "pid", .kind = PROTO_INTEGER, .bit = PROTO_KILL_PID, .required = 1, .offset = offsetof(proto_kill_t, pid), .min_value = 1, .max_value = 2147483647 },
+    { .name = "signal", .kind = PROTO_INTEGER, .bit = PROTO_KILL_SIGNAL, .offset = offsetof(proto_kill_t, signal), .min_value = 0, .max_value = 64 },
+};
+
+static const proto_object_t kill_object = { kill_fields, 2, sizeof(proto_kill_t) };
+
+static const char *const scene_action_values[] = { "snapshot", "mutate", "unsubscribe", NULL };
+
+static const proto_field_t scene_fields[] = {
+    { .name = "action", .kind = PROTO_STRING, .bit = PROTO_SCENE_ACTION, .required = 1, .offset = offsetof(proto_scene_t, action), .max = PROTO_SCENE_ACTION_MAX, .values = scene_action_values },
+    { .name = "ops", .kind = PROTO_JSON, .bit = PROTO_SCENE_OPS, .offset = offsetof(proto_scene_t, ops) },
+};
+
+static const proto_object_t scene_object = { scene_fields, 2, sizeof(proto_scene_t) };
+
+static const proto_field_t batch_fields[] = {
+    { .name = "requests", .kind = PROTO_JSONS, .bit = PROTO_BATCH_REQUESTS, .required = 1, .offset = offsetof(proto_batch_t, requests), .count_offset = offsetof(proto_batch_t, requests_count), .max_items = PROTO_BATCH_REQUESTS_MAX_ITEMS },
+};
+
+static const proto_object_t batch_object = { batch_fields, 1, offsetof(proto_batch_t, requests) };
+
+const proto_message_info_t proto_messages[] = {
+    { NULL, NULL },
+    { "login", &login_object },
+    { "resume", &resume_object },
+    { "unlock", &unlock_object },
+    { "lock", &lock_object },
+    { "logout", &logout_object },
+    { "desktop_session", &desktop_session_object },
+    { "system_status", &system_status_object },
+    { "memory_stats", &memory_stats_object },
+    { "metrics", &metrics_object },
+    { "resource_usage", &resource_usage_object },
+    { "trace", &trace_object },
+    { "thumbnail", &thumbnail_object },
+    { "search", &search_object },
+    { "list_apps", &list_apps_object },
+    { "search_apps", &search_apps_object },
+    { "launch", &launch_object },
+    { "kill", &kill_object },
+    { "scene", &scene_object },
+    { "batch", &batch_object },
+};
+
+const int proto_message_count = PROTO_MSG_COUNT;
+
+int proto_decode_request(char *text, size_t len, proto_request_t *request) {
+    return proto_decode(text, len, &request->head, &request->u);
+}
@@ -0,0 +1,249 @@
+// Generated by script/gen_protocol.ts from sys/vldwmapi/protocol.json; do not edit
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Constants
+#define PROTO_LOGIN_USERNAME (1u << 0)
+#define PROTO_LOGIN_USERNAME_MAX 255
+#define PROTO_LOGIN_PASSWORD (1u << 1)
+#define PROTO_LOGIN_PASSWORD_MAX 255
+#define PROTO_RESUME_TOKEN (1u << 0)
+#define PROTO_RESUME_TOKEN_MAX 127
+#define PROTO_UNLOCK_TOKEN (1u << 0)
+#define PROTO_UNLOCK_TOKEN_MAX 127
+#define PROTO_UNLOCK_PASSWORD (1u << 1)
+#define PROTO_UNLOCK_PASSWORD_MAX 255
+#define PROTO_DESKTOP_SESSION_ACTION (1u << 0)
+#define PROTO_DESKTOP_SESSION_ACTION_MAX 32
+#define PROTO_DESKTOP_SESSION_PATH (1u << 1)
+#define PROTO_DESKTOP_SESSION_PATH_MAX 4095
+#define PROTO_DESKTOP_SESSION_PARAMS (1u << 2)
+#define PROTO_DESKTOP_SESSION_PARAMS_PATH (1u << 0)
+#define PROTO_DESKTOP_SESSION_PARAMS_PATH_MAX 4095
+#define PROTO_TRACE_ACTION (1u << 0)
+#define PROTO_TRACE_ACTION_MAX 8
+#define PROTO_THUMBNAIL_PATHS (1u << 0)
+#define PROTO_THUMBNAIL_PATHS_MAX 4095
+#define PROTO_THUMBNAIL_PATHS_MAX_ITEMS 64
+#define PROTO_THUMBNAIL_SIZE (1u << 1)
+#define PROTO_SEARCH_QUERY (1u << 0)
+#define PROTO_SEARCH_QUERY_MAX 255
+#define PROTO_SEARCH_MODE (1u << 1)
+#define PROTO_SEARCH_MODE_MAX 16
+#define PROTO_SEARCH_OFFSET (1u << 2)
+#define PROTO_SEARCH_LIMIT (1u << 3)
+#define PROTO_LIST_APPS_LOCALE (1u << 0)
+#define PROTO_LIST_APPS_LOCALE_MAX 63
+#define PROTO_LIST_APPS_INCLUDE_HIDDEN (1u << 1)
+#define PROTO_SEARCH_APPS_QUERY (1u << 0)
+#define PROTO_SEARCH_APPS_QUERY_MAX 255
+#define PROTO_SEARCH_APPS_LOCALE (1u << 1)
+#define PROTO_SEARCH_APPS_LOCALE_MAX 63
+#define PROTO_SEARCH_APPS_LIMIT (1u << 2)
+#define PROTO_LAUNCH_APP (1u << 0)
+#define PROTO_LAUNCH_APP_MAX 255
+#define PROTO_LAUNCH_FILES (1u << 1)
+#define PROTO_LAUNCH_FILES_MAX 4095
+#define PROTO_LAUNCH_FILES_MAX_ITEMS 255
+#define PROTO_LAUNCH_ARGV (1u << 2)
+#define PROTO_LAUNCH_ARGV_MAX 4095
+#define PROTO_LAUNCH_ARGV_MAX_ITEMS 255
+#define PROTO_LAUNCH_CWD (1u << 3)
+#define PROTO_LAUNCH_CWD_MAX 4095
+#define PROTO_LAUNCH_ENV (1u << 4)
+#define PROTO_LAUNCH_ENV_MAX 4095
+#define PROTO_LAUNCH_ENV_MAX_ITEMS 64
+#define PROTO_LAUNCH_ISOLATE (1u << 5)
+#define PROTO_KILL_PID (1u << 0)
+#define PROTO_KILL_SIGNAL (1u << 1)
+#define PROTO_SCENE_ACTION (1u << 0)
+#define PROTO_SCENE_ACTION_MAX 16
+#define PROTO_SCENE_OPS (1u << 1)
+#define PROTO_BATCH_REQUESTS (1u << 0)
+#define PROTO_BATCH_REQUESTS_MAX_ITEMS 32
+
+typedef enum {
+    PROTO_MSG_NONE = 0,         // Missing or unknown type
+    PROTO_MSG_LOGIN,
+    PROTO_MSG_RESUME,
+    PROTO_MSG_UNLOCK,
+    PROTO_MSG_LOCK,
+    PROTO_MSG_LOGOUT,
+    PROTO_MSG_DESKTOP_SESSION,
+    PROTO_MSG_SYSTEM_STATUS,
+    PROTO_MSG_MEMORY_STATS,
+    PROTO_MSG_METRICS,
+    PROTO_MSG_RESOURCE_USAGE,
+    PROTO_MSG_TRACE,
+    PROTO_MSG_THUMBNAIL,
+    PROTO_MSG_SEARCH,
+    PROTO_MSG_LIST_APPS,
+    PROTO_MSG_SEARCH_APPS,
+    PROTO_MSG_LAUNCH,
+    PROTO_MSG_KILL,
+    PROTO_MSG_SCENE,
+    PROTO_MSG_BATCH,
+    PROTO_MSG_COUNT
+} proto_msg_t;
+
+// Password login; over the Unix socket a peer may leave out the password for its own user
+typedef struct {
+    uint32_t present;
+    proto_str_t username;
+    proto_str_t password;
+} proto_login_t;
+
+// Reattach to a session with the token from login
+typedef struct {
+    uint32_t present;
+    proto_str_t token;
+} proto_resume_t;
+
+// Unlock with a recent token, or with the password once the token is too old
+typedef struct {
+    uint32_t present;
+    proto_str_t token;
+    proto_str_t password;
+} proto_unlock_t;
+
+typedef struct {
+    uint32_t present;
+} proto_lock_t;
+
+typedef struct {
+    uint32_t present;
+} proto_logout_t;
+
+// Older clients send the path here
+typedef struct {
+    uint32_t present;
+    proto_str_t path;
+} proto_desktop_session_params_t;
+
+// Directory listings, file details and the process list
+typedef struct {
+    uint32_t present;
+    proto_str_t action;
+    proto_str_t path;
+    proto_desktop_session_params_t params;
+} proto_desktop_session_t;
+
+typedef struct {
+    uint32_t present;
+} proto_system_status_t;
+
+typedef struct {
+    uint32_t present;
+} proto_memory_stats_t;
+
+typedef struct {
+    uint32_t present;
+} proto_metrics_t;
+
+typedef struct {
+    uint32_t present;
+} proto_resource_usage_t;
+
+typedef struct {
+    uint32_t present;
+    proto_str_t action;
+} proto_trace_t;
+
+// PNG thumbnails, answered with binary frames
+typedef struct {
+    uint32_t present;
+    int paths_count;
+    int64_t size;
+    proto_str_t paths[PROTO_THUMBNAIL_PATHS_MAX_ITEMS];
+} proto_thumbnail_t;
+
+// File names under the indexed directories, best match first
+typedef struct {
+    uint32_t present;
+    proto_str_t query;
+    proto_str_t mode;
+    int64_t offset;
+    int64_t limit;
+} proto_search_t;
+
+typedef struct {
+    uint32_t present;
+    proto_str_t locale;
+    int include_hidden;
+} proto_list_apps_t;
+
+typedef struct {
+    uint32_t present;
+    proto_str_t query;
+    proto_str_t locale;
+    int64_t limit;
+} proto_search_apps_t;
+
+// Start a catalog application by desktop id, or an explicit argv
+typedef struct {
+    uint32_t present;
+    proto_str_t app;
+    int files_count;
+    int argv_count;
+    proto_str_t cwd;
+    int env_count;
+    int isolate;
+    proto_str_t files[PROTO_LAUNCH_FILES_MAX_ITEMS];
+    proto_str_t argv[PROTO_LAUNCH_ARGV_MAX_ITEMS];
+    proto_pair_t env[PROTO_LAUNCH_ENV_MAX_ITEMS];
+} proto_launch_t;
+
+// Signal a launched program; the default SIGKILL ends everything it forked
+typedef struct {
+    uint32_t present;
+    int64_t pid;
+    int64_t signal;
+} proto_kill_t;
+
+typedef struct {
+    uint32_t present;
+    proto_str_t action;
+    proto_str_t ops;
+} proto_scene_t;
+
+// Sub-requests run in order; the reply carries their replies in the same order
+typedef struct {
+    uint32_t present;
+    int requests_count;
+    proto_str_t requests[PROTO_BATCH_REQUESTS_MAX_ITEMS];
+} proto_batch_t;
+
+typedef struct {
+    proto_head_t head;
+    union {
+        proto_login_t login;
+        proto_resume_t resume;
+        proto_unlock_t unlock;
+        proto_lock_t lock;
+        proto_logout_t logout;
+        proto_desktop_session_t desktop_session;
+        proto_system_status_t system_status;
+        proto_memory_stats_t memory_stats;
+        proto_metrics_t metrics;
+        proto_resource_usage_t resource_usage;
+        proto_trace_t trace;
+        proto_thumbnail_t thumbnail;
+        proto_search_t search;
+        proto_list_apps_t list_apps;
+        proto_search_apps_t search_apps;
+        proto_launch_t launch;
+        proto_kill_t kill;
+        proto_scene_t scene;
+        proto_batch_t batch;
+    } u;
+} proto_request_t;
+
+// Decode text, which is modified, into request->u.<type> (see proto_decode)
+int proto_decode_request(char *text, size_t len, proto_request_t *request);
+
+#endif // MESSAGES_H
@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+
+#include "metaio.h"
+#include "usercred.h"
+
+// A thread's io_uring, mapped by hand: liburing is not a dependency.
+// Each in-flight statx has a slot holding its buffer and entry index.
+typedef struct {
+    int fd;
+    unsigned depth;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;               // Same as sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t cq_map_size;
+    size_t sqes_size;
+    struct statx *buffers;
+    size_t *slot_items;
+    unsigned *free_slots;
+} meta_ring_t;
+
+// A batch shared with the pool; pool threads and the caller claim
+// METAIO_CHUNK entries at a time until none are left
+typedef struct meta_batch {
+    int dirfd;
+    const user_cred_t *cred;    // The caller's, taken on by pool threads; NULL for root
+    meta_stat_t *items;
+    size_t count;
+    size_t next;
+    int workers;                // Pool threads still stating claimed entries
+    struct meta_batch *next_batch;
+} meta_batch_t;
+
+static const char *g_mode_names[METAIO_MODE_COUNT] = { "serial", "threads", "uring" };
+
+static metaio_mode_t g_wanted = METAIO_URING;
+static metaio_mode_t g_mode = METAIO_SERIAL;
+static unsigned g_depth = METAIO_DEFAULT_DEPTH;
+
+// Rings outlive their threads until cleanup; a thread whose ring is from
+// before a re-init makes a new one
+static meta_ring_t *g_rings[METAIO_MAX_RINGS];
+static int g_ring_count = 0;
+static unsigned g_generation = 0;
+static __thread meta_ring_t *t_ring = NULL;
+static __thread unsigned t_ring_generation = 0;
+static __thread int t_ring_unavailable = 0;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_batch_done = PTHREAD_COND_INITIALIZER;
+static meta_batch_t *g_batches = NULL;
+static pthread_t g_threads[METAIO_POOL_THREADS];
+static int g_thread_count = 0;
+static int g_stopping = 0;
+
+int metaio_set_mode(const char *name) {
+    for (int i = 0; i < METAIO_MODE_COUNT; i++) {
+        if (strcmp(name, g_mode_names[i]) == 0) {
+            g_wanted = (metaio_mode_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int metaio_set_depth(int depth) {
+    if (depth < 1 || depth > METAIO_MAX_DEPTH) return -1;
+    g_depth = (unsigned)depth;
+    return 0;
+}
+
+metaio_mode_t metaio_mode(void) {
+    return g_mode;
+}
+
+const char *metaio_mode_name(metaio_mode_t mode) {
+    return (unsigned)mode < METAIO_MODE_COUNT ? g_mode_names[mode] : "unknown";
+}
+
+static void stat_one(int dirfd, meta_stat_t *item) {
+    item->error = fstatat(dirfd, item->name, &item->st, 0) == 0 ? 0 : errno;
+}
+
+static void stat_serial(int dirfd, meta_stat_t *items, size_t count) {
+    for (size_t i = 0; i < count; i++) stat_one(dirfd, &items[i]);
+}
+
+// io_uring
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void ring_free(meta_ring_t *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_map_size);
+    if (ring->fd >= 0) close(ring->fd);
+    free(ring->buffers);
+    free(ring->slot_items);
+    free(ring->free_slots);
+    free(ring);
+}
+
+static meta_ring_t *ring_new(unsigned depth) {
+    struct io_uring_params params;
+    meta_ring_t *ring = calloc(1, sizeof(meta_ring_t));
+
+    if (!ring) return NULL;
+    memset(&params, 0, sizeof(params));
+    ring->fd = uring_setup(depth, &params);
+    if (ring->fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    // The kernel rounds the depth up to a power of two
+    ring->depth = params.sq_entries;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) goto fail;
+    ring->cq_map = ring->sq_map;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) goto fail;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) goto fail;
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    ring->buffers = malloc(ring->depth * sizeof(struct statx));
+    ring->slot_items = malloc(ring->depth * sizeof(size_t));
+    ring->free_slots = malloc(ring->depth * sizeof(unsigned));
+    if (!ring->buffers || !ring->slot_items || !ring->free_slots) goto fail;
+    return ring;
+
+fail:
+    ring_free(ring);
+    return NULL;
+}
+
+// Whether this kernel's io_uring knows statx (5.6 and later)
+static int uring_supports_statx(void) {
+    struct {
+        struct io_uring_probe probe;
+        struct io_uring_probe_op ops[IORING_OP_LAST];
+    } probe;
+    struct io_uring_params params;
+    int supported = 0;
+
+    memset(&params, 0, sizeof(params));
+    int fd = uring_setup(1, &params);
+    if (fd < 0) return 0;
+    memset(&probe, 0, sizeof(probe));
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, &probe, IORING_OP_LAST) == 0) {
+        supported = probe.probe.last_op >= IORING_OP_STATX &&
+                    (probe.ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    }
+    close(fd);
+    return supported;
+}
+
+// Rings are created the first time a thread stats through one
+static meta_ring_t *get_ring(void) {
+    unsigned generation = __atomic_load_n(&g_generation, __ATOMIC_ACQUIRE);
+
+    if (t_ring_generation != generation) {
+        t_ring = NULL;
+        t_ring_unavailable = 0;
+        t_ring_generation = generation;
+    }
+    if (t_ring || t_ring_unavailable) return t_ring;
+
+    int index = __atomic_fetch_add(&g_ring_count, 1, __ATOMIC_RELAXED);
+    meta_ring_t *ring = index < METAIO_MAX_RINGS ? ring_new(g_depth) : NULL;
+    if (!ring) {
+        t_ring_unavailable = 1;
+        return NULL;
+    }
+    __atomic_store_n(&g_rings[index], ring, __ATOMIC_RELEASE);
+    t_ring = ring;
+    return ring;
+}
+
+// Statx runs in kernel workers, not on this thread. When the thread is
+// acting as a session user, its credentials are registered with the
+// ring and every statx names them. 0 when the daemon's own are fine.
+static int ring_personality(meta_ring_t *ring) {
+    if (!user_cred_current()) return 0;
+    return (int)syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PERSONALITY, NULL, 0);
+}
+
+static void statx_to_stat(const struct statx *sx, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(sx->stx_dev_major, sx->stx_dev_minor);
+    st->st_ino = sx->stx_ino;
+    st->st_mode = sx->stx_mode;
+    st->st_nlink = sx->stx_nlink;
+    st->st_uid = sx->stx_uid;
+    st->st_gid = sx->stx_gid;
+    st->st_rdev = makedev(sx->stx_rdev_major, sx->stx_rdev_minor);
+    st->st_size = (off_t)sx->stx_size;
+    st->st_blksize = sx->stx_blksize;
+    st->st_blocks = (blkcnt_t)sx->stx_blocks;
+    st->st_atim.tv_sec = sx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = sx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = sx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = sx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = sx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = sx->stx_ctime.tv_nsec;
+}
+
+// Keeps the ring full: as each statx completes the next entry takes its
+// slot. personality, if not 0, is the credentials every statx runs with.
+// Returns -1 if the ring stops working.
+static int stat_uring(meta_ring_t *ring, int dirfd, meta_stat_t *items, size_t count, unsigned personality) {
+    size_t next = 0, done = 0;
+    unsigned free_count = ring->depth, queued = 0;
+
+    for (unsigned i = 0; i < ring->depth; i++) ring->free_slots[i] = i;
+    while (done < count) {
+        unsigned tail = *ring->sq_tail;
+        while (free_count > 0 && next < count) {
+            unsigned slot = ring->free_slots[--free_count];
+            unsigned index = tail & *ring->sq_mask;
+            struct io_uring_sqe *sqe = &ring->sqes[index];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (uint64_t)(uintptr_t)items[next].name;
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uint64_t)(uintptr_t)&ring->buffers[slot];
+            sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+            sqe->user_data = slot;
+            sqe->personality = (uint16_t)personality;
+            ring->sq_array[index] = index;
+            ring->slot_items[slot] = next++;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        int submitted = uring_enter(ring->fd, queued, 1);
+        if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) break;
+        if (submitted > 0) queued -= (unsigned)submitted;
+
+        unsigned head = *ring->cq_head;
+        unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            unsigned slot = (unsigned)cqe->user_data;
+            meta_stat_t *item = &items[ring->slot_items[slot]];
+
+            if (cqe->res < 0) item->error = -cqe->res;
+            else {
+                item->error = 0;
+                statx_to_stat(&ring->buffers[slot], &item->st);
+            }
+            ring->free_slots[free_count++] = slot;
+            done++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (done == count) return 0;
+
+    // Statx calls still in the kernel write into this ring's buffers, so
+    // it is left alone until cleanup
+    t_ring_unavailable = 1;
+    t_ring = NULL;
+    return -1;
+}
+
+// Thread pool fallback
+
+static void stat_claimed(meta_batch_t *batch) {
+    for (;;) {
+        size_t start = __atomic_fetch_add(&batch->next, METAIO_CHUNK, __ATOMIC_RELAXED);
+        if (start >= batch->count) return;
+        size_t end = start + METAIO_CHUNK < batch->count ? start + METAIO_CHUNK : batch->count;
+        stat_serial(batch->dirfd, batch->items + start, end - start);
+    }
+}
+
+// A pool thread stats with the access of whoever made the batch; if it
+// cannot take on those credentials, what it claims is reported denied
+static void stat_claimed_as(meta_batch_t *batch) {
+    if (!batch->cred) {
+        stat_claimed(batch);
+        return;
+    }
+    if (user_cred_enter(batch->cred) == 0) {
+        stat_claimed(batch);
+        user_cred_leave();
+        return;
+    }
+    for (;;) {
+        size_t start = __atomic_fetch_add(&batch->next, METAIO_CHUNK, __ATOMIC_RELAXED);
+        if (start >= batch->count) return;
+        for (size_t i = start; i < batch->count && i < start + METAIO_CHUNK; i++) batch->items[i].error = EACCES;
+    }
+}
+
+// Called with g_lock held
+static void unlink_batch(meta_batch_t *batch) {
+    for (meta_batch_t **link = &g_batches; *link; link = &(*link)->next_batch) {
+        if (*link == batch) {
+            *link = batch->next_batch;
+            return;
+        }
+    }
+}
+
+static void *pool_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        while (!g_batches && !g_stopping) {
+            pthread_cond_wait(&g_work_ready, &g_lock);
+        }
+        if (g_stopping) break;
+
+        meta_batch_t *batch = g_batches;
+        batch->workers++;
+        pthread_mutex_unlock(&g_lock);
+        stat_claimed_as(batch);
+        pthread_mutex_lock(&g_lock);
+
+        // Nothing left to claim; the caller waits for the last one out
+        unlink_batch(batch);
+        if (--batch->workers == 0) pthread_cond_broadcast(&g_batch_done);
+    }
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+static void stat_pool(int dirfd, meta_stat_t *items, size_t count) {
+    meta_batch_t batch = { dirfd, user_cred_current(), items, count, 0, 0, NULL };
+    meta_batch_t **tail = &g_batches;
+
+    pthread_mutex_lock(&g_lock);
+    while (*tail) tail = &(*tail)->next_batch;
+    *tail = &batch;
+    pthread_cond_broadcast(&g_work_ready);
+    pthread_mutex_unlock(&g_lock);
+
+    // The caller works on its own batch too, already as the right user
+    stat_claimed(&batch);
+
+    pthread_mutex_lock(&g_lock);
+    unlink_batch(&batch);
+    while (batch.workers > 0) pthread_cond_wait(&g_batch_done, &g_lock);
+    pthread_mutex_unlock(&g_lock);
+}
+
+void metaio_stat(int dirfd, meta_stat_t *items, size_t count) {
+    if (count == 0) return;
+
+    // One entry gains nothing from a round trip through either backend
+    if (count == 1 || g_mode == METAIO_SERIAL) {
+        stat_serial(dirfd, items, count);
+        return;
+    }
+    if (g_mode == METAIO_URING) {
+        // Completions come in any order, so a failed ring's batch is
+        // stated again from the start
+        meta_ring_t *ring = get_ring();
+        int personality = ring ? ring_personality(ring) : -1;
+        if (personality < 0 || stat_uring(ring, dirfd, items, count, (unsigned)personality) != 0) {
+            stat_serial(dirfd, items, count);
+        }
+        if (ring && personality > 0) {
+            syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PERSONALITY, NULL, personality);
+        }
+        return;
+    }
+    stat_pool(dirfd, items, count);
+}
+
+static int start_pool(int threads) {
+    g_stopping = 0;
+    for (g_thread_count = 0; g_thread_count < threads; g_thread_count++) {
+        if (pthread_create(&g_threads[g_thread_count], NULL, pool_main, NULL) != 0) return -1;
+    }
+    return 0;
+}
+
+int init_metaio(void) {
+    printf("🗂️ Initializing metadata engine...\n");
+
+    g_mode = g_wanted;
+    if (g_mode == METAIO_URING && !uring_supports_statx()) {
+        printf("🗂️ io_uring statx unavailable, using a thread pool\n");
+        g_mode = METAIO_THREADS;
+    }
+    if (g_mode == METAIO_THREADS) {
+        int threads = g_depth < METAIO_POOL_THREADS ? (int)g_depth : METAIO_POOL_THREADS;
+        if (start_pool(threads - 1) != 0) {
+            cleanup_metaio();
+            return -1;
+        }
+    }
+    __atomic_add_fetch(&g_generation, 1, __ATOMIC_RELEASE);
+    printf("🗂️ Metadata engine: %s, queue depth %u\n", g_mode_names[g_mode], g_depth);
+    return 0;
+}
+
+// Threads that stat through a ring must be done before this runs
+void cleanup_metaio(void) {
+    printf("🗂️ Cleaning up metadata engine...\n");
+
+    pthread_mutex_lock(&g_lock);
+    g_stopping = 1;
+    pthread_cond_broadcast(&g_work_ready);
+    pthread_mutex_unlock(&g_lock);
+    for (int i = 0; i < g_thread_count; i++) {
+        pthread_join(g_threads[i], NULL);
+    }
+    g_thread_count = 0;
+
+    int count = g_ring_count < METAIO_MAX_RINGS ? g_ring_count : METAIO_MAX_RINGS;
+    for (int i = 0; i < count; i++) {
+        if (g_rings[i]) ring_free(g_rings[i]);
+        g_rings[i] = NULL;
+    }
+    g_ring_count = 0;
+    __atomic_add_fetch(&g_generation, 1, __ATOMIC_RELEASE);
+    t_ring = NULL;
+    g_mode = METAIO_SERIAL;
+}
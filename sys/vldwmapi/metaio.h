@@ -0,0 +1,45 @@
+#ifndef METAIO_H
+#define METAIO_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Constants
+#define METAIO_DEFAULT_DEPTH 64                 // Stats in flight per batch
+#define METAIO_MAX_DEPTH 4096
+#define METAIO_MAX_RINGS 32                     // Threads with their own io_uring
+#define METAIO_POOL_THREADS 8                   // Fallback pool, capped by the depth
+#define METAIO_CHUNK 16                         // Entries a pool thread claims at once
+
+// How a batch of stats is carried out
+typedef enum {
+    METAIO_SERIAL = 0,          // fstatat() one after another on the caller's thread
+    METAIO_THREADS,             // Spread over a pool of threads
+    METAIO_URING,               // statx submitted through the calling thread's io_uring
+    METAIO_MODE_COUNT
+} metaio_mode_t;
+
+// One entry of a batch: name is relative to the batch's directory fd
+// (or absolute). st is filled in when error is 0, else error is the errno.
+typedef struct {
+    const char *name;
+    struct stat st;
+    int error;
+} meta_stat_t;
+
+// Metadata engine functions. The mode is the one wanted: io_uring falls
+// back to the pool on kernels without statx support in io_uring.
+int metaio_set_mode(const char *name);
+int metaio_set_depth(int depth);
+int init_metaio(void);
+void cleanup_metaio(void);
+metaio_mode_t metaio_mode(void);
+const char *metaio_mode_name(metaio_mode_t mode);
+
+// Stat every entry, following symlinks, with up to the queue depth in
+// flight at once. Safe to call from any thread; returns when all are done.
+// Access is checked as the caller: pool threads and io_uring take on the
+// credentials of a thread inside user_cred_enter().
+void metaio_stat(int dirfd, meta_stat_t *items, size_t count);
+
+#endif // METAIO_H
@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "metrics.h"
+#include "bufpool.h"
+
+// Log-linear ("HDR-style") histogram: values below 16 get exact
+// buckets, every power of two above that is split into 16 sub-buckets,
+// so any recorded value is known to within 1/16 of itself
+typedef struct {
+    uint64_t buckets[METRICS_HIST_BUCKETS];
+    uint64_t sum;
+    uint64_t max;
+} histogram_t;
+
+// Everything one thread records. A thread owns its shard, so updates
+// are plain loads and stores (no lock prefix); readers add the shards
+// up. Threads past the last shard share it and fall back to atomic
+// read-modify-write.
+typedef struct {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    histogram_t histograms[METRIC_HIST_COUNT];
+    histogram_t messages[METRIC_MSG_COUNT];
+    int shared;
+} metrics_shard_t;
+
+typedef struct {
+    const char *name;
+    const char *labels;
+    const char *help;
+} metric_info_t;
+
+static metrics_shard_t g_shards[METRICS_MAX_SHARDS];
+static int g_shards_used = 0;
+static __thread metrics_shard_t *t_shard = NULL;
+static int64_t g_gauges[METRIC_GAUGE_COUNT];
+static uint64_t g_started_ns = 0;
+
+static const char *message_names[METRIC_MSG_COUNT] = {
+    "login", "resume", "unlock", "lock", "logout", "desktop_session",
+    "system_status", "memory_stats", "metrics", "trace", "batch", "scene", "thumbnail", "search", "list_apps",
+    "search_apps", "launch", "resource_usage", "kill", "other"
+};
+
+// Counters sharing a name are one family told apart by their labels
+static const metric_info_t counter_info[METRIC_COUNTER_COUNT] = {
+    { "vldwmapi_connections_total", "result=\"accepted\"", "TCP connections by accept outcome" },
+    { "vldwmapi_connections_total", "result=\"rejected\"", NULL },
+    { "vldwmapi_websocket_handshakes_total", "result=\"ok\"", "WebSocket upgrades by outcome" },
+    { "vldwmapi_websocket_handshakes_total", "result=\"rejected\"", NULL },
+    { "vldwmapi_pam_authentications_total", "result=\"success\"", "PAM authentications by outcome" },
+    { "vldwmapi_pam_authentications_total", "result=\"failure\"", NULL },
+    { "vldwmapi_http_requests_total", NULL, "Plain HTTP requests served" },
+    { "vldwmapi_websocket_received_bytes_total", NULL, "Bytes read from upgraded connections" },
+    { "vldwmapi_websocket_invalid_frames_total", NULL, "Frames that closed the connection as malformed or oversized" },
+    { "vldwmapi_log_records_lost_total", "reason=\"ring_full\"", "Log records not written, by reason" },
+    { "vldwmapi_log_records_lost_total", "reason=\"rate_limited\"", NULL },
+    { "vldwmapi_requests_throttled_total", "class=\"auth\"", "Requests refused by a connection's token bucket, by message class" },
+    { "vldwmapi_requests_throttled_total", "class=\"filesystem\"", NULL },
+    { "vldwmapi_requests_throttled_total", "class=\"monitoring\"", NULL },
+    { "vldwmapi_requests_throttled_total", "class=\"process\"", NULL },
+    { "vldwmapi_requests_deferred_total", "reason=\"read_budget\"", "Requests left for a later loop iteration or worker turn" },
+    { "vldwmapi_requests_deferred_total", "reason=\"fair_queue\"", NULL },
+    { "vldwmapi_requests_refused_total", "reason=\"queue_full\"", "Requests refused because the connection's queue was full" },
+};
+
+static const metric_info_t gauge_info[METRIC_GAUGE_COUNT] = {
+    { "vldwmapi_clients_connected", NULL, "Open client connections" },
+    { "vldwmapi_websocket_clients", NULL, "Connections upgraded to WebSocket" },
+    { "vldwmapi_send_queue_bytes", NULL, "Response bytes queued but not yet sent" },
+    { "vldwmapi_fair_queue_depth", NULL, "Requests waiting in the fair queue for a worker" },
+};
+
+static const metric_info_t histogram_info[METRIC_HIST_COUNT] = {
+    { "vldwmapi_websocket_handshake_duration_seconds", NULL, "Time to validate and answer an upgrade" },
+    { "vldwmapi_pam_duration_seconds", NULL, "Time spent in pam_authenticate and pam_acct_mgmt" },
+    { "vldwmapi_loop_iteration_seconds", NULL, "Event loop time spent handling one wakeup" },
+    { "vldwmapi_loop_lag_seconds", NULL, "How late the event loop serviced its periodic tick" },
+    { "vldwmapi_launch_duration_seconds", NULL, "Time from a launch request to the program's exec" },
+};
+
+static int bucket_index(uint64_t value) {
+    if (value < METRICS_HIST_SUB_BUCKETS) return (int)value;
+    if (value >> (METRICS_HIST_MAX_BITS + 1)) value = (1ull << (METRICS_HIST_MAX_BITS + 1)) - 1;
+
+    int shift = 63 - __builtin_clzll(value) - METRICS_HIST_SUB_BITS;
+    return (shift + 1) * METRICS_HIST_SUB_BUCKETS + (int)((value >> shift) & (METRICS_HIST_SUB_BUCKETS - 1));
+}
+
+// Midpoint of a bucket, used as the value of every sample in it
+static uint64_t bucket_value(int index) {
+    if (index < METRICS_HIST_SUB_BUCKETS) return index;
+
+    int shift = index / METRICS_HIST_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(METRICS_HIST_SUB_BUCKETS + index % METRICS_HIST_SUB_BUCKETS) << shift;
+    return low + ((1ull << shift) >> 1);
+}
+
+static metrics_shard_t *get_shard(void) {
+    if (!t_shard) {
+        int index = __atomic_fetch_add(&g_shards_used, 1, __ATOMIC_RELAXED);
+        if (index >= METRICS_MAX_SHARDS - 1) {
+            index = METRICS_MAX_SHARDS - 1;
+            __atomic_store_n(&g_shards[index].shared, 1, __ATOMIC_RELAXED);
+        }
+        t_shard = &g_shards[index];
+    }
+    return t_shard;
+}
+
+static void add(uint64_t *cell, uint64_t n, int shared) {
+    if (shared) {
+        __atomic_add_fetch(cell, n, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(cell, __atomic_load_n(cell, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+    }
+}
+
+static void histogram_record(histogram_t *h, uint64_t ns, int shared) {
+    add(&h->buckets[bucket_index(ns)], 1, shared);
+    add(&h->sum, ns, shared);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    if (ns <= max) return;
+    if (!shared) {
+        __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+        return;
+    }
+    while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Merge one histogram (given by its offset in the shard) across shards
+static void histogram_summarize(size_t offset, metrics_summary_t *summary) {
+    static const double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t *targets[4] = { &summary->p50, &summary->p90, &summary->p99, &summary->p999 };
+    uint64_t counts[METRICS_HIST_BUCKETS];
+    uint64_t seen = 0;
+    int next = 0;
+
+    memset(summary, 0, sizeof(*summary));
+    memset(counts, 0, sizeof(counts));
+    for (int s = 0; s < METRICS_MAX_SHARDS; s++) {
+        const histogram_t *h = (const histogram_t *)((const char *)&g_shards[s] + offset);
+        uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+        for (int i = 0; i < METRICS_HIST_BUCKETS; i++) {
+            counts[i] += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        }
+        summary->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+        if (max > summary->max) summary->max = max;
+    }
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++) summary->count += counts[i];
+    if (summary->count == 0) return;
+
+    for (int i = 0; i < METRICS_HIST_BUCKETS && next < 4; i++) {
+        seen += counts[i];
+        while (next < 4 && seen >= (uint64_t)(quantiles[next] * summary->count + 0.5) && seen > 0) {
+            uint64_t value = bucket_value(i);
+            *targets[next++] = value < summary->max ? value : summary->max;
+        }
+    }
+}
+
+int init_metrics(void) {
+    printf("📈 Initializing metrics...\n");
+    memset(g_gauges, 0, sizeof(g_gauges));
+    g_started_ns = metrics_now_ns();
+    return 0;
+}
+
+void cleanup_metrics(void) {
+    printf("📈 Cleaning up metrics...\n");
+}
+
+void metrics_count(metric_counter_t counter, uint64_t n) {
+    metrics_shard_t *shard = get_shard();
+    add(&shard->counters[counter], n, shard->shared);
+}
+
+void metrics_gauge_set(metric_gauge_t gauge, int64_t value) {
+    __atomic_store_n(&g_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_add(metric_gauge_t gauge, int64_t delta) {
+    __atomic_add_fetch(&g_gauges[gauge], delta, __ATOMIC_RELAXED);
+}
+
+void metrics_observe(metric_histogram_t histogram, uint64_t ns) {
+    metrics_shard_t *shard = get_shard();
+    histogram_record(&shard->histograms[histogram], ns, shard->shared);
+}
+
+void metrics_observe_message(metric_message_t type, uint64_t ns) {
+    metrics_shard_t *shard = get_shard();
+    histogram_record(&shard->messages[type], ns, shard->shared);
+}
+
+static uint64_t counter_value(int counter) {
+    uint64_t total = 0;
+    for (int s = 0; s < METRICS_MAX_SHARDS; s++) {
+        total += __atomic_load_n(&g_shards[s].counters[counter], __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+#define HISTOGRAM_OFFSET(i) (offsetof(metrics_shard_t, histograms) + (i) * sizeof(histogram_t))
+#define MESSAGE_OFFSET(i) (offsetof(metrics_shard_t, messages) + (i) * sizeof(histogram_t))
+
+// Histogram slot for a message "type" field; unknown types share one
+metric_message_t metrics_message_type(const char *type) {
+    if (type) {
+        for (int i = 0; i < METRIC_MSG_OTHER; i++) {
+            if (strcmp(type, message_names[i]) == 0) return (metric_message_t)i;
+        }
+    }
+    return METRIC_MSG_OTHER;
+}
+
+const char *metrics_message_name(metric_message_t type) {
+    return message_names[type];
+}
+
+void metrics_histogram_summary(metric_histogram_t histogram, metrics_summary_t *summary) {
+    histogram_summarize(HISTOGRAM_OFFSET(histogram), summary);
+}
+
+void metrics_message_summary(metric_message_t type, metrics_summary_t *summary) {
+    histogram_summarize(MESSAGE_OFFSET(type), summary);
+}
+
+// Prometheus text output
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int error;
+} text_buffer_t;
+
+static void appendf(text_buffer_t *t, const char *fmt, ...) {
+    va_list args;
+
+    for (int attempt = 0; attempt < 2 && !t->error; attempt++) {
+        size_t room = t->cap - t->len;
+        va_start(args, fmt);
+        int n = vsnprintf(t->buf ? t->buf + t->len : NULL, t->buf ? room : 0, fmt, args);
+        va_end(args);
+
+        if (n < 0) {
+            t->error = 1;
+        } else if (t->buf && (size_t)n < room) {
+            t->len += n;
+            return;
+        } else {
+            char *grown = bufpool_grow(t->buf, t->len, &t->cap, t->len + n + BUFPOOL_MIN_SIZE);
+            if (!grown) t->error = 1;
+            t->buf = grown ? grown : t->buf;
+        }
+    }
+}
+
+static void append_header(text_buffer_t *t, const metric_info_t *info, const char *type) {
+    if (!info->help) return;
+    appendf(t, "# HELP %s %s\n# TYPE %s %s\n", info->name, info->help, info->name, type);
+}
+
+// Summaries carry quantiles computed from the log-linear buckets
+static void append_summary(text_buffer_t *t, const char *name, const char *labels, const metrics_summary_t *s) {
+    static const char *quantile_names[4] = { "0.5", "0.9", "0.99", "0.999" };
+    const uint64_t values[4] = { s->p50, s->p90, s->p99, s->p999 };
+    const char *sep = labels ? "," : "";
+    char braced[80] = "";
+
+    if (labels) snprintf(braced, sizeof(braced), "{%s}", labels);
+    else labels = "";
+    for (int i = 0; i < 4; i++) {
+        appendf(t, "%s{%s%squantile=\"%s\"} %.9f\n", name, labels, sep, quantile_names[i], values[i] / 1e9);
+    }
+    appendf(t, "%s_sum%s %.9f\n", name, braced, s->sum / 1e9);
+    appendf(t, "%s_count%s %llu\n", name, braced, (unsigned long long)s->count);
+}
+
+// Append the exposition text to a pooled buffer (grown as needed)
+int metrics_render_prometheus(char **buf, size_t *len, size_t *cap) {
+    text_buffer_t t = { *buf, *len, *cap, 0 };
+    metrics_summary_t summary;
+    char labels[64];
+
+    appendf(&t, "# HELP vldwmapi_uptime_seconds Seconds since the daemon started\n"
+                "# TYPE vldwmapi_uptime_seconds gauge\n"
+                "vldwmapi_uptime_seconds %.3f\n", (metrics_now_ns() - g_started_ns) / 1e9);
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        const metric_info_t *info = &counter_info[i];
+        append_header(&t, info, "counter");
+        appendf(&t, "%s%s%s%s %llu\n", info->name, info->labels ? "{" : "", info->labels ? info->labels : "",
+                info->labels ? "}" : "", (unsigned long long)counter_value(i));
+    }
+
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+        append_header(&t, &gauge_info[i], "gauge");
+        appendf(&t, "%s %lld\n", gauge_info[i].name, (long long)__atomic_load_n(&g_gauges[i], __ATOMIC_RELAXED));
+    }
+
+    for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+        append_header(&t, &histogram_info[i], "summary");
+        histogram_summarize(HISTOGRAM_OFFSET(i), &summary);
+        append_summary(&t, histogram_info[i].name, NULL, &summary);
+    }
+
+    appendf(&t, "# HELP vldwmapi_message_duration_seconds Time to handle one WebSocket message, by type\n"
+                "# TYPE vldwmapi_message_duration_seconds summary\n");
+    for (int i = 0; i < METRIC_MSG_COUNT; i++) {
+        snprintf(labels, sizeof(labels), "type=\"%s\"", message_names[i]);
+        histogram_summarize(MESSAGE_OFFSET(i), &summary);
+        append_summary(&t, "vldwmapi_message_duration_seconds", labels, &summary);
+    }
+
+    *buf = t.buf;
+    *len = t.len;
+    *cap = t.cap;
+    return t.error ? -1 : 0;
+}
+
+// JSON output for the "metrics" WebSocket message
+
+// Keys from the name tables aren't literals, so quote them here
+static void write_name_key(json_writer_t *w, const char *name) {
+    char key[64];
+    int len = snprintf(key, sizeof(key), "\"%s\":", name);
+    json_write_key(w, key, len);
+}
+
+static void write_summary(json_writer_t *w, const metrics_summary_t *s) {
+    json_begin_object(w);
+    json_field_uint(w, "count", s->count);
+    json_key(w, "mean_us");
+    json_write_fixed(w, s->count ? s->sum / 1e3 / s->count : 0.0, 1);
+    json_key(w, "p50_us");
+    json_write_fixed(w, s->p50 / 1e3, 1);
+    json_key(w, "p90_us");
+    json_write_fixed(w, s->p90 / 1e3, 1);
+    json_key(w, "p99_us");
+    json_write_fixed(w, s->p99 / 1e3, 1);
+    json_key(w, "p999_us");
+    json_write_fixed(w, s->p999 / 1e3, 1);
+    json_key(w, "max_us");
+    json_write_fixed(w, s->max / 1e3, 1);
+    json_end_object(w);
+}
+
+void metrics_write_json(json_writer_t *w) {
+    static const char *counter_keys[METRIC_COUNTER_COUNT] = {
+        "connections_accepted", "connections_rejected", "handshakes_ok", "handshakes_rejected",
+        "pam_success", "pam_failure", "http_requests", "websocket_received_bytes", "websocket_invalid_frames",
+        "log_records_dropped", "log_records_suppressed", "throttled_auth", "throttled_filesystem",
+        "throttled_monitoring", "throttled_process", "deferred_read_budget", "deferred_fair_queue",
+        "refused_queue_full"
+    };
+    static const char *gauge_keys[METRIC_GAUGE_COUNT] = {
+        "clients_connected", "websocket_clients", "send_queue_bytes", "fair_queue_depth"
+    };
+    static const char *histogram_keys[METRIC_HIST_COUNT] = {
+        "handshake", "pam", "loop_iteration", "loop_lag", "launch"
+    };
+    metrics_summary_t summary;
+
+    json_begin_object(w);
+    json_key(w, "uptime_seconds");
+    json_write_fixed(w, (metrics_now_ns() - g_started_ns) / 1e9, 3);
+
+    json_key(w, "counters");
+    json_begin_object(w);
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        write_name_key(w, counter_keys[i]);
+        json_write_uint(w, counter_value(i));
+    }
+    json_end_object(w);
+
+    json_key(w, "gauges");
+    json_begin_object(w);
+    for (int i = 0; i < METRIC_GAUGE_COUNT; i++) {
+        write_name_key(w, gauge_keys[i]);
+        json_write_int(w, __atomic_load_n(&g_gauges[i], __ATOMIC_RELAXED));
+    }
+    json_end_object(w);
+
+    json_key(w, "latency");
+    json_begin_object(w);
+    for (int i = 0; i < METRIC_HIST_COUNT; i++) {
+        histogram_summarize(HISTOGRAM_OFFSET(i), &summary);
+        write_name_key(w, histogram_keys[i]);
+        write_summary(w, &summary);
+    }
+    json_end_object(w);
+
+    json_key(w, "messages");
+    json_begin_object(w);
+    for (int i = 0; i < METRIC_MSG_COUNT; i++) {
+        histogram_summarize(MESSAGE_OFFSET(i), &summary);
+        if (summary.count == 0) continue;
+        write_name_key(w, message_names[i]);
+        write_summary(w, &summary);
+    }
+    json_end_object(w);
+    json_end_object(w);
+}
@@ -0,0 +1,116 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "jsonwriter.h"
+
+// Constants
+#define METRICS_HTTP_PATH "/metrics"
+#define METRICS_LAG_INTERVAL_MS 500
+#define METRICS_MAX_SHARDS 8                        // Threads recording without atomics
+#define METRICS_HIST_SUB_BITS 4                     // 16 sub-buckets: values within 1/16
+#define METRICS_HIST_SUB_BUCKETS (1 << METRICS_HIST_SUB_BITS)
+#define METRICS_HIST_MAX_BITS 40                    // Clamp at ~18 minutes in ns
+#define METRICS_HIST_BUCKETS ((METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 2) * METRICS_HIST_SUB_BUCKETS)
+
+// WebSocket message types with their own latency histogram
+typedef enum {
+    METRIC_MSG_LOGIN = 0,
+    METRIC_MSG_RESUME,
+    METRIC_MSG_UNLOCK,
+    METRIC_MSG_LOCK,
+    METRIC_MSG_LOGOUT,
+    METRIC_MSG_DESKTOP_SESSION,
+    METRIC_MSG_SYSTEM_STATUS,
+    METRIC_MSG_MEMORY_STATS,
+    METRIC_MSG_METRICS,
+    METRIC_MSG_TRACE,
+    METRIC_MSG_BATCH,
+    METRIC_MSG_SCENE,
+    METRIC_MSG_THUMBNAIL,
+    METRIC_MSG_SEARCH,
+    METRIC_MSG_LIST_APPS,
+    METRIC_MSG_SEARCH_APPS,
+    METRIC_MSG_LAUNCH,
+    METRIC_MSG_RESOURCE_USAGE,
+    METRIC_MSG_KILL,
+    METRIC_MSG_OTHER,
+    METRIC_MSG_COUNT
+} metric_message_t;
+
+typedef enum {
+    METRIC_CONNECTIONS_ACCEPTED = 0,
+    METRIC_CONNECTIONS_REJECTED,
+    METRIC_HANDSHAKES_OK,
+    METRIC_HANDSHAKES_REJECTED,
+    METRIC_PAM_SUCCESS,
+    METRIC_PAM_FAILURE,
+    METRIC_HTTP_REQUESTS,
+    METRIC_WS_BYTES_RECEIVED,
+    METRIC_WS_FRAMES_INVALID,
+    METRIC_LOG_DROPPED,
+    METRIC_LOG_SUPPRESSED,
+    METRIC_THROTTLED_AUTH,              // In sched_class_t order
+    METRIC_THROTTLED_FILESYSTEM,
+    METRIC_THROTTLED_MONITORING,
+    METRIC_THROTTLED_PROCESS,
+    METRIC_DEFERRED_READ_BUDGET,
+    METRIC_DEFERRED_FAIR_QUEUE,
+    METRIC_REFUSED_QUEUE_FULL,
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+typedef enum {
+    METRIC_CLIENTS_CONNECTED = 0,
+    METRIC_WEBSOCKET_CLIENTS,
+    METRIC_SEND_QUEUE_BYTES,
+    METRIC_FAIR_QUEUE_DEPTH,
+    METRIC_GAUGE_COUNT
+} metric_gauge_t;
+
+typedef enum {
+    METRIC_HIST_HANDSHAKE = 0,
+    METRIC_HIST_PAM,
+    METRIC_HIST_LOOP_ITERATION,
+    METRIC_HIST_LOOP_LAG,
+    METRIC_HIST_LAUNCH,
+    METRIC_HIST_COUNT
+} metric_histogram_t;
+
+// Point-in-time view of one histogram; latencies in nanoseconds
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+} metrics_summary_t;
+
+// Monotonic clock for latency measurements
+static inline uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Metrics functions. Recording is lock-free and safe from any thread:
+// each thread writes its own shard. Rendering adds the shards up.
+int init_metrics(void);
+void cleanup_metrics(void);
+void metrics_count(metric_counter_t counter, uint64_t n);
+void metrics_gauge_set(metric_gauge_t gauge, int64_t value);
+void metrics_gauge_add(metric_gauge_t gauge, int64_t delta);
+void metrics_observe(metric_histogram_t histogram, uint64_t ns);
+void metrics_observe_message(metric_message_t type, uint64_t ns);
+metric_message_t metrics_message_type(const char *type);
+const char *metrics_message_name(metric_message_t type);
+void metrics_histogram_summary(metric_histogram_t histogram, metrics_summary_t *summary);
+void metrics_message_summary(metric_message_t type, metrics_summary_t *summary);
+int metrics_render_prometheus(char **buf, size_t *len, size_t *cap);
+void metrics_write_json(json_writer_t *w);
+
+#endif // METRICS_H
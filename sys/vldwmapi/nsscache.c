@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+
+#include "nsscache.h"
+
+#define NSS_BUFFER_SIZE 16384
+#define NSS_BUFFER_MAX (1 << 20)
+
+// One cached answer. Positive user entries are reachable by uid and by
+// name; negative entries only by the key that missed. Group entries
+// reuse the same layout with gid in user.gid and the name in user.name.
+typedef struct nss_entry {
+    struct nss_entry *next_by_id;
+    struct nss_entry *next_by_name;
+    struct nss_entry *next_all;
+    int found;
+    int has_id;
+    int has_name;
+    time_t expires;
+    nss_user_t user;
+} nss_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    nss_entry_t *by_id[NSS_CACHE_BUCKETS];
+    nss_entry_t *by_name[NSS_CACHE_BUCKETS];
+    nss_entry_t *all;
+    int count;
+} nss_table_t;
+
+static nss_table_t g_users = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static nss_table_t g_groups = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static nss_cache_stats_t g_stats;
+
+static time_t now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static unsigned int hash_name(const char *name) {
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash % NSS_CACHE_BUCKETS;
+}
+
+static unsigned int hash_id(unsigned int id) {
+    return (id * 2654435761u) % NSS_CACHE_BUCKETS;
+}
+
+static void copy_field(char *dest, size_t size, const char *src) {
+    snprintf(dest, size, "%s", src ? src : "");
+}
+
+static void fill_user(nss_user_t *user, const struct passwd *pwd) {
+    copy_field(user->name, sizeof(user->name), pwd->pw_name);
+    user->uid = pwd->pw_uid;
+    user->gid = pwd->pw_gid;
+    copy_field(user->home, sizeof(user->home), pwd->pw_dir);
+    copy_field(user->shell, sizeof(user->shell), pwd->pw_shell);
+    copy_field(user->gecos, sizeof(user->gecos), pwd->pw_gecos);
+}
+
+// NSS lookups, made without holding any cache lock. Returns 1 if found,
+// 0 if the database says no such entry, -1 on lookup failure (which is
+// not cached, so a flaky directory server doesn't poison the cache).
+static int fetch_user(const char *name, uid_t uid, nss_user_t *user) {
+    char stack_buffer[NSS_BUFFER_SIZE];
+    char *buffer = stack_buffer;
+    size_t size = sizeof(stack_buffer);
+    struct passwd pwd, *result = NULL;
+    int err;
+
+    for (;;) {
+        err = name ? getpwnam_r(name, &pwd, buffer, size, &result)
+                   : getpwuid_r(uid, &pwd, buffer, size, &result);
+        if (err != ERANGE || size >= NSS_BUFFER_MAX) break;
+
+        size *= 4;
+        char *bigger = realloc(buffer == stack_buffer ? NULL : buffer, size);
+        if (!bigger) break;
+        buffer = bigger;
+    }
+
+    if (result) fill_user(user, result);
+    if (buffer != stack_buffer) free(buffer);
+    if (result) return 1;
+    return (err == 0 || err == ENOENT || err == ESRCH) ? 0 : -1;
+}
+
+static int fetch_group(gid_t gid, char *name, size_t name_size) {
+    char stack_buffer[NSS_BUFFER_SIZE];
+    char *buffer = stack_buffer;
+    size_t size = sizeof(stack_buffer);
+    struct group grp, *result = NULL;
+    int err;
+
+    for (;;) {
+        err = getgrgid_r(gid, &grp, buffer, size, &result);
+        if (err != ERANGE || size >= NSS_BUFFER_MAX) break;
+
+        size *= 4;
+        char *bigger = realloc(buffer == stack_buffer ? NULL : buffer, size);
+        if (!bigger) break;
+        buffer = bigger;
+    }
+
+    if (result) copy_field(name, name_size, result->gr_name);
+    if (buffer != stack_buffer) free(buffer);
+    if (result) return 1;
+    return (err == 0 || err == ENOENT || err == ESRCH) ? 0 : -1;
+}
+
+// Drop expired entries; if the table is still full, start over
+static void purge_table(nss_table_t *table, int everything) {
+    time_t now = now_seconds();
+    nss_entry_t *keep = NULL;
+
+    memset(table->by_id, 0, sizeof(table->by_id));
+    memset(table->by_name, 0, sizeof(table->by_name));
+    table->count = 0;
+
+    for (nss_entry_t *entry = table->all, *next; entry; entry = next) {
+        next = entry->next_all;
+        if (everything || entry->expires <= now) {
+            free(entry);
+            continue;
+        }
+        entry->next_all = keep;
+        keep = entry;
+        if (entry->has_id) {
+            unsigned int b = hash_id(entry->user.uid);
+            entry->next_by_id = table->by_id[b];
+            table->by_id[b] = entry;
+        }
+        if (entry->has_name) {
+            unsigned int b = hash_name(entry->user.name);
+            entry->next_by_name = table->by_name[b];
+            table->by_name[b] = entry;
+        }
+        table->count++;
+    }
+    table->all = keep;
+}
+
+// Caller holds the table lock
+static void table_insert(nss_table_t *table, const nss_user_t *user, int found, int has_id, int has_name) {
+    if (table->count >= NSS_CACHE_MAX_ENTRIES) {
+        purge_table(table, 0);
+        if (table->count >= NSS_CACHE_MAX_ENTRIES) purge_table(table, 1);
+    }
+
+    nss_entry_t *entry = calloc(1, sizeof(nss_entry_t));
+    if (!entry) return;
+
+    entry->user = *user;
+    entry->found = found;
+    entry->has_id = has_id;
+    entry->has_name = has_name;
+    entry->expires = now_seconds() + (found ? NSS_CACHE_TTL : NSS_NEGATIVE_TTL);
+
+    // New entries go to the front, so they shadow any expired ones
+    entry->next_all = table->all;
+    table->all = entry;
+    if (has_id) {
+        unsigned int b = hash_id(user->uid);
+        entry->next_by_id = table->by_id[b];
+        table->by_id[b] = entry;
+    }
+    if (has_name) {
+        unsigned int b = hash_name(user->name);
+        entry->next_by_name = table->by_name[b];
+        table->by_name[b] = entry;
+    }
+    table->count++;
+}
+
+// Caller holds the table lock
+static const nss_entry_t *table_find_id(nss_table_t *table, unsigned int id) {
+    time_t now = now_seconds();
+    for (nss_entry_t *entry = table->by_id[hash_id(id)]; entry; entry = entry->next_by_id) {
+        if (entry->user.uid == id && entry->expires > now) return entry;
+    }
+    return NULL;
+}
+
+static const nss_entry_t *table_find_name(nss_table_t *table, const char *name) {
+    time_t now = now_seconds();
+    for (nss_entry_t *entry = table->by_name[hash_name(name)]; entry; entry = entry->next_by_name) {
+        if (strcmp(entry->user.name, name) == 0 && entry->expires > now) return entry;
+    }
+    return NULL;
+}
+
+// Caller holds the lock of the table the entry came from
+static int use_entry(const nss_entry_t *entry, nss_user_t *user) {
+    if (!entry->found) {
+        __atomic_add_fetch(&g_stats.negative_hits, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_add_fetch(&g_stats.hits, 1, __ATOMIC_RELAXED);
+    if (user) *user = entry->user;
+    return 0;
+}
+
+int init_nss_cache(void) {
+    printf("👥 Initializing user/group cache...\n");
+    memset(&g_stats, 0, sizeof(g_stats));
+    return 0;
+}
+
+void cleanup_nss_cache(void) {
+    printf("👥 Cleaning up user/group cache...\n");
+    nss_cache_flush();
+}
+
+void nss_cache_flush(void) {
+    pthread_mutex_lock(&g_users.lock);
+    purge_table(&g_users, 1);
+    pthread_mutex_unlock(&g_users.lock);
+
+    pthread_mutex_lock(&g_groups.lock);
+    purge_table(&g_groups, 1);
+    pthread_mutex_unlock(&g_groups.lock);
+}
+
+int nss_get_user_by_name(const char *name, nss_user_t *user) {
+    nss_user_t fetched;
+    int result;
+
+    __atomic_add_fetch(&g_stats.lookups, 1, __ATOMIC_RELAXED);
+    if (!name || strlen(name) >= NSS_MAX_NAME_LEN) {
+        // Too long to key the cache; ask NSS directly
+        return (name && fetch_user(name, 0, user ? user : &fetched) == 1) ? 0 : -1;
+    }
+
+    pthread_mutex_lock(&g_users.lock);
+    const nss_entry_t *entry = table_find_name(&g_users, name);
+    if (entry) {
+        result = use_entry(entry, user);
+        pthread_mutex_unlock(&g_users.lock);
+        return result;
+    }
+    pthread_mutex_unlock(&g_users.lock);
+
+    __atomic_add_fetch(&g_stats.misses, 1, __ATOMIC_RELAXED);
+    memset(&fetched, 0, sizeof(fetched));
+    int found = fetch_user(name, 0, &fetched);
+    if (found < 0) return -1;
+
+    pthread_mutex_lock(&g_users.lock);
+    if (found) {
+        table_insert(&g_users, &fetched, 1, 1, 1);
+    } else {
+        copy_field(fetched.name, sizeof(fetched.name), name);
+        table_insert(&g_users, &fetched, 0, 0, 1);
+    }
+    pthread_mutex_unlock(&g_users.lock);
+
+    if (found && user) *user = fetched;
+    return found ? 0 : -1;
+}
+
+int nss_get_user_by_uid(uid_t uid, nss_user_t *user) {
+    nss_user_t fetched;
+    int result;
+
+    __atomic_add_fetch(&g_stats.lookups, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&g_users.lock);
+    const nss_entry_t *entry = table_find_id(&g_users, uid);
+    if (entry) {
+        result = use_entry(entry, user);
+        pthread_mutex_unlock(&g_users.lock);
+        return result;
+    }
+    pthread_mutex_unlock(&g_users.lock);
+
+    __atomic_add_fetch(&g_stats.misses, 1, __ATOMIC_RELAXED);
+    memset(&fetched, 0, sizeof(fetched));
+    int found = fetch_user(NULL, uid, &fetched);
+    if (found < 0) return -1;
+
+    pthread_mutex_lock(&g_users.lock);
+    if (found) {
+        table_insert(&g_users, &fetched, 1, 1, strlen(fetched.name) < NSS_MAX_NAME_LEN - 1);
+    } else {
+        fetched.uid = uid;
+        table_insert(&g_users, &fetched, 0, 1, 0);
+    }
+    pthread_mutex_unlock(&g_users.lock);
+
+    if (found && user) *user = fetched;
+    return found ? 0 : -1;
+}
+
+int nss_get_group_name(gid_t gid, char *name, size_t size) {
+    nss_user_t fetched;
+
+    __atomic_add_fetch(&g_stats.lookups, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&g_groups.lock);
+    const nss_entry_t *entry = table_find_id(&g_groups, gid);
+    if (entry) {
+        int result = use_entry(entry, NULL);
+        if (result == 0) copy_field(name, size, entry->user.name);
+        pthread_mutex_unlock(&g_groups.lock);
+        return result;
+    }
+    pthread_mutex_unlock(&g_groups.lock);
+
+    __atomic_add_fetch(&g_stats.misses, 1, __ATOMIC_RELAXED);
+    memset(&fetched, 0, sizeof(fetched));
+    int found = fetch_group(gid, fetched.name, sizeof(fetched.name));
+    if (found < 0) return -1;
+
+    fetched.uid = gid;
+    pthread_mutex_lock(&g_groups.lock);
+    table_insert(&g_groups, &fetched, found, 1, 0);
+    pthread_mutex_unlock(&g_groups.lock);
+
+    if (found) copy_field(name, size, fetched.name);
+    return found ? 0 : -1;
+}
+
+void nss_cache_get_stats(nss_cache_stats_t *stats) {
+    stats->hits = __atomic_load_n(&g_stats.hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&g_stats.misses, __ATOMIC_RELAXED);
+    stats->negative_hits = __atomic_load_n(&g_stats.negative_hits, __ATOMIC_RELAXED);
+    stats->lookups = __atomic_load_n(&g_stats.lookups, __ATOMIC_RELAXED);
+}
+
+void nss_batch_init(nss_batch_t *batch) {
+    batch->uid_count = 0;
+    batch->gid_count = 0;
+}
+
+// Remember a distinct owner; owners past NSS_BATCH_MAX are left out and
+// simply reported without a name
+void nss_batch_add(nss_batch_t *batch, uid_t uid, gid_t gid) {
+    int i;
+
+    for (i = 0; i < batch->uid_count && batch->uids[i] != uid; i++);
+    if (i == batch->uid_count && batch->uid_count < NSS_BATCH_MAX) {
+        batch->uids[batch->uid_count] = uid;
+        batch->user_names[batch->uid_count++][0] = '\0';
+    }
+
+    for (i = 0; i < batch->gid_count && batch->gids[i] != gid; i++);
+    if (i == batch->gid_count && batch->gid_count < NSS_BATCH_MAX) {
+        batch->gids[batch->gid_count] = gid;
+        batch->group_names[batch->gid_count++][0] = '\0';
+    }
+}
+
+// Answer every cached owner under a single lock hold per table, then go
+// to NSS only for the misses
+void nss_batch_resolve(nss_batch_t *batch) {
+    int missing_users[NSS_BATCH_MAX], missing_groups[NSS_BATCH_MAX];
+    int user_misses = 0, group_misses = 0;
+
+    pthread_mutex_lock(&g_users.lock);
+    for (int i = 0; i < batch->uid_count; i++) {
+        const nss_entry_t *entry = table_find_id(&g_users, batch->uids[i]);
+        if (!entry) {
+            missing_users[user_misses++] = i;
+        } else if (use_entry(entry, NULL) == 0) {
+            copy_field(batch->user_names[i], NSS_MAX_NAME_LEN, entry->user.name);
+        }
+    }
+    pthread_mutex_unlock(&g_users.lock);
+
+    pthread_mutex_lock(&g_groups.lock);
+    for (int i = 0; i < batch->gid_count; i++) {
+        const nss_entry_t *entry = table_find_id(&g_groups, batch->gids[i]);
+        if (!entry) {
+            missing_groups[group_misses++] = i;
+        } else if (use_entry(entry, NULL) == 0) {
+            copy_field(batch->group_names[i], NSS_MAX_NAME_LEN, entry->user.name);
+        }
+    }
+    pthread_mutex_unlock(&g_groups.lock);
+
+    // Misses are counted again by the single lookups below
+    __atomic_add_fetch(&g_stats.lookups, batch->uid_count + batch->gid_count - user_misses - group_misses,
+                       __ATOMIC_RELAXED);
+
+    for (int m = 0; m < user_misses; m++) {
+        nss_user_t user;
+        int i = missing_users[m];
+        if (nss_get_user_by_uid(batch->uids[i], &user) == 0) {
+            copy_field(batch->user_names[i], NSS_MAX_NAME_LEN, user.name);
+        }
+    }
+    for (int m = 0; m < group_misses; m++) {
+        int i = missing_groups[m];
+        nss_get_group_name(batch->gids[i], batch->group_names[i], NSS_MAX_NAME_LEN);
+    }
+}
+
+const char *nss_batch_user(const nss_batch_t *batch, uid_t uid) {
+    for (int i = 0; i < batch->uid_count; i++) {
+        if (batch->uids[i] == uid) return batch->user_names[i][0] ? batch->user_names[i] : NULL;
+    }
+    return NULL;
+}
+
+const char *nss_batch_group(const nss_batch_t *batch, gid_t gid) {
+    for (int i = 0; i < batch->gid_count; i++) {
+        if (batch->gids[i] == gid) return batch->group_names[i][0] ? batch->group_names[i] : NULL;
+    }
+    return NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef NSSCACHE_H
+#define NSSCACHE_H
+
+#include <sys/types.h>
+
+// Constants
+#define NSS_CACHE_TTL 300
+#define NSS_NEGATIVE_TTL 30
+#define NSS_CACHE_BUCKETS 1024
+#define NSS_CACHE_MAX_ENTRIES 4096
+#define NSS_MAX_NAME_LEN 64
+#define NSS_MAX_HOME_LEN 256
+#define NSS_MAX_SHELL_LEN 64
+#define NSS_MAX_GECOS_LEN 128
+#define NSS_BATCH_MAX 64
+
+// Cached copy of the passwd fields the daemon uses
+typedef struct {
+    char name[NSS_MAX_NAME_LEN];
+    uid_t uid;
+    gid_t gid;
+    char home[NSS_MAX_HOME_LEN];
+    char shell[NSS_MAX_SHELL_LEN];
+    char gecos[NSS_MAX_GECOS_LEN];
+} nss_user_t;
+
+// Distinct owners of one response, resolved together
+typedef struct {
+    uid_t uids[NSS_BATCH_MAX];
+    gid_t gids[NSS_BATCH_MAX];
+    char user_names[NSS_BATCH_MAX][NSS_MAX_NAME_LEN];
+    char group_names[NSS_BATCH_MAX][NSS_MAX_NAME_LEN];
+    int uid_count;
+    int gid_count;
+} nss_batch_t;
+
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long negative_hits;
+    unsigned long lookups;
+} nss_cache_stats_t;
+
+// NSS cache functions (thread-safe)
+int init_nss_cache(void);
+void cleanup_nss_cache(void);
+void nss_cache_flush(void);
+int nss_get_user_by_name(const char *name, nss_user_t *user);
+int nss_get_user_by_uid(uid_t uid, nss_user_t *user);
+int nss_get_group_name(gid_t gid, char *name, size_t size);
+void nss_cache_get_stats(nss_cache_stats_t *stats);
+
+// Batched owner-name resolution
+void nss_batch_init(nss_batch_t *batch);
+void nss_batch_add(nss_batch_t *batch, uid_t uid, gid_t gid);
+void nss_batch_resolve(nss_batch_t *batch);
+const char *nss_batch_user(const nss_batch_t *batch, uid_t uid);
+const char *nss_batch_group(const nss_batch_t *batch, gid_t gid);
+
+#endif // NSSCACHE_H
@@ -0,0 +1,574 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+
+#define NUMBER_MAX_LEN 32
+
+// A field the message can't have is remembered and stepped over, so the
+// rest of the message, its "id" in particular, is still read. Text that
+// isn't JSON stops the decode where it is.
+typedef struct {
+    char *p;
+    char *end;
+    proto_head_t *head;
+    int rejected;               // A field error has been recorded
+} parser_t;
+
+static void reject(parser_t *ps, const char *what, const char *name, size_t name_len) {
+    if (ps->rejected) return;
+    ps->rejected = 1;
+    if (name) {
+        snprintf(ps->head->error, sizeof(ps->head->error), "%s: %.*s", what, (int)name_len, name);
+    } else {
+        snprintf(ps->head->error, sizeof(ps->head->error), "%s", what);
+    }
+}
+
+static void reject_field(parser_t *ps, const char *what, const proto_field_t *field) {
+    reject(ps, what, field->name, strlen(field->name));
+}
+
+static int fail(parser_t *ps, const char *what) {
+    snprintf(ps->head->error, sizeof(ps->head->error), "%s", what);
+    return -1;
+}
+
+static int invalid(parser_t *ps) {
+    return fail(ps, "Invalid JSON");
+}
+
+static void skip_ws(parser_t *ps) {
+    while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\r' || *ps->p == '\n')) ps->p++;
+}
+
+static int at(parser_t *ps, char c) {
+    return ps->p < ps->end && *ps->p == c;
+}
+
+static int at_number(parser_t *ps) {
+    return ps->p < ps->end && (*ps->p == '-' || (*ps->p >= '0' && *ps->p <= '9'));
+}
+
+// After a member or an item: 1 at the closing bracket, 0 at a comma,
+// -1 otherwise. Either is consumed.
+static int next_item(parser_t *ps, char close) {
+    skip_ws(ps);
+    if (at(ps, close)) {
+        ps->p++;
+        return 1;
+    }
+    if (!at(ps, ',')) return invalid(ps);
+    ps->p++;
+    skip_ws(ps);
+    return 0;
+}
+
+static int hex4(const char *p, const char *end, unsigned *out) {
+    unsigned value = 0;
+
+    if (end - p < 4) return -1;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= (unsigned)(c - '0');
+        else if (c >= 'a' && c <= 'f') value |= (unsigned)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') value |= (unsigned)(c - 'A' + 10);
+        else return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+static size_t put_utf8(char *out, unsigned cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// The escape at *r, decoded into utf8 and stepped over; returns its
+// length, or -1 if it is not one JSON allows
+static int read_escape(char **r, const char *end, char *utf8) {
+    char *p = *r;
+    unsigned cp, low;
+
+    if (end - p < 2) return -1;
+    *r = p + 2;
+    switch (p[1]) {
+        case '"': case '\\': case '/': utf8[0] = p[1]; return 1;
+        case 'b': utf8[0] = '\b'; return 1;
+        case 'f': utf8[0] = '\f'; return 1;
+        case 'n': utf8[0] = '\n'; return 1;
+        case 'r': utf8[0] = '\r'; return 1;
+        case 't': utf8[0] = '\t'; return 1;
+        case 'u': break;
+        default: return -1;
+    }
+    if (hex4(p + 2, end, &cp) != 0 || (cp >= 0xDC00 && cp <= 0xDFFF)) return -1;
+    *r = p + 6;
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        if (end - p < 12 || p[6] != '\\' || p[7] != 'u' ||
+            hex4(p + 8, end, &low) != 0 || low < 0xDC00 || low > 0xDFFF) {
+            return -1;
+        }
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        *r = p + 12;
+    }
+    return (int)put_utf8(utf8, cp);
+}
+
+// The string at ps->p. With out set it is unescaped over itself and
+// NUL-terminated at most where the closing quote was: an escape never
+// decodes to more bytes than it takes up, and text up to the first one
+// is not moved at all. Without out, or once it has gone over max or held
+// a \u0000, it is only checked.
+static int read_string(parser_t *ps, proto_str_t *out, size_t max, const proto_field_t *field) {
+    char *r = ps->p + 1;
+    char *w = r;
+    size_t len = 0;
+    int writing = out != NULL;
+
+    for (;;) {
+        char utf8[4];
+        const char *from = r;
+        size_t n;
+
+        while (r < ps->end && *r != '"' && *r != '\\' && (unsigned char)*r >= 0x20) r++;
+        n = (size_t)(r - from);
+        if (n == 0) {
+            if (r >= ps->end || (unsigned char)*r < 0x20) return invalid(ps);
+            if (*r == '"') break;
+            int decoded = read_escape(&r, ps->end, utf8);
+            if (decoded < 0) return invalid(ps);
+            // A NUL would cut the C string short of its length
+            if (decoded == 1 && utf8[0] == '\0' && field && writing) {
+                reject_field(ps, "Invalid value", field);
+                writing = 0;
+            }
+            from = utf8;
+            n = (size_t)decoded;
+        }
+
+        len += n;
+        if (len > max && writing) {
+            reject_field(ps, "Field too long", field);
+            writing = 0;
+        }
+        if (writing) {
+            if (w != from) memmove(w, from, n);
+            w += n;
+        }
+    }
+
+    if (writing) {
+        *w = '\0';
+        out->ptr = ps->p + 1;
+        out->len = len;
+    }
+    ps->p = r + 1;
+    return 0;
+}
+
+// Keys are matched as written; one spelled with escapes is not a field of
+// this protocol. Leaves ps->p at the value.
+static int read_key(parser_t *ps, proto_str_t *key) {
+    if (!at(ps, '"')) return invalid(ps);
+    key->ptr = ps->p + 1;
+    if (read_string(ps, NULL, (size_t)-1, NULL) != 0) return -1;
+    key->len = (size_t)(ps->p - 1 - key->ptr);
+    skip_ws(ps);
+    if (!at(ps, ':')) return invalid(ps);
+    ps->p++;
+    skip_ws(ps);
+    return 0;
+}
+
+static int str_is(const char *ptr, size_t len, const char *name) {
+    return strlen(name) == len && memcmp(ptr, name, len) == 0;
+}
+
+// A JSON number, copied out for strtod. *integral is set when it has no
+// fraction and fits int64_t.
+static int read_number(parser_t *ps, int64_t *value, int *integral) {
+    char buf[NUMBER_MAX_LEN + 1];
+    char *start = ps->p;
+    char *stop;
+
+    while (ps->p < ps->end && ((*ps->p >= '0' && *ps->p <= '9') || *ps->p == '-' || *ps->p == '+' ||
+                               *ps->p == '.' || *ps->p == 'e' || *ps->p == 'E')) {
+        ps->p++;
+    }
+    size_t len = (size_t)(ps->p - start);
+    if (len == 0 || len > NUMBER_MAX_LEN) return invalid(ps);
+    char first = start[0] == '-' && len > 1 ? start[1] : start[0];
+    if (first < '0' || first > '9') return invalid(ps);
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    double d = strtod(buf, &stop);
+    if (stop != buf + len) return invalid(ps);
+
+    *integral = d >= -9.2e18 && d <= 9.2e18 && (double)(int64_t)d == d;
+    *value = *integral ? (int64_t)d : 0;
+    return 0;
+}
+
+static int read_literal(parser_t *ps, const char *word) {
+    size_t len = strlen(word);
+
+    if ((size_t)(ps->end - ps->p) < len || memcmp(ps->p, word, len) != 0) return invalid(ps);
+    ps->p += len;
+    return 0;
+}
+
+// Checks and steps over any value without changing it
+static int skip_value(parser_t *ps, int depth) {
+    int64_t number;
+    int integral;
+
+    if (ps->p >= ps->end) return invalid(ps);
+    switch (*ps->p) {
+        case '"': return read_string(ps, NULL, (size_t)-1, NULL);
+        case 't': return read_literal(ps, "true");
+        case 'f': return read_literal(ps, "false");
+        case 'n': return read_literal(ps, "null");
+        case '{':
+        case '[': {
+            char close = *ps->p == '{' ? '}' : ']';
+            int done;
+            if (depth >= PROTO_MAX_DEPTH) return fail(ps, "Nested too deeply");
+            ps->p++;
+            skip_ws(ps);
+            if (at(ps, close)) {
+                ps->p++;
+                return 0;
+            }
+            do {
+                proto_str_t key;
+                if (close == '}' && read_key(ps, &key) != 0) return -1;
+                if (skip_value(ps, depth + 1) != 0) return -1;
+            } while ((done = next_item(ps, close)) == 0);
+            return done < 0 ? -1 : 0;
+        }
+        default:
+            return read_number(ps, &number, &integral);
+    }
+}
+
+// A value of the wrong JSON type is rejected and stepped over
+static int mismatch(parser_t *ps, const char *what, const proto_field_t *field, int depth) {
+    reject_field(ps, what, field);
+    return skip_value(ps, depth);
+}
+
+static int read_field_string(parser_t *ps, const proto_field_t *field, proto_str_t *out, int depth) {
+    if (!at(ps, '"')) return mismatch(ps, "Expected a string", field, depth);
+    return read_string(ps, out, field->max, field);
+}
+
+// Items of a string[] or json[] field; those past max_items are checked
+// and dropped
+static int decode_array(parser_t *ps, const proto_field_t *field, char *base, int depth) {
+    proto_str_t *items = (proto_str_t *)(base + field->offset);
+    int *count = (int *)(base + field->count_offset);
+    int done;
+
+    ps->p++;
+    skip_ws(ps);
+    *count = 0;
+    if (at(ps, ']')) {
+        ps->p++;
+        return 0;
+    }
+    do {
+        if (*count == field->max_items) {
+            reject_field(ps, "Too many items", field);
+            if (skip_value(ps, depth + 1) != 0) return -1;
+            continue;
+        }
+        proto_str_t *item = &items[(*count)++];
+        if (field->kind == PROTO_STRINGS) {
+            if (read_field_string(ps, field, item, depth + 1) != 0) return -1;
+        } else {
+            item->ptr = ps->p;
+            if (skip_value(ps, depth + 1) != 0) return -1;
+            item->len = (size_t)(ps->p - item->ptr);
+        }
+    } while ((done = next_item(ps, ']')) == 0);
+    return done < 0 ? -1 : 0;
+}
+
+static int decode_map(parser_t *ps, const proto_field_t *field, char *base, int depth) {
+    proto_pair_t *pairs = (proto_pair_t *)(base + field->offset);
+    int *count = (int *)(base + field->count_offset);
+    int done;
+
+    ps->p++;
+    skip_ws(ps);
+    *count = 0;
+    if (at(ps, '}')) {
+        ps->p++;
+        return 0;
+    }
+    do {
+        if (!at(ps, '"')) return invalid(ps);
+        if (*count == field->max_items) {
+            proto_str_t key;
+            reject_field(ps, "Too many items", field);
+            if (read_key(ps, &key) != 0 || skip_value(ps, depth + 1) != 0) return -1;
+            continue;
+        }
+        proto_pair_t *pair = &pairs[(*count)++];
+        if (read_string(ps, &pair->key, field->max, field) != 0) return -1;
+        skip_ws(ps);
+        if (!at(ps, ':')) return invalid(ps);
+        ps->p++;
+        skip_ws(ps);
+        if (read_field_string(ps, field, &pair->value, depth + 1) != 0) return -1;
+    } while ((done = next_item(ps, '}')) == 0);
+    return done < 0 ? -1 : 0;
+}
+
+static int decode_object(parser_t *ps, const proto_object_t *object, char *base, int depth);
+
+static int decode_value(parser_t *ps, const proto_field_t *field, char *base, int depth) {
+    uint32_t *present = (uint32_t *)base;
+    int64_t number;
+    int integral;
+
+    if (*present & field->bit) return mismatch(ps, "Duplicate field", field, depth);
+    // null is the same as leaving the field out
+    if (at(ps, 'n')) return read_literal(ps, "null");
+    *present |= field->bit;
+
+    switch (field->kind) {
+        case PROTO_STRING: {
+            proto_str_t *out = (proto_str_t *)(base + field->offset);
+            if (read_field_string(ps, field, out, depth) != 0) return -1;
+            if (field->values && out->ptr) {
+                const char *const *value = field->values;
+                while (*value && !str_is(out->ptr, out->len, *value)) value++;
+                if (!*value) reject_field(ps, "Invalid value", field);
+            }
+            return 0;
+        }
+        case PROTO_INTEGER:
+            if (!at_number(ps)) return mismatch(ps, "Expected an integer", field, depth);
+            if (read_number(ps, &number, &integral) != 0) return -1;
+            if (!integral) {
+                reject_field(ps, "Expected an integer", field);
+            } else if (number < field->min_value || number > field->max_value) {
+                reject_field(ps, "Out of range", field);
+            }
+            *(int64_t *)(base + field->offset) = number;
+            return 0;
+        case PROTO_BOOLEAN:
+            if (!at(ps, 't') && !at(ps, 'f')) return mismatch(ps, "Expected a boolean", field, depth);
+            *(int *)(base + field->offset) = at(ps, 't');
+            return read_literal(ps, at(ps, 't') ? "true" : "false");
+        case PROTO_STRINGS:
+        case PROTO_JSONS:
+            if (!at(ps, '[')) return mismatch(ps, "Expected an array", field, depth);
+            return decode_array(ps, field, base, depth);
+        case PROTO_MAP:
+            if (!at(ps, '{')) return mismatch(ps, "Expected an object", field, depth);
+            return decode_map(ps, field, base, depth);
+        case PROTO_OBJECT:
+            if (!at(ps, '{')) return mismatch(ps, "Expected an object", field, depth);
+            return decode_object(ps, field->object, base + field->offset, depth + 1);
+        case PROTO_JSON: {
+            proto_str_t *out = (proto_str_t *)(base + field->offset);
+            out->ptr = ps->p;
+            if (skip_value(ps, depth + 1) != 0) return -1;
+            out->len = (size_t)(ps->p - out->ptr);
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static int decode_member(parser_t *ps, const proto_object_t *object, char *base, const proto_str_t *key, int depth) {
+    for (int i = 0; i < object->field_count; i++) {
+        if (str_is(key->ptr, key->len, object->fields[i].name)) {
+            return decode_value(ps, &object->fields[i], base, depth);
+        }
+    }
+    reject(ps, "Unknown field", key->ptr, key->len);
+    return skip_value(ps, depth);
+}
+
+static void check_required(parser_t *ps, const proto_object_t *object, const char *base) {
+    uint32_t present = *(const uint32_t *)base;
+
+    for (int i = 0; i < object->field_count; i++) {
+        const proto_field_t *field = &object->fields[i];
+        if (field->required && !(present & field->bit)) reject_field(ps, "Missing field", field);
+    }
+}
+
+// Nested object; ps->p is at its '{'
+static int decode_object(parser_t *ps, const proto_object_t *object, char *base, int depth) {
+    int done;
+
+    if (depth >= PROTO_MAX_DEPTH) return fail(ps, "Nested too deeply");
+    ps->p++;
+    skip_ws(ps);
+    if (at(ps, '}')) {
+        ps->p++;
+    } else {
+        do {
+            proto_str_t key;
+            if (read_key(ps, &key) != 0) return -1;
+            if (decode_member(ps, object, base, &key, depth) != 0) return -1;
+        } while ((done = next_item(ps, '}')) == 0);
+        if (done < 0) return -1;
+    }
+    check_required(ps, object, base);
+    return 0;
+}
+
+static int find_type(const char *name, size_t len) {
+    for (int i = 1; i < proto_message_count; i++) {
+        if (str_is(name, len, proto_messages[i].name)) return i;
+    }
+    return 0;
+}
+
+// When "type" is not the first key, look ahead for it without touching
+// the text, from the key at ps->p to the end of the top-level object.
+// Returns the type, 0 if unknown, -1 if there is none.
+static int scan_type(const parser_t *ps) {
+    parser_t scan = *ps;
+
+    for (;;) {
+        proto_str_t key;
+        if (read_key(&scan, &key) != 0) return -1;
+        if (str_is(key.ptr, key.len, "type") && at(&scan, '"')) {
+            const char *name = scan.p + 1;
+            if (read_string(&scan, NULL, (size_t)-1, NULL) != 0) return -1;
+            return find_type(name, (size_t)(scan.p - 1 - name));
+        }
+        if (skip_value(&scan, 1) != 0 || next_item(&scan, '}') != 0) return -1;
+    }
+}
+
+// Once the type is known the body can be filled in; the fields of an
+// unknown type are only stepped over
+static const proto_object_t *set_type(parser_t *ps, int type, void *body) {
+    if (type <= 0) {
+        reject(ps, type < 0 ? "Missing type" : "Unknown type", NULL, 0);
+        return NULL;
+    }
+    ps->head->type = type;
+    memset(body, 0, proto_messages[type].object->clear_size);
+    return proto_messages[type].object;
+}
+
+// "id": a short string or an integer, echoed in the reply. Anything
+// else is stepped over and the reply goes without.
+static int read_id(parser_t *ps) {
+    proto_id_t *id = &ps->head->id;
+    proto_str_t text;
+    int64_t number;
+    int integral;
+
+    id->present = 0;
+    if (at(ps, '"')) {
+        if (read_string(ps, &text, (size_t)-1, NULL) != 0) return -1;
+        if (text.len <= PROTO_ID_MAX) {
+            id->present = 1;
+            id->is_string = 1;
+            id->text = text;
+        }
+        return 0;
+    }
+    if (at_number(ps)) {
+        if (read_number(ps, &number, &integral) != 0) return -1;
+        id->present = integral;
+        id->is_string = 0;
+        id->number = number;
+        return 0;
+    }
+    return skip_value(ps, 1);
+}
+
+int proto_decode(char *text, size_t len, proto_head_t *head, void *body) {
+    parser_t ps = { text, text + len, head, 0 };
+    const proto_object_t *object = NULL;
+    int type_seen = 0;
+    int done;
+
+    memset(head, 0, sizeof(*head));
+    skip_ws(&ps);
+    if (!at(&ps, '{')) return invalid(&ps);
+    ps.p++;
+    skip_ws(&ps);
+
+    if (at(&ps, '}')) {
+        ps.p++;
+    } else {
+        do {
+            proto_str_t key;
+            char *key_at = ps.p;
+
+            if (read_key(&ps, &key) != 0) return -1;
+            if (str_is(key.ptr, key.len, "type")) {
+                proto_str_t name = { NULL, 0 };
+                if (type_seen++) {
+                    reject(&ps, "Duplicate field", "type", 4);
+                    if (skip_value(&ps, 1) != 0) return -1;
+                    continue;
+                }
+                if (at(&ps, '"')) {
+                    if (read_string(&ps, &name, (size_t)-1, NULL) != 0) return -1;
+                } else if (skip_value(&ps, 1) != 0) {
+                    return -1;
+                }
+                // Already known when it was looked ahead for
+                if (!head->type) object = set_type(&ps, name.ptr ? find_type(name.ptr, name.len) : -1, body);
+            } else if (str_is(key.ptr, key.len, "id")) {
+                if (read_id(&ps) != 0) return -1;
+            } else {
+                if (!type_seen && !head->type && !ps.rejected) {
+                    parser_t scan = ps;
+                    scan.p = key_at;
+                    object = set_type(&ps, scan_type(&scan), body);
+                }
+                if (object) {
+                    if (decode_member(&ps, object, body, &key, 1) != 0) return -1;
+                } else if (skip_value(&ps, 1) != 0) {
+                    return -1;
+                }
+            }
+        } while ((done = next_item(&ps, '}')) == 0);
+        if (done < 0) return -1;
+    }
+
+    skip_ws(&ps);
+    if (ps.p != ps.end) return invalid(&ps);
+    if (!type_seen && !head->type) set_type(&ps, -1, body);
+    if (object) check_required(&ps, object, body);
+    return ps.rejected ? -1 : 0;
+}
+
+const char *proto_message_name(int type) {
+    if (type <= 0 || type >= proto_message_count) return NULL;
+    return proto_messages[type].name;
+}
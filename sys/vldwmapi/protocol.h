@@ -0,0 +1,95 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define PROTO_ID_MAX 64                 // Longest string "id" echoed back
+#define PROTO_MAX_DEPTH 32              // Nesting inside a json field
+#define PROTO_ERROR_MAX 96
+
+// A string inside the message buffer, unescaped in place and
+// NUL-terminated, so ptr also works as a C string. NULL when absent.
+typedef struct {
+    const char *ptr;
+    size_t len;
+} proto_str_t;
+
+typedef struct {
+    proto_str_t key;
+    proto_str_t value;
+} proto_pair_t;
+
+typedef enum {
+    PROTO_STRING = 0,
+    PROTO_INTEGER,              // int64_t
+    PROTO_BOOLEAN,              // int
+    PROTO_STRINGS,              // proto_str_t[max_items] and an int count
+    PROTO_MAP,                  // proto_pair_t[max_items] and an int count; string values only
+    PROTO_OBJECT,               // Nested struct with its own field table
+    PROTO_JSON,                 // proto_str_t of the raw JSON text, parsed later by the handler
+    PROTO_JSONS,                // proto_str_t[max_items] of raw array elements and an int count
+} proto_kind_t;
+
+typedef struct proto_object proto_object_t;
+
+// Where and how one field of a message is decoded. The tables are
+// generated from protocol.json into messages.c.
+typedef struct {
+    const char *name;
+    proto_kind_t kind;
+    uint32_t bit;               // In the struct's present mask
+    int required;
+    size_t offset;
+    size_t count_offset;        // Arrays and maps
+    size_t max;                 // Bytes per string, after unescaping
+    int max_items;
+    int64_t min_value;
+    int64_t max_value;
+    const char *const *values;  // Allowed strings, NULL-terminated; NULL for any
+    const proto_object_t *object;
+} proto_field_t;
+
+// A decoded struct starts with its uint32_t present mask. Everything up
+// to clear_size is zeroed before decoding; the arrays after it are only
+// valid up to their counts.
+struct proto_object {
+    const proto_field_t *fields;
+    int field_count;
+    size_t clear_size;
+};
+
+typedef struct {
+    const char *name;
+    const proto_object_t *object;
+} proto_message_info_t;
+
+typedef struct {
+    int present;
+    int is_string;
+    proto_str_t text;
+    int64_t number;
+} proto_id_t;
+
+// Common part of every decoded request
+typedef struct {
+    int type;                   // Index into proto_messages; 0 if missing or unknown
+    proto_id_t id;              // Ignored unless a short string or an integer
+    char error[PROTO_ERROR_MAX];
+} proto_head_t;
+
+extern const proto_message_info_t proto_messages[];
+extern const int proto_message_count;
+
+// Decode one request in a single pass over text, which is modified:
+// strings are unescaped where they are and the fields point at them.
+// Unknown, duplicate, oversized and mistyped fields are rejected as they
+// are reached, before the handler runs or anything is allocated.
+// Returns 0, or -1 with head->error set to the first problem. A message
+// with a bad field is still read to the end, so head->type and head->id
+// are there to answer it with; only broken JSON stops the decode short.
+int proto_decode(char *text, size_t len, proto_head_t *head, void *body);
+const char *proto_message_name(int type);
+
+#endif // PROTOCOL_H
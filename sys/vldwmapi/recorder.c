@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "recorder.h"
+
+#define VARINT_MAX 10
+#define RECORD_HEADER_MAX (1 + 3 * VARINT_MAX)
+
+// Values of these keys never reach the capture
+static const char *const g_secret_keys[] = { "password", "token" };
+
+static const char *g_path = NULL;
+static int g_fd = -1;
+static unsigned char g_buf[RECORDER_BUFFER_SIZE];
+static size_t g_buf_len = 0;
+static uint64_t g_last_us = 0;          // Monotonic time of the last record
+static uint64_t g_flushed_ns = 0;
+static char *g_scratch = NULL;          // Redacted copy of a message
+static size_t g_scratch_cap = 0;
+
+static uint64_t clock_us(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static size_t put_varint(unsigned char *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+static int get_varint(rec_reader_t *reader, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && reader->pos < reader->len; shift += 7) {
+        unsigned char byte = reader->data[reader->pos++];
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return 0;
+    }
+    return -1;
+}
+
+static int write_all(const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(g_fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// A capture that can't be written stops; the daemon carries on
+static void stop_recording(void) {
+    fprintf(stderr, "⚠️ Recording to %s stopped: %s\n", g_path, strerror(errno));
+    close(g_fd);
+    g_fd = -1;
+    g_buf_len = 0;
+}
+
+void recorder_flush(void) {
+    if (g_fd < 0 || g_buf_len == 0) return;
+    if (write_all(g_buf, g_buf_len) != 0) {
+        stop_recording();
+        return;
+    }
+    g_buf_len = 0;
+}
+
+static void put_record(rec_kind_t kind, uint64_t time, uint64_t conn_id, const char *data, size_t len) {
+    unsigned char header[RECORD_HEADER_MAX];
+    size_t header_len = 0;
+
+    header[header_len++] = (unsigned char)kind;
+    header_len += put_varint(header + header_len, time);
+    header_len += put_varint(header + header_len, conn_id);
+    if (kind == REC_MESSAGE) header_len += put_varint(header + header_len, len);
+
+    if (g_buf_len + header_len + len > sizeof(g_buf)) recorder_flush();
+    if (g_fd < 0) return;
+    if (header_len + len > sizeof(g_buf)) {
+        // Bigger than the buffer: straight through
+        if (write_all(header, header_len) != 0 || write_all(data, len) != 0) stop_recording();
+        return;
+    }
+    memcpy(g_buf + g_buf_len, header, header_len);
+    if (len) memcpy(g_buf + g_buf_len + header_len, data, len);
+    g_buf_len += header_len + len;
+}
+
+static void record(rec_kind_t kind, uint64_t conn_id, const char *data, size_t len) {
+    uint64_t now = clock_us(CLOCK_MONOTONIC);
+    uint64_t delta = now > g_last_us ? now - g_last_us : 0;
+
+    g_last_us = now;
+    put_record(kind, delta, conn_id, data, len);
+}
+
+int recorder_set_path(const char *path) {
+    if (!path || !path[0]) return -1;
+    g_path = path;
+    return 0;
+}
+
+void recorder_open(uint64_t conn_id) {
+    if (g_fd >= 0) record(REC_OPEN, conn_id, NULL, 0);
+}
+
+void recorder_close(uint64_t conn_id) {
+    if (g_fd >= 0) record(REC_CLOSE, conn_id, NULL, 0);
+}
+
+void recorder_message(uint64_t conn_id, const char *payload, size_t len) {
+    int key_count = (int)(sizeof(g_secret_keys) / sizeof(g_secret_keys[0]));
+    int replaced;
+
+    if (g_fd < 0) return;
+    size_t needed = recorder_replace_fields(payload, len, g_secret_keys, key_count, RECORDER_REDACTED,
+                                            g_scratch, g_scratch_cap, &replaced);
+    if (needed > g_scratch_cap) {
+        char *grown = realloc(g_scratch, needed);
+        if (!grown) return;
+        g_scratch = grown;
+        g_scratch_cap = needed;
+        recorder_replace_fields(payload, len, g_secret_keys, key_count, RECORDER_REDACTED,
+                                g_scratch, g_scratch_cap, &replaced);
+    }
+    record(REC_MESSAGE, conn_id, g_scratch, needed);
+}
+
+void recorder_tick(uint64_t now_ns) {
+    if (g_fd < 0) return;
+    if (now_ns - g_flushed_ns >= RECORDER_FLUSH_INTERVAL_MS * 1000000ull) {
+        recorder_flush();
+        g_flushed_ns = now_ns;
+    }
+}
+
+static void emit(char *out, size_t cap, size_t *n, const char *data, size_t len) {
+    if (*n + len <= cap) memcpy(out + *n, data, len);
+    *n += len;
+}
+
+// Index just past the string starting at in[i]
+static size_t skip_string(const char *in, size_t len, size_t i) {
+    for (i++; i < len; i++) {
+        if (in[i] == '\\') i++;
+        else if (in[i] == '"') return i + 1;
+    }
+    return len;
+}
+
+static size_t skip_space(const char *in, size_t len, size_t i) {
+    while (i < len && (in[i] == ' ' || in[i] == '\t' || in[i] == '\r' || in[i] == '\n')) i++;
+    return i;
+}
+
+static int key_listed(const char *key, size_t key_len, const char *const *keys, int key_count) {
+    for (int k = 0; k < key_count; k++) {
+        if (strlen(keys[k]) == key_len && memcmp(key, keys[k], key_len) == 0) return 1;
+    }
+    return 0;
+}
+
+// Works on the raw text, so a malformed message is copied as far as it
+// goes rather than dropped
+size_t recorder_replace_fields(const char *in, size_t len, const char *const *keys, int key_count,
+                               const char *value, char *out, size_t cap, int *replaced) {
+    size_t n = 0, i = 0;
+
+    *replaced = 0;
+    while (i < len) {
+        if (in[i] != '"') {
+            size_t start = i;
+            while (i < len && in[i] != '"') i++;
+            emit(out, cap, &n, in + start, i - start);
+            continue;
+        }
+
+        size_t end = skip_string(in, len, i);
+        size_t colon = skip_space(in, len, end);
+        emit(out, cap, &n, in + i, end - i);
+        if (colon >= len || in[colon] != ':' || !key_listed(in + i + 1, end - i - 2, keys, key_count)) {
+            i = end;
+            continue;
+        }
+
+        // Objects and arrays are left alone; their own keys are checked
+        size_t start = skip_space(in, len, colon + 1);
+        if (start >= len || in[start] == '{' || in[start] == '[') {
+            i = end;
+            continue;
+        }
+        size_t stop = start;
+        if (in[start] == '"') {
+            stop = skip_string(in, len, start);
+        } else {
+            while (stop < len && !strchr(",}] \t\r\n", in[stop])) stop++;
+        }
+        emit(out, cap, &n, in + end, start - end);
+        emit(out, cap, &n, "\"", 1);
+        emit(out, cap, &n, value, strlen(value));
+        emit(out, cap, &n, "\"", 1);
+        (*replaced)++;
+        i = stop;
+    }
+    return n;
+}
+
+int rec_reader_open(rec_reader_t *reader, const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    memset(reader, 0, sizeof(*reader));
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)strlen(RECORDER_MAGIC)) {
+        close(fd);
+        return -1;
+    }
+    reader->data = malloc(st.st_size);
+    reader->len = (size_t)st.st_size;
+    while (reader->data && reader->pos < reader->len) {
+        ssize_t n = read(fd, reader->data + reader->pos, reader->len - reader->pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        reader->pos += n;
+    }
+    close(fd);
+    if (!reader->data || reader->pos != reader->len ||
+        memcmp(reader->data, RECORDER_MAGIC, strlen(RECORDER_MAGIC)) != 0) {
+        rec_reader_close(reader);
+        return -1;
+    }
+    reader->pos = strlen(RECORDER_MAGIC);
+    return 0;
+}
+
+int rec_reader_next(rec_reader_t *reader, rec_event_t *event) {
+    uint64_t time, conn_id, len = 0;
+
+    if (reader->pos >= reader->len) return 0;
+    event->kind = (rec_kind_t)reader->data[reader->pos++];
+    if (event->kind > REC_CLOSE || get_varint(reader, &time) != 0 || get_varint(reader, &conn_id) != 0) return -1;
+    if (event->kind == REC_MESSAGE && (get_varint(reader, &len) != 0 || len > reader->len - reader->pos)) return -1;
+
+    if (event->kind == REC_SEGMENT) {
+        // A clock stepped back between runs doesn't reorder the capture
+        if (reader->first_us == 0) reader->first_us = reader->clock_us = time;
+        if (time > reader->clock_us) reader->clock_us = time;
+    } else {
+        reader->clock_us += time;
+    }
+    event->time_us = reader->clock_us - reader->first_us;
+    event->conn_id = conn_id;
+    event->data = (const char *)reader->data + reader->pos;
+    event->len = (size_t)len;
+    reader->pos += len;
+    return 1;
+}
+
+void rec_reader_close(rec_reader_t *reader) {
+    free(reader->data);
+    memset(reader, 0, sizeof(*reader));
+}
+
+int init_recorder(void) {
+    struct stat st;
+
+    printf("🎙️ Initializing traffic recorder...\n");
+    if (!g_path) return 0;
+
+    // Appended to, so the daemon that takes over in an upgrade carries on
+    // with the same capture. Messages are private: owner only.
+    g_fd = open(g_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (g_fd < 0) {
+        fprintf(stderr, "❌ Cannot open capture file %s: %s\n", g_path, strerror(errno));
+        return -1;
+    }
+    if (fstat(g_fd, &st) == 0 && st.st_size == 0 && write_all(RECORDER_MAGIC, strlen(RECORDER_MAGIC)) != 0) {
+        close(g_fd);
+        g_fd = -1;
+        return -1;
+    }
+    g_last_us = clock_us(CLOCK_MONOTONIC);
+    put_record(REC_SEGMENT, clock_us(CLOCK_REALTIME), 0, NULL, 0);
+    recorder_flush();
+    printf("🎙️ Recording inbound messages to %s\n", g_path);
+    return 0;
+}
+
+void cleanup_recorder(void) {
+    printf("🎙️ Cleaning up traffic recorder...\n");
+    recorder_flush();
+    if (g_fd >= 0) close(g_fd);
+    g_fd = -1;
+    free(g_scratch);
+    g_scratch = NULL;
+    g_scratch_cap = 0;
+}
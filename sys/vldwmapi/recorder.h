@@ -0,0 +1,68 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Constants
+#define RECORDER_MAGIC "VLDWMREC"               // First 8 bytes of a capture
+#define RECORDER_BUFFER_SIZE (64 * 1024)        // Records written out at a time
+#define RECORDER_FLUSH_INTERVAL_MS 1000         // Longest a record waits in the buffer
+#define RECORDER_REDACTED "[redacted]"
+
+// Capture file: the magic, then records of
+//   kind (1 byte), time (varint), connection id (varint)
+// and for messages a varint length and the payload. Times are
+// microseconds since the previous record; a segment record carries the
+// wall clock instead and starts every run of the daemon, so a capture
+// survives an upgrade that appends to it. Connection ids are the
+// daemon's and stay the same across an upgrade.
+typedef enum {
+    REC_SEGMENT = 0,
+    REC_OPEN,                   // WebSocket handshake done
+    REC_MESSAGE,                // Inbound text message, secrets redacted
+    REC_CLOSE,
+} rec_kind_t;
+
+typedef struct {
+    rec_kind_t kind;
+    uint64_t time_us;           // Since the start of the first segment
+    uint64_t conn_id;
+    const char *data;           // REC_MESSAGE only; points into the capture
+    size_t len;
+} rec_event_t;
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t pos;
+    uint64_t first_us;          // Wall clock of the first segment
+    uint64_t clock_us;          // Wall clock of the last record
+} rec_reader_t;
+
+// Recording, from the event loop thread. Calls are cheap no-ops unless
+// a capture file was given.
+int recorder_set_path(const char *path);        // From the command line before init_recorder()
+void recorder_open(uint64_t conn_id);
+void recorder_message(uint64_t conn_id, const char *payload, size_t len);
+void recorder_close(uint64_t conn_id);
+void recorder_tick(uint64_t now_ns);            // Writes out records older than the flush interval
+void recorder_flush(void);
+
+// Copy a JSON text, writing value as a string in place of the scalar
+// values of the named keys at any depth. Returns the length needed,
+// like snprintf; out holds the copy only when that fits in cap.
+size_t recorder_replace_fields(const char *in, size_t len, const char *const *keys, int key_count,
+                               const char *value, char *out, size_t cap, int *replaced);
+
+// Reading a capture (replay tool). next returns 1 with an event, 0 at
+// the end and -1 if the capture is damaged.
+int rec_reader_open(rec_reader_t *reader, const char *path);
+int rec_reader_next(rec_reader_t *reader, rec_event_t *event);
+void rec_reader_close(rec_reader_t *reader);
+
+// Recorder functions
+int init_recorder(void);
+void cleanup_recorder(void);
+
+#endif // RECORDER_H
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scene.h"
+#include "metrics.h"
+
+static scene_window_t g_windows[SCENE_MAX_WINDOWS];
+static int g_window_count = 0;
+static char g_focus[SCENE_ID_MAX];          // Empty when nothing has focus
+static int g_next_z = 1;
+static uint64_t g_version = 0;
+
+// Changes since the last delta
+static uint64_t g_flushed_version = 0;
+static uint64_t g_deadline = 0;
+static char g_removed[SCENE_MAX_WINDOWS][SCENE_ID_MAX];
+static int g_removed_count = 0;
+static int g_removed_overflow = 0;          // Too many closes: send everything
+
+static const char *state_names[] = { "normal", "maximized", "minimized" };
+
+static scene_window_t *find_window(const char *id) {
+    for (int i = 0; i < g_window_count; i++) {
+        if (strcmp(g_windows[i].id, id) == 0) return &g_windows[i];
+    }
+    return NULL;
+}
+
+static int parse_state(const char *name) {
+    for (int i = 0; i < (int)(sizeof(state_names) / sizeof(state_names[0])); i++) {
+        if (strcmp(name, state_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Every change bumps the version and starts the frame it is sent in
+static void mark_changed(scene_window_t *window) {
+    g_version++;
+    if (window) {
+        window->version = g_version;
+        window->dirty = 1;
+    }
+    if (!g_deadline) g_deadline = metrics_now_ns() + (uint64_t)SCENE_FRAME_MS * 1000000;
+}
+
+static void raise_window(scene_window_t *window) {
+    window->z = g_next_z++;
+}
+
+// Copy the optional members of a "set" or "open" op
+static int apply_fields(scene_window_t *window, const json_value_t *op, const char **error) {
+    static const struct { const char *key; size_t offset; } geometry[] = {
+        { "x", offsetof(scene_window_t, x) },
+        { "y", offsetof(scene_window_t, y) },
+        { "width", offsetof(scene_window_t, width) },
+        { "height", offsetof(scene_window_t, height) },
+    };
+    const char *title = json_value_get_string(op, "title");
+    const char *state = json_value_get_string(op, "state");
+    const json_value_t *on_top = json_value_member(op, "always_on_top");
+
+    for (size_t i = 0; i < sizeof(geometry) / sizeof(geometry[0]); i++) {
+        const json_value_t *value = json_value_member(op, geometry[i].key);
+        if (!value) continue;
+        if (value->type != JSON_VALUE_NUMBER) {
+            *error = "Invalid geometry";
+            return -1;
+        }
+        *(int *)((char *)window + geometry[i].offset) = (int)value->u.number;
+    }
+    if (state) {
+        int parsed = parse_state(state);
+        if (parsed < 0) {
+            *error = "Invalid state";
+            return -1;
+        }
+        window->state = (scene_window_state_t)parsed;
+        if (window->state == SCENE_WINDOW_MINIMIZED && strcmp(g_focus, window->id) == 0) {
+            g_focus[0] = '\0';
+        }
+    }
+    if (title) snprintf(window->title, sizeof(window->title), "%s", title);
+    if (on_top && on_top->type == JSON_VALUE_BOOL) window->always_on_top = on_top->u.boolean;
+    return 0;
+}
+
+static void remove_window(scene_window_t *window) {
+    if (g_removed_count < SCENE_MAX_WINDOWS) {
+        memcpy(g_removed[g_removed_count++], window->id, SCENE_ID_MAX);
+    } else {
+        g_removed_overflow = 1;
+    }
+    if (strcmp(g_focus, window->id) == 0) g_focus[0] = '\0';
+
+    int index = (int)(window - g_windows);
+    memmove(&g_windows[index], &g_windows[index + 1], (g_window_count - index - 1) * sizeof(scene_window_t));
+    g_window_count--;
+}
+
+static int apply_op(const json_value_t *op, const char **error) {
+    const char *name = json_value_get_string(op, "op");
+    const char *id = json_value_get_string(op, "id");
+    scene_window_t *window;
+
+    if (!name || !id || strlen(id) >= SCENE_ID_MAX) {
+        *error = "Invalid op";
+        return -1;
+    }
+    window = find_window(id);
+
+    if (strcmp(name, "open") == 0) {
+        if (window) {
+            *error = "Window exists";
+            return -1;
+        }
+        if (g_window_count >= SCENE_MAX_WINDOWS) {
+            *error = "Scene full";
+            return -1;
+        }
+        window = &g_windows[g_window_count];
+        memset(window, 0, sizeof(*window));
+        memcpy(window->id, id, strlen(id) + 1);
+        window->x = window->y = 100;
+        window->width = 800;
+        window->height = 600;
+        if (apply_fields(window, op, error) != 0) return -1;
+        raise_window(window);
+        g_window_count++;
+        mark_changed(window);
+        return 0;
+    }
+
+    if (!window) {
+        *error = "No such window";
+        return -1;
+    }
+
+    if (strcmp(name, "set") == 0) {
+        if (apply_fields(window, op, error) != 0) {
+            // Members before the bad one were taken
+            mark_changed(window);
+            return -1;
+        }
+    } else if (strcmp(name, "focus") == 0) {
+        // Like activating a window in the shell: front, and unminimized
+        memcpy(g_focus, window->id, SCENE_ID_MAX);
+        if (window->state == SCENE_WINDOW_MINIMIZED) window->state = SCENE_WINDOW_NORMAL;
+        raise_window(window);
+    } else if (strcmp(name, "blur") == 0) {
+        if (strcmp(g_focus, window->id) == 0) g_focus[0] = '\0';
+    } else if (strcmp(name, "raise") == 0) {
+        raise_window(window);
+    } else if (strcmp(name, "close") == 0) {
+        remove_window(window);
+        mark_changed(NULL);
+        return 0;
+    } else {
+        *error = "Unknown op";
+        return -1;
+    }
+    mark_changed(window);
+    return 0;
+}
+
+int init_scene(void) {
+    printf("🪟 Initializing scene graph...\n");
+    g_window_count = 0;
+    g_focus[0] = '\0';
+    g_next_z = 1;
+    g_version = g_flushed_version = 0;
+    g_deadline = 0;
+    g_removed_count = g_removed_overflow = 0;
+    return 0;
+}
+
+void cleanup_scene(void) {
+    printf("🪟 Cleaning up scene graph...\n");
+    g_window_count = 0;
+}
+
+uint64_t scene_version(void) {
+    return g_version;
+}
+
+// Apply a "ops" array in order. Ops before an invalid one stay applied.
+int scene_apply(const json_value_t *ops, const char **error) {
+    int count = 0;
+
+    *error = NULL;
+    if (!ops || ops->type != JSON_VALUE_ARRAY) {
+        *error = "Missing ops";
+        return -1;
+    }
+    for (const json_value_t *op = ops->u.child; op; op = op->next) {
+        if (++count > SCENE_MAX_OPS) {
+            *error = "Too many ops";
+            return -1;
+        }
+        if (apply_op(op, error) != 0) return -1;
+    }
+    return 0;
+}
+
+static void write_window(json_writer_t *w, const scene_window_t *window) {
+    json_begin_object(w);
+    json_field_string(w, "id", window->id);
+    json_field_string(w, "title", window->title);
+    json_field_int(w, "x", window->x);
+    json_field_int(w, "y", window->y);
+    json_field_int(w, "width", window->width);
+    json_field_int(w, "height", window->height);
+    json_field_int(w, "z", window->z);
+    json_field_string(w, "state", state_names[window->state]);
+    json_field_bool(w, "always_on_top", window->always_on_top);
+    json_field_uint(w, "version", window->version);
+    json_end_object(w);
+}
+
+static void write_focus(json_writer_t *w) {
+    json_key(w, "focus");
+    if (g_focus[0]) json_write_string(w, g_focus);
+    else json_write_null(w);
+}
+
+// Whole scene, as fields of the open object
+void scene_write_snapshot(json_writer_t *w) {
+    json_field_uint(w, "version", g_version);
+    write_focus(w);
+    json_key(w, "windows");
+    json_begin_array(w);
+    for (int i = 0; i < g_window_count; i++) {
+        write_window(w, &g_windows[i]);
+    }
+    json_end_array(w);
+}
+
+// When the pending delta should go out; 0 if nothing changed
+uint64_t scene_flush_deadline(void) {
+    return g_deadline;
+}
+
+// Everything changed since the last delta, as fields of the open object.
+// Windows carry their full state, so a client holding any version from
+// "from" up to "version" can apply the delta. Returns 0 when there was
+// nothing to send.
+int scene_write_delta(json_writer_t *w) {
+    if (!g_deadline) return 0;
+
+    json_field_uint(w, "from", g_flushed_version);
+    json_field_uint(w, "version", g_version);
+    write_focus(w);
+    if (g_removed_overflow) json_field_bool(w, "full", 1);
+    json_key(w, "removed");
+    json_begin_array(w);
+    for (int i = 0; i < g_removed_count && !g_removed_overflow; i++) {
+        json_write_string(w, g_removed[i]);
+    }
+    json_end_array(w);
+    json_key(w, "windows");
+    json_begin_array(w);
+    for (int i = 0; i < g_window_count; i++) {
+        if (g_windows[i].dirty || g_removed_overflow) write_window(w, &g_windows[i]);
+        g_windows[i].dirty = 0;
+    }
+    json_end_array(w);
+
+    g_flushed_version = g_version;
+    g_deadline = 0;
+    g_removed_count = g_removed_overflow = 0;
+    return 1;
+}
+
+// The scene carried across a binary upgrade. Subscribers already saw
+// everything flushed; anything pending goes out with the next delta.
+void scene_save_state(upgrade_buf_t *buf) {
+    upgrade_put(buf, &g_version, sizeof(g_version));
+    upgrade_put(buf, &g_flushed_version, sizeof(g_flushed_version));
+    upgrade_put(buf, &g_next_z, sizeof(g_next_z));
+    upgrade_put(buf, g_focus, sizeof(g_focus));
+    upgrade_put(buf, &g_window_count, sizeof(g_window_count));
+    upgrade_put(buf, g_windows, g_window_count * sizeof(scene_window_t));
+}
+
+int scene_restore_state(upgrade_reader_t *reader) {
+    int count;
+
+    upgrade_get(reader, &g_version, sizeof(g_version));
+    upgrade_get(reader, &g_flushed_version, sizeof(g_flushed_version));
+    upgrade_get(reader, &g_next_z, sizeof(g_next_z));
+    upgrade_get(reader, g_focus, sizeof(g_focus));
+    g_focus[SCENE_ID_MAX - 1] = '\0';
+    if (upgrade_get(reader, &count, sizeof(count)) != 0 || count < 0 || count > SCENE_MAX_WINDOWS) return -1;
+    if (upgrade_get(reader, g_windows, count * sizeof(scene_window_t)) != 0) return -1;
+    g_window_count = count;
+    for (int i = 0; i < count; i++) {
+        if (g_windows[i].dirty && !g_deadline) g_deadline = metrics_now_ns();
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+#include "jsonwriter.h"
+#include "jsonreader.h"
+#include "upgrade.h"
+
+// Constants
+#define SCENE_MAX_WINDOWS 64
+#define SCENE_MAX_OPS 64                    // Mutations per message
+#define SCENE_ID_MAX 64
+#define SCENE_TITLE_MAX 128
+#define SCENE_FRAME_MS 16                   // Deltas are coalesced per frame
+
+typedef enum {
+    SCENE_WINDOW_NORMAL = 0,
+    SCENE_WINDOW_MAXIMIZED,
+    SCENE_WINDOW_MINIMIZED
+} scene_window_state_t;
+
+// One window of the scene graph
+typedef struct {
+    char id[SCENE_ID_MAX];
+    char title[SCENE_TITLE_MAX];
+    int x;
+    int y;
+    int width;
+    int height;
+    int z;                                  // Larger is in front
+    scene_window_state_t state;
+    int always_on_top;
+    uint64_t version;                       // Scene version of the last change
+    int dirty;                              // Changed since the last delta
+} scene_window_t;
+
+// Scene functions. The scene belongs to the event loop thread.
+int init_scene(void);
+void cleanup_scene(void);
+uint64_t scene_version(void);
+int scene_apply(const json_value_t *ops, const char **error);
+void scene_write_snapshot(json_writer_t *w);
+uint64_t scene_flush_deadline(void);
+int scene_write_delta(json_writer_t *w);
+void scene_save_state(upgrade_buf_t *buf);
+int scene_restore_state(upgrade_reader_t *reader);
+
+#endif // SCENE_H
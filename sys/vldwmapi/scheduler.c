@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scheduler.h"
+#include "metrics.h"
+
+#define TOKEN_UNIT 1000000000ull        // One request, in nanotokens: rate * elapsed ns refills exactly
+
+typedef struct {
+    const char *name;
+    uint32_t rate;                      // Requests per second; 0 for no limit
+    uint32_t burst;
+    int weight;                         // Items per fair queue turn
+} class_info_t;
+
+static class_info_t g_classes[SCHED_CLASS_COUNT] = {
+    [SCHED_CLASS_AUTH] = { "auth", 1, 5, 1 },
+    [SCHED_CLASS_FILESYSTEM] = { "filesystem", 50, 100, 4 },
+    [SCHED_CLASS_MONITORING] = { "monitoring", 10, 20, 2 },
+    [SCHED_CLASS_PROCESS] = { "process", 10, 20, 2 },
+    [SCHED_CLASS_OTHER] = { "other", 0, 0, 1 },
+};
+
+static const struct {
+    const char *type;
+    sched_class_t cls;
+} g_message_classes[] = {
+    { "login", SCHED_CLASS_AUTH },
+    { "resume", SCHED_CLASS_AUTH },
+    { "unlock", SCHED_CLASS_AUTH },
+    { "desktop_session", SCHED_CLASS_FILESYSTEM },
+    { "search", SCHED_CLASS_FILESYSTEM },
+    { "thumbnail", SCHED_CLASS_FILESYSTEM },
+    { "system_status", SCHED_CLASS_MONITORING },
+    { "memory_stats", SCHED_CLASS_MONITORING },
+    { "metrics", SCHED_CLASS_MONITORING },
+    { "resource_usage", SCHED_CLASS_MONITORING },
+    { "trace", SCHED_CLASS_MONITORING },
+    { "launch", SCHED_CLASS_PROCESS },
+    { "kill", SCHED_CLASS_PROCESS },
+};
+
+// Work waiting for a worker, per connection and class. Active flows form
+// a FIFO ring of turns (deficit round robin with item counts).
+typedef struct {
+    int used;
+    uint64_t conn_id;
+    sched_class_t cls;
+    work_item_t *head;
+    work_item_t *tail;
+    int queued;
+    int credit;                         // Items left in the current turn
+    int next_active;
+} sched_flow_t;
+
+static sched_flow_t g_flows[SCHED_MAX_FLOWS];
+static int g_active_head = -1;
+static int g_active_tail = -1;
+static int g_queued = 0;
+
+sched_class_t sched_class_of(const char *msg_type) {
+    if (!msg_type) return SCHED_CLASS_OTHER;
+    for (size_t i = 0; i < sizeof(g_message_classes) / sizeof(g_message_classes[0]); i++) {
+        if (strcmp(msg_type, g_message_classes[i].type) == 0) return g_message_classes[i].cls;
+    }
+    return SCHED_CLASS_OTHER;
+}
+
+const char *sched_class_name(sched_class_t cls) {
+    return (unsigned)cls < SCHED_CLASS_COUNT ? g_classes[cls].name : "other";
+}
+
+// "class=RATE[/BURST]"; a rate of 0 lifts the limit. Before any
+// connection exists, since buckets start full at the old burst.
+int sched_set_rate(const char *spec) {
+    const char *eq = spec ? strchr(spec, '=') : NULL;
+    char *end;
+
+    if (!eq) return -1;
+    for (int i = 0; i < SCHED_CLASS_OTHER; i++) {
+        if (strlen(g_classes[i].name) != (size_t)(eq - spec) ||
+            strncmp(spec, g_classes[i].name, eq - spec) != 0) continue;
+
+        long rate = strtol(eq + 1, &end, 10), burst = rate;
+        if (end == eq + 1 || rate < 0 || rate > 1000000) return -1;
+        if (*end == '/') {
+            const char *at = end + 1;
+            burst = strtol(at, &end, 10);
+            if (end == at || burst < 1 || burst > 1000000) return -1;
+        }
+        if (*end != '\0') return -1;
+        g_classes[i].rate = (uint32_t)rate;
+        g_classes[i].burst = rate == 0 ? 0 : (uint32_t)(burst < 1 ? 1 : burst);
+        return 0;
+    }
+    return -1;
+}
+
+void sched_bucket_init(sched_bucket_t *bucket, uint64_t now) {
+    for (int i = 0; i < SCHED_CLASS_COUNT; i++) {
+        bucket->tokens[i] = (uint64_t)g_classes[i].burst * TOKEN_UNIT;
+    }
+    bucket->refilled = now;
+}
+
+int sched_take(sched_bucket_t *bucket, sched_class_t cls, uint64_t now, uint32_t *retry_ms) {
+    const class_info_t *info = &g_classes[cls];
+
+    if (info->rate == 0) return 1;
+
+    // Every class refills from the same timestamp. Idle time beyond what
+    // fills the largest bucket does not matter, so it is capped to keep
+    // the products in range.
+    if (now > bucket->refilled) {
+        uint64_t elapsed = now - bucket->refilled;
+        if (elapsed > 1000ull * TOKEN_UNIT) elapsed = 1000ull * TOKEN_UNIT;
+        for (int i = 0; i < SCHED_CLASS_COUNT; i++) {
+            uint64_t cap = (uint64_t)g_classes[i].burst * TOKEN_UNIT;
+            bucket->tokens[i] += elapsed * g_classes[i].rate;
+            if (bucket->tokens[i] > cap) bucket->tokens[i] = cap;
+        }
+        bucket->refilled = now;
+    }
+
+    if (bucket->tokens[cls] >= TOKEN_UNIT) {
+        bucket->tokens[cls] -= TOKEN_UNIT;
+        return 1;
+    }
+    if (retry_ms) {
+        uint64_t missing = TOKEN_UNIT - bucket->tokens[cls];
+        *retry_ms = (uint32_t)((missing / info->rate + 999999) / 1000000);
+    }
+    metrics_count(METRIC_THROTTLED_AUTH + cls, 1);
+    return 0;
+}
+
+static sched_flow_t *find_flow(uint64_t conn_id, sched_class_t cls, int create) {
+    sched_flow_t *free_flow = NULL;
+
+    for (int i = 0; i < SCHED_MAX_FLOWS; i++) {
+        if (!g_flows[i].used) {
+            if (!free_flow) free_flow = &g_flows[i];
+        } else if (g_flows[i].conn_id == conn_id && g_flows[i].cls == cls) {
+            return &g_flows[i];
+        }
+    }
+    if (!create || !free_flow) return NULL;
+
+    memset(free_flow, 0, sizeof(*free_flow));
+    free_flow->used = 1;
+    free_flow->conn_id = conn_id;
+    free_flow->cls = cls;
+    free_flow->next_active = -1;
+    return free_flow;
+}
+
+static void activate(sched_flow_t *flow) {
+    int index = (int)(flow - g_flows);
+    flow->next_active = -1;
+    if (g_active_tail >= 0) g_flows[g_active_tail].next_active = index;
+    else g_active_head = index;
+    g_active_tail = index;
+}
+
+static void deactivate_head(void) {
+    sched_flow_t *flow = &g_flows[g_active_head];
+    g_active_head = flow->next_active;
+    if (g_active_head < 0) g_active_tail = -1;
+    flow->next_active = -1;
+}
+
+// 1 when a connection has as much waiting as it may; refuse the request
+// rather than queue or run it on the event loop
+int sched_flow_full(uint64_t conn_id, sched_class_t cls) {
+    sched_flow_t *flow = find_flow(conn_id, cls, 0);
+    if (flow && flow->queued >= SCHED_MAX_FLOW_QUEUED) {
+        metrics_count(METRIC_REFUSED_QUEUE_FULL, 1);
+        return 1;
+    }
+    return 0;
+}
+
+// Straight to a worker while one is free and nobody is waiting;
+// otherwise into the connection's flow. -1 if neither is possible, and
+// the caller runs the work itself.
+int sched_submit(uint64_t conn_id, sched_class_t cls, work_item_t *item) {
+    if (g_queued == 0 && workqueue_pending() < SCHED_WORKER_SLOTS) {
+        return workqueue_submit(item);
+    }
+
+    sched_flow_t *flow = find_flow(conn_id, cls, 1);
+    if (!flow || flow->queued >= SCHED_MAX_FLOW_QUEUED) return -1;
+
+    item->next = NULL;
+    if (flow->tail) flow->tail->next = item;
+    else flow->head = item;
+    flow->tail = item;
+    if (flow->queued++ == 0) activate(flow);
+    g_queued++;
+    metrics_count(METRIC_DEFERRED_FAIR_QUEUE, 1);
+    metrics_gauge_set(METRIC_FAIR_QUEUE_DEPTH, g_queued);
+    sched_pump();
+    return 0;
+}
+
+// Fill free worker slots, one turn at a time. Call after work completes.
+void sched_pump(void) {
+    while (g_active_head >= 0 && workqueue_pending() < SCHED_WORKER_SLOTS) {
+        sched_flow_t *flow = &g_flows[g_active_head];
+        work_item_t *item = flow->head;
+
+        if (flow->credit == 0) flow->credit = g_classes[flow->cls].weight;
+        flow->head = item->next;
+        if (!flow->head) flow->tail = NULL;
+        flow->queued--;
+        flow->credit--;
+        g_queued--;
+
+        if (flow->queued == 0) {
+            deactivate_head();
+            flow->used = 0;
+        } else if (flow->credit == 0) {
+            deactivate_head();
+            activate(flow);
+        }
+
+        if (workqueue_submit(item) != 0) {
+            item->run(item);
+            item->complete(item);
+        }
+    }
+    metrics_gauge_set(METRIC_FAIR_QUEUE_DEPTH, g_queued);
+}
+
+// The connection is gone: complete its waiting items without running
+// them, so their owners can release them
+void sched_cancel(uint64_t conn_id) {
+    for (int i = 0; i < SCHED_MAX_FLOWS; i++) {
+        sched_flow_t *flow = &g_flows[i];
+        if (!flow->used || flow->conn_id != conn_id) continue;
+
+        // Unlink from the ring of turns
+        int prev = -1;
+        for (int at = g_active_head; at >= 0; prev = at, at = g_flows[at].next_active) {
+            if (at != i) continue;
+            if (prev >= 0) g_flows[prev].next_active = flow->next_active;
+            else g_active_head = flow->next_active;
+            if (g_active_tail == i) g_active_tail = prev;
+            break;
+        }
+
+        work_item_t *item = flow->head;
+        g_queued -= flow->queued;
+        memset(flow, 0, sizeof(*flow));
+        flow->next_active = -1;
+        while (item) {
+            work_item_t *next = item->next;
+            item->complete(item);
+            item = next;
+        }
+    }
+    metrics_gauge_set(METRIC_FAIR_QUEUE_DEPTH, g_queued);
+}
+
+int sched_queued(void) {
+    return g_queued;
+}
+
+static void reset_flows(void) {
+    memset(g_flows, 0, sizeof(g_flows));
+    for (int i = 0; i < SCHED_MAX_FLOWS; i++) g_flows[i].next_active = -1;
+    g_active_head = g_active_tail = -1;
+    g_queued = 0;
+}
+
+int init_scheduler(void) {
+    printf("⚖️ Initializing request scheduler...\n");
+    reset_flows();
+    return 0;
+}
+
+// Waiting items are dropped; their owners go away with the process
+void cleanup_scheduler(void) {
+    printf("⚖️ Cleaning up request scheduler...\n");
+    reset_flows();
+}
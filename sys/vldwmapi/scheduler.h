@@ -0,0 +1,52 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include "workqueue.h"
+
+// Constants
+#define SCHED_FRAMES_PER_TURN 8                 // Messages one connection may have handled per loop iteration
+#define SCHED_MAX_FLOWS 128                     // Connection and class pairs with queued work
+#define SCHED_MAX_FLOW_QUEUED 16                // Waiting items per flow before requests are refused
+#define SCHED_WORKER_SLOTS WORKQUEUE_THREADS    // Items handed to the work queue at a time
+
+// Message classes, each with its own token bucket per connection and
+// its own weight in the fair queue
+typedef enum {
+    SCHED_CLASS_AUTH = 0,           // login, resume, unlock: PAM and token checks
+    SCHED_CLASS_FILESYSTEM,         // desktop_session, search, thumbnail
+    SCHED_CLASS_MONITORING,         // system_status, memory_stats, metrics, resource_usage, trace
+    SCHED_CLASS_PROCESS,            // launch, kill
+    SCHED_CLASS_OTHER,              // Not rate limited
+    SCHED_CLASS_COUNT
+} sched_class_t;
+
+// Token buckets of one connection, in billionths of a request
+typedef struct {
+    uint64_t tokens[SCHED_CLASS_COUNT];
+    uint64_t refilled;              // metrics_now_ns() of the last refill
+} sched_bucket_t;
+
+sched_class_t sched_class_of(const char *msg_type);
+const char *sched_class_name(sched_class_t cls);
+
+// Rate limiting: 1 if the request may run now; otherwise 0 with the
+// milliseconds until a token is available
+void sched_bucket_init(sched_bucket_t *bucket, uint64_t now);
+int sched_take(sched_bucket_t *bucket, sched_class_t cls, uint64_t now, uint32_t *retry_ms);
+int sched_set_rate(const char *spec);          // From the command line: "class=RATE[/BURST]"
+
+// Weighted fair queue in front of the work queue. Each connection and
+// class is a flow; flows take turns, a flow getting as many items per
+// turn as its class weight. Event loop thread only.
+int sched_flow_full(uint64_t conn_id, sched_class_t cls);
+int sched_submit(uint64_t conn_id, sched_class_t cls, work_item_t *item);
+void sched_pump(void);
+void sched_cancel(uint64_t conn_id);
+int sched_queued(void);
+
+// Scheduler functions
+int init_scheduler(void);
+void cleanup_scheduler(void);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "sessiontoken.h"
+#include "desktopsession.h"
+
+// Binary layout before encoding: 40 bytes of claims followed by the
+// HMAC-SHA256 of those bytes, all base64url without padding
+#define TOKEN_PAYLOAD_LEN 40
+#define TOKEN_MAC_LEN 32
+#define TOKEN_RAW_LEN (TOKEN_PAYLOAD_LEN + TOKEN_MAC_LEN)
+
+typedef struct {
+    unsigned char key[SESSION_TOKEN_KEY_LEN];
+    unsigned char id;
+    time_t created;
+    int valid;
+} token_key_t;
+
+// Keys rotate every SESSION_TOKEN_KEY_ROTATION seconds; older keys stay
+// around long enough to verify every token they signed
+static token_key_t g_keys[SESSION_TOKEN_KEY_SLOTS];
+static int g_current_key = -1;
+
+static const char base64url_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static size_t base64url_encode(const unsigned char *input, size_t len, char *output) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)input[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)input[i + 1] << 8;
+        if (i + 2 < len) v |= input[i + 2];
+        output[out++] = base64url_table[(v >> 18) & 0x3F];
+        output[out++] = base64url_table[(v >> 12) & 0x3F];
+        if (i + 1 < len) output[out++] = base64url_table[(v >> 6) & 0x3F];
+        if (i + 2 < len) output[out++] = base64url_table[v & 0x3F];
+    }
+    output[out] = '\0';
+    return out;
+}
+
+static int base64url_value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-') return 62;
+    if (c == '_') return 63;
+    return -1;
+}
+
+// Decodes exactly out_len bytes; anything else is malformed
+static int base64url_decode(const char *input, unsigned char *output, size_t out_len) {
+    size_t in_len = strlen(input);
+    if (in_len != (out_len * 4 + 2) / 3) return -1;
+
+    size_t out = 0;
+    uint32_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in_len; i++) {
+        int v = base64url_value(input[i]);
+        if (v < 0) return -1;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            output[out++] = (unsigned char)(acc >> bits);
+        }
+    }
+    return out == out_len ? 0 : -1;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (24 - i * 8));
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (56 - i * 8));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static const token_key_t *find_key(unsigned char id) {
+    for (int i = 0; i < SESSION_TOKEN_KEY_SLOTS; i++) {
+        if (g_keys[i].valid && g_keys[i].id == id) return &g_keys[i];
+    }
+    return NULL;
+}
+
+static int sign_payload(const token_key_t *key, const unsigned char *payload, unsigned char *mac) {
+    unsigned int mac_len = 0;
+    if (!HMAC(EVP_sha256(), key->key, SESSION_TOKEN_KEY_LEN, payload, TOKEN_PAYLOAD_LEN, mac, &mac_len)) {
+        return -1;
+    }
+    return mac_len == TOKEN_MAC_LEN ? 0 : -1;
+}
+
+int init_session_tokens(void) {
+    printf("🎫 Initializing session tokens...\n");
+    memset(g_keys, 0, sizeof(g_keys));
+    g_current_key = -1;
+    return session_token_rotate_key();
+}
+
+void cleanup_session_tokens(void) {
+    printf("🎫 Cleaning up session tokens...\n");
+    OPENSSL_cleanse(g_keys, sizeof(g_keys));
+    g_current_key = -1;
+}
+
+// Start signing with a fresh random key. The oldest slot is reused,
+// which invalidates tokens signed with it.
+int session_token_rotate_key(void) {
+    int next = (g_current_key + 1) % SESSION_TOKEN_KEY_SLOTS;
+    unsigned char next_id = (g_current_key >= 0) ? (unsigned char)(g_keys[g_current_key].id + 1) : 1;
+    token_key_t key;
+
+    if (RAND_bytes(key.key, sizeof(key.key)) != 1) {
+        fprintf(stderr, "❌ Failed to generate session token key\n");
+        return -1;
+    }
+    key.id = next_id;
+    key.created = time(NULL);
+    key.valid = 1;
+
+    g_keys[next] = key;
+    g_current_key = next;
+    OPENSSL_cleanse(&key, sizeof(key));
+    return 0;
+}
+
+// Keys carried across a binary upgrade, so issued tokens stay valid
+void session_token_save_state(upgrade_buf_t *buf) {
+    upgrade_put(buf, &g_current_key, sizeof(g_current_key));
+    upgrade_put(buf, g_keys, sizeof(g_keys));
+}
+
+int session_token_restore_state(upgrade_reader_t *reader) {
+    token_key_t keys[SESSION_TOKEN_KEY_SLOTS];
+    int current;
+
+    if (upgrade_get(reader, &current, sizeof(current)) != 0 || upgrade_get(reader, keys, sizeof(keys)) != 0 ||
+        current < 0 || current >= SESSION_TOKEN_KEY_SLOTS || !keys[current].valid) {
+        OPENSSL_cleanse(keys, sizeof(keys));
+        return -1;
+    }
+    memcpy(g_keys, keys, sizeof(g_keys));
+    g_current_key = current;
+    OPENSSL_cleanse(keys, sizeof(keys));
+    return 0;
+}
+
+int session_token_issue(uid_t uid, uint64_t session_id, char *token, size_t size, session_claims_t *claims) {
+    unsigned char raw[TOKEN_RAW_LEN];
+    time_t now = time(NULL);
+
+    if (size < SESSION_TOKEN_MAX_LEN || g_current_key < 0) return -1;
+
+    // Rotate lazily so no timer is needed
+    if (now - g_keys[g_current_key].created >= SESSION_TOKEN_KEY_ROTATION && session_token_rotate_key() != 0) {
+        return -1;
+    }
+    const token_key_t *key = &g_keys[g_current_key];
+
+    memset(raw, 0, sizeof(raw));
+    raw[0] = SESSION_TOKEN_VERSION;
+    raw[1] = key->id;
+    put_u32(raw + 4, (uint32_t)uid);
+    put_u64(raw + 8, session_id);
+    put_u64(raw + 16, (uint64_t)now);
+    put_u64(raw + 24, (uint64_t)(now + SESSION_TOKEN_LIFETIME));
+    if (RAND_bytes(raw + 32, 8) != 1 || sign_payload(key, raw, raw + TOKEN_PAYLOAD_LEN) != 0) {
+        return -1;
+    }
+
+    base64url_encode(raw, sizeof(raw), token);
+    if (claims) {
+        claims->uid = uid;
+        claims->session_id = session_id;
+        claims->issued_at = now;
+        claims->expires_at = now + SESSION_TOKEN_LIFETIME;
+        claims->key_id = key->id;
+    }
+    return 0;
+}
+
+// Check signature, expiry, that the bound session still exists for the
+// same user, and whether the operation may skip PAM at this token age
+int session_token_verify(const char *token, token_op_t op, session_claims_t *claims) {
+    unsigned char raw[TOKEN_RAW_LEN];
+    unsigned char mac[TOKEN_MAC_LEN];
+    desktop_session_t session;
+    session_claims_t parsed;
+    time_t now = time(NULL);
+
+    if (!token || strlen(token) >= SESSION_TOKEN_MAX_LEN || base64url_decode(token, raw, sizeof(raw)) != 0) {
+        return SESSION_TOKEN_MALFORMED;
+    }
+    if (raw[0] != SESSION_TOKEN_VERSION) {
+        return SESSION_TOKEN_MALFORMED;
+    }
+
+    const token_key_t *key = find_key(raw[1]);
+    if (!key || sign_payload(key, raw, mac) != 0 ||
+        CRYPTO_memcmp(mac, raw + TOKEN_PAYLOAD_LEN, TOKEN_MAC_LEN) != 0) {
+        return SESSION_TOKEN_BAD_SIGNATURE;
+    }
+
+    parsed.key_id = raw[1];
+    parsed.uid = (uid_t)get_u32(raw + 4);
+    parsed.session_id = get_u64(raw + 8);
+    parsed.issued_at = (time_t)get_u64(raw + 16);
+    parsed.expires_at = (time_t)get_u64(raw + 24);
+
+    if (now >= parsed.expires_at || parsed.issued_at > now + 60) {
+        return SESSION_TOKEN_EXPIRED;
+    }
+
+    // Stopping a session removes it, which revokes every token bound to it
+    if (get_session_by_id(parsed.session_id, &session) != 0 || session.uid != parsed.uid) {
+        return SESSION_TOKEN_REVOKED;
+    }
+
+    if (op == TOKEN_OP_UNLOCK && now - parsed.issued_at > SESSION_TOKEN_UNLOCK_WINDOW) {
+        return SESSION_TOKEN_NEEDS_PAM;
+    }
+
+    if (claims) *claims = parsed;
+    return SESSION_TOKEN_OK;
+}
+
+const char *session_token_strerror(int result) {
+    switch (result) {
+        case SESSION_TOKEN_OK: return "Token accepted";
+        case SESSION_TOKEN_MALFORMED: return "Malformed token";
+        case SESSION_TOKEN_BAD_SIGNATURE: return "Invalid token signature";
+        case SESSION_TOKEN_EXPIRED: return "Token expired";
+        case SESSION_TOKEN_REVOKED: return "Session no longer active";
+        case SESSION_TOKEN_NEEDS_PAM: return "Password required";
+        default: return "Token rejected";
+    }
+}
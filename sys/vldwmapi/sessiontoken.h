@@ -0,0 +1,55 @@
+#ifndef SESSIONTOKEN_H
+#define SESSIONTOKEN_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "upgrade.h"
+
+// Constants
+#define SESSION_TOKEN_VERSION 1
+#define SESSION_TOKEN_LIFETIME (12 * 60 * 60)
+#define SESSION_TOKEN_KEY_ROTATION (6 * 60 * 60)
+#define SESSION_TOKEN_KEY_SLOTS 3
+#define SESSION_TOKEN_KEY_LEN 32
+#define SESSION_TOKEN_UNLOCK_WINDOW (15 * 60)
+#define SESSION_TOKEN_MAX_LEN 128
+
+// Verification results
+#define SESSION_TOKEN_OK 0
+#define SESSION_TOKEN_MALFORMED -1
+#define SESSION_TOKEN_BAD_SIGNATURE -2
+#define SESSION_TOKEN_EXPIRED -3
+#define SESSION_TOKEN_REVOKED -4
+#define SESSION_TOKEN_NEEDS_PAM -5
+
+// Operations a token may be presented for. A token only ever stands in
+// for a login or an unlock. Past that, requests act as the connection's
+// uid: files are opened with its credentials (usercred.h), programs are
+// launched as it, kill and resource_usage reach only its session's
+// programs, and trace needs uid 0. The window scene is shared by all.
+typedef enum {
+    TOKEN_OP_RESUME = 0,    // Reattach a reconnecting shell to its session
+    TOKEN_OP_UNLOCK         // Unlock the screen shortly after a PAM login
+} token_op_t;
+
+// Claims carried by a token
+typedef struct {
+    uid_t uid;
+    uint64_t session_id;
+    time_t issued_at;
+    time_t expires_at;
+    unsigned char key_id;
+} session_claims_t;
+
+// Session token functions
+int init_session_tokens(void);
+void cleanup_session_tokens(void);
+int session_token_rotate_key(void);
+int session_token_issue(uid_t uid, uint64_t session_id, char *token, size_t size, session_claims_t *claims);
+int session_token_verify(const char *token, token_op_t op, session_claims_t *claims);
+const char *session_token_strerror(int result);
+void session_token_save_state(upgrade_buf_t *buf);
+int session_token_restore_state(upgrade_reader_t *reader);
+
+#endif // SESSIONTOKEN_H
@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "staticfiles.h"
+
+#define STATIC_SENDFILE_CHUNK (1 << 20)
+
+// Open addressing table from URL path to file entry. Directory aliases
+// ("/desktop", "/desktop/") point at the same entry as their index.html.
+typedef struct {
+    char *key;
+    static_file_t *file;
+} static_slot_t;
+
+static static_file_t **g_files = NULL;
+static int g_file_count = 0;
+static int g_file_capacity = 0;
+static static_slot_t *g_slots = NULL;
+static size_t g_slot_mask = 0;
+static size_t g_slot_used = 0;
+static int g_enabled = 0;
+
+static const struct {
+    const char *ext;
+    const char *type;
+} content_types[] = {
+    { "html", "text/html; charset=utf-8" },
+    { "js", "text/javascript; charset=utf-8" },
+    { "mjs", "text/javascript; charset=utf-8" },
+    { "css", "text/css; charset=utf-8" },
+    { "json", "application/json" },
+    { "map", "application/json" },
+    { "svg", "image/svg+xml" },
+    { "txt", "text/plain; charset=utf-8" },
+    { "wasm", "application/wasm" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "webp", "image/webp" },
+    { "ico", "image/x-icon" },
+    { "woff", "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf", "font/ttf" },
+};
+
+static size_t hash_path(const char *path) {
+    size_t hash = 1469598103934665603ULL;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static const char *lookup_content_type(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if (dot && !strchr(dot, '/')) {
+        for (size_t i = 0; i < sizeof(content_types) / sizeof(content_types[0]); i++) {
+            if (strcasecmp(dot + 1, content_types[i].ext) == 0) {
+                return content_types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+// Bun emits content-hashed names such as "chunk-2fce6291.js"; those can be
+// cached forever because any change produces a new name.
+static int is_hashed_name(const char *path) {
+    const char *base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    const char *dot = strrchr(base, '.');
+    const char *dash = NULL;
+
+    if (!dot) return 0;
+    for (const char *p = base; p < dot; p++) {
+        if (*p == '-') dash = p;
+    }
+    if (!dash || dot - dash - 1 < 8) return 0;
+
+    int digits = 0;
+    for (const char *p = dash + 1; p < dot; p++) {
+        if ((*p >= '0' && *p <= '9')) {
+            digits++;
+        } else if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))) {
+            return 0;
+        }
+    }
+    return digits > 0;
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t name_len = strlen(name), suffix_len = strlen(suffix);
+    return name_len > suffix_len && strcmp(name + name_len - suffix_len, suffix) == 0;
+}
+
+static int slot_insert(char *key, static_file_t *file) {
+    if ((g_slot_used + 1) * 2 > g_slot_mask + 1) {
+        size_t new_size = g_slots ? (g_slot_mask + 1) * 2 : 256;
+        static_slot_t *slots = calloc(new_size, sizeof(static_slot_t));
+        if (!slots) return -1;
+
+        for (size_t i = 0; g_slots && i <= g_slot_mask; i++) {
+            if (!g_slots[i].key) continue;
+            size_t j = hash_path(g_slots[i].key) & (new_size - 1);
+            while (slots[j].key) j = (j + 1) & (new_size - 1);
+            slots[j] = g_slots[i];
+        }
+        free(g_slots);
+        g_slots = slots;
+        g_slot_mask = new_size - 1;
+    }
+
+    size_t i = hash_path(key) & g_slot_mask;
+    while (g_slots[i].key) {
+        if (strcmp(g_slots[i].key, key) == 0) {
+            // First registration wins; aliases never shadow real files
+            free(key);
+            return 0;
+        }
+        i = (i + 1) & g_slot_mask;
+    }
+    g_slots[i].key = key;
+    g_slots[i].file = file;
+    g_slot_used++;
+    return 0;
+}
+
+static void open_variant(static_variant_t *variant, const char *fs_path, const char *suffix) {
+    char path[STATIC_MAX_PATH_LEN];
+    struct stat st;
+
+    variant->fd = -1;
+    variant->size = 0;
+    if (snprintf(path, sizeof(path), "%s%s", fs_path, suffix) >= (int)sizeof(path)) return;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;
+    }
+    variant->fd = fd;
+    variant->size = st.st_size;
+}
+
+static int add_file(const char *fs_path, const char *url_path) {
+    struct stat st;
+    int fd = open(fs_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    static_file_t *file = calloc(1, sizeof(static_file_t));
+    if (!file || !(file->url_path = strdup(url_path))) {
+        free(file);
+        close(fd);
+        return -1;
+    }
+
+    file->content_type = lookup_content_type(url_path);
+    file->mtime = st.st_mtime;
+    file->immutable = is_hashed_name(url_path);
+    file->variants[STATIC_VARIANT_IDENTITY].fd = fd;
+    file->variants[STATIC_VARIANT_IDENTITY].size = st.st_size;
+    open_variant(&file->variants[STATIC_VARIANT_BR], fs_path, ".br");
+    open_variant(&file->variants[STATIC_VARIANT_GZIP], fs_path, ".gz");
+    snprintf(file->etag, sizeof(file->etag), "\"%llx-%llx\"",
+             (unsigned long long)st.st_size, (unsigned long long)st.st_mtime);
+
+    if (g_file_count == g_file_capacity) {
+        int capacity = g_file_capacity ? g_file_capacity * 2 : 64;
+        static_file_t **files = realloc(g_files, capacity * sizeof(static_file_t *));
+        if (!files) {
+            close(fd);
+            free(file->url_path);
+            free(file);
+            return -1;
+        }
+        g_files = files;
+        g_file_capacity = capacity;
+    }
+    g_files[g_file_count++] = file;
+
+    char *key = strdup(url_path);
+    if (!key || slot_insert(key, file) != 0) return -1;
+
+    // Serve "<dir>/index.html" for "<dir>" and "<dir>/" as well
+    if (has_suffix(url_path, "/index.html")) {
+        size_t dir_len = strlen(url_path) - strlen("index.html");
+        char *with_slash = strndup(url_path, dir_len);
+        char *without_slash = dir_len > 1 ? strndup(url_path, dir_len - 1) : NULL;
+        if (with_slash) slot_insert(with_slash, file);
+        if (without_slash) slot_insert(without_slash, file);
+    }
+    return 0;
+}
+
+static int scan_directory(const char *fs_dir, const char *url_dir, int depth) {
+    DIR *dir = opendir(fs_dir);
+    struct dirent *entry;
+    char fs_path[STATIC_MAX_PATH_LEN];
+    char url_path[STATIC_MAX_PATH_LEN];
+    struct stat st;
+
+    if (!dir) return -1;
+    if (depth > 16) {
+        closedir(dir);
+        return 0;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        if (snprintf(fs_path, sizeof(fs_path), "%s/%s", fs_dir, entry->d_name) >= (int)sizeof(fs_path) ||
+            snprintf(url_path, sizeof(url_path), "%s/%s", url_dir, entry->d_name) >= (int)sizeof(url_path)) {
+            continue;
+        }
+        if (stat(fs_path, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            scan_directory(fs_path, url_path, depth + 1);
+        } else if (S_ISREG(st.st_mode)) {
+            // Precompressed siblings are attached to their original file
+            if (has_suffix(entry->d_name, ".gz") || has_suffix(entry->d_name, ".br")) {
+                char original[STATIC_MAX_PATH_LEN];
+                snprintf(original, sizeof(original), "%.*s", (int)(strlen(fs_path) - 3), fs_path);
+                if (access(original, F_OK) == 0) continue;
+            }
+            add_file(fs_path, url_path);
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+int init_static_files(const char *root) {
+    char resolved[STATIC_MAX_PATH_LEN];
+
+    if (!root || !root[0]) {
+        return 0;
+    }
+
+    printf("📦 Indexing frontend build in %s...\n", root);
+    if (!realpath(root, resolved) || scan_directory(resolved, "", 0) != 0) {
+        fprintf(stderr, "❌ Cannot read frontend build directory %s\n", root);
+        return -1;
+    }
+
+    int compressed = 0;
+    for (int i = 0; i < g_file_count; i++) {
+        if (g_files[i]->variants[STATIC_VARIANT_BR].fd >= 0 ||
+            g_files[i]->variants[STATIC_VARIANT_GZIP].fd >= 0) {
+            compressed++;
+        }
+    }
+    printf("📦 Serving %d files (%d precompressed) from %s\n", g_file_count, compressed, resolved);
+    g_enabled = 1;
+    return 0;
+}
+
+void cleanup_static_files(void) {
+    for (int i = 0; i < g_file_count; i++) {
+        for (int v = 0; v < STATIC_VARIANT_COUNT; v++) {
+            if (g_files[i]->variants[v].fd >= 0) close(g_files[i]->variants[v].fd);
+        }
+        free(g_files[i]->url_path);
+        free(g_files[i]);
+    }
+    for (size_t i = 0; g_slots && i <= g_slot_mask; i++) {
+        free(g_slots[i].key);
+    }
+    free(g_files);
+    free(g_slots);
+    g_files = NULL;
+    g_slots = NULL;
+    g_file_count = g_file_capacity = 0;
+    g_slot_mask = g_slot_used = 0;
+    g_enabled = 0;
+}
+
+int static_files_enabled(void) {
+    return g_enabled;
+}
+
+const static_file_t *static_files_lookup(const char *url_path) {
+    if (!g_slots) return NULL;
+
+    size_t i = hash_path(url_path) & g_slot_mask;
+    while (g_slots[i].key) {
+        if (strcmp(g_slots[i].key, url_path) == 0) return g_slots[i].file;
+        i = (i + 1) & g_slot_mask;
+    }
+    return NULL;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Strip the query, percent-decode and refuse anything that could climb
+// out of the build directory
+static int normalize_target(const char *target, char *path, size_t size) {
+    size_t out = 0;
+
+    if (target[0] != '/') return 0;
+    for (size_t i = 0; target[i] && target[i] != '?' && target[i] != '#'; i++) {
+        char c = target[i];
+        if (c == '%') {
+            int hi = hex_value(target[i + 1]);
+            int lo = hi >= 0 ? hex_value(target[i + 2]) : -1;
+            if (lo < 0) return 0;
+            c = (char)(hi * 16 + lo);
+            i += 2;
+        }
+        if (c == '\0' || c == '\\' || out + 1 >= size) return 0;
+        path[out++] = c;
+    }
+    path[out] = '\0';
+
+    return strstr(path, "/../") == NULL && !has_suffix(path, "/..") && strstr(path, "//") == NULL;
+}
+
+static int build_simple_response(static_transfer_t *transfer, int status, const char *reason,
+                                 const char *extra_header, int keep_alive) {
+    int len = snprintf(transfer->header, sizeof(transfer->header),
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: text/plain; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "%s"
+        "Connection: %s\r\n"
+        "\r\n"
+        "%s",
+        status, reason, strlen(reason), extra_header ? extra_header : "",
+        keep_alive ? "keep-alive" : "close", reason);
+    transfer->header_len = (len > 0 && len < (int)sizeof(transfer->header)) ? len : 0;
+    return transfer->header_len > 0 ? 0 : -1;
+}
+
+// Fill in the response headers and file window for a GET or HEAD.
+// The body is streamed later by static_transfer_send.
+int static_prepare_response(const http_request_t *request, static_transfer_t *transfer) {
+    char path[STATIC_MAX_PATH_LEN];
+    char range_header[96] = "";
+    int is_head = strcmp(request->method, "HEAD") == 0;
+    int status = 200;
+    int variant = STATIC_VARIANT_IDENTITY;
+
+    static_transfer_reset(transfer);
+    transfer->keep_alive = http_request_keep_alive(request);
+
+    if (!is_head && strcmp(request->method, "GET") != 0) {
+        return build_simple_response(transfer, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n", transfer->keep_alive);
+    }
+    if (!normalize_target(request->target, path, sizeof(path))) {
+        return build_simple_response(transfer, 400, "Bad Request", NULL, transfer->keep_alive);
+    }
+
+    const static_file_t *file = static_files_lookup(path);
+    if (!file && strcmp(path, "/") == 0) {
+        file = static_files_lookup(STATIC_DEFAULT_INDEX);
+    }
+    if (!file) {
+        return build_simple_response(transfer, 404, "Not Found", NULL, transfer->keep_alive);
+    }
+
+    int has_variants = file->variants[STATIC_VARIANT_BR].fd >= 0 || file->variants[STATIC_VARIANT_GZIP].fd >= 0;
+
+    // Ranges always address the identity representation
+    if (!(request->flags & HTTP_FLAG_HAS_RANGE)) {
+        if ((request->accept_encoding & HTTP_ENCODING_BR) && file->variants[STATIC_VARIANT_BR].fd >= 0) {
+            variant = STATIC_VARIANT_BR;
+        } else if ((request->accept_encoding & HTTP_ENCODING_GZIP) && file->variants[STATIC_VARIANT_GZIP].fd >= 0) {
+            variant = STATIC_VARIANT_GZIP;
+        }
+    }
+
+    // Each representation gets its own validator
+    char etag[STATIC_ETAG_LEN + 4];
+    size_t etag_len = strlen(file->etag);
+    memcpy(etag, file->etag, etag_len + 1);
+    if (variant != STATIC_VARIANT_IDENTITY) {
+        snprintf(etag + etag_len - 1, sizeof(etag) - etag_len + 1, "-%s\"",
+                 variant == STATIC_VARIANT_BR ? "br" : "gz");
+    }
+
+    const static_variant_t *rep = &file->variants[variant];
+    off_t start = 0, length = rep->size;
+
+    if (http_etag_matches(request, etag)) {
+        status = 304;
+        length = 0;
+    } else if (request->flags & HTTP_FLAG_HAS_RANGE) {
+        long long first = request->range_start, last = request->range_end;
+        if (first < 0) {
+            first = (last >= rep->size) ? 0 : rep->size - last;
+            last = rep->size - 1;
+        } else if (last < 0 || last >= rep->size) {
+            last = rep->size - 1;
+        }
+
+        if (first >= rep->size) {
+            char unsatisfiable[64];
+            snprintf(unsatisfiable, sizeof(unsatisfiable), "Content-Range: bytes */%lld\r\n", (long long)rep->size);
+            return build_simple_response(transfer, 416, "Range Not Satisfiable", unsatisfiable, transfer->keep_alive);
+        }
+
+        status = 206;
+        start = first;
+        length = last - first + 1;
+        snprintf(range_header, sizeof(range_header), "Content-Range: bytes %lld-%lld/%lld\r\n",
+                 first, last, (long long)rep->size);
+    }
+
+    char cache_control[80];
+    if (file->immutable) {
+        snprintf(cache_control, sizeof(cache_control), "public, max-age=%d, immutable", STATIC_IMMUTABLE_MAX_AGE);
+    } else {
+        snprintf(cache_control, sizeof(cache_control), "no-cache");
+    }
+
+    int len = snprintf(transfer->header, sizeof(transfer->header),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %lld\r\n"
+        "ETag: %s\r\n"
+        "Cache-Control: %s\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "%s%s%s"
+        "Connection: %s\r\n"
+        "\r\n",
+        status == 200 ? "200 OK" : status == 206 ? "206 Partial Content" : "304 Not Modified",
+        file->content_type,
+        (long long)(status == 304 ? 0 : length),
+        etag,
+        cache_control,
+        variant == STATIC_VARIANT_BR ? "Content-Encoding: br\r\n" :
+            variant == STATIC_VARIANT_GZIP ? "Content-Encoding: gzip\r\n" : "",
+        has_variants ? "Vary: Accept-Encoding\r\n" : "",
+        range_header,
+        transfer->keep_alive ? "keep-alive" : "close");
+    if (len <= 0 || len >= (int)sizeof(transfer->header)) {
+        return -1;
+    }
+
+    transfer->header_len = len;
+    if (!is_head && status != 304) {
+        transfer->fd = rep->fd;
+        transfer->offset = start;
+        transfer->remaining = length;
+    }
+    return 0;
+}
+
+// Push as much of the response as the socket accepts without blocking
+int static_transfer_send(int client_socket, static_transfer_t *transfer) {
+    while (transfer->header_sent < transfer->header_len) {
+        ssize_t n = send(client_socket, transfer->header + transfer->header_sent,
+                         transfer->header_len - transfer->header_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? STATIC_SEND_PENDING : STATIC_SEND_ERROR;
+        }
+        transfer->header_sent += n;
+    }
+
+    while (transfer->remaining > 0) {
+        size_t chunk = transfer->remaining < STATIC_SENDFILE_CHUNK ? transfer->remaining : STATIC_SENDFILE_CHUNK;
+        ssize_t n = sendfile(client_socket, transfer->fd, &transfer->offset, chunk);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? STATIC_SEND_PENDING : STATIC_SEND_ERROR;
+        }
+        if (n == 0) {
+            // File shrank underneath us; the promised length can't be met
+            return STATIC_SEND_ERROR;
+        }
+        transfer->remaining -= n;
+    }
+
+    return STATIC_SEND_DONE;
+}
+
+void static_transfer_reset(static_transfer_t *transfer) {
+    transfer->fd = -1;
+    transfer->offset = 0;
+    transfer->remaining = 0;
+    transfer->keep_alive = 0;
+    transfer->header_len = 0;
+    transfer->header_sent = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef STATICFILES_H
+#define STATICFILES_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "httpparser.h"
+
+// Constants
+#define STATIC_MAX_PATH_LEN 1024
+#define STATIC_HEADER_SIZE 512
+#define STATIC_ETAG_LEN 48
+#define STATIC_DEFAULT_INDEX "/display/index.html"
+#define STATIC_IMMUTABLE_MAX_AGE 31536000
+
+// Precompressed variants, in order of preference
+#define STATIC_VARIANT_IDENTITY 0
+#define STATIC_VARIANT_BR 1
+#define STATIC_VARIANT_GZIP 2
+#define STATIC_VARIANT_COUNT 3
+
+// Transfer results
+#define STATIC_SEND_ERROR -1
+#define STATIC_SEND_PENDING 0
+#define STATIC_SEND_DONE 1
+
+// One representation of a file, opened once at startup
+typedef struct {
+    int fd;
+    off_t size;
+} static_variant_t;
+
+// Index entry for a file in the frontend build directory
+typedef struct {
+    char *url_path;
+    const char *content_type;
+    time_t mtime;
+    int immutable;
+    char etag[STATIC_ETAG_LEN];
+    static_variant_t variants[STATIC_VARIANT_COUNT];
+} static_file_t;
+
+// In-flight response: header bytes first, then the file body via sendfile
+typedef struct {
+    int fd;
+    off_t offset;
+    off_t remaining;
+    int keep_alive;
+    unsigned short header_len;
+    unsigned short header_sent;
+    char header[STATIC_HEADER_SIZE];
+} static_transfer_t;
+
+// Static file serving functions
+int init_static_files(const char *root);
+void cleanup_static_files(void);
+int static_files_enabled(void);
+const static_file_t *static_files_lookup(const char *url_path);
+int static_prepare_response(const http_request_t *request, static_transfer_t *transfer);
+int static_transfer_send(int client_socket, static_transfer_t *transfer);
+void static_transfer_reset(static_transfer_t *transfer);
+
+#endif // STATICFILES_H
@@ -0,0 +1,252 @@
+// File access as the session user: one user cannot list, stat,
+// thumbnail or find by search another user's private home, through any
+// of the metadata engine's modes, and thumbnails are cached in the
+// user's own home.
+// Makes two homes owned by otherwise unused uids, so it must run as root.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <png.h>
+
+#include "../desktopsession.h"
+#include "../jsonwriter.h"
+#include "../nsscache.h"
+#include "../metaio.h"
+#include "../usercred.h"
+#include "../thumbnail.h"
+#include "../fileindex.h"
+#include "../arena.h"
+
+#define ALICE 60001
+#define BOB 60002
+#define FILES_PER_HOME 100      // Enough for every pool thread to claim some
+
+static int g_failures = 0;
+static const char *g_mode_name = "";
+
+#define CHECK(cond, what) do { \
+    if (!(cond)) { \
+        printf("FAIL %s: %s\n", g_mode_name, what); \
+        g_failures++; \
+    } \
+} while (0)
+
+static void make_cred(user_cred_t *cred, uid_t id) {
+    memset(cred, 0, sizeof(*cred));
+    cred->uid = id;
+    cred->gid = id;
+    cred->groups[0] = id;
+    cred->group_count = 1;
+}
+
+static int make_file(const char *path, uid_t owner) {
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+    int ok = write(fd, path, strlen(path)) >= 0 && fchown(fd, owner, owner) == 0;
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+static int make_home(const char *base, const char *name, uid_t owner, char *home, size_t size) {
+    char path[MAX_PATH_LEN];
+
+    snprintf(home, size, "%s/%s", base, name);
+    if (mkdir(home, 0700) != 0 || chown(home, owner, owner) != 0) return -1;
+    for (int i = 0; i < FILES_PER_HOME; i++) {
+        snprintf(path, sizeof(path), "%s/file_%03d.txt", home, i);
+        if (make_file(path, owner) != 0) return -1;
+    }
+    return 0;
+}
+
+// A small opaque PNG owned by owner
+static int make_png(const char *path, uid_t owner) {
+    unsigned char pixels[16 * 16 * 4];
+    png_image png;
+
+    memset(pixels, 0x80, sizeof(pixels));
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    png.width = png.height = 16;
+    png.format = PNG_FORMAT_RGBA;
+    if (!png_image_write_to_file(&png, path, 0, pixels, 0, NULL)) return -1;
+    return chown(path, owner, owner);
+}
+
+// 0 if the listing worked; *found says whether name appears in it
+static int list_as(const user_cred_t *cred, arena_t *arena, json_writer_t *w, const char *path,
+                   const char *name, int *found) {
+    json_writer_reset(w);
+    if (cred && user_cred_enter(cred) != 0) return -2;
+    int result = list_directory(arena, w, path);
+    if (cred) user_cred_leave();
+    arena_reset(arena);
+    *found = result == 0 && memmem(json_writer_payload(w), json_writer_payload_len(w), name, strlen(name)) != NULL;
+    return result;
+}
+
+// 0 if a thumbnail was made or loaded; *cached says which
+static int thumbnail_as(const user_cred_t *cred, const char *home, const char *path, int *cached) {
+    char cache_root[MAX_PATH_LEN];
+    const char *error = NULL;
+    thumbnail_t thumb;
+
+    if (user_cred_enter(cred) != 0) return -2;
+    thumbnail_cache_root(home, cache_root, sizeof(cache_root));
+    int result = thumbnail_get(path, THUMBNAIL_DEFAULT_SIZE, cache_root, &thumb, &error);
+    user_cred_leave();
+    if (result == 0) {
+        *cached = thumb.cached;
+        thumbnail_release(&thumb);
+    }
+    return result;
+}
+
+// Number of matches for query that cred's user is shown
+static long search_as(const user_cred_t *cred, arena_t *arena, json_writer_t *w, const char *query) {
+    const char *total;
+
+    json_writer_reset(w);
+    if (user_cred_enter(cred) != 0) return -2;
+    json_begin_object(w);
+    file_index_search(arena, w, query, 0, 0, FILE_INDEX_DEFAULT_LIMIT);
+    json_end_object(w);
+    user_cred_leave();
+    arena_reset(arena);
+    total = memmem(json_writer_payload(w), json_writer_payload_len(w), "\"total\":", 8);
+    return total ? strtol(total + 8, NULL, 10) : -1;
+}
+
+// Index base and wait for the first crawl to finish
+static int index_tree(const char *base) {
+    file_index_stats_t stats;
+    const char *roots[] = { base };
+
+    setenv("XDG_CACHE_HOME", base, 1);
+    if (init_file_index(roots, 1) != 0) return -1;
+    for (int i = 0; i < 1000; i++) {
+        file_index_get_stats(&stats);
+        if (!stats.crawling && stats.entries > 0) return 0;
+        usleep(10000);
+    }
+    return -1;
+}
+
+static int info_as(const user_cred_t *cred, json_writer_t *w, const char *path) {
+    json_writer_reset(w);
+    if (cred && user_cred_enter(cred) != 0) return -2;
+    int result = get_file_info(w, path);
+    if (cred) user_cred_leave();
+    return result;
+}
+
+int main(void) {
+    static const char *modes[] = { "serial", "threads", "uring" };
+    char base[] = "/var/tmp/vldwm-access-test-XXXXXX";
+    char alice_home[MAX_PATH_LEN], bob_home[MAX_PATH_LEN];
+    char secret[MAX_PATH_LEN + 16], link[MAX_PATH_LEN + 16], command[MAX_PATH_LEN + 16];
+    char alice_png[MAX_PATH_LEN + 16], bob_png[MAX_PATH_LEN + 16], png_link[MAX_PATH_LEN + 16];
+    char fifo[MAX_PATH_LEN + 16], cache[MAX_PATH_LEN + 32];
+    struct stat st;
+    int cached;
+    user_cred_t alice, bob;
+    json_writer_t writer;
+    arena_t arena;
+    int found;
+
+    if (geteuid() != 0) {
+        printf("access_test: skipped, needs root to switch users\n");
+        return 0;
+    }
+    if (!mkdtemp(base) || chmod(base, 0755) != 0 ||
+        make_home(base, "alice", ALICE, alice_home, sizeof(alice_home)) != 0 ||
+        make_home(base, "bob", BOB, bob_home, sizeof(bob_home)) != 0) {
+        perror("setup");
+        return 1;
+    }
+    // As many links into bob's home as files, so every pool thread and
+    // ring slot resolves some of them
+    snprintf(secret, sizeof(secret), "%s/secret.txt", bob_home);
+    if (make_file(secret, BOB) != 0) {
+        perror("setup");
+        return 1;
+    }
+    for (int i = 0; i < FILES_PER_HOME; i++) {
+        snprintf(link, sizeof(link), "%s/to_bob_%03d", alice_home, i);
+        if (symlink(secret, link) != 0 || lchown(link, ALICE, ALICE) != 0) {
+            perror("setup");
+            return 1;
+        }
+    }
+
+    snprintf(alice_png, sizeof(alice_png), "%s/photo.png", alice_home);
+    snprintf(bob_png, sizeof(bob_png), "%s/photo.png", bob_home);
+    snprintf(png_link, sizeof(png_link), "%s/link.png", alice_home);
+    snprintf(fifo, sizeof(fifo), "%s/fifo.png", alice_home);
+    if (make_png(alice_png, ALICE) != 0 || make_png(bob_png, BOB) != 0 || symlink(alice_png, png_link) != 0 ||
+        mkfifo(fifo, 0600) != 0 || chown(fifo, ALICE, ALICE) != 0) {
+        perror("setup");
+        return 1;
+    }
+
+    make_cred(&alice, ALICE);
+    make_cred(&bob, BOB);
+    init_nss_cache();
+    arena_init(&arena, ARENA_DEFAULT_SIZE);
+    json_writer_init(&writer, 0);
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        g_mode_name = modes[m];
+        metaio_set_mode(modes[m]);
+        if (init_metaio() != 0) return 1;
+
+        CHECK(list_as(&alice, &arena, &writer, bob_home, "secret.txt", &found) == -1,
+              "alice lists bob's 0700 home");
+        CHECK(info_as(&alice, &writer, secret) == -1, "alice stats a file in bob's home");
+        CHECK(list_as(&alice, &arena, &writer, alice_home, "file_000.txt", &found) == 0 && found,
+              "alice cannot list her own home");
+        CHECK(list_as(&alice, &arena, &writer, alice_home, "to_bob_", &found) == 0 && !found,
+              "alice's listing follows links into bob's home");
+        CHECK(list_as(&bob, &arena, &writer, bob_home, "secret.txt", &found) == 0 && found,
+              "bob cannot list his own home");
+        CHECK(user_cred_current() == NULL, "credentials still in effect after leaving");
+        CHECK(list_as(NULL, &arena, &writer, bob_home, "secret.txt", &found) == 0 && found,
+              "root's access not restored");
+
+        cleanup_metaio();
+    }
+
+    g_mode_name = "thumbnails";
+    init_thumbnails();
+    CHECK(thumbnail_as(&alice, alice_home, bob_png, &cached) != 0, "alice thumbnails an image in bob's home");
+    CHECK(thumbnail_as(&alice, alice_home, alice_png, &cached) == 0 && !cached, "alice cannot thumbnail her image");
+    CHECK(thumbnail_as(&alice, alice_home, alice_png, &cached) == 0 && cached, "alice's thumbnail was not cached");
+    snprintf(cache, sizeof(cache), "%s/.cache/thumbnails/normal", alice_home);
+    CHECK(stat(cache, &st) == 0 && st.st_uid == ALICE, "alice's cache directory is not hers");
+    CHECK(thumbnail_as(&alice, alice_home, png_link, &cached) != 0, "a symlink was followed");
+    CHECK(thumbnail_as(&alice, alice_home, fifo, &cached) != 0, "a FIFO was opened as an image");
+    cleanup_thumbnails();
+
+    g_mode_name = "search";
+    if (index_tree(base) != 0) {
+        printf("FAIL search: the index did not finish\n");
+        return 1;
+    }
+    CHECK(search_as(&alice, &arena, &writer, "secret") == 0, "alice finds a file in bob's home");
+    CHECK(search_as(&bob, &arena, &writer, "secret") == 1, "bob cannot find his own file");
+    CHECK(search_as(&alice, &arena, &writer, "photo.png") == 1, "alice is not shown just her own photo");
+    CHECK(search_as(&alice, &arena, &writer, "to_bob_") == FILES_PER_HOME, "alice cannot find her own links");
+    cleanup_file_index();
+
+    json_writer_free(&writer);
+    arena_free(&arena);
+    cleanup_nss_cache();
+    snprintf(command, sizeof(command), "rm -rf '%s'", base);
+    if (system(command) != 0) fprintf(stderr, "could not remove %s\n", base);
+
+    printf("access_test: %s\n", g_failures ? "FAILED" : "ok");
+    return g_failures ? 1 : 0;
+}
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <jpeglib.h>
+#include <png.h>
+#include <openssl/evp.h>
+
+#include "thumbnail.h"
+#include "imagescale.h"
+#include "bufpool.h"
+
+// Sizes and directory names from the freedesktop thumbnail spec
+static const struct {
+    int size;
+    const char *dir;
+} g_sizes[] = {
+    { 128, "normal" },
+    { 256, "large" },
+    { 512, "x-large" },
+    { 1024, "xx-large" },
+};
+
+#define SIZE_COUNT (int)(sizeof(g_sizes) / sizeof(g_sizes[0]))
+
+static const unsigned char png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+typedef struct {
+    unsigned char *pixels;      // RGBA, malloc'd
+    int width;
+    int height;
+} image_t;
+
+static int make_dir(const char *path) {
+    return mkdir(path, 0700) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+int init_thumbnails(void) {
+    printf("🖼️ Initializing thumbnail service...\n");
+    return 0;
+}
+
+// Each user's thumbnails go to their own ~/.cache/thumbnails, the
+// spec's default; the daemon cannot see a user's $XDG_CACHE_HOME. Made
+// with that user's credentials, so the directories are theirs.
+int thumbnail_cache_root(const char *home, char *root, size_t size) {
+    char path[PATH_MAX];
+
+    root[0] = '\0';
+    if (!home || home[0] != '/') return -1;
+    if ((size_t)snprintf(path, sizeof(path), "%s/.cache", home) >= sizeof(path) || make_dir(path) != 0) return -1;
+    if ((size_t)snprintf(root, size, "%s/thumbnails", path) >= size - 32 || make_dir(root) != 0) {
+        root[0] = '\0';
+        return -1;
+    }
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", root, g_sizes[i].dir) < sizeof(path)) {
+            make_dir(path);
+        }
+    }
+    return 0;
+}
+
+void cleanup_thumbnails(void) {
+    printf("🖼️ Cleaning up thumbnail service...\n");
+}
+
+// The spec's sizes: the smallest one at least as large as requested
+int thumbnail_size_for(int requested) {
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        if (requested <= g_sizes[i].size) return g_sizes[i].size;
+    }
+    return g_sizes[SIZE_COUNT - 1].size;
+}
+
+static const char *size_dir(int size) {
+    for (int i = 0; i < SIZE_COUNT; i++) {
+        if (size == g_sizes[i].size) return g_sizes[i].dir;
+    }
+    return g_sizes[0].dir;
+}
+
+// file:// URI with everything outside the unreserved set escaped
+static int file_uri(const char *path, char *uri, size_t size) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t n = snprintf(uri, size, "file://");
+
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        if (n + 4 > size) return -1;
+        if ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') ||
+            strchr("-_.~/", *p)) {
+            uri[n++] = *p;
+        } else {
+            uri[n++] = '%';
+            uri[n++] = hex[*p >> 4];
+            uri[n++] = hex[*p & 15];
+        }
+    }
+    uri[n] = '\0';
+    return 0;
+}
+
+// Cache file name: MD5 of the URI in hex
+static int cache_path(const char *cache_root, const char *uri, int size, char *path, size_t path_size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    char name[2 * EVP_MAX_MD_SIZE + 1];
+
+    if (!cache_root || !cache_root[0] || !EVP_Digest(uri, strlen(uri), digest, &digest_len, EVP_md5(), NULL)) return -1;
+    for (unsigned int i = 0; i < digest_len; i++) {
+        snprintf(name + i * 2, 3, "%02x", digest[i]);
+    }
+    return (size_t)snprintf(path, path_size, "%s/%s/%s.png", cache_root, size_dir(size), name) < path_size ? 0 : -1;
+}
+
+static uint32_t read_be32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int text_chunk_is(const unsigned char *data, uint32_t len, const char *key, const char *value) {
+    size_t key_len = strlen(key), value_len = strlen(value);
+    return len == key_len + 1 + value_len && memcmp(data, key, key_len) == 0 && data[key_len] == '\0' &&
+           memcmp(data + key_len + 1, value, value_len) == 0;
+}
+
+// A cached thumbnail is valid when its Thumb::URI and Thumb::MTime text
+// chunks match the file. The chunks are checked without decoding the
+// image.
+static int load_cached(const char *path, const char *uri, const char *mtime, thumbnail_t *thumb) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    int uri_ok = 0, mtime_ok = 0;
+
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || st.st_size < 8 || st.st_size > THUMBNAIL_MAX_CACHED_FILE) {
+        close(fd);
+        return -1;
+    }
+
+    thumb->png = bufpool_get(st.st_size, &thumb->cap);
+    ssize_t got = thumb->png ? read(fd, thumb->png, st.st_size) : -1;
+    close(fd);
+    if (got != st.st_size || memcmp(thumb->png, png_signature, 8) != 0) {
+        thumbnail_release(thumb);
+        return -1;
+    }
+    thumb->len = got;
+
+    for (size_t offset = 8; offset + 12 <= thumb->len;) {
+        const unsigned char *chunk = thumb->png + offset;
+        uint32_t len = read_be32(chunk);
+        if (len > thumb->len - offset - 12) break;
+        if (memcmp(chunk + 4, "IHDR", 4) == 0 && len >= 8) {
+            thumb->width = read_be32(chunk + 8);
+            thumb->height = read_be32(chunk + 12);
+        } else if (memcmp(chunk + 4, "tEXt", 4) == 0) {
+            uri_ok |= text_chunk_is(chunk + 8, len, "Thumb::URI", uri);
+            mtime_ok |= text_chunk_is(chunk + 8, len, "Thumb::MTime", mtime);
+        } else if (memcmp(chunk + 4, "IEND", 4) == 0) {
+            break;
+        }
+        offset += 12 + len;
+    }
+
+    if (!uri_ok || !mtime_ok || thumb->width <= 0 || thumb->height <= 0) {
+        thumbnail_release(thumb);
+        return -1;
+    }
+    thumb->cached = 1;
+    return 0;
+}
+
+// libjpeg reports errors by calling error_exit, which must not return
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf jump;
+} jpeg_error_t;
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    longjmp(((jpeg_error_t *)cinfo->err)->jump, 1);
+}
+
+static void jpeg_quiet(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+// Decode at the smallest of 1/8, 1/4, 1/2 or full scale that still
+// covers the thumbnail, so large photos are never decoded in full
+static int decode_jpeg(FILE *file, int size, image_t *image, const char **error) {
+    struct jpeg_decompress_struct cinfo;
+    jpeg_error_t jerr;
+    unsigned char *volatile pixels = NULL;
+    JSAMPLE *volatile line = NULL;
+
+    cinfo.err = jpeg_std_error(&jerr.base);
+    jerr.base.error_exit = jpeg_error_exit;
+    jerr.base.output_message = jpeg_quiet;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(pixels);
+        free(line);
+        *error = "Cannot decode JPEG";
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+
+    unsigned int longest = cinfo.image_width > cinfo.image_height ? cinfo.image_width : cinfo.image_height;
+    unsigned int denom = 8;
+    while (denom > 1 && longest / denom < (unsigned int)size) denom /= 2;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_calc_output_dimensions(&cinfo);
+
+    if ((size_t)cinfo.output_width * cinfo.output_height > THUMBNAIL_MAX_PIXELS) {
+        jpeg_destroy_decompress(&cinfo);
+        *error = "Image too large";
+        return -1;
+    }
+
+    jpeg_start_decompress(&cinfo);
+    pixels = malloc((size_t)cinfo.output_width * cinfo.output_height * 4);
+    line = malloc((size_t)cinfo.output_width * cinfo.output_components);
+    if (!pixels || !line) longjmp(jerr.jump, 1);
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        unsigned char *out = pixels + (size_t)cinfo.output_scanline * cinfo.output_width * 4;
+        JSAMPROW row = line;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+        for (unsigned int x = 0; x < cinfo.output_width; x++) {
+            out[x * 4] = line[x * 3];
+            out[x * 4 + 1] = line[x * 3 + 1];
+            out[x * 4 + 2] = line[x * 3 + 2];
+            out[x * 4 + 3] = 255;
+        }
+    }
+    jpeg_finish_decompress(&cinfo);
+
+    image->pixels = pixels;
+    image->width = cinfo.output_width;
+    image->height = cinfo.output_height;
+    jpeg_destroy_decompress(&cinfo);
+    free(line);
+    return 0;
+}
+
+// PNG has no scaled decode; libpng's simplified API converts any colour
+// type and bit depth to RGBA
+static int decode_png(FILE *file, image_t *image, const char **error) {
+    png_image png;
+
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_stdio(&png, file)) {
+        *error = "Cannot decode PNG";
+        return -1;
+    }
+    if ((size_t)png.width * png.height > THUMBNAIL_MAX_PIXELS) {
+        png_image_free(&png);
+        *error = "Image too large";
+        return -1;
+    }
+
+    png.format = PNG_FORMAT_RGBA;
+    image->pixels = malloc(PNG_IMAGE_SIZE(png));
+    if (!image->pixels || !png_image_finish_read(&png, NULL, image->pixels, 0, NULL)) {
+        png_image_free(&png);
+        free(image->pixels);
+        image->pixels = NULL;
+        *error = "Cannot decode PNG";
+        return -1;
+    }
+    image->width = png.width;
+    image->height = png.height;
+    return 0;
+}
+
+// Takes over fd, an open regular file
+static int decode_image(int fd, int size, image_t *image, const char **error) {
+    unsigned char magic[8];
+    FILE *file = fdopen(fd, "rb");
+    int result = -1;
+
+    if (!file) {
+        close(fd);
+        *error = "Out of memory";
+        return -1;
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)) {
+        *error = "Unsupported image";
+    } else if (magic[0] == 0xff && magic[1] == 0xd8 && magic[2] == 0xff) {
+        rewind(file);
+        result = decode_jpeg(file, size, image, error);
+    } else if (memcmp(magic, png_signature, 8) == 0) {
+        rewind(file);
+        result = decode_png(file, image, error);
+    } else {
+        *error = "Unsupported image";
+    }
+    fclose(file);
+    return result;
+}
+
+static void png_write_buffer(png_structp png, png_bytep data, png_size_t len) {
+    thumbnail_t *thumb = png_get_io_ptr(png);
+    unsigned char *grown = bufpool_grow(thumb->png, thumb->len, &thumb->cap, thumb->len + len);
+    if (!grown) png_error(png, "out of memory");
+    thumb->png = grown;
+    memcpy(thumb->png + thumb->len, data, len);
+    thumb->len += len;
+}
+
+static void png_flush_buffer(png_structp png) {
+    (void)png;
+}
+
+// Encode with the spec's metadata so the cache entry can be validated
+static int encode_png(const image_t *image, const char *uri, const char *mtime, thumbnail_t *thumb) {
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    png_text text[3];
+
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        thumbnail_release(thumb);
+        return -1;
+    }
+
+    png_set_write_fn(png, thumb, png_write_buffer, png_flush_buffer);
+    png_set_compression_level(png, THUMBNAIL_PNG_LEVEL);
+    png_set_IHDR(png, info, image->width, image->height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    memset(text, 0, sizeof(text));
+    text[0].compression = text[1].compression = text[2].compression = PNG_TEXT_COMPRESSION_NONE;
+    text[0].key = "Thumb::URI";
+    text[0].text = (char *)uri;
+    text[1].key = "Thumb::MTime";
+    text[1].text = (char *)mtime;
+    text[2].key = "Software";
+    text[2].text = "vldwmapi";
+    png_set_text(png, info, text, 3);
+
+    png_write_info(png, info);
+    for (int y = 0; y < image->height; y++) {
+        png_write_row(png, image->pixels + (size_t)y * image->width * 4);
+    }
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+
+    thumb->width = image->width;
+    thumb->height = image->height;
+    return 0;
+}
+
+// Written under a temporary name and renamed, so readers never see a
+// partial file
+static void store_cached(const char *path, const thumbnail_t *thumb) {
+    char tmp[PATH_MAX + 72];
+    if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp)) return;
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) return;
+    int ok = fchmod(fd, 0600) == 0 && write(fd, thumb->png, thumb->len) == (ssize_t)thumb->len;
+    if (close(fd) != 0) ok = 0;
+    if (!ok || rename(tmp, path) != 0) unlink(tmp);
+}
+
+// The path is opened once, without following a final symlink, and the
+// checks and the decode all use that descriptor, so the file cannot be
+// swapped in between. O_NONBLOCK keeps a FIFO from stalling the worker
+// before fstat() turns it away.
+static int open_image(const char *path, struct stat *st, const char **error) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, st) != 0 || !S_ISREG(st->st_mode) || fcntl(fd, F_SETFL, 0) != 0) {
+        if (fd >= 0) close(fd);
+        *error = "Cannot access path";
+        return -1;
+    }
+    return fd;
+}
+
+// Thumbnail of an image file fitting size x size, from the cache under
+// cache_root (none if NULL) when it is still valid for the file's mtime.
+// The file is read with the calling thread's credentials.
+int thumbnail_get(const char *path, int size, const char *cache_root, thumbnail_t *thumb, const char **error) {
+    char uri[3 * PATH_MAX + 8];
+    char cached[PATH_MAX + 64];
+    char mtime[24];
+    struct stat st;
+    image_t image = { NULL, 0, 0 };
+
+    memset(thumb, 0, sizeof(*thumb));
+    size = thumbnail_size_for(size);
+
+    if (!path || path[0] != '/' || file_uri(path, uri, sizeof(uri)) != 0) {
+        *error = "Invalid path";
+        return -1;
+    }
+    int fd = open_image(path, &st, error);
+    if (fd < 0) return -1;
+    snprintf(mtime, sizeof(mtime), "%lld", (long long)st.st_mtime);
+
+    int have_cache = cache_path(cache_root, uri, size, cached, sizeof(cached)) == 0;
+    if (have_cache && load_cached(cached, uri, mtime, thumb) == 0) {
+        close(fd);
+        return 0;
+    }
+
+    if (decode_image(fd, size, &image, error) != 0) return -1;
+
+    int width, height;
+    image_fit(image.width, image.height, size, &width, &height);
+    if (width != image.width || height != image.height) {
+        unsigned char *scaled = malloc((size_t)width * height * 4);
+        if (!scaled || image_scale_rgba(image.pixels, image.width, image.height, (size_t)image.width * 4,
+                                        scaled, width, height) != 0) {
+            free(scaled);
+            free(image.pixels);
+            *error = "Out of memory";
+            return -1;
+        }
+        free(image.pixels);
+        image.pixels = scaled;
+        image.width = width;
+        image.height = height;
+    }
+
+    int result = encode_png(&image, uri, mtime, thumb);
+    free(image.pixels);
+    if (result != 0) {
+        *error = "Cannot encode thumbnail";
+        return -1;
+    }
+    if (have_cache) store_cached(cached, thumb);
+    return 0;
+}
+
+void thumbnail_release(thumbnail_t *thumb) {
+    bufpool_put(thumb->png, thumb->cap);
+    thumb->png = NULL;
+    thumb->len = thumb->cap = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <stddef.h>
+
+// Constants
+#define THUMBNAIL_DEFAULT_SIZE 128
+#define THUMBNAIL_MAX_PIXELS (64 * 1024 * 1024)        // Larger decoded images are refused
+#define THUMBNAIL_MAX_CACHED_FILE (8 * 1024 * 1024)
+#define THUMBNAIL_PNG_LEVEL 3                           // Favour encode speed; results are cached
+
+// A thumbnail as PNG bytes (pooled buffer)
+typedef struct {
+    unsigned char *png;
+    size_t len;
+    size_t cap;
+    int width;
+    int height;
+    int cached;                 // Served from the on-disk cache
+} thumbnail_t;
+
+// Thumbnail functions. thumbnail_get() is safe to call from several
+// worker threads at once; it opens files and the cache with the calling
+// thread's credentials (see usercred.h).
+int init_thumbnails(void);
+void cleanup_thumbnails(void);
+int thumbnail_size_for(int requested);
+int thumbnail_cache_root(const char *home, char *root, size_t size);
+int thumbnail_get(const char *path, int size, const char *cache_root, thumbnail_t *thumb, const char **error);
+void thumbnail_release(thumbnail_t *thumb);
+
+#endif // THUMBNAIL_H
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+// Spans of one thread. Only the owning thread writes; head is published
+// with release order after each event, so a reader on another thread
+// sees whole events except ones overwritten while it reads. Clearing
+// moves cleared up to head rather than touching head itself.
+typedef struct {
+    uint64_t head;
+    uint64_t cleared;                   // Events before this were dropped
+    pid_t tid;
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+int g_trace_enabled = 0;
+
+static trace_ring_t *g_rings[TRACE_MAX_THREADS];
+static int g_ring_count = 0;
+static uint64_t g_next_request = 0;
+
+// Reference point for turning ticks into microseconds at dump time
+static uint64_t g_ref_ticks = 0;
+static uint64_t g_ref_ns = 0;
+
+static __thread trace_ring_t *t_ring = NULL;
+static __thread int t_ring_unavailable = 0;
+static __thread uint64_t t_request = 0;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Rings are allocated the first time a thread records with tracing on
+static trace_ring_t *get_ring(void) {
+    if (t_ring || t_ring_unavailable) return t_ring;
+
+    int index = __atomic_fetch_add(&g_ring_count, 1, __ATOMIC_RELAXED);
+    trace_ring_t *ring = index < TRACE_MAX_THREADS ? calloc(1, sizeof(trace_ring_t)) : NULL;
+    if (!ring) {
+        t_ring_unavailable = 1;
+        return NULL;
+    }
+    ring->tid = (pid_t)syscall(SYS_gettid);
+    __atomic_store_n(&g_rings[index], ring, __ATOMIC_RELEASE);
+    t_ring = ring;
+    return ring;
+}
+
+void trace_record(const char *name, uint64_t start, int64_t arg) {
+    trace_ring_t *ring = get_ring();
+    if (!ring) return;
+
+    uint64_t head = ring->head;
+    trace_event_t *event = &ring->events[head & TRACE_RING_MASK];
+    event->start = start;
+    event->end = trace_now();
+    event->name = name;
+    event->request = t_request;
+    event->arg = arg;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int init_tracing(void) {
+    printf("🔍 Initializing request tracing (off; SIGUSR1 toggles, SIGUSR2 dumps)...\n");
+    g_ref_ticks = trace_now();
+    g_ref_ns = monotonic_ns();
+    return 0;
+}
+
+void cleanup_tracing(void) {
+    printf("🔍 Cleaning up request tracing...\n");
+    __atomic_store_n(&g_trace_enabled, 0, __ATOMIC_RELAXED);
+    // Rings stay allocated: other threads may still hold theirs
+}
+
+// Async-signal-safe, so a signal handler may flip it
+void trace_set_enabled(int enabled) {
+    __atomic_store_n(&g_trace_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+// Spans recorded on this thread from now on belong to a new request
+uint64_t trace_next_request(void) {
+    t_request = __atomic_add_fetch(&g_next_request, 1, __ATOMIC_RELAXED);
+    return t_request;
+}
+
+void trace_set_request(uint64_t request) {
+    t_request = request;
+}
+
+// Lets work handed to another thread keep tracing as the same request
+uint64_t trace_current_request(void) {
+    return t_request;
+}
+
+// Stop tracing and drop everything recorded so far. Spans already open
+// on other threads may still land after the mark; head stays theirs.
+void trace_clear(void) {
+    trace_set_enabled(0);
+    int count = __atomic_load_n(&g_ring_count, __ATOMIC_RELAXED);
+    for (int i = 0; i < count && i < TRACE_MAX_THREADS; i++) {
+        trace_ring_t *ring = __atomic_load_n(&g_rings[i], __ATOMIC_ACQUIRE);
+        if (ring) __atomic_store_n(&ring->cleared, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    }
+}
+
+// Chrome trace-event JSON ("X" complete events), loadable in
+// chrome://tracing and Perfetto. Timestamps are microseconds since the
+// daemon started.
+void trace_write_json(json_writer_t *w) {
+    uint64_t now_ticks = trace_now();
+    uint64_t now_ns = monotonic_ns();
+    double ticks_per_us = now_ns > g_ref_ns ? (double)(now_ticks - g_ref_ticks) / ((now_ns - g_ref_ns) / 1e3) : 1e3;
+    int pid = getpid();
+    int count = __atomic_load_n(&g_ring_count, __ATOMIC_RELAXED);
+
+    if (ticks_per_us <= 0) ticks_per_us = 1e3;
+
+    json_begin_object(w);
+    json_field_string(w, "displayTimeUnit", "ns");
+    json_key(w, "traceEvents");
+    json_begin_array(w);
+
+    json_begin_object(w);
+    json_field_string(w, "name", "process_name");
+    json_field_string(w, "ph", "M");
+    json_field_int(w, "pid", pid);
+    json_key(w, "args");
+    json_begin_object(w);
+    json_field_string(w, "name", "vldwmapi");
+    json_end_object(w);
+    json_end_object(w);
+
+    for (int i = 0; i < count && i < TRACE_MAX_THREADS; i++) {
+        trace_ring_t *ring = __atomic_load_n(&g_rings[i], __ATOMIC_ACQUIRE);
+        if (!ring) continue;
+
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t cleared = __atomic_load_n(&ring->cleared, __ATOMIC_ACQUIRE);
+        uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        if (first < cleared) first = cleared;
+
+        for (uint64_t n = first; n < head; n++) {
+            const trace_event_t *event = &ring->events[n & TRACE_RING_MASK];
+            if (event->start < g_ref_ticks || event->end < event->start) continue;
+
+            json_begin_object(w);
+            json_field_string(w, "name", event->name);
+            json_field_string(w, "cat", "vldwmapi");
+            json_field_string(w, "ph", "X");
+            json_key(w, "ts");
+            json_write_fixed(w, (event->start - g_ref_ticks) / ticks_per_us, 3);
+            json_key(w, "dur");
+            json_write_fixed(w, (event->end - event->start) / ticks_per_us, 3);
+            json_field_int(w, "pid", pid);
+            json_field_int(w, "tid", ring->tid);
+            json_key(w, "args");
+            json_begin_object(w);
+            json_field_uint(w, "request", event->request);
+            json_field_int(w, "arg", event->arg);
+            json_end_object(w);
+            json_end_object(w);
+        }
+    }
+
+    json_end_array(w);
+    json_end_object(w);
+}
+
+// TRACE_DUMP_DIR, made if missing; refused unless it is a real
+// directory that only the daemon's user can write to
+static int open_dump_dir(void) {
+    struct stat st;
+
+    if (mkdir(TRACE_DUMP_DIR, 0700) != 0 && errno != EEXIST) return -1;
+    int fd = open(TRACE_DUMP_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || st.st_uid != geteuid() || (st.st_mode & 022)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Written to TRACE_DUMP_PATH, never through a symlink someone else
+// left there
+int trace_dump_file(void) {
+    const char *name = strrchr(TRACE_DUMP_PATH, '/') + 1;
+    json_writer_t w;
+    int result = -1;
+
+    json_writer_init(&w, 0);
+    trace_write_json(&w);
+    int dir = w.error ? -1 : open_dump_dir();
+    int fd = dir >= 0 ? openat(dir, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600) : -1;
+    if (fd >= 0) {
+        const char *data = json_writer_payload(&w);
+        size_t len = json_writer_payload_len(&w), done = 0;
+        while (done < len) {
+            ssize_t n = write(fd, data + done, len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        result = done == len ? 0 : -1;
+        if (close(fd) != 0) result = -1;
+    }
+    if (dir >= 0) close(dir);
+    json_writer_free(&w);
+
+    if (result == 0) printf("🔍 Trace written to %s\n", TRACE_DUMP_PATH);
+    else fprintf(stderr, "❌ Failed to write trace to %s\n", TRACE_DUMP_PATH);
+    return result;
+}
@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "jsonwriter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Constants
+#define TRACE_RING_SIZE 16384           // Spans kept per thread (power of two)
+#define TRACE_MAX_THREADS 16
+#define TRACE_DUMP_DIR "/run/vldwmapi"          // Private to the daemon's user
+#define TRACE_DUMP_PATH TRACE_DUMP_DIR "/trace.json"
+
+// One completed span. Names are string literals, so only the pointer
+// is stored.
+typedef struct {
+    uint64_t start;                     // Timestamp counter ticks
+    uint64_t end;
+    const char *name;
+    uint64_t request;                   // Request the span belongs to, 0 if none
+    int64_t arg;                        // Span-specific value (bytes, entries, result)
+} trace_event_t;
+
+extern int g_trace_enabled;
+
+// Raw timestamp: the TSC where there is one, converted to wall time
+// only when the buffers are dumped
+static inline uint64_t trace_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// Start a span; 0 while tracing is off, so a disabled span costs one
+// load and a branch
+static inline uint64_t trace_begin(void) {
+    return __atomic_load_n(&g_trace_enabled, __ATOMIC_RELAXED) ? trace_now() : 0;
+}
+
+void trace_record(const char *name, uint64_t start, int64_t arg);
+
+// Close a span opened with trace_begin()
+static inline void trace_end(const char *name, uint64_t start, int64_t arg) {
+    if (start) trace_record(name, start, arg);
+}
+
+// Tracing functions
+int init_tracing(void);
+void cleanup_tracing(void);
+void trace_set_enabled(int enabled);
+uint64_t trace_next_request(void);
+void trace_set_request(uint64_t request);
+uint64_t trace_current_request(void);
+void trace_write_json(json_writer_t *w);
+int trace_dump_file(void);
+void trace_clear(void);
+
+#endif // TRACE_H
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "upgrade.h"
+
+#define MSG_READY 'R'
+#define MSG_ACCEPTED 'A'
+#define MSG_REFUSED 'N'
+#define FDS_PER_MESSAGE 64
+
+extern char **environ;
+
+// First message of a handoff; descriptors and state bytes follow
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t fd_count;
+    uint64_t len;
+} handoff_header_t;
+
+static const char handoff_magic[8] = { 'V', 'L', 'D', 'W', 'M', 'U', 'P', 'G' };
+
+static int g_handoff_fd = -1;
+static pid_t g_new_pid = -1;
+
+void upgrade_put(upgrade_buf_t *buf, const void *data, size_t len) {
+    if (buf->error) return;
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) cap *= 2;
+        char *grown = realloc(buf->data, cap);
+        if (!grown) {
+            buf->error = 1;
+            return;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+int upgrade_get(upgrade_reader_t *reader, void *data, size_t len) {
+    if (reader->error || reader->len - reader->pos < len) {
+        reader->error = 1;
+        memset(data, 0, len);
+        return -1;
+    }
+    memcpy(data, reader->data + reader->pos, len);
+    reader->pos += len;
+    return 0;
+}
+
+void upgrade_buf_free(upgrade_buf_t *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+// Wait for one message; 1 byte replies carry the protocol codes
+static ssize_t recv_timeout(int fd, void *data, size_t len, int timeout_ms) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int ready;
+
+    do {
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0) {
+        errno = ready == 0 ? ETIMEDOUT : errno;
+        return -1;
+    }
+    return recv(fd, data, len, 0);
+}
+
+// The new binary is started like the launch helper: posix_spawn, with
+// its end of a socket pair on a fixed descriptor
+int upgrade_start(const char *exe, char *const argv[]) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+    int sv[2];
+
+    if (g_handoff_fd >= 0) return -1;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+        perror("socketpair");
+        return -1;
+    }
+    if (sv[1] == UPGRADE_TAKEOVER_FD) {
+        int moved = fcntl(sv[1], F_DUPFD_CLOEXEC, UPGRADE_TAKEOVER_FD + 1);
+        close(sv[1]);
+        sv[1] = moved;
+    }
+
+    // SIGCHLD is blocked in the daemon for the launcher's signalfd
+    sigemptyset(&none);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], UPGRADE_TAKEOVER_FD);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    int err = sv[1] >= 0 ? posix_spawn(&g_new_pid, exe, &actions, &attr, argv, environ) : errno;
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (sv[1] >= 0) close(sv[1]);
+    if (err != 0) {
+        fprintf(stderr, "❌ Could not start %s: %s\n", exe, strerror(err));
+        close(sv[0]);
+        g_new_pid = -1;
+        return -1;
+    }
+
+    g_handoff_fd = sv[0];
+    fcntl(g_handoff_fd, F_SETFL, fcntl(g_handoff_fd, F_GETFL) | O_NONBLOCK);
+    printf("♻️ Started %s as pid %d; waiting for it to initialize\n", exe, g_new_pid);
+    return 0;
+}
+
+int upgrade_fd(void) {
+    return g_handoff_fd;
+}
+
+// After the handoff fd turned readable: 1 once the new binary is ready,
+// 0 to keep waiting, -1 if it failed (the upgrade is then abandoned)
+int upgrade_poll_ready(void) {
+    char code;
+    ssize_t n = recv(g_handoff_fd, &code, 1, MSG_DONTWAIT);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    if (n == 1 && code == MSG_READY) return 1;
+    printf("⚠️ New binary failed before taking over\n");
+    upgrade_abort();
+    return -1;
+}
+
+static int send_all_messages(int fd, const upgrade_buf_t *state, const int *fds, int fd_count) {
+    handoff_header_t header;
+    char cmsg_buf[CMSG_SPACE(FDS_PER_MESSAGE * sizeof(int))];
+
+    memcpy(header.magic, handoff_magic, sizeof(header.magic));
+    header.version = UPGRADE_VERSION;
+    header.fd_count = (uint32_t)fd_count;
+    header.len = state->len;
+    if (send(fd, &header, sizeof(header), MSG_NOSIGNAL) != (ssize_t)sizeof(header)) return -1;
+
+    // Descriptors in groups, each riding on a one-byte message
+    for (int sent = 0; sent < fd_count; sent += FDS_PER_MESSAGE) {
+        int count = fd_count - sent < FDS_PER_MESSAGE ? fd_count - sent : FDS_PER_MESSAGE;
+        char byte = 0;
+        struct iovec iov = { &byte, 1 };
+        struct msghdr msg;
+
+        memset(&msg, 0, sizeof(msg));
+        memset(cmsg_buf, 0, sizeof(cmsg_buf));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds + sent, count * sizeof(int));
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL) != 1) return -1;
+    }
+
+    for (size_t off = 0; off < state->len; off += UPGRADE_CHUNK) {
+        size_t len = state->len - off < UPGRADE_CHUNK ? state->len - off : UPGRADE_CHUNK;
+        if (send(fd, state->data + off, len, MSG_NOSIGNAL) != (ssize_t)len) return -1;
+    }
+    return 0;
+}
+
+// Hand everything over and wait for the verdict. 0 means the new binary
+// owns the connections now and this process should exit without
+// touching them; otherwise carry on as before.
+int upgrade_send_state(const upgrade_buf_t *state, const int *fds, int fd_count) {
+    char code = 0;
+
+    if (g_handoff_fd < 0 || state->error || fd_count > UPGRADE_MAX_FDS) return -1;
+    fcntl(g_handoff_fd, F_SETFL, fcntl(g_handoff_fd, F_GETFL) & ~O_NONBLOCK);
+
+    if (send_all_messages(g_handoff_fd, state, fds, fd_count) != 0 ||
+        recv_timeout(g_handoff_fd, &code, 1, UPGRADE_ACK_TIMEOUT_MS) != 1 || code != MSG_ACCEPTED) {
+        printf("⚠️ New binary did not take over (%s)\n", code == MSG_REFUSED ? "state refused" : strerror(errno));
+        upgrade_abort();
+        return -1;
+    }
+    close(g_handoff_fd);
+    g_handoff_fd = -1;
+    printf("♻️ Handed %d descriptors and %zu bytes of state to pid %d\n", fd_count, state->len, g_new_pid);
+    return 0;
+}
+
+// Stop a new binary that never took over. Once it has exited the
+// launcher's reaping of known pids leaves it alone, so wait for it here.
+void upgrade_abort(void) {
+    if (g_handoff_fd >= 0) close(g_handoff_fd);
+    g_handoff_fd = -1;
+    if (g_new_pid > 0) {
+        kill(g_new_pid, SIGTERM);
+        waitpid(g_new_pid, NULL, 0);
+    }
+    g_new_pid = -1;
+}
+
+int upgrade_signal_ready(int fd) {
+    char code = MSG_READY;
+    return send(fd, &code, 1, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
+
+int upgrade_receive_state(int fd, upgrade_buf_t *state, int *fds, int max_fds, int *fd_count) {
+    char cmsg_buf[CMSG_SPACE(FDS_PER_MESSAGE * sizeof(int))];
+    handoff_header_t header;
+
+    memset(state, 0, sizeof(*state));
+    *fd_count = 0;
+    if (recv_timeout(fd, &header, sizeof(header), UPGRADE_READY_TIMEOUT_MS) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, handoff_magic, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "❌ No handoff from the running daemon\n");
+        return -1;
+    }
+    if (header.version != UPGRADE_VERSION || header.fd_count > (uint32_t)max_fds) {
+        fprintf(stderr, "❌ Handoff version %u with %u descriptors is not supported\n",
+                header.version, header.fd_count);
+        return -1;
+    }
+
+    while (*fd_count < (int)header.fd_count) {
+        char byte;
+        struct iovec iov = { &byte, 1 };
+        struct msghdr msg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof(cmsg_buf);
+        if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != 1) return -1;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            if (*fd_count + count > (int)header.fd_count) return -1;
+            memcpy(fds + *fd_count, CMSG_DATA(cmsg), count * sizeof(int));
+            *fd_count += count;
+        }
+        if (msg.msg_flags & MSG_CTRUNC) return -1;
+    }
+
+    state->data = malloc(header.len ? header.len : 1);
+    if (!state->data) return -1;
+    state->cap = header.len;
+    while (state->len < header.len) {
+        ssize_t n = recv(fd, state->data + state->len, header.len - state->len, 0);
+        if (n <= 0) return -1;
+        state->len += n;
+    }
+    return 0;
+}
+
+int upgrade_ack(int fd, int accepted) {
+    char code = accepted ? MSG_ACCEPTED : MSG_REFUSED;
+    return send(fd, &code, 1, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
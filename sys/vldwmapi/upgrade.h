@@ -0,0 +1,52 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Constants
+#define UPGRADE_TAKEOVER_ARG "--takeover"       // Appended to argv of the new binary
+#define UPGRADE_TAKEOVER_FD 3                   // Its end of the handoff socket
+#define UPGRADE_VERSION 5                       // Bumped whenever the state layout changes
+#define UPGRADE_MAX_FDS ((1 << 20) + 512)       // Connections, listeners, launch helper, program pidfds
+#define UPGRADE_CHUNK (32 * 1024)               // State bytes per handoff message
+#define UPGRADE_READY_TIMEOUT_MS 60000          // New binary initializing
+#define UPGRADE_DRAIN_TIMEOUT_MS 1000           // In-flight work finishing before the handoff
+#define UPGRADE_ACK_TIMEOUT_MS 5000
+
+// Serialized daemon state. Both sides are builds of the same tree on
+// the same machine, so values are copied in native layout; the version
+// and the struct sizes in the header catch a mismatch.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    int error;
+} upgrade_buf_t;
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t pos;
+    int error;
+} upgrade_reader_t;
+
+void upgrade_put(upgrade_buf_t *buf, const void *data, size_t len);
+int upgrade_get(upgrade_reader_t *reader, void *data, size_t len);
+void upgrade_buf_free(upgrade_buf_t *buf);
+
+// Running daemon: start the new binary, wait (on the event loop) until
+// it has initialized, then hand over state and descriptors
+int upgrade_start(const char *exe, char *const argv[]);
+int upgrade_fd(void);
+int upgrade_poll_ready(void);
+int upgrade_send_state(const upgrade_buf_t *state, const int *fds, int fd_count);
+void upgrade_abort(void);
+
+// New binary
+int upgrade_signal_ready(int fd);
+int upgrade_receive_state(int fd, upgrade_buf_t *state, int *fds, int max_fds, int *fd_count);
+int upgrade_ack(int fd, int accepted);
+
+#endif // UPGRADE_H
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <grp.h>
+#include <unistd.h>
+#include <sys/fsuid.h>
+#include <sys/syscall.h>
+
+#include "usercred.h"
+#include "nsscache.h"
+
+// The thread's own groups, put back by user_cred_leave()
+static __thread const user_cred_t *t_current = NULL;
+static __thread int t_entered = 0;
+static __thread gid_t t_saved_groups[USER_CRED_MAX_GROUPS];
+static __thread int t_saved_group_count = 0;
+
+int user_cred_lookup(uid_t uid, user_cred_t *cred) {
+    nss_user_t user;
+
+    if (nss_get_user_by_uid(uid, &user) != 0) return -1;
+    cred->uid = uid;
+    cred->gid = user.gid;
+    cred->group_count = USER_CRED_MAX_GROUPS;
+    if (getgrouplist(user.name, user.gid, cred->groups, &cred->group_count) < 0) {
+        cred->groups[0] = user.gid;
+        cred->group_count = 1;
+    }
+    return 0;
+}
+
+// Raw system call: glibc's setgroups() applies the list to every thread
+static int set_thread_groups(int count, const gid_t *groups) {
+    return syscall(SYS_setgroups, count, groups) == 0 ? 0 : -1;
+}
+
+// Only the file system ids change, and with them the capabilities that
+// override file permissions; the thread keeps CAP_SETUID to switch back.
+// A user the daemon already runs as needs no switch.
+int user_cred_enter(const user_cred_t *cred) {
+    if (t_entered) return -1;
+    if (cred->uid == geteuid() && cred->gid == getegid()) {
+        t_entered = 1;
+        return 0;
+    }
+
+    int count = getgroups(USER_CRED_MAX_GROUPS, t_saved_groups);
+    if (count < 0 || set_thread_groups(cred->group_count, cred->groups) != 0) return -1;
+    t_saved_group_count = count;
+    t_entered = 1;
+    t_current = cred;
+    setfsgid(cred->gid);
+    setfsuid(cred->uid);
+
+    // Both report the previous id whether or not the change took, so
+    // asking again with an invalid id is the only way to check
+    if ((uid_t)setfsuid((uid_t)-1) != cred->uid || (gid_t)setfsgid((gid_t)-1) != cred->gid) {
+        user_cred_leave();
+        errno = EPERM;
+        return -1;
+    }
+    return 0;
+}
+
+void user_cred_leave(void) {
+    if (!t_entered) return;
+    t_entered = 0;
+    if (!t_current) return;
+
+    // Root's file system ids first: they bring the capabilities back
+    setfsuid(geteuid());
+    setfsgid(getegid());
+    if (set_thread_groups(t_saved_group_count, t_saved_groups) != 0) {
+        fprintf(stderr, "⚠️ Could not restore thread groups: %s\n", strerror(errno));
+    }
+    t_current = NULL;
+}
+
+// The credentials the calling thread is using, or NULL for the daemon's own
+const user_cred_t *user_cred_current(void) {
+    return t_current;
+}
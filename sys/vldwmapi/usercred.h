@@ -0,0 +1,26 @@
+#ifndef USERCRED_H
+#define USERCRED_H
+
+#include <sys/types.h>
+
+// Constants
+#define USER_CRED_MAX_GROUPS 256                // Supplementary groups carried over
+
+// Who file access is checked as: a session user's ids and groups
+typedef struct {
+    uid_t uid;
+    gid_t gid;
+    gid_t groups[USER_CRED_MAX_GROUPS];
+    int group_count;
+} user_cred_t;
+
+// Session user credentials (thread-safe). user_cred_enter() switches
+// only the calling thread's filesystem ids and groups, so a worker can
+// open files with a user's access while every other thread stays root.
+// Each successful enter must be paired with user_cred_leave().
+int user_cred_lookup(uid_t uid, user_cred_t *cred);
+int user_cred_enter(const user_cred_t *cred);
+void user_cred_leave(void);
+const user_cred_t *user_cred_current(void);
+
+#endif // USERCRED_H
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "websocket.h"
+
+static const char base64_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha1_block(uint32_t state[5], const unsigned char block[64]) {
+    uint32_t w[80];
+    uint32_t a, b, c, d, e;
+
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t temp = ROTL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL32(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+// SHA-1 over a single buffer, entirely on the stack. Only used for the
+// handshake accept key, so no streaming interface is needed.
+void ws_sha1(const unsigned char *data, size_t len, unsigned char digest[20]) {
+    uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    unsigned char block[64];
+    size_t offset = 0;
+
+    while (len - offset >= 64) {
+        sha1_block(state, data + offset);
+        offset += 64;
+    }
+
+    size_t rest = len - offset;
+    memcpy(block, data + offset, rest);
+    block[rest++] = 0x80;
+    if (rest > 56) {
+        memset(block + rest, 0, 64 - rest);
+        sha1_block(state, block);
+        rest = 0;
+    }
+    memset(block + rest, 0, 56 - rest);
+
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) {
+        block[63 - i] = (unsigned char)(bits >> (i * 8));
+    }
+    sha1_block(state, block);
+
+    for (int i = 0; i < 5; i++) {
+        digest[i * 4] = (unsigned char)(state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)state[i];
+    }
+}
+
+// Base64 encode into a caller buffer of at least 4 * ((len + 2) / 3) + 1 bytes
+size_t ws_base64_encode(const unsigned char *input, size_t len, char *output) {
+    size_t out = 0;
+    size_t i = 0;
+
+    for (; i + 2 < len; i += 3) {
+        uint32_t v = ((uint32_t)input[i] << 16) | ((uint32_t)input[i + 1] << 8) | input[i + 2];
+        output[out++] = base64_table[(v >> 18) & 0x3F];
+        output[out++] = base64_table[(v >> 12) & 0x3F];
+        output[out++] = base64_table[(v >> 6) & 0x3F];
+        output[out++] = base64_table[v & 0x3F];
+    }
+    if (i < len) {
+        uint32_t v = (uint32_t)input[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)input[i + 1] << 8;
+        output[out++] = base64_table[(v >> 18) & 0x3F];
+        output[out++] = base64_table[(v >> 12) & 0x3F];
+        output[out++] = (i + 1 < len) ? base64_table[(v >> 6) & 0x3F] : '=';
+        output[out++] = '=';
+    }
+    output[out] = '\0';
+    return out;
+}
+
+void ws_compute_accept_key(const char *key, char accept_key[WS_ACCEPT_KEY_LEN + 1]) {
+    unsigned char concat[WS_KEY_LEN + sizeof(WS_MAGIC_STRING) - 1];
+    unsigned char hash[20];
+
+    memcpy(concat, key, WS_KEY_LEN);
+    memcpy(concat + WS_KEY_LEN, WS_MAGIC_STRING, sizeof(WS_MAGIC_STRING) - 1);
+    ws_sha1(concat, sizeof(concat), hash);
+    ws_base64_encode(hash, sizeof(hash), accept_key);
+}
+
+// Returns 0 for a valid RFC 6455 upgrade, otherwise the HTTP status to reply with
+int ws_validate_upgrade(const http_request_t *request) {
+    if (strcmp(request->method, "GET") != 0) return 400;
+    if (request->version_major != 1 || request->version_minor < 1) return 400;
+    if (!(request->flags & HTTP_FLAG_UPGRADE_WEBSOCKET)) return 400;
+    if (!(request->flags & HTTP_FLAG_CONNECTION_UPGRADE)) return 400;
+    if (request->ws_key[0] == '\0') return 400;
+    if (request->ws_version != WS_PROTOCOL_VERSION) return 426;
+    return 0;
+}
+
+int ws_build_handshake_response(const http_request_t *request, char *response, size_t size) {
+    static const char head[] =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: ";
+    size_t len = sizeof(head) - 1;
+
+    if (size < len + WS_ACCEPT_KEY_LEN + 5) return 0;
+
+    memcpy(response, head, len);
+    ws_compute_accept_key(request->ws_key, response + len);
+    len += WS_ACCEPT_KEY_LEN;
+    memcpy(response + len, "\r\n\r\n", 5);
+    return (int)(len + 4);
+}
+
+int ws_build_error_response(int status, char *response, size_t size) {
+    const char *reason = (status == 426) ? "Upgrade Required" : "Bad Request";
+    int len = snprintf(response, size,
+        "HTTP/1.1 %d %s\r\n"
+        "Sec-WebSocket-Version: %d\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n", status, reason, WS_PROTOCOL_VERSION);
+    return (len > 0 && (size_t)len < size) ? len : 0;
+}
+
+// WebSocket handshake. On a rejected upgrade the matching HTTP error is
+// sent and 0 is returned so the caller drops the connection.
+int perform_websocket_handshake(int client_socket, const http_request_t *request) {
+    char response[WS_HANDSHAKE_RESPONSE_SIZE];
+    int status = ws_validate_upgrade(request);
+    int len;
+
+    if (status != 0) {
+        len = ws_build_error_response(status, response, sizeof(response));
+        if (len > 0) send(client_socket, response, len, MSG_NOSIGNAL);
+        return 0;
+    }
+
+    len = ws_build_handshake_response(request, response, sizeof(response));
+    return len > 0 && send(client_socket, response, len, MSG_NOSIGNAL) == len;
+}
+
+// Server-to-client frame header (FIN set, never masked) for a payload of
+// payload_len bytes; returns the header length
+size_t ws_frame_header(int opcode, size_t payload_len, unsigned char header[WS_MAX_FRAME_HEADER]) {
+    size_t len = 0;
+
+    header[len++] = 0x80 | (opcode & 0x0F);
+    if (payload_len < 126) {
+        header[len++] = (unsigned char)payload_len;
+    } else if (payload_len < 65536) {
+        header[len++] = 126;
+        header[len++] = (unsigned char)(payload_len >> 8);
+        header[len++] = (unsigned char)payload_len;
+    } else {
+        header[len++] = 127;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            header[len++] = (unsigned char)((uint64_t)payload_len >> shift);
+        }
+    }
+    return len;
+}
+
+// Parse the frame at the start of buffer and unmask its payload in
+// place. Returns the opcode, WS_FRAME_INCOMPLETE (with *frame_len set to
+// the full frame size once the header is in, else 0) or WS_FRAME_INVALID
+// for frames that are malformed or longer than max_payload.
+int parse_websocket_frame(char *buffer, size_t buffer_len, size_t max_payload,
+                          char **payload, size_t *payload_len, size_t *frame_len) {
+    const unsigned char *bytes = (const unsigned char *)buffer;
+    *frame_len = 0;
+    if (buffer_len < 2) return WS_FRAME_INCOMPLETE;
+    
+    int opcode = bytes[0] & 0x0F;
+    int masked = (bytes[1] >> 7) & 1;
+    uint64_t length = bytes[1] & 0x7F;
+    size_t header_len = 2;
+    
+    // Extended payload length
+    if (length == 126) {
+        if (buffer_len < 4) return WS_FRAME_INCOMPLETE;
+        length = ((uint64_t)bytes[2] << 8) | bytes[3];
+        header_len = 4;
+    } else if (length == 127) {
+        if (buffer_len < 10) return WS_FRAME_INCOMPLETE;
+        length = 0;
+        for (int i = 2; i < 10; i++) length = (length << 8) | bytes[i];
+        header_len = 10;
+    }
+    
+    // Clients must mask every frame
+    if (!masked || length > max_payload) return WS_FRAME_INVALID;
+    header_len += 4;
+    
+    *frame_len = header_len + length;
+    if (buffer_len < *frame_len) return WS_FRAME_INCOMPLETE;
+    
+    // Unmask in place
+    const unsigned char *mask = bytes + header_len - 4;
+    char *data = buffer + header_len;
+    for (size_t i = 0; i < length; i++) {
+        data[i] ^= mask[i & 3];
+    }
+    *payload = data;
+    *payload_len = length;
+    
+    return opcode;
+}
+
+// Server-to-client text frame; returns the frame length, or 0 if
+// frame_size can't hold it
+int create_websocket_frame(const char* payload, int payload_len, char* frame, int frame_size) {
+    if (payload_len < 0 || frame_size < payload_len + WS_MAX_FRAME_HEADER) return 0;
+    
+    size_t header_len = ws_frame_header(WS_OPCODE_TEXT, payload_len, (unsigned char *)frame);
+    memcpy(frame + header_len, payload, payload_len);
+    
+    return (int)header_len + payload_len;
+}
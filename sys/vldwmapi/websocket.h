@@ -0,0 +1,41 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+#include "httpparser.h"
+
+// WebSocket constants
+#define WS_MAGIC_STRING "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_ACCEPT_KEY_LEN 28
+#define WS_PROTOCOL_VERSION 13
+#define WS_HANDSHAKE_RESPONSE_SIZE 256
+#define WS_MAX_FRAME_HEADER 10
+
+// WebSocket opcodes
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+// parse_websocket_frame results besides an opcode
+#define WS_FRAME_INVALID -1
+#define WS_FRAME_INCOMPLETE -2
+
+// Handshake functions
+void ws_sha1(const unsigned char *data, size_t len, unsigned char digest[20]);
+size_t ws_base64_encode(const unsigned char *input, size_t len, char *output);
+void ws_compute_accept_key(const char *key, char accept_key[WS_ACCEPT_KEY_LEN + 1]);
+int ws_validate_upgrade(const http_request_t *request);
+int ws_build_handshake_response(const http_request_t *request, char *response, size_t size);
+int ws_build_error_response(int status, char *response, size_t size);
+int perform_websocket_handshake(int client_socket, const http_request_t *request);
+
+// Framing
+size_t ws_frame_header(int opcode, size_t payload_len, unsigned char header[WS_MAX_FRAME_HEADER]);
+int parse_websocket_frame(char *buffer, size_t buffer_len, size_t max_payload,
+                          char **payload, size_t *payload_len, size_t *frame_len);
+int create_websocket_frame(const char* payload, int payload_len, char* frame, int frame_size);
+
+#endif // WEBSOCKET_H
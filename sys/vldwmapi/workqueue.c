@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "workqueue.h"
+
+// FIFO of intrusive items
+typedef struct {
+    work_item_t *head;
+    work_item_t *tail;
+} item_list_t;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_work_ready = PTHREAD_COND_INITIALIZER;
+static item_list_t g_queued;
+static item_list_t g_done;
+static pthread_t g_threads[WORKQUEUE_THREADS];
+static int g_thread_count = 0;
+static int g_stopping = 0;
+static int g_pending = 0;           // Submitted and not yet completed
+static int g_event_fd = -1;
+
+static void list_push(item_list_t *list, work_item_t *item) {
+    item->next = NULL;
+    if (list->tail) list->tail->next = item;
+    else list->head = item;
+    list->tail = item;
+}
+
+static work_item_t *list_pop(item_list_t *list) {
+    work_item_t *item = list->head;
+    if (item) {
+        list->head = item->next;
+        if (!list->head) list->tail = NULL;
+    }
+    return item;
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_lock);
+    for (;;) {
+        while (!g_queued.head && !g_stopping) {
+            pthread_cond_wait(&g_work_ready, &g_lock);
+        }
+        if (g_stopping) break;
+
+        work_item_t *item = list_pop(&g_queued);
+        pthread_mutex_unlock(&g_lock);
+        item->run(item);
+        pthread_mutex_lock(&g_lock);
+
+        // Wake the event loop only when the done list goes non-empty
+        int was_empty = g_done.head == NULL;
+        list_push(&g_done, item);
+        if (was_empty) {
+            uint64_t one = 1;
+            if (write(g_event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+                perror("workqueue eventfd");
+            }
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return NULL;
+}
+
+int init_workqueue(int threads) {
+    printf("🧵 Initializing work queue (%d threads)...\n", threads);
+
+    if (threads < 1) threads = 1;
+    if (threads > WORKQUEUE_THREADS) threads = WORKQUEUE_THREADS;
+
+    g_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_event_fd < 0) return -1;
+
+    g_stopping = 0;
+    for (g_thread_count = 0; g_thread_count < threads; g_thread_count++) {
+        if (pthread_create(&g_threads[g_thread_count], NULL, worker_main, NULL) != 0) {
+            cleanup_workqueue();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Queued and finished items are dropped; their owners go away with the
+// process
+void cleanup_workqueue(void) {
+    printf("🧵 Cleaning up work queue...\n");
+
+    pthread_mutex_lock(&g_lock);
+    g_stopping = 1;
+    pthread_cond_broadcast(&g_work_ready);
+    pthread_mutex_unlock(&g_lock);
+
+    for (int i = 0; i < g_thread_count; i++) {
+        pthread_join(g_threads[i], NULL);
+    }
+    g_thread_count = 0;
+    g_queued.head = g_queued.tail = NULL;
+    g_done.head = g_done.tail = NULL;
+    g_pending = 0;
+
+    if (g_event_fd >= 0) close(g_event_fd);
+    g_event_fd = -1;
+}
+
+int workqueue_submit(work_item_t *item) {
+    if (g_thread_count == 0) return -1;
+
+    pthread_mutex_lock(&g_lock);
+    list_push(&g_queued, item);
+    g_pending++;
+    pthread_cond_signal(&g_work_ready);
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+// Readable while finished items wait for workqueue_complete()
+int workqueue_fd(void) {
+    return g_event_fd;
+}
+
+// Run complete() for every finished item; returns how many there were
+int workqueue_complete(void) {
+    uint64_t value;
+    work_item_t *item;
+    int count = 0;
+
+    if (read(g_event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        perror("workqueue eventfd");
+    }
+
+    pthread_mutex_lock(&g_lock);
+    item = g_done.head;
+    g_done.head = g_done.tail = NULL;
+    pthread_mutex_unlock(&g_lock);
+
+    while (item) {
+        work_item_t *next = item->next;
+        item->complete(item);
+        item = next;
+        count++;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    g_pending -= count;
+    pthread_mutex_unlock(&g_lock);
+    return count;
+}
+
+// Items submitted but not yet completed, for back-pressure
+int workqueue_pending(void) {
+    pthread_mutex_lock(&g_lock);
+    int pending = g_pending;
+    pthread_mutex_unlock(&g_lock);
+    return pending;
+}
@@ -0,0 +1,24 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+// Constants
+#define WORKQUEUE_THREADS 4
+
+// Work handed to a worker thread. Embed this in the request struct:
+// run() is called on a worker, then complete() on the event loop thread
+// from workqueue_complete().
+typedef struct work_item {
+    void (*run)(struct work_item *item);
+    void (*complete)(struct work_item *item);
+    struct work_item *next;
+} work_item_t;
+
+// Work queue functions
+int init_workqueue(int threads);
+void cleanup_workqueue(void);
+int workqueue_submit(work_item_t *item);
+int workqueue_fd(void);
+int workqueue_complete(void);
+int workqueue_pending(void);
+
+#endif // WORKQUEUE_H